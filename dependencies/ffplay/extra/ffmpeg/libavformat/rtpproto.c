@@ -24,6 +24,8 @@
  * RTP protocol
  */
 
+#define _GNU_SOURCE /* recvmmsg() */
+
 #include "libavutil/parseutils.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
@@ -42,6 +44,9 @@
 #include <sys/poll.h>
 #endif
 
+/* Size of each datagram slot for batched receive, same as RTP_MAX_PACKET_LENGTH */
+#define RTP_BATCH_PKT_SIZE 8192
+
 typedef struct RTPContext {
     const AVClass *class;
     URLContext *rtp_hd, *rtcp_hd;
@@ -58,6 +63,15 @@ typedef struct RTPContext {
     int dscp;
     char *sources;
     char *block;
+    int recv_batch;
+#if HAVE_RECVMMSG
+    /* Datagrams read by one recvmmsg() call and not yet returned by rtp_read() */
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *msg_addrs;
+    uint8_t *msg_buf;
+    int nb_msgs, next_msg, msg_fd_index;
+#endif
 } RTPContext;
 
 #define OFFSET(x) offsetof(RTPContext, x)
@@ -75,6 +89,7 @@ static const AVOption options[] = {
     { "dscp",               "DSCP class",                                                       OFFSET(dscp),            AV_OPT_TYPE_INT,    { .i64 = -1 },    -1, INT_MAX, .flags = D|E },
     { "sources",            "Source list",                                                      OFFSET(sources),         AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",              "Block list",                                                       OFFSET(block),           AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
+    { "recv_batch",         "Datagrams read per system call, 1 disables batching",              OFFSET(recv_batch),      AV_OPT_TYPE_INT,    { .i64 =  1 },     1, 1024,    .flags = D },
     { NULL }
 };
 
@@ -203,6 +218,74 @@ static int rtp_check_source_lists(RTPContext *s, struct sockaddr_storage *source
     return 0;
 }
 
+#if HAVE_RECVMMSG
+static int rtp_alloc_batch(RTPContext *s)
+{
+    int i;
+
+    s->msgs      = av_mallocz_array(s->recv_batch, sizeof(*s->msgs));
+    s->iovs      = av_mallocz_array(s->recv_batch, sizeof(*s->iovs));
+    s->msg_addrs = av_mallocz_array(s->recv_batch, sizeof(*s->msg_addrs));
+    s->msg_buf   = av_malloc_array(s->recv_batch, RTP_BATCH_PKT_SIZE);
+    if (!s->msgs || !s->iovs || !s->msg_addrs || !s->msg_buf)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->recv_batch; i++) {
+        s->iovs[i].iov_base           = s->msg_buf + i * RTP_BATCH_PKT_SIZE;
+        s->iovs[i].iov_len            = RTP_BATCH_PKT_SIZE;
+        s->msgs[i].msg_hdr.msg_iov    = &s->iovs[i];
+        s->msgs[i].msg_hdr.msg_iovlen = 1;
+        s->msgs[i].msg_hdr.msg_name   = &s->msg_addrs[i];
+    }
+    return 0;
+}
+
+static void rtp_free_batch(RTPContext *s)
+{
+    av_freep(&s->msgs);
+    av_freep(&s->iovs);
+    av_freep(&s->msg_addrs);
+    av_freep(&s->msg_buf);
+    s->nb_msgs = s->next_msg = 0;
+}
+
+/* Read up to recv_batch datagrams from one socket, which poll() reported readable */
+static int rtp_recv_batch(RTPContext *s, int fd, int fd_index)
+{
+    int i, n;
+
+    for (i = 0; i < s->recv_batch; i++)
+        s->msgs[i].msg_hdr.msg_namelen = sizeof(s->msg_addrs[i]);
+    n = recvmmsg(fd, s->msgs, s->recv_batch, MSG_DONTWAIT, NULL);
+    if (n < 0)
+        return ff_neterrno();
+    s->nb_msgs      = n;
+    s->next_msg     = 0;
+    s->msg_fd_index = fd_index;
+    return n;
+}
+
+/* Return the next buffered datagram, 0 if none is left */
+static int rtp_read_batched(RTPContext *s, uint8_t *buf, int size)
+{
+    struct sockaddr_storage *addrs[2] = { &s->last_rtp_source, &s->last_rtcp_source };
+    socklen_t *addr_lens[2] = { &s->last_rtp_source_len, &s->last_rtcp_source_len };
+
+    while (s->next_msg < s->nb_msgs) {
+        struct mmsghdr *msg = &s->msgs[s->next_msg];
+        int len = FFMIN(msg->msg_len, size);
+
+        s->next_msg++;
+        if (len <= 0 || rtp_check_source_lists(s, msg->msg_hdr.msg_name))
+            continue;
+        memcpy(addrs[s->msg_fd_index], msg->msg_hdr.msg_name, msg->msg_hdr.msg_namelen);
+        *addr_lens[s->msg_fd_index] = msg->msg_hdr.msg_namelen;
+        memcpy(buf, msg->msg_hdr.msg_iov->iov_base, len);
+        return len;
+    }
+    return 0;
+}
+#endif
+
 /**
  * add option to url of the form:
  * "http://host:port/path?option1=val1&option2=val2...
@@ -419,6 +502,12 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
 
     h->max_packet_size = s->rtp_hd->max_packet_size;
     h->is_streamed = 1;
+#if HAVE_RECVMMSG
+    if (s->recv_batch > 1 && (flags & AVIO_FLAG_READ) && rtp_alloc_batch(s) < 0) {
+        rtp_free_batch(s);
+        goto fail;
+    }
+#endif
     return 0;
 
  fail:
@@ -438,6 +527,11 @@ static int rtp_read(URLContext *h, uint8_t *buf, int size)
     struct sockaddr_storage *addrs[2] = { &s->last_rtp_source, &s->last_rtcp_source };
     socklen_t *addr_lens[2] = { &s->last_rtp_source_len, &s->last_rtcp_source_len };
 
+#if HAVE_RECVMMSG
+    if (s->msgs && (len = rtp_read_batched(s, buf, size)) > 0)
+        return len;
+#endif
+
     for(;;) {
         if (ff_check_interrupt(&h->interrupt_callback))
             return AVERROR_EXIT;
@@ -447,6 +541,19 @@ static int rtp_read(URLContext *h, uint8_t *buf, int size)
             for (i = 1; i >= 0; i--) {
                 if (!(p[i].revents & POLLIN))
                     continue;
+#if HAVE_RECVMMSG
+                if (s->msgs) {
+                    len = rtp_recv_batch(s, p[i].fd, i);
+                    if (len < 0) {
+                        if (len == AVERROR(EAGAIN) || len == AVERROR(EINTR))
+                            continue;
+                        return AVERROR(EIO);
+                    }
+                    if ((len = rtp_read_batched(s, buf, size)) > 0)
+                        return len;
+                    continue;
+                }
+#endif
                 *addr_lens[i] = sizeof(*addrs[i]);
                 len = recvfrom(p[i].fd, buf, size, 0,
                                 (struct sockaddr *)addrs[i], addr_lens[i]);
@@ -558,12 +665,29 @@ static int rtp_close(URLContext *h)
     for (i = 0; i < s->nb_ssm_exclude_addrs; i++)
         av_freep(&s->ssm_exclude_addrs[i]);
     av_freep(&s->ssm_exclude_addrs);
+#if HAVE_RECVMMSG
+    rtp_free_batch(s);
+#endif
 
     ffurl_close(s->rtp_hd);
     ffurl_close(s->rtcp_hd);
     return 0;
 }
 
+int ff_rtp_has_pending(URLContext *h)
+{
+#if HAVE_RECVMMSG
+    RTPContext *s;
+
+    if (strcmp(h->prot->name, "rtp"))
+        return 0;
+    s = h->priv_data;
+    return s->next_msg < s->nb_msgs;
+#else
+    return 0;
+#endif
+}
+
 /**
  * Return the local rtp port used by the RTP connection
  * @param h media file context
@@ -28,4 +28,11 @@ int ff_rtp_set_remote_url(URLContext *h, const char *uri);
 int ff_rtp_get_local_rtp_port(URLContext *h);
 int ff_rtp_get_local_rtcp_port(URLContext *h);
 
+/**
+ * Return nonzero if datagrams read by a batched receive are still
+ * buffered in the RTP context. They are not reported by poll() on the
+ * underlying sockets.
+ */
+int ff_rtp_has_pending(URLContext *h);
+
 #endif /* AVFORMAT_RTPPROTO_H */
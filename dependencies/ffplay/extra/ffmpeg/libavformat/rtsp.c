@@ -76,7 +76,8 @@
 
 #define COMMON_OPTS() \
     { "reorder_queue_size", "set number of packets to buffer for handling of reordered packets", OFFSET(reordering_queue_size), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, DEC }, \
-    { "buffer_size",        "Underlying protocol send/receive buffer size",                  OFFSET(buffer_size),           AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, DEC|ENC } \
+    { "buffer_size",        "Underlying protocol send/receive buffer size",                  OFFSET(buffer_size),           AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, DEC|ENC }, \
+    { "recv_batch",         "number of RTP datagrams read per system call, 1 disables batching", OFFSET(recv_batch),        AV_OPT_TYPE_INT, { .i64 = 1 }, 1, 1024, DEC } \
 
 
 const AVOption ff_rtsp_options[] = {
@@ -123,6 +124,8 @@ static AVDictionary *map_to_opts(RTSPState *rt)
 
     snprintf(buf, sizeof(buf), "%d", rt->buffer_size);
     av_dict_set(&opts, "buffer_size", buf, 0);
+    snprintf(buf, sizeof(buf), "%d", rt->recv_batch);
+    av_dict_set(&opts, "recv_batch", buf, 0);
 
     return opts;
 }
@@ -1939,6 +1942,17 @@ static int udp_read_packet(AVFormatContext *s, RTSPStream **prtsp_st,
             return AVERROR_EXIT;
         if (wait_end && wait_end - av_gettime_relative() < 0)
             return AVERROR(EAGAIN);
+        /* datagrams already batched by the rtp protocol don't show up in poll() */
+        for (i = 0; i < rt->nb_rtsp_streams; i++) {
+            rtsp_st = rt->rtsp_streams[i];
+            if (rtsp_st->rtp_handle && ff_rtp_has_pending(rtsp_st->rtp_handle)) {
+                ret = ffurl_read(rtsp_st->rtp_handle, buf, buf_size);
+                if (ret > 0) {
+                    *prtsp_st = rtsp_st;
+                    return ret;
+                }
+            }
+        }
         max_p = 0;
         if (rt->rtsp_hd) {
             tcp_fd = ffurl_get_file_handle(rt->rtsp_hd);
@@ -408,6 +408,11 @@ typedef struct RTSPState {
 
     char default_lang[4];
     int buffer_size;
+
+    /**
+     * Number of datagrams read per system call for RTP over UDP.
+     */
+    int recv_batch;
 } RTSPState;
 
 #define RTSP_FLAG_FILTER_SRC  0x1    /**< Filter incoming UDP packets -
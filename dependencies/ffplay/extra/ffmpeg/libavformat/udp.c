@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* recvmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -113,6 +114,13 @@ typedef struct UDPContext {
     struct sockaddr_storage local_addr_storage;
     char *sources;
     char *block;
+    int recv_batch;
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+    /* Batched receive for the circular buffer thread */
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    uint8_t *msg_buf;
+#endif
 } UDPContext;
 
 #define OFFSET(x) offsetof(UDPContext, x)
@@ -137,6 +145,7 @@ static const AVOption options[] = {
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
+    { "recv_batch",     "Datagrams read per system call by the circular buffer thread, 1 disables batching", OFFSET(recv_batch), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, 1024, D },
     { NULL }
 };
 
@@ -496,6 +505,64 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+/* Size of each datagram slot for batched receive, larger datagrams are
+ * truncated by the kernel and dropped */
+#define UDP_BATCH_PKT_SIZE 8192
+
+static int udp_alloc_batch(UDPContext *s)
+{
+    int i;
+
+    s->msgs    = av_mallocz_array(s->recv_batch, sizeof(*s->msgs));
+    s->iovs    = av_mallocz_array(s->recv_batch, sizeof(*s->iovs));
+    s->msg_buf = av_malloc_array(s->recv_batch, UDP_BATCH_PKT_SIZE);
+    if (!s->msgs || !s->iovs || !s->msg_buf)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->recv_batch; i++) {
+        s->iovs[i].iov_base           = s->msg_buf + i * UDP_BATCH_PKT_SIZE;
+        s->iovs[i].iov_len            = UDP_BATCH_PKT_SIZE;
+        s->msgs[i].msg_hdr.msg_iov    = &s->iovs[i];
+        s->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return 0;
+}
+
+static void udp_free_batch(UDPContext *s)
+{
+    av_freep(&s->msgs);
+    av_freep(&s->iovs);
+    av_freep(&s->msg_buf);
+}
+#endif
+
+/* Called with s->mutex held. Returns 0 if the datagram was queued or
+ * dropped on a nonfatal overrun, <0 if the thread must stop. */
+static int circular_buffer_put(URLContext *h, const uint8_t *buf, int len)
+{
+    UDPContext *s = h->priv_data;
+    uint8_t hdr[4];
+
+    if(av_fifo_space(s->fifo) < len + 4) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                    "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        } else {
+            av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                    "To avoid, increase fifo_size URL option. "
+                    "To survive in such case, use overrun_nonfatal option\n");
+            s->circular_buffer_error = AVERROR(EIO);
+            return s->circular_buffer_error;
+        }
+    }
+    AV_WL32(hdr, len);
+    av_fifo_generic_write(s->fifo, hdr, 4, NULL);
+    av_fifo_generic_write(s->fifo, (void *)buf, len, NULL);
+    return 0;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -511,12 +578,21 @@ static void *circular_buffer_task_rx( void *_URLContext)
     }
     while(1) {
         int len;
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+        int i;
+#endif
 
         pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+        /* Wait for one datagram, then take whatever else is already queued */
+        if (s->msgs)
+            len = recvmmsg(s->udp_fd, s->msgs, s->recv_batch, MSG_WAITFORONE, NULL);
+        else
+#endif
         len = recv(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
         pthread_mutex_lock(&s->mutex);
@@ -527,23 +603,23 @@ static void *circular_buffer_task_rx( void *_URLContext)
             }
             continue;
         }
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
+
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+        if (s->msgs) {
+            for (i = 0; i < len; i++) {
+                /* A partial datagram is worse than a lost one */
+                if (s->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    av_log(h, AV_LOG_WARNING, "Dropping datagram larger than %d bytes, "
+                           "use recv_batch=1 for larger datagrams\n", UDP_BATCH_PKT_SIZE);
+                    continue;
+                }
+                if (circular_buffer_put(h, s->iovs[i].iov_base, s->msgs[i].msg_len) < 0)
+                    goto end;
             }
-        }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
+        } else
+#endif
+        if (circular_buffer_put(h, s->tmp+4, len) < 0)
+            goto end;
         pthread_cond_signal(&s->cond);
     }
 
@@ -968,6 +1044,10 @@ static int udp_open(URLContext *h, const char *uri, int flags)
 
         /* start the task going */
         s->fifo = av_fifo_alloc(s->circular_buffer_size);
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+        if (!is_output && s->recv_batch > 1 && udp_alloc_batch(s) < 0)
+            goto fail;
+#endif
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -998,6 +1078,9 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+    udp_free_batch(s);
+#endif
     for (i = 0; i < num_include_sources; i++)
         av_freep(&include_sources[i]);
     for (i = 0; i < num_exclude_sources; i++)
@@ -1155,6 +1238,9 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+#if HAVE_PTHREAD_CANCEL && HAVE_RECVMMSG
+    udp_free_batch(s);
+#endif
     return 0;
 }
 
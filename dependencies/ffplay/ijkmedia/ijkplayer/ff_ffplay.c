@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <signal.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "libavutil/avstring.h"
 #include "libavutil/eval.h"
@@ -43,6 +44,7 @@
 #include "libavutil/samplefmt.h"
 #include "libavutil/avassert.h"
 #include "libavutil/time.h"
+#include "libavutil/intreadwrite.h"
 #include "libavformat/avformat.h"
 #if CONFIG_AVDEVICE
 #include "libavdevice/avdevice.h"
@@ -2393,6 +2395,210 @@ static int is_realtime(AVFormatContext *s)
     return 0;
 }
 
+/* codec parameters of live inputs, keyed by url: a reopen of the same camera skips avformat_find_stream_info */
+#define FFP_INFO_CACHE_SIZE     16
+#define FFP_INFO_MAX_STREAMS    4
+
+typedef struct FFStreamInfo {
+    uint64_t           key;
+    int                nb_streams;
+    AVCodecParameters *par[FFP_INFO_MAX_STREAMS];
+    AVRational         time_base[FFP_INFO_MAX_STREAMS];
+    AVRational         frame_rate[FFP_INFO_MAX_STREAMS];
+} FFStreamInfo;
+
+static FFStreamInfo    g_info_cache[FFP_INFO_CACHE_SIZE];
+static int             g_info_next;
+static pthread_mutex_t g_info_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t stream_info_key(const char *url)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*url) {
+        h ^= (unsigned char) *url++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* the _l functions are called with g_info_lock held */
+static void stream_info_clear_l(FFStreamInfo *info)
+{
+    int i;
+    for (i = 0; i < FFP_INFO_MAX_STREAMS; i++)
+        avcodec_parameters_free(&info->par[i]);
+    info->key        = 0;
+    info->nb_streams = 0;
+}
+
+static FFStreamInfo *stream_info_find_l(uint64_t key)
+{
+    int i;
+    for (i = 0; i < FFP_INFO_CACHE_SIZE; i++) {
+        if (g_info_cache[i].key == key && g_info_cache[i].nb_streams > 0)
+            return &g_info_cache[i];
+    }
+    return NULL;
+}
+
+static void stream_info_save(uint64_t key, AVFormatContext *ic)
+{
+    FFStreamInfo *info;
+    AVStream *st;
+    int i;
+
+    if (ic->nb_streams == 0 || ic->nb_streams > FFP_INFO_MAX_STREAMS)
+        return;
+
+    pthread_mutex_lock(&g_info_lock);
+    info = stream_info_find_l(key);
+    if (!info) {
+        info = &g_info_cache[g_info_next];
+        g_info_next = (g_info_next + 1) % FFP_INFO_CACHE_SIZE;
+    }
+    stream_info_clear_l(info);
+    for (i = 0; i < ic->nb_streams; i++) {
+        st = ic->streams[i];
+        info->par[i] = avcodec_parameters_alloc();
+        if (!info->par[i] || avcodec_parameters_copy(info->par[i], st->codecpar) < 0) {
+            stream_info_clear_l(info);
+            goto end;
+        }
+        info->time_base[i]  = st->time_base;
+        info->frame_rate[i] = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+    }
+    info->nb_streams = ic->nb_streams;
+    info->key        = key;
+end:
+    pthread_mutex_unlock(&g_info_lock);
+}
+
+/* fills what the demuxer left empty; fails when the streams differ from the cached ones */
+static int stream_info_apply(uint64_t key, AVFormatContext *ic)
+{
+    FFStreamInfo *info;
+    AVCodecParameters *par, *cached;
+    AVStream *st;
+    int i, ret = 0;
+
+    pthread_mutex_lock(&g_info_lock);
+    info = stream_info_find_l(key);
+    if (!info)
+        goto end;
+    if (info->nb_streams != ic->nb_streams)
+        goto drop;
+    for (i = 0; i < ic->nb_streams; i++) {
+        if (ic->streams[i]->codecpar->codec_type != info->par[i]->codec_type ||
+            ic->streams[i]->codecpar->codec_id   != info->par[i]->codec_id)
+            goto drop;
+    }
+
+    for (i = 0; i < ic->nb_streams; i++) {
+        st     = ic->streams[i];
+        par    = st->codecpar;
+        cached = info->par[i];
+        // values from the SDP win over the cached ones
+        if (par->extradata_size <= 0 && cached->extradata_size > 0) {
+            av_freep(&par->extradata);
+            par->extradata = av_mallocz(cached->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!par->extradata)
+                goto end;
+            memcpy(par->extradata, cached->extradata, cached->extradata_size);
+            par->extradata_size = cached->extradata_size;
+        }
+        if (par->width <= 0 || par->height <= 0) {
+            par->width  = cached->width;
+            par->height = cached->height;
+        }
+        if (par->format < 0)
+            par->format = cached->format;
+        if (par->sample_rate <= 0)
+            par->sample_rate = cached->sample_rate;
+        if (par->channels <= 0) {
+            par->channels       = cached->channels;
+            par->channel_layout = cached->channel_layout;
+        }
+        if (st->time_base.num <= 0 || st->time_base.den <= 0)
+            st->time_base = info->time_base[i];
+        if (st->avg_frame_rate.num <= 0 || st->avg_frame_rate.den <= 0)
+            st->avg_frame_rate = info->frame_rate[i];
+        if (st->r_frame_rate.num <= 0 || st->r_frame_rate.den <= 0)
+            st->r_frame_rate = info->frame_rate[i];
+    }
+    ret = 1;
+    goto end;
+drop:
+    av_log(NULL, AV_LOG_INFO, "stream info cache: streams changed, probe again\n");
+    stream_info_clear_l(info);
+end:
+    pthread_mutex_unlock(&g_info_lock);
+    return ret;
+}
+
+static const uint8_t *find_start_code(const uint8_t *p, const uint8_t *end)
+{
+    for (; p + 3 <= end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+    return end;
+}
+
+/* first sps in annex b data, or in an avcC record */
+static const uint8_t *find_sps(enum AVCodecID codec_id, const uint8_t *data, int size, int *len)
+{
+    const uint8_t *end = data + size;
+    const uint8_t *p, *next;
+    int type;
+
+    if (codec_id == AV_CODEC_ID_H264 && size >= 8 && data[0] == 1) {
+        *len = AV_RB16(data + 6);
+        return (data[5] & 0x1f) && 8 + *len <= size ? data + 8 : NULL;
+    }
+    p = find_start_code(data, end);
+    while (p < end) {
+        p += 3;
+        next = find_start_code(p, end);
+        *len = next - p;
+        // trailing zero of a 4 byte start code
+        while (*len > 0 && p[*len - 1] == 0)
+            (*len)--;
+        if (*len > 0) {
+            type = codec_id == AV_CODEC_ID_HEVC ? (p[0] >> 1) & 0x3f : p[0] & 0x1f;
+            if (type == (codec_id == AV_CODEC_ID_HEVC ? 33 : 7))
+                return p;
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+/* compares the sps of the first keyframe with the cached one and drops the entry when the camera changed */
+static void stream_info_check(uint64_t key, int stream_index, AVStream *st, const AVPacket *pkt)
+{
+    FFStreamInfo *info;
+    AVCodecParameters *cached;
+    const uint8_t *sps, *cached_sps;
+    int len, cached_len;
+
+    if (st->codecpar->codec_id != AV_CODEC_ID_H264 && st->codecpar->codec_id != AV_CODEC_ID_HEVC)
+        return;
+
+    pthread_mutex_lock(&g_info_lock);
+    info = stream_info_find_l(key);
+    if (info && stream_index < info->nb_streams) {
+        cached     = info->par[stream_index];
+        sps        = find_sps(cached->codec_id, pkt->data, pkt->size, &len);
+        cached_sps = cached->extradata_size > 0 ?
+                     find_sps(cached->codec_id, cached->extradata, cached->extradata_size, &cached_len) : NULL;
+        if (sps && cached_sps && (len != cached_len || memcmp(sps, cached_sps, len))) {
+            av_log(NULL, AV_LOG_WARNING, "stream info cache: sps changed, dropped\n");
+            stream_info_clear_l(info);
+        }
+    }
+    pthread_mutex_unlock(&g_info_lock);
+}
+
 /* this thread gets the stream from the disk or the network */
 static int read_thread(void *arg)
 {
@@ -2414,6 +2620,8 @@ static int read_thread(void *arg)
     int last_error = 0;
     int64_t prev_io_tick_counter = 0;
     int64_t io_tick_counter = 0;
+    uint64_t info_key = 0;
+    int check_info = 0;
     av_log(NULL, AV_LOG_ERROR, "wdm======================g_count========%d\n",g_count);
     if(g_count == 0){
 		for(;;){
@@ -2483,7 +2691,17 @@ static int read_thread(void *arg)
     opts = setup_find_stream_info_opts(ic, ffp->codec_opts);
     orig_nb_streams = ic->nb_streams;
 
-    err = avformat_find_stream_info(ic, opts);
+    if (is_realtime(ic))
+        info_key = stream_info_key(is->filename);
+    if (info_key && stream_info_apply(info_key, ic)) {
+        av_log(ffp, AV_LOG_INFO, "%s: stream info cache hit, skip probing\n", is->filename);
+        check_info = 1;
+        err = 0;
+    } else {
+        err = avformat_find_stream_info(ic, opts);
+        if (err >= 0 && info_key)
+            stream_info_save(info_key, ic);
+    }
 
     for (i = 0; i < orig_nb_streams; i++)
         av_dict_free(&opts[i]);
@@ -2874,6 +3092,11 @@ static int read_thread(void *arg)
             is->eof = 0;
         }
 
+        if (check_info && pkt->stream_index == is->video_stream && (pkt->flags & AV_PKT_FLAG_KEY)) {
+            check_info = 0;
+            stream_info_check(info_key, pkt->stream_index, ic->streams[pkt->stream_index], pkt);
+        }
+
         if (pkt->flags & AV_PKT_FLAG_DISCONTINUITY) {
             if (is->audio_stream >= 0) {
                 packet_queue_put(&is->audioq, &flush_pkt);
@@ -3111,6 +3334,9 @@ static void ffp_log_callback_brief(void *ptr, int level, const char *fmt, va_lis
     VLOG(ffplv, IJK_LOG_TAG, fmt, vl);
 }
 
+#define FFP_LOG_REPEAT_BURST    10
+#define FFP_LOG_REPEAT_WINDOW   1000
+
 static void ffp_log_callback_report(void *ptr, int level, const char *fmt, va_list vl)
 {
     if (level > av_log_get_level())
@@ -3118,9 +3344,29 @@ static void ffp_log_callback_report(void *ptr, int level, const char *fmt, va_li
 
     int ffplv __unused = log_level_av_to_ijk(level);
 
+    // per-thread: after FFP_LOG_REPEAT_BURST lines with the same fmt within a window, only count them
+    static __thread const char *last_fmt;
+    static __thread int         last_repeat;
+    static __thread int         last_suppressed;
+    static __thread Uint64      last_window;
+    Uint64 now = SDL_GetTickHR();
+    if (fmt == last_fmt && now - last_window < FFP_LOG_REPEAT_WINDOW) {
+        if (++last_repeat > FFP_LOG_REPEAT_BURST) {
+            last_suppressed++;
+            return;
+        }
+    } else {
+        if (last_suppressed > 0)
+            ALOG(ffplv, IJK_LOG_TAG, "last message repeated %d times\n", last_suppressed);
+        last_fmt        = fmt;
+        last_repeat     = 1;
+        last_suppressed = 0;
+        last_window     = now;
+    }
+
     va_list vl2;
     char line[1024];
-    static int print_prefix = 1;
+    static __thread int print_prefix = 1;
 
     va_copy(vl2, vl);
     // av_log_default_callback(ptr, level, fmt, vl);
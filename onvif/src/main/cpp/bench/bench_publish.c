@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "libavformat/avformat.h"
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+
+#include "platform.h"
+#include "data.h"
+#include "video.h"
+#include "packer.h"
+#include "sendqueue.h"
+#include "rtmp_sink.h"
+
+//sffstreamer 推流路径的基准测试。
+//Annex-B 录像先用data.c 的ReadVideoPacket 全部读进内存，再不限速地打包、进发送队列，
+//经过本机回环发到rtmp_sink。统计吞吐、每帧的内存分配次数和各阶段耗时的分位数
+
+#define BENCH_WAIT_US      50 //队列快满时等待发送，不让丢帧策略影响结果
+#define BENCH_DRAIN_MS     5000 //推完后等待sink 收完，超过没有进展就结束
+#define BENCH_DEFAULT_RATE 25
+
+typedef struct BenchFrame
+{
+    unsigned char *data;
+    int size;
+} BenchFrame;
+
+typedef struct BenchCapture
+{
+    const char *path;
+    BenchFrame *frames;
+    int nFrames;
+    unsigned long long nBytes;
+    int width;
+    int height;
+    int rate;
+    long long nOpen; //OpenAVFormat 的耗时us
+    long long *pRead; //每帧ReadVideoPacket 的耗时us
+    unsigned long long nReadAllocs; //ReadVideoPacket 里的分配次数
+} BenchCapture;
+
+typedef struct BenchOptions
+{
+    BOOL bEventLoop;
+    int nLoops;
+    SendOptions send;
+    BOOL bSendOptions;
+} BenchOptions;
+
+//链接时用--wrap 统计分配次数，释放不计
+static unsigned long long m_nAllocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **memptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&m_nAllocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    __atomic_add_fetch(&m_nAllocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&m_nAllocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    __atomic_add_fetch(&m_nAllocs, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(memptr, alignment, size);
+}
+
+static unsigned long long GetAllocs(void)
+{
+    return __atomic_load_n(&m_nAllocs, __ATOMIC_RELAXED);
+}
+
+static int CompareTime(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+//times 会被排序
+static void PrintPercentiles(const char *name, long long *times, int n)
+{
+    if (n <= 0)
+    {
+        printf("  %-6s %10s\n", name, "-");
+        return;
+    }
+    qsort(times, n, sizeof(long long), CompareTime);
+    printf("  %-6s %10lld %10lld %10lld %10lld %10d\n", name, times[n / 2],
+           times[(int) (n * 0.9)], times[(int) (n * 0.99)], times[n - 1], n);
+}
+
+static void FreeCapture(BenchCapture *cap)
+{
+    int i;
+    for (i = 0; i < cap->nFrames; i++)
+        free(cap->frames[i].data);
+    free(cap->frames);
+    free(cap->pRead);
+    memset(cap, 0, sizeof(BenchCapture));
+}
+
+//整个文件读进内存，读的耗时单独统计，不算在推流里
+static BOOL LoadCapture(const char *path, BenchCapture *cap)
+{
+    AVFormatNode *pAVFormat;
+    AVStream *st;
+    AVPacket packet;
+    int nCapacity = 0;
+    unsigned long long nAllocs;
+    long long t0;
+    BOOL bRet = FALSE;
+
+    memset(cap, 0, sizeof(BenchCapture));
+    cap->path = path;
+    pAVFormat = AllocAVFormat();
+    if (pAVFormat == NULL)
+        return FALSE;
+    //和initCamStream 同样的打开路径，没有编进解码器，宽高可能拿不到，只用于metadata
+    t0 = GetTickUs();
+    if (!OpenAVFormat(pAVFormat, path, NULL))
+    {
+        LOGE("Couldn't open capture %s", path);
+        goto end;
+    }
+    cap->nOpen = GetTickUs() - t0;
+    pAVFormat->videoindex = av_find_best_stream(pAVFormat->pFormatCtx,
+                            AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (pAVFormat->videoindex < 0)
+    {
+        LOGE("Didn't find a video stream in %s", path);
+        goto end;
+    }
+    DiscardOtherStreams(pAVFormat);
+    st = pAVFormat->pFormatCtx->streams[pAVFormat->videoindex];
+    cap->width = st->codecpar->width;
+    cap->height = st->codecpar->height;
+    cap->rate = st->avg_frame_rate.den > 0 && st->avg_frame_rate.num > 0
+                ? st->avg_frame_rate.num / st->avg_frame_rate.den : BENCH_DEFAULT_RATE;
+
+    while (TRUE)
+    {
+        nAllocs = GetAllocs();
+        t0 = GetTickUs();
+        if (!ReadVideoPacket(pAVFormat, &packet))
+            break;
+        cap->nReadAllocs += GetAllocs() - nAllocs;
+        if (cap->nFrames == nCapacity)
+        {
+            nCapacity = nCapacity ? nCapacity * 2 : 1024;
+            cap->frames = (BenchFrame *) realloc(cap->frames, nCapacity * sizeof(BenchFrame));
+            cap->pRead = (long long *) realloc(cap->pRead, nCapacity * sizeof(long long));
+            if (cap->frames == NULL || cap->pRead == NULL)
+            {
+                av_packet_unref(&packet);
+                goto end;
+            }
+        }
+        cap->pRead[cap->nFrames] = GetTickUs() - t0;
+        cap->frames[cap->nFrames].data = (unsigned char *) malloc(packet.size);
+        if (cap->frames[cap->nFrames].data == NULL)
+        {
+            av_packet_unref(&packet);
+            goto end;
+        }
+        memcpy(cap->frames[cap->nFrames].data, packet.data, packet.size);
+        cap->frames[cap->nFrames].size = packet.size;
+        cap->nBytes += packet.size;
+        cap->nFrames++;
+        av_packet_unref(&packet);
+    }
+    bRet = cap->nFrames > 0;
+
+end:
+    FreeAVFormat(pAVFormat);
+    if (!bRet)
+        FreeCapture(cap);
+    return bRet;
+}
+
+//等sink 收到nFrames 帧，一段时间没有进展返回FALSE
+static BOOL WaitSink(RtmpSink *sink, unsigned int nFrames)
+{
+    unsigned int n, last = 0;
+    long long tProgress = GetTickUs();
+
+    while ((n = RtmpSinkFrames(sink)) < nFrames)
+    {
+        if (n != last)
+        {
+            last = n;
+            tProgress = GetTickUs();
+        }
+        else if (GetTickUs() - tProgress > BENCH_DRAIN_MS * 1000LL)
+        {
+            return FALSE;
+        }
+        usleep(1000);
+    }
+    return TRUE;
+}
+
+static BOOL RunCapture(BenchCapture *cap, const BenchOptions *opts)
+{
+    unsigned int nTotal = (unsigned int) cap->nFrames * opts->nLoops;
+    unsigned int i, tick, flags, nAccepted = 0, nPackError = 0;
+    unsigned long long nAllocs;
+    long long *pPack, *pPush, *pStart, *pE2e;
+    long long t0, t1, t2, tBegin, tEnd;
+    long long stats[SEND_QUEUE_STATS_COUNT];
+    int nE2e = 0, nCodec;
+    char url[64];
+    RtmpSink *sink = NULL;
+    RtmpNode *pRtmpNode = NULL;
+    BenchFrame *frame;
+    FrameBuf *f;
+    double sec;
+    BOOL bStopped = FALSE;
+    BOOL bRet = FALSE;
+
+    pPack = (long long *) calloc(nTotal, sizeof(long long));
+    pPush = (long long *) calloc(nTotal, sizeof(long long));
+    pStart = (long long *) calloc(nTotal + 1, sizeof(long long));
+    pE2e = (long long *) calloc(nTotal, sizeof(long long));
+    if (!pPack || !pPush || !pStart || !pE2e || !StartRtmpSink(&sink, nTotal))
+        goto end;
+    snprintf(url, sizeof(url), "rtmp://127.0.0.1:%d/live/bench", sink->port);
+
+    pRtmpNode = AllocRtmpNode();
+    if (pRtmpNode == NULL
+            || !InitSendQueue(&pRtmpNode->m_pSendQueue, url, opts->bEventLoop,
+                              opts->bSendOptions ? &opts->send : NULL))
+        goto end;
+    pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+    pRtmpNode->m_SendSpsPps = SendSpsPps(pRtmpNode->m_pSendQueue,
+                                         (char *) cap->frames[0].data, cap->frames[0].size,
+                                         cap->width, cap->height, cap->rate,
+                                         &pRtmpNode->m_Codec);
+    pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+    if (!pRtmpNode->m_SendSpsPps)
+    {
+        LOGE("No sps/pps in the first frame of %s", cap->path);
+        goto end;
+    }
+
+    //时间戳用帧序号，sink 按它找回进队列的时间。0 留给sequence header
+    nAllocs = GetAllocs();
+    tBegin = GetTickUs();
+    for (i = 0; i < nTotal; i++)
+    {
+        frame = &cap->frames[i % cap->nFrames];
+        tick = i + 1;
+        while (SendQueueDepth(pRtmpNode->m_pSendQueue) >= SEND_QUEUE_HIGH_WATER - 1)
+            usleep(BENCH_WAIT_US);
+
+        pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+        t0 = GetTickUs();
+        f = PackH264((char *) frame->data, frame->size, pRtmpNode->m_Codec, &flags);
+        t1 = GetTickUs();
+        if (f == NULL)
+        {
+            pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+            nPackError++;
+            continue;
+        }
+        pStart[tick] = t0;
+        if (SendQueuePush(pRtmpNode->m_pSendQueue, f, RTMP_PACKET_TYPE_VIDEO, tick, flags))
+            nAccepted++;
+        UnrefFrameBuf(f);
+        t2 = GetTickUs();
+        pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+        pPack[i] = t1 - t0;
+        pPush[i] = t2 - t1;
+    }
+    if (!WaitSink(sink, nAccepted))
+        LOGE("Sink stalled at %u of %u frames", RtmpSinkFrames(sink), nAccepted);
+    nAllocs = GetAllocs() - nAllocs;
+    GetSendQueueStats(pRtmpNode->m_pSendQueue, stats);
+    nCodec = pRtmpNode->m_Codec;
+
+    FreeRtmpNode(pRtmpNode);
+    pRtmpNode = NULL;
+    StopRtmpSink(sink);
+    bStopped = TRUE;
+    tEnd = sink->nLastRecv > tBegin ? sink->nLastRecv : GetTickUs();
+    for (tick = 1; tick <= nTotal; tick++)
+    {
+        if (pStart[tick] && sink->pRecvTime[tick])
+            pE2e[nE2e++] = sink->pRecvTime[tick] - pStart[tick];
+    }
+
+    sec = (tEnd - tBegin) / 1e6;
+    printf("%s: %s %dx%d, %d frames x %d loops, %s\n", cap->path,
+           nCodec == VIDEO_CODEC_HEVC ? "hevc" : "h264", cap->width, cap->height,
+           cap->nFrames, opts->nLoops,
+           opts->bEventLoop ? "epoll" : "send thread");
+    printf("  open: %lld us\n", cap->nOpen);
+    printf("  frames: %u sent, %u received, %u pack errors, drops nonref/gop/latency %lld/%lld/%lld\n",
+           nAccepted, sink->nFrames, nPackError, stats[1], stats[2], stats[3]);
+    printf("  throughput: %.1f frames/s, %.2f MB/s annex-b in, %.2f MB/s rtmp out\n",
+           sink->nFrames / sec, cap->nBytes * (double) opts->nLoops / sec / 1e6,
+           sink->nBytes / sec / 1e6);
+    printf("  allocations: %.2f per frame (%llu total), read %.2f per frame\n",
+           nTotal ? (double) nAllocs / nTotal : 0.0, nAllocs,
+           (double) cap->nReadAllocs / cap->nFrames);
+    printf("  send errors %lld, reconnects %lld, rtt %lld ms, pings answered %u, chunk size %u\n",
+           stats[4], stats[5], stats[14], sink->nPings, sink->nChunkSize);
+    printf("  %-6s %10s %10s %10s %10s %10s\n", "us", "p50", "p90", "p99", "max", "n");
+    PrintPercentiles("read", cap->pRead, cap->nFrames);
+    PrintPercentiles("pack", pPack, nTotal - nPackError);
+    PrintPercentiles("push", pPush, nTotal - nPackError);
+    PrintPercentiles("e2e", pE2e, nE2e);
+    bRet = sink->nFrames == nAccepted;
+
+end:
+    if (pRtmpNode)
+        FreeRtmpNode(pRtmpNode);
+    if (sink)
+    {
+        if (!bStopped)
+            StopRtmpSink(sink);
+        FreeRtmpSink(sink);
+    }
+    free(pPack);
+    free(pPush);
+    free(pStart);
+    free(pE2e);
+    return bRet;
+}
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c dir] [-e] [-l loops] [-p kbps] [-t ms] capture.h264|capture.h265 ...\n"
+            "  -c  stream info cache directory, a second run skips probing\n"
+            "  -e  send from the epoll publisher thread instead of a send thread\n"
+            "  -l  replay each capture this many times (default 1)\n"
+            "  -p  token bucket pacing rate in kbps (default off)\n"
+            "  -t  target latency in ms for the drop policy (default off)\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opts;
+    BenchCapture cap;
+    int c, i, nFailed = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.nLoops = 1;
+    while ((c = getopt(argc, argv, "c:el:p:t:")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            SetStreamInfoCacheDir(optarg);
+            break;
+        case 'e':
+            opts.bEventLoop = TRUE;
+            break;
+        case 'l':
+            opts.nLoops = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'p':
+            opts.send.nPaceKbps = atoi(optarg);
+            opts.bSendOptions = TRUE;
+            break;
+        case 't':
+            opts.send.nTargetLatency = atoi(optarg);
+            opts.bSendOptions = TRUE;
+            break;
+        default:
+            Usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    av_register_all();
+    av_log_set_level(AV_LOG_ERROR);
+    //sink 读到推流端断开时librtmp 会打错误日志
+    RTMP_LogSetLevel(RTMP_LOGCRIT);
+    for (i = optind; i < argc; i++)
+    {
+        if (!LoadCapture(argv[i], &cap))
+        {
+            nFailed++;
+            continue;
+        }
+        if (!RunCapture(&cap, &opts))
+            nFailed++;
+        FreeCapture(&cap);
+    }
+    return nFailed ? 1 : 0;
+}
@@ -0,0 +1,321 @@
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "librtmp/rtmp.h"
+#include "librtmp/amf.h"
+
+#include "rtmp_sink.h"
+
+#define SAVC(x) static const AVal av_##x = AVC(#x)
+
+SAVC(connect);
+SAVC(createStream);
+SAVC(publish);
+SAVC(_result);
+SAVC(onStatus);
+SAVC(fmsVer);
+SAVC(capabilities);
+SAVC(mode);
+SAVC(level);
+SAVC(code);
+SAVC(description);
+SAVC(objectEncoding);
+SAVC(status);
+static const AVal av_FMS_version = AVC("FMS/3,5,1,525");
+static const AVal av_NetConnection_Connect_Success = AVC("NetConnection.Connect.Success");
+static const AVal av_Connection_succeeded = AVC("Connection succeeded.");
+static const AVal av_NetStream_Publish_Start = AVC("NetStream.Publish.Start");
+static const AVal av_Started_publishing = AVC("Started publishing");
+
+long long GetTickUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void InitInvoke(RTMPPacket *packet, char *pbuf, int nChannel,
+                       int nStreamId)
+{
+    packet->m_nChannel = nChannel;
+    packet->m_headerType = RTMP_PACKET_SIZE_MEDIUM;
+    packet->m_packetType = RTMP_PACKET_TYPE_INVOKE;
+    packet->m_nTimeStamp = 0;
+    packet->m_nInfoField2 = nStreamId;
+    packet->m_hasAbsTimestamp = 0;
+    packet->m_body = pbuf + RTMP_MAX_HEADER_SIZE;
+}
+
+//同rtmpsrv 的SendConnectResult，去掉了data 对象
+static BOOL SendConnectResult(RTMP *r, double txn)
+{
+    RTMPPacket packet;
+    char pbuf[384], *pend = pbuf + sizeof(pbuf);
+    char *enc;
+
+    InitInvoke(&packet, pbuf, 0x03, 0);
+    enc = packet.m_body;
+    enc = AMF_EncodeString(enc, pend, &av__result);
+    enc = AMF_EncodeNumber(enc, pend, txn);
+    *enc++ = AMF_OBJECT;
+    enc = AMF_EncodeNamedString(enc, pend, &av_fmsVer, &av_FMS_version);
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_capabilities, 31.0);
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_mode, 1.0);
+    *enc++ = 0;
+    *enc++ = 0;
+    *enc++ = AMF_OBJECT_END;
+
+    *enc++ = AMF_OBJECT;
+    enc = AMF_EncodeNamedString(enc, pend, &av_level, &av_status);
+    enc = AMF_EncodeNamedString(enc, pend, &av_code, &av_NetConnection_Connect_Success);
+    enc = AMF_EncodeNamedString(enc, pend, &av_description, &av_Connection_succeeded);
+    enc = AMF_EncodeNamedNumber(enc, pend, &av_objectEncoding, r->m_fEncoding);
+    *enc++ = 0;
+    *enc++ = 0;
+    *enc++ = AMF_OBJECT_END;
+
+    packet.m_nBodySize = enc - packet.m_body;
+    return RTMP_SendPacket(r, &packet, FALSE);
+}
+
+static BOOL SendResultNumber(RTMP *r, double txn, double ID)
+{
+    RTMPPacket packet;
+    char pbuf[256], *pend = pbuf + sizeof(pbuf);
+    char *enc;
+
+    InitInvoke(&packet, pbuf, 0x03, 0);
+    enc = packet.m_body;
+    enc = AMF_EncodeString(enc, pend, &av__result);
+    enc = AMF_EncodeNumber(enc, pend, txn);
+    *enc++ = AMF_NULL;
+    enc = AMF_EncodeNumber(enc, pend, ID);
+
+    packet.m_nBodySize = enc - packet.m_body;
+    return RTMP_SendPacket(r, &packet, FALSE);
+}
+
+//librtmp 的RTMP_ConnectStream 收到它才返回
+static BOOL SendPublishStart(RTMP *r, int nStreamId)
+{
+    RTMPPacket packet;
+    char pbuf[512], *pend = pbuf + sizeof(pbuf);
+    char *enc;
+
+    InitInvoke(&packet, pbuf, 0x05, nStreamId);
+    enc = packet.m_body;
+    enc = AMF_EncodeString(enc, pend, &av_onStatus);
+    enc = AMF_EncodeNumber(enc, pend, 0);
+    *enc++ = AMF_NULL;
+    *enc++ = AMF_OBJECT;
+    enc = AMF_EncodeNamedString(enc, pend, &av_level, &av_status);
+    enc = AMF_EncodeNamedString(enc, pend, &av_code, &av_NetStream_Publish_Start);
+    enc = AMF_EncodeNamedString(enc, pend, &av_description, &av_Started_publishing);
+    *enc++ = 0;
+    *enc++ = 0;
+    *enc++ = AMF_OBJECT_END;
+
+    packet.m_nBodySize = enc - packet.m_body;
+    return RTMP_SendPacket(r, &packet, FALSE);
+}
+
+static BOOL ServeInvoke(RtmpSink *s, RTMP *r, RTMPPacket *packet)
+{
+    AMFObject obj;
+    AVal method;
+    double txn;
+    BOOL bRet = TRUE;
+
+    if (packet->m_nBodySize == 0 || packet->m_body[0] != AMF_STRING)
+        return TRUE;
+    if (AMF_Decode(&obj, packet->m_body, packet->m_nBodySize, FALSE) < 0)
+    {
+        LOGE("RtmpSink decode invoke error!");
+        return FALSE;
+    }
+    AMFProp_GetString(AMF_GetProp(&obj, NULL, 0), &method);
+    txn = AMFProp_GetNumber(AMF_GetProp(&obj, NULL, 1));
+
+    //releaseStream/FCPublish 等不用回应，客户端不等它们的结果
+    if (AVMATCH(&method, &av_connect))
+        bRet = SendConnectResult(r, txn);
+    else if (AVMATCH(&method, &av_createStream))
+        bRet = SendResultNumber(r, txn, 1.0);
+    else if (AVMATCH(&method, &av_publish))
+        bRet = SendPublishStart(r, packet->m_nInfoField2);
+    AMF_Reset(&obj);
+    return bRet;
+}
+
+static BOOL ServePacket(RtmpSink *s, RTMP *r, RTMPPacket *packet)
+{
+    unsigned char *body = (unsigned char *) packet->m_body;
+    unsigned int ts;
+
+    switch (packet->m_packetType)
+    {
+    case RTMP_PACKET_TYPE_CHUNK_SIZE:
+        //rtmpsrv 没有处理，推流端会改大chunk
+        if (packet->m_nBodySize >= 4)
+        {
+            r->m_inChunkSize = AMF_DecodeInt32(packet->m_body);
+            s->nChunkSize = r->m_inChunkSize;
+        }
+        break;
+
+    case RTMP_PACKET_TYPE_CONTROL:
+        //回复推流端测RTT 的ping
+        if (packet->m_nBodySize >= 6 && ((body[0] << 8) | body[1]) == 6)
+        {
+            s->nPings++;
+            return RTMP_SendCtrl(r, 7, AMF_DecodeInt32(packet->m_body + 2), 0);
+        }
+        break;
+
+    case RTMP_PACKET_TYPE_INVOKE:
+        return ServeInvoke(s, r, packet);
+
+    case RTMP_PACKET_TYPE_INFO:
+    case RTMP_PACKET_TYPE_AUDIO:
+        s->nBytes += packet->m_nBodySize;
+        break;
+
+    case RTMP_PACKET_TYPE_VIDEO:
+        s->nBytes += packet->m_nBodySize;
+        ts = packet->m_nTimeStamp;
+        if (ts == 0)
+            break;
+        s->nLastRecv = GetTickUs();
+        if (ts <= s->nMaxTs)
+            s->pRecvTime[ts] = s->nLastRecv;
+        __atomic_store_n(&s->nFrames, s->nFrames + 1, __ATOMIC_RELEASE);
+        break;
+
+    default:
+        break;
+    }
+    return TRUE;
+}
+
+static void *SinkThread(void *arg)
+{
+    RtmpSink *s = (RtmpSink *) arg;
+    RTMPPacket packet;
+    RTMP *r;
+    int fd, on = 1;
+
+    fd = accept(s->listenFd, NULL, NULL);
+    if (fd < 0)
+    {
+        if (s->bRunning)
+            LOGE("RtmpSink accept error! errno:%d", errno);
+        return NULL;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    r = RTMP_Alloc();
+    if (r == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    RTMP_Init(r);
+    r->m_sb.sb_socket = fd;
+    __atomic_store_n(&s->fd, fd, __ATOMIC_RELEASE);
+    if (!RTMP_Serve(r))
+    {
+        LOGE("RtmpSink handshake failed!");
+        goto cleanup;
+    }
+
+    memset(&packet, 0, sizeof(RTMPPacket));
+    while (RTMP_IsConnected(r) && RTMP_ReadPacket(r, &packet))
+    {
+        if (!RTMPPacket_IsReady(&packet))
+            continue;
+        if (!ServePacket(s, r, &packet))
+        {
+            RTMPPacket_Free(&packet);
+            break;
+        }
+        RTMPPacket_Free(&packet);
+    }
+
+cleanup:
+    __atomic_store_n(&s->fd, -1, __ATOMIC_RELEASE);
+    RTMP_Close(r);
+    RTMP_Free(r);
+    return NULL;
+}
+
+BOOL StartRtmpSink(RtmpSink **s, unsigned int nMaxTs)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int on = 1;
+    RtmpSink *sink = (RtmpSink *) calloc(1, sizeof(RtmpSink));
+    if (sink == NULL)
+        return FALSE;
+    sink->fd = -1;
+    sink->nMaxTs = nMaxTs;
+    sink->nChunkSize = RTMP_DEFAULT_CHUNKSIZE;
+    sink->pRecvTime = (long long *) calloc(nMaxTs + 1, sizeof(long long));
+    sink->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sink->pRecvTime == NULL || sink->listenFd < 0)
+        goto error;
+    setsockopt(sink->listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(sink->listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+            || listen(sink->listenFd, 1) < 0
+            || getsockname(sink->listenFd, (struct sockaddr *) &addr, &len) < 0)
+    {
+        LOGE("RtmpSink listen error! errno:%d", errno);
+        goto error;
+    }
+    sink->port = ntohs(addr.sin_port);
+    sink->bRunning = TRUE;
+    if (pthread_create(&sink->thread, NULL, SinkThread, sink) != 0)
+        goto error;
+    *s = sink;
+    return TRUE;
+
+error:
+    if (sink->listenFd >= 0)
+        close(sink->listenFd);
+    free(sink->pRecvTime);
+    free(sink);
+    return FALSE;
+}
+
+unsigned int RtmpSinkFrames(RtmpSink *s)
+{
+    return __atomic_load_n(&s->nFrames, __ATOMIC_ACQUIRE);
+}
+
+void StopRtmpSink(RtmpSink *s)
+{
+    int fd;
+
+    s->bRunning = FALSE;
+    //唤醒accept 或RTMP_ReadPacket
+    shutdown(s->listenFd, SHUT_RDWR);
+    fd = __atomic_load_n(&s->fd, __ATOMIC_ACQUIRE);
+    if (fd >= 0)
+        shutdown(fd, SHUT_RDWR);
+    pthread_join(s->thread, NULL);
+}
+
+void FreeRtmpSink(RtmpSink *s)
+{
+    close(s->listenFd);
+    free(s->pRecvTime);
+    free(s);
+}
@@ -0,0 +1,41 @@
+#ifndef __RTMP_SINK_H
+#define __RTMP_SINK_H
+
+#include <pthread.h>
+
+#include "platform.h"
+
+//本机回环上的RTMP 服务器，从rtmpdump 的rtmpsrv 改出来。
+//只接受一个推流连接，回应connect/createStream/publish，收到的视频帧记下到达时间
+typedef struct RtmpSink
+{
+    int port;
+    int listenFd;
+    int fd;
+    BOOL bRunning;
+    pthread_t thread;
+    //以下只由sink 线程写，StopRtmpSink 之后才能读
+    unsigned int nFrames; //视频消息数，不包括sequence header
+    unsigned long long nBytes; //所有音视频和metadata 消息的字节数
+    unsigned int nChunkSize;
+    unsigned int nPings;
+    long long *pRecvTime; //按时间戳记录到达时间us，时间戳0 是sequence header 不记
+    unsigned int nMaxTs;
+    long long nLastRecv;
+} RtmpSink;
+
+//单调时钟，us
+long long GetTickUs(void);
+
+//监听127.0.0.1 的随机端口，nMaxTs 是最大的帧时间戳
+BOOL StartRtmpSink(RtmpSink **s, unsigned int nMaxTs);
+
+//已收到的视频帧数，推流线程等待对端收完时调用
+unsigned int RtmpSinkFrames(RtmpSink *s);
+
+//停止并等待sink 线程退出，之后可以读统计
+void StopRtmpSink(RtmpSink *s);
+
+void FreeRtmpSink(RtmpSink *s);
+
+#endif
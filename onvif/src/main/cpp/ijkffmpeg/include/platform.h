@@ -7,15 +7,62 @@
 
 #define _DEBUG_
 
+//日志级别，数值和android_LogPriority 一致
+#define LOG_LEVEL_VERBOSE  2
+#define LOG_LEVEL_DEBUG    3
+#define LOG_LEVEL_INFO     4
+#define LOG_LEVEL_WARN     5
+#define LOG_LEVEL_ERROR    6
+#define LOG_LEVEL_SILENT   8
+
+//编译期门限，低于它的日志连参数求值一起去掉
+#ifndef LOG_LEVEL
+#ifdef _DEBUG_
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL LOG_LEVEL_ERROR
+#endif
+#endif
+
 #ifdef ANDROID
 #include <jni.h>
 #include <android/log.h>
-#define LOGE(format, ...)  __android_log_print(ANDROID_LOG_ERROR, "(>_<)", format, ##__VA_ARGS__)
-#define LOGI(format, ...)  __android_log_print(ANDROID_LOG_INFO,  "(^_^)", format, ##__VA_ARGS__)
-#define printf(format, ...)  __android_log_print(ANDROID_LOG_INFO, "(^_^)", format, ##__VA_ARGS__)
+#endif
+
+#ifdef LOG_ASYNC
+//见rtmp/logger.h
+void LogWrite(int level, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+#define LOG_PRINT(level, tag, format, ...)  LogWrite(level, tag, format, ##__VA_ARGS__)
+#elif defined(ANDROID)
+#define LOG_PRINT(level, tag, format, ...)  __android_log_print(level, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_PRINT(level, tag, format, ...)  printf(tag " " format "\n", ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOGE(format, ...)  LOG_PRINT(LOG_LEVEL_ERROR, "(>_<)", format, ##__VA_ARGS__)
 #else
-#define LOGE(format, ...)  printf("(>_<) " format "\n", ##__VA_ARGS__)
-#define LOGI(format, ...)  printf("(^_^) " format "\n", ##__VA_ARGS__)
+#define LOGE(format, ...)  ((void) 0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOGW(format, ...)  LOG_PRINT(LOG_LEVEL_WARN, "(>_<)", format, ##__VA_ARGS__)
+#else
+#define LOGW(format, ...)  ((void) 0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOGI(format, ...)  LOG_PRINT(LOG_LEVEL_INFO, "(^_^)", format, ##__VA_ARGS__)
+#else
+#define LOGI(format, ...)  ((void) 0)
+#endif
+//每帧都会走到的日志用LOGD，默认编译掉
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOGD(format, ...)  LOG_PRINT(LOG_LEVEL_DEBUG, "(^_^)", format, ##__VA_ARGS__)
+#else
+#define LOGD(format, ...)  ((void) 0)
+#endif
+
+#ifdef ANDROID
+#define printf(format, ...)  LOGI(format, ##__VA_ARGS__)
 #endif
 
 typedef int BOOL;
@@ -6,97 +6,67 @@
 #include <string.h>
 #include <memory.h>
 #include <assert.h>
+#include <stdint.h>
 //#include <conio.h>
 
 #define MAXH264FRAMESIZE 1024 *100
 #define MAXAACFRAMESIZE  1024 *10
 
-//读取字节结构体
+//读取比特的结构体。未读的比特高位对齐放在64位的cache 中，不够时按字节从p 装入，
+//每次装到56位以上，读ue/se 只要一次clz
 typedef struct Tag_bs_t
 {
-    unsigned char *p_start; //缓冲区首地址(这个开始是最低地址)
-    unsigned char *p; //缓冲区当前的读写指针 当前字节的地址，这个会不断的++，每次++，进入一个新的字节
-    unsigned char *p_end; //缓冲区尾地址		//typedef unsigned char   uint8_t;
-    int i_left; // p所指字节当前还有多少 “位” 可读写 count number of available(可用的)位
+    unsigned char *p_start; //缓冲区首地址
+    unsigned char *p; //下一个要装进cache 的字节
+    unsigned char *p_end; //缓冲区尾地址
+    uint64_t cache; //未读的比特，高位对齐，i_bits 以外的位都是0
+    int i_bits; //cache 中未读的比特数
+    int i_zeros; //装入时连续的0 字节数，用于去掉防竞争字节
+    int b_escape; //是否去掉00 00 03 中的03
 } bs_t;
 
 /*
- 函数名称：
- 函数功能：初始化结构体
- 参    数：
- 返 回 值：无返回值,void类型
- 思    路：
- 资    料：
-
+ 函数功能：初始化结构体，p_data 是已经去掉防竞争字节的RBSP
  */
 void bs_init(bs_t *s, void *p_data, int i_data);
 
 /*
- 该函数的作用是：从s中读出i_count位，并将其做为uint32_t类型返回
- 思路:
- 若i_count>0且s流并未结束，则开始或继续读取码流；
- 若s当前字节中剩余位数大于等于要读取的位数i_count，则直接读取；
- 若s当前字节中剩余位数小于要读取的位数i_count，则读取剩余位，进入s下一字节继续读取。
- 补充:
- 写入s时，i_left表示s当前字节还没被写入的位，若一个新的字节，则i_left=8；
- 读取s时，i_left表示s当前字节还没被读取的位，若一个新的字节，则i_left＝8。
- 注意两者的区别和联系。
-
- 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000 00000000 0000000
- -------- -----000 00000000 ...
- 写入s时：i_left = 3
- 读取s时：i_left = 5
-
- 我思：
- 字节流提前放在了结构体bs_s的对象bs_t里了，可能字节流不会一次性读取/分析完，而是根据需要，每次都读取几比特
- bs_s里，有专门的字段用来记录历史读取的结果,每次读取，都会在上次的读取位置上进行
- 比如，100字节的流，经过若干次读取，当前位置处于中间一个字节处，前3个比特已经读取过了，此次要读取2比特
+ 函数功能：初始化结构体，p_data 直接是nal 的数据(不含起始码)，读的时候跳过00 00 03 中的03，
+ 不用先拷贝一份去掉防竞争字节
+ */
+void bs_init_nal(bs_t *s, void *p_data, int i_data);
 
- 00001001
- 000 01 001 (已读过的 本次要读的 以后要读的 )
- i_count = 2	(计划去读2比特)
- i_left  = 5	(还有5比特未读，在本字节中)
- i_shr = s->i_left - i_count = 5 - 2 = 3
- *s->p >> i_shr，就把本次要读的比特移到了字节最右边(未读，但本次不需要的给移到了字节外，抛掉了)
- 00000001
- i_mask[i_count] 即i_mask[2] 即0x03:00000011
- ( *s->p >> i_shr )&i_mask[i_count]; 即00000001 & 00000011 也就是00000001 按位与 00000011
- 结果是：00000001
- i_result |= ( *s->p >> i_shr )&i_mask[i_count];即i_result |=00000001 也就是 i_result =i_result | 00000001 = 00000000 00000000 00000000 00000000 | 00000001 =00000000 00000000 00000000 00000001
- i_result =
- return( i_result ); 返回的i_result是4字节长度的，是unsigned类型 sizeof(unsigned)=4
+/*
+ 函数功能：从s中读出i_count位(0~32)，并将其做为无符号数返回
+ 思    路：cache 中不够i_count 位时先装入，然后取cache 的高i_count 位。
+ 数据结束后读到的位为0
+ 资    料：毕厚杰：第145页，u(n)/u(v)
  */
 int bs_read(bs_t *s, int i_count);
 
 /*
- 函数名称：
- 函数功能：从s中读出1位，并将其做为uint32_t类型返回。
- 函数参数：
- 返 回 值：
- 思    路：若s流并未结束，则读取一位
- 资    料：
- 毕厚杰：第145页，u(n)/u(v)，读进连续的若干比特，并将它们解释为“无符号整数”
- return i_result;	//unsigned int
+ 函数功能：从s中读出1位
  */
 int bs_read1(bs_t *s);
 
 /*
- 函数名称：
- 函数功能：从s中解码并读出一个语法元素值
- 参    数：
- 返 回 值：
+ 函数功能：从s中解码并读出一个ue(v)
  思    路：
- 从s的当前位读取并计数，直至读取到1为止；
- while( bs_read1( s ) == 0 && s->p < s->p_end && i < 32 )这个循环用i记录了s当前位置到1为止的0的个数，并丢弃读到的第一个1；
+ cache 中高位连续0 的个数i 用clz 一次得到，丢掉i 个0 和后面的1，
  返回2^i-1+bs_read(s,i)。
- 例：当s字节中存放的是0001010时，1前有3个0，所以i＝3；
+ 例：当s 中存放的是0001010时，1前有3个0，所以i＝3；
  返回的是：2^i-1+bs_read(s,i)即：8－1＋010＝9
- 资    料：
- 毕厚杰：第145页，ue(v)；无符号指数Golomb熵编码
- x264中bs.h文件部分函数解读 http://wmnmtm.blog.163.com/blog/static/382457142011724101824726/
- 无符号整数指数哥伦布码编码 http://wmnmtm.blog.163.com/blog/static/38245714201172623027946/
+ 超过31个0 或者数据已结束时返回0，并且之后不再读到数据
+ 资    料：毕厚杰：第145页，ue(v)；无符号指数Golomb熵编码
  */
 int bs_read_ue(bs_t *s);
 
-#endif
+/*
+ 函数功能：从s中解码并读出一个se(v)，k=ue(v)，k 为奇数时是(k+1)/2，偶数时是-k/2
+ */
+int bs_read_se(bs_t *s);
 
+//所有数据都已读完
+int bs_eof(bs_t *s);
+
+#endif
@@ -9,7 +9,10 @@
 
 typedef struct _RTMPMetadata
 {
-    // video, must be h264 type
+    // video, h264 or hevc
+    int nCodec; // VIDEO_CODEC_H264/VIDEO_CODEC_HEVC
+    unsigned int nVpsLen; // hevc only
+    unsigned char Vps[1024];
     unsigned int nWidth;
     unsigned int nHeight;
     unsigned int nFrameRate; // fps
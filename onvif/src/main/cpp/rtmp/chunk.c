@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "chunk.h"
+#include "librtmp/rtmp.h"
+
+static unsigned char *PutBe24(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 16;
+    p[1] = v >> 8;
+    p[2] = v;
+    return p + 3;
+}
+
+static unsigned char *PutBe32(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+    return p + 4;
+}
+
+void ChunkCursorInit(ChunkCursor *c, unsigned int nPacketType,
+                     unsigned int nTimestamp, int nStreamId,
+                     const unsigned char *body, unsigned int size,
+                     unsigned int chunkSize)
+{
+    unsigned char *p = c->hdr0;
+    BOOL bExtended = nTimestamp >= 0xffffff;
+    unsigned int nChunks;
+    unsigned int csid = nPacketType <= RTMP_PACKET_TYPE_CLIENT_BW
+                        ? CHUNK_CONTROL_ID : CHUNK_STREAM_ID;
+
+    //type 0: basic header, timestamp, 消息长度, 消息类型, stream id(小端)
+    *p++ = csid;
+    p = PutBe24(p, bExtended ? 0xffffff : nTimestamp);
+    p = PutBe24(p, size);
+    *p++ = nPacketType;
+    *p++ = nStreamId;
+    *p++ = nStreamId >> 8;
+    *p++ = nStreamId >> 16;
+    *p++ = nStreamId >> 24;
+    if (bExtended)
+        p = PutBe32(p, nTimestamp);
+    c->nHdr0 = p - c->hdr0;
+
+    //type 3 头在扩展时间戳时也要带上时间戳，和librtmp 一致
+    p = c->hdr3;
+    *p++ = 0xc0 | csid;
+    if (bExtended)
+        p = PutBe32(p, nTimestamp);
+    c->nHdr3 = p - c->hdr3;
+
+    c->body = body;
+    c->size = size;
+    c->chunkSize = chunkSize;
+    c->wire = 0;
+    nChunks = size == 0 ? 1 : (size + chunkSize - 1) / chunkSize;
+    c->total = c->nHdr0 + (nChunks - 1) * c->nHdr3 + size;
+}
+
+int ChunkCursorFill(ChunkCursor *c, struct iovec *iov, int max)
+{
+    unsigned int k, off, first, payload, hdr, n;
+    const unsigned char *h;
+    int count = 0;
+
+    if (c->wire >= c->total)
+        return 0;
+
+    //由wire 算出当前是第几个chunk，以及在这个chunk 中的偏移
+    first = c->nHdr0 + (c->size < c->chunkSize ? c->size : c->chunkSize);
+    if (c->wire < first)
+    {
+        k = 0;
+        off = c->wire;
+    }
+    else
+    {
+        k = 1 + (c->wire - first) / (c->nHdr3 + c->chunkSize);
+        off = (c->wire - first) % (c->nHdr3 + c->chunkSize);
+    }
+
+    while (count < max && k * c->chunkSize < c->size + (k == 0))
+    {
+        h = k == 0 ? c->hdr0 : c->hdr3;
+        hdr = k == 0 ? c->nHdr0 : c->nHdr3;
+        payload = c->size - k * c->chunkSize;
+        if (payload > c->chunkSize)
+            payload = c->chunkSize;
+
+        if (off < hdr)
+        {
+            iov[count].iov_base = (void *) (h + off);
+            iov[count].iov_len = hdr - off;
+            count++;
+            off = hdr;
+            if (count == max)
+                break;
+        }
+        n = off - hdr;
+        if (n < payload)
+        {
+            iov[count].iov_base = (void *) (c->body + k * c->chunkSize + n);
+            iov[count].iov_len = payload - n;
+            count++;
+        }
+        off = 0;
+        k++;
+    }
+    return count;
+}
+
+BOOL ChunkCursorAdvance(ChunkCursor *c, unsigned int n)
+{
+    c->wire += n;
+    return c->wire >= c->total;
+}
+
+BOOL ChunkSendMessage(int fd, unsigned int nPacketType, unsigned int nTimestamp,
+                      int nStreamId, const unsigned char *body, unsigned int size,
+                      unsigned int chunkSize)
+{
+    ChunkCursor c;
+    struct iovec iov[CHUNK_IOV_MAX];
+    struct msghdr msg;
+    int ret;
+
+    ChunkCursorInit(&c, nPacketType, nTimestamp, nStreamId, body, size,
+                    chunkSize);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    do
+    {
+        msg.msg_iovlen = ChunkCursorFill(&c, iov, CHUNK_IOV_MAX);
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            //SO_SNDTIMEO 超时也算错误，和librtmp 的WriteN 一致
+            LOGE("ChunkSendMessage sendmsg error! errno:%d\n", errno);
+            return FALSE;
+        }
+    }
+    while (!ChunkCursorAdvance(&c, ret));
+    return TRUE;
+}
+
+void ChunkReaderInit(ChunkReader *r)
+{
+    memset(r, 0, sizeof(ChunkReader));
+    r->chunkSize = CHUNK_IN_SIZE;
+}
+
+static unsigned int GetBe24(const unsigned char *p)
+{
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static unsigned int GetBe32(const unsigned char *p)
+{
+    return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static ChunkReaderStream *FindReaderStream(ChunkReader *r, int csid, BOOL bAlloc)
+{
+    int i;
+    ChunkReaderStream *pFree = NULL;
+    for (i = 0; i < CHUNK_READER_STREAMS; i++)
+    {
+        if (r->streams[i].csid == csid)
+            return &r->streams[i];
+        if (!pFree && (r->streams[i].csid == 0 || r->streams[i].remain == 0))
+            pFree = &r->streams[i];
+    }
+    if (!bAlloc)
+        return NULL;
+    if (!pFree)
+        pFree = &r->streams[0];
+    memset(pFree, 0, sizeof(ChunkReaderStream));
+    pFree->csid = csid;
+    return pFree;
+}
+
+void ChunkReaderSetStream(ChunkReader *r, int csid, unsigned int type,
+                          unsigned int length, unsigned int remain, BOOL bExtended)
+{
+    ChunkReaderStream *s = FindReaderStream(r, csid, TRUE);
+    s->type = type;
+    s->length = length;
+    s->remain = remain;
+    s->bExtended = bExtended;
+}
+
+static int ReaderCsid(const unsigned char *h)
+{
+    int csid = h[0] & 0x3f;
+    if (csid == 0)
+        return 64 + h[1];
+    if (csid == 1)
+        return 64 + h[1] + (h[2] << 8);
+    return csid;
+}
+
+//当前已收到的头还需要多少字节，不知道扩展时间戳前先按没有算
+static unsigned int ReaderHeaderSize(ChunkReader *r)
+{
+    const unsigned char *h = r->hdr;
+    unsigned int fmt = h[0] >> 6;
+    unsigned int nBasic = (h[0] & 0x3f) == 0 ? 2 : (h[0] & 0x3f) == 1 ? 3 : 1;
+    unsigned int nMsg = fmt == 0 ? 11 : fmt == 1 ? 7 : fmt == 2 ? 3 : 0;
+    ChunkReaderStream *s;
+    BOOL bExtended;
+
+    if (r->nHdr < nBasic + (nMsg ? 3 : 0))
+        return nBasic + (nMsg ? 3 : 0);
+    if (nMsg)
+    {
+        bExtended = GetBe24(h + nBasic) == 0xffffff;
+    }
+    else
+    {
+        s = FindReaderStream(r, ReaderCsid(h), FALSE);
+        bExtended = s && s->bExtended;
+    }
+    return nBasic + nMsg + (bExtended ? 4 : 0);
+}
+
+static void ReaderStartChunk(ChunkReader *r)
+{
+    const unsigned char *h = r->hdr;
+    unsigned int fmt = h[0] >> 6;
+    unsigned int nBasic = (h[0] & 0x3f) == 0 ? 2 : (h[0] & 0x3f) == 1 ? 3 : 1;
+    ChunkReaderStream *s = FindReaderStream(r, ReaderCsid(h), TRUE);
+
+    if (fmt <= 1)
+    {
+        s->length = GetBe24(h + nBasic + 3);
+        s->type = h[nBasic + 6];
+    }
+    if (fmt <= 2)
+    {
+        s->bExtended = GetBe24(h + nBasic) == 0xffffff;
+        //新的消息头，之前没收完的消息作废
+        s->remain = 0;
+    }
+    if (s->remain == 0)
+    {
+        s->remain = s->length;
+        r->nBody = 0;
+    }
+    r->cur = s;
+    r->nPayload = s->remain < r->chunkSize ? s->remain : r->chunkSize;
+    r->bBody = TRUE;
+}
+
+static void ReaderEndMessage(ChunkReader *r, ChunkMessageCallback pfnMessage,
+                             void *ctx)
+{
+    ChunkReaderStream *s = r->cur;
+    unsigned int size;
+    if (s->type == RTMP_PACKET_TYPE_CHUNK_SIZE && r->nBody >= 4)
+    {
+        size = GetBe32(r->body) & 0x7fffffff;
+        if (size > 0)
+            r->chunkSize = size;
+    }
+    if (pfnMessage)
+        pfnMessage(ctx, s->type, r->body, s->length);
+}
+
+void ChunkReaderFeed(ChunkReader *r, const unsigned char *data, unsigned int len,
+                     ChunkMessageCallback pfnMessage, void *ctx)
+{
+    unsigned int n, copy;
+
+    while (len > 0)
+    {
+        if (!r->bBody)
+        {
+            r->hdr[r->nHdr++] = *data++;
+            len--;
+            if (r->nHdr < ReaderHeaderSize(r))
+                continue;
+            r->nHdr = 0;
+            ReaderStartChunk(r);
+            //长度为0 的消息
+            if (r->cur->remain == 0)
+            {
+                r->bBody = FALSE;
+                ReaderEndMessage(r, pfnMessage, ctx);
+            }
+            continue;
+        }
+
+        n = len < r->nPayload ? len : r->nPayload;
+        if (r->nBody < CHUNK_READER_BODY)
+        {
+            copy = CHUNK_READER_BODY - r->nBody;
+            if (copy > n)
+                copy = n;
+            memcpy(r->body + r->nBody, data, copy);
+            r->nBody += copy;
+        }
+        data += n;
+        len -= n;
+        r->nPayload -= n;
+        r->cur->remain -= n;
+        if (r->cur->remain == 0)
+        {
+            r->bBody = FALSE;
+            ReaderEndMessage(r, pfnMessage, ctx);
+        }
+        else if (r->nPayload == 0)
+        {
+            r->bBody = FALSE;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef __CHUNK_H
+#define __CHUNK_H
+
+#include <sys/uio.h>
+
+#include "platform.h"
+
+#define CHUNK_STREAM_ID  0x04 //音视频和metadata 都在chunk stream 4 上发送
+#define CHUNK_CONTROL_ID 0x02 //协议控制消息(类型1-6)在chunk stream 2 上发送
+#define CHUNK_IOV_MAX    128 //一次sendmsg 最多的iovec 数
+#define CHUNK_OUT_SIZE   4096 //连接后协商的发送chunk 大小，和FFmpeg/OBS 相同
+
+//把一个RTMP 消息切成chunk 写到iovec 中，不拷贝body。
+//wire 是已经写到socket 的字节数(chunk 头 + body)，部分写之后从这里继续
+typedef struct ChunkCursor
+{
+    unsigned char hdr0[16]; //第一个chunk 的type 0 头
+    int nHdr0;
+    unsigned char hdr3[5]; //后续chunk 的type 3 头
+    int nHdr3;
+    const unsigned char *body;
+    unsigned int size;
+    unsigned int chunkSize;
+    unsigned int wire;
+    unsigned int total; //整个消息在线路上的字节数
+} ChunkCursor;
+
+void ChunkCursorInit(ChunkCursor *c, unsigned int nPacketType,
+                     unsigned int nTimestamp, int nStreamId,
+                     const unsigned char *body, unsigned int size,
+                     unsigned int chunkSize);
+
+//从当前位置开始最多填max 个iovec，返回填的个数
+int ChunkCursorFill(ChunkCursor *c, struct iovec *iov, int max);
+
+//写出n 字节后调用，返回TRUE 表示整个消息已经写完
+BOOL ChunkCursorAdvance(ChunkCursor *c, unsigned int n);
+
+//阻塞socket 上用sendmsg 发送整个消息，一个关键帧只需要几次系统调用
+BOOL ChunkSendMessage(int fd, unsigned int nPacketType, unsigned int nTimestamp,
+                      int nStreamId, const unsigned char *body, unsigned int size,
+                      unsigned int chunkSize);
+
+#define CHUNK_IN_SIZE         128 //对方没有发Set Chunk Size 之前的chunk 大小
+#define CHUNK_READER_STREAMS  8
+#define CHUNK_READER_BODY     16 //只保存消息body 的前16 字节，够控制消息用
+
+typedef struct ChunkReaderStream
+{
+    int csid; //0 表示空闲
+    unsigned int type;
+    unsigned int length;
+    BOOL bExtended; //上一个头带扩展时间戳，type 3 头也带
+    unsigned int remain; //当前消息还没收到的body，0 表示下一个chunk 开始新消息
+} ChunkReaderStream;
+
+//解析服务器发来的chunk 流，只关心控制消息，其它消息的body 直接跳过
+typedef struct ChunkReader
+{
+    unsigned int chunkSize;
+    unsigned char hdr[18];
+    unsigned int nHdr;
+    BOOL bBody; //正在读chunk 的body
+    unsigned int nPayload; //当前chunk 还没收到的body
+    ChunkReaderStream *cur;
+    ChunkReaderStream streams[CHUNK_READER_STREAMS];
+    unsigned char body[CHUNK_READER_BODY];
+    unsigned int nBody;
+} ChunkReader;
+
+typedef void (*ChunkMessageCallback)(void *ctx, unsigned int type,
+                                     const unsigned char *body, unsigned int size);
+
+void ChunkReaderInit(ChunkReader *r);
+
+//接着别的解析器(librtmp)读时，填入csid 上一个消息的头。remain 不为0 表示这个消息还没收完
+void ChunkReaderSetStream(ChunkReader *r, int csid, unsigned int type,
+                          unsigned int length, unsigned int remain, BOOL bExtended);
+
+//每收完一个消息调用一次pfnMessage，body 最多CHUNK_READER_BODY 字节，size 是消息的实际长度。
+//Set Chunk Size 在这里处理
+void ChunkReaderFeed(ChunkReader *r, const unsigned char *data, unsigned int len,
+                     ChunkMessageCallback pfnMessage, void *ctx);
+
+#endif
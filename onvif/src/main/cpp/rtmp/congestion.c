@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "congestion.h"
+#include "librtmp/rtmp.h"
+
+unsigned int GetTickMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned int) ts.tv_sec * 1000u + (unsigned int) (ts.tv_nsec / 1000000);
+}
+
+static unsigned int GetBe32(const unsigned char *p)
+{
+    return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//速率用1/8 的指数平均
+static void UpdateRate(Congestion *c, unsigned int rate)
+{
+    unsigned int old = c->nRate;
+    __atomic_store_n(&c->nRate, old ? (unsigned int) (((unsigned long long) old * 7 + rate) / 8)
+                     : rate, __ATOMIC_RELAXED);
+}
+
+void InitCongestion(Congestion *c, const SendOptions *opts)
+{
+    memset(c, 0, sizeof(Congestion));
+    if (opts)
+        c->opts = *opts;
+    if (c->opts.nPaceKbps > 0)
+    {
+        if (c->opts.nBurstBytes <= 0)
+            c->opts.nBurstBytes = (int) ((long long) c->opts.nPaceKbps * 125 * CONGESTION_BURST_MS / 1000);
+        //至少能放下一个完整的chunk
+        if (c->opts.nBurstBytes < CHUNK_OUT_SIZE + 16)
+            c->opts.nBurstBytes = CHUNK_OUT_SIZE + 16;
+    }
+    ResetCongestion(c);
+}
+
+void ResetCongestion(Congestion *c)
+{
+    unsigned int now = GetTickMs();
+    __atomic_store_n(&c->bSentTs, FALSE, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nSocketDelay, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nDelayTime, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nOutq, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nAckWindow, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nAckSeq, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nRtt, 0, __ATOMIC_RELAXED);
+    c->nSampleBytes = c->nBytesOut;
+    c->nSampleOutq = 0;
+    c->nSampleTime = now;
+    c->bAck = FALSE;
+    c->nTokens = c->opts.nBurstBytes;
+    c->nTokenTime = now;
+    c->nPingTime = now;
+    c->bPong = FALSE;
+    ChunkReaderInit(&c->reader);
+}
+
+void CongestionOnWrite(Congestion *c, int fd, unsigned int n)
+{
+    unsigned int now = GetTickMs();
+    unsigned int dt = now - c->nSampleTime;
+    unsigned long long delivered;
+    unsigned int rate, nDelay;
+    int outq = 0;
+
+    c->nBytesOut += n;
+    if (dt < CONGESTION_SAMPLE_MS)
+        return;
+    if (ioctl(fd, SIOCOUTQ, &outq) < 0 || outq < 0)
+        outq = 0;
+
+    //这段时间离开socket 的字节 = 写进去的 - 发送缓冲增加的
+    delivered = c->nBytesOut - c->nSampleBytes + c->nSampleOutq;
+    delivered = delivered > (unsigned int) outq ? delivered - outq : 0;
+    rate = (unsigned int) (delivered * 1000 / dt);
+    //发送缓冲一直有积压时测到的才是网络的速率，否则只是写得少
+    if ((c->nSampleOutq > 0 && outq > 0) || rate > c->nRate)
+        UpdateRate(c, rate);
+
+    nDelay = c->nRate ? (unsigned int) ((unsigned long long) outq * 1000 / c->nRate) : 0;
+    __atomic_store_n(&c->nOutq, outq, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nSocketDelay, nDelay, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->nDelayTime, now, __ATOMIC_RELAXED);
+    c->nSampleBytes = c->nBytesOut;
+    c->nSampleOutq = outq;
+    c->nSampleTime = now;
+}
+
+void CongestionOnFrame(Congestion *c, unsigned int timestamp)
+{
+    __atomic_store_n(&c->nSentTs, timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->bSentTs, TRUE, __ATOMIC_RELEASE);
+}
+
+static void OnUserControl(Congestion *c, const unsigned char *body,
+                          unsigned int size)
+{
+    unsigned int event, rtt, old;
+
+    if (size < CONGESTION_CONTROL_SIZE)
+        return;
+    event = (body[0] << 8) | body[1];
+    if (event == USER_CONTROL_PING_REQUEST)
+    {
+        c->bPong = TRUE;
+        c->nPongTs = GetBe32(body + 2);
+    }
+    else if (event == USER_CONTROL_PING_RESPONSE)
+    {
+        //ping 里放的是发送时的GetTickMs
+        rtt = GetTickMs() - GetBe32(body + 2);
+        if (rtt > 60000)
+            return;
+        old = c->nRtt;
+        __atomic_store_n(&c->nRtt, old ? (old * 7 + rtt) / 8 : (rtt ? rtt : 1),
+                         __ATOMIC_RELAXED);
+    }
+}
+
+static void OnServerMessage(void *ctx, unsigned int type,
+                            const unsigned char *body, unsigned int size)
+{
+    Congestion *c = (Congestion *) ctx;
+    unsigned int now, seq, dt;
+
+    if (size < 4)
+        return;
+    if (type == RTMP_PACKET_TYPE_CONTROL)
+    {
+        OnUserControl(c, body, size);
+    }
+    else if (type == RTMP_PACKET_TYPE_SERVER_BW)
+    {
+        __atomic_store_n(&c->nAckWindow, GetBe32(body), __ATOMIC_RELAXED);
+    }
+    else if (type == RTMP_PACKET_TYPE_BYTES_READ_REPORT)
+    {
+        //两次确认之间服务器收到的字节数，发送缓冲有积压时作为速率的采样
+        now = GetTickMs();
+        seq = GetBe32(body);
+        dt = now - c->nAckTime;
+        if (c->bAck && dt > 0 && c->nSampleOutq > 0)
+            UpdateRate(c, (unsigned int) ((unsigned long long) (seq - c->nAckSeq) * 1000 / dt));
+        c->bAck = TRUE;
+        c->nAckTime = now;
+        __atomic_store_n(&c->nAckSeq, seq, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->nAcks, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void CongestionAttach(Congestion *c, RTMP *pRtmp)
+{
+    RTMPPacket *p;
+    int i;
+
+    if (pRtmp->m_inChunkSize > 0)
+        c->reader.chunkSize = pRtmp->m_inChunkSize;
+    for (i = 0; i < pRtmp->m_channelsAllocatedIn; i++)
+    {
+        p = pRtmp->m_vecChannelsIn[i];
+        if (p == NULL)
+            continue;
+        //librtmp 在保存的头里用0xffffff 标记扩展时间戳
+        ChunkReaderSetStream(&c->reader, i, p->m_packetType, p->m_nBodySize,
+                             p->m_nBodySize - p->m_nBytesRead,
+                             p->m_nTimeStamp == 0xffffff);
+    }
+    if (pRtmp->m_sb.sb_size > 0)
+    {
+        ChunkReaderFeed(&c->reader, (unsigned char *) pRtmp->m_sb.sb_start,
+                        pRtmp->m_sb.sb_size, OnServerMessage, c);
+        pRtmp->m_sb.sb_size = 0;
+    }
+}
+
+BOOL CongestionReadInput(Congestion *c, int fd)
+{
+    unsigned char buf[4096];
+    int ret;
+
+    while (TRUE)
+    {
+        ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (ret > 0)
+        {
+            ChunkReaderFeed(&c->reader, buf, ret, OnServerMessage, c);
+            continue;
+        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+        return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+unsigned int CongestionTokens(Congestion *c, unsigned int want, int *pWaitMs)
+{
+    unsigned int now, need;
+    long long rate;
+
+    if (c->opts.nPaceKbps <= 0)
+        return want;
+    rate = (long long) c->opts.nPaceKbps * 125; // bytes/s
+    now = GetTickMs();
+    c->nTokens += (long long) (now - c->nTokenTime) * rate / 1000;
+    if (c->nTokens > c->opts.nBurstBytes)
+        c->nTokens = c->opts.nBurstBytes;
+    c->nTokenTime = now;
+
+    //至少攒够一个chunk 再发，避免很多小的写
+    need = want < CHUNK_OUT_SIZE ? want : CHUNK_OUT_SIZE;
+    if (c->nTokens < need)
+    {
+        *pWaitMs = (int) ((need - c->nTokens) * 1000 / rate) + 1;
+        return 0;
+    }
+    return c->nTokens < want ? (unsigned int) c->nTokens : want;
+}
+
+void CongestionConsume(Congestion *c, unsigned int n)
+{
+    if (c->opts.nPaceKbps > 0)
+        c->nTokens -= n;
+}
+
+static unsigned int PutUserControl(unsigned char *body, unsigned int event,
+                                   unsigned int ts)
+{
+    body[0] = event >> 8;
+    body[1] = event;
+    body[2] = ts >> 24;
+    body[3] = ts >> 16;
+    body[4] = ts >> 8;
+    body[5] = ts;
+    return CONGESTION_CONTROL_SIZE;
+}
+
+unsigned int CongestionControl(Congestion *c, unsigned char *body)
+{
+    unsigned int now;
+
+    if (c->bPong)
+    {
+        c->bPong = FALSE;
+        return PutUserControl(body, USER_CONTROL_PING_RESPONSE, c->nPongTs);
+    }
+    now = GetTickMs();
+    if (now - c->nPingTime < CONGESTION_PING_MS)
+        return 0;
+    c->nPingTime = now;
+    return PutUserControl(body, USER_CONTROL_PING_REQUEST, now);
+}
+
+unsigned int CongestionLatency(Congestion *c, unsigned int timestamp,
+                               unsigned int nDepth)
+{
+    unsigned int nQueue = 0, nSentTs;
+    unsigned int nSocket = __atomic_load_n(&c->nSocketDelay, __ATOMIC_RELAXED);
+    unsigned int dt = GetTickMs() - __atomic_load_n(&c->nDelayTime, __ATOMIC_RELAXED);
+    unsigned int nLatency;
+
+    //上次采样之后发送缓冲按估计的速率在减少
+    nSocket = nSocket > dt ? nSocket - dt : 0;
+    if (nDepth > 0 && __atomic_load_n(&c->bSentTs, __ATOMIC_ACQUIRE))
+    {
+        nSentTs = __atomic_load_n(&c->nSentTs, __ATOMIC_RELAXED);
+        if (timestamp > nSentTs)
+            nQueue = timestamp - nSentTs;
+    }
+    nLatency = nQueue + nSocket;
+    __atomic_store_n(&c->nLatency, nLatency, __ATOMIC_RELAXED);
+    return nLatency;
+}
@@ -0,0 +1,91 @@
+#ifndef __CONGESTION_H
+#define __CONGESTION_H
+
+#include "platform.h"
+#include "chunk.h"
+
+#define CONGESTION_SAMPLE_MS   100 //上行速率的采样间隔
+#define CONGESTION_BURST_MS    100 //令牌桶默认能存下的数据时长
+#define CONGESTION_PING_MS     5000 //发ping 测RTT 的间隔
+#define CONGESTION_CONTROL_SIZE  6 //User Control 消息的长度
+
+//User Control 事件类型
+#define USER_CONTROL_PING_REQUEST   6
+#define USER_CONTROL_PING_RESPONSE  7
+
+//连接的拥塞控制选项，connectRtmpSer 时传入
+typedef struct SendOptions
+{
+    int nTargetLatency; //目标延迟ms，超过一半丢非参考帧，超过后丢整个GOP。0 为只按队列长度丢帧
+    int nPaceKbps; //令牌桶限速，大的关键帧分散发送。0 不限速
+    int nBurstBytes; //令牌桶大小，0 为CONGESTION_BURST_MS 的数据量
+} SendOptions;
+
+//发送队列的拥塞状态。消费者(发送线程或epoll 线程)更新，生产者只原子读取结果
+typedef struct Congestion
+{
+    SendOptions opts;
+    //消费者写，生产者读
+    unsigned int nSentTs; //最后发完的帧的时间戳
+    BOOL bSentTs;
+    unsigned int nSocketDelay; //nDelayTime 时socket 发送缓冲中的数据估计还要多少ms 发完
+    unsigned int nDelayTime;
+    unsigned int nRate; //估计的上行速率，bytes/s
+    unsigned int nOutq; //socket 发送缓冲中还没被确认的字节数
+    unsigned int nAckWindow; //服务器的Window Acknowledgement Size
+    unsigned int nAckSeq; //服务器最近一次确认收到的字节数
+    unsigned int nAcks;
+    unsigned int nLatency; //生产者最近一次估计的延迟
+    unsigned int nRtt; //ping 测得的RTT，ms，1/8 指数平均，0 表示还没有
+    //以下只由消费者访问，时间是GetTickMs 的值
+    unsigned long long nBytesOut;
+    unsigned long long nSampleBytes;
+    unsigned int nSampleOutq;
+    unsigned int nSampleTime;
+    BOOL bAck;
+    unsigned int nAckTime;
+    long long nTokens;
+    unsigned int nTokenTime;
+    unsigned int nPingTime;
+    BOOL bPong; //服务器发了ping，要回复
+    unsigned int nPongTs;
+    ChunkReader reader;
+} Congestion;
+
+//单调时钟，ms
+unsigned int GetTickMs(void);
+
+void InitCongestion(Congestion *c, const SendOptions *opts);
+
+//重连后调用，之前的采样和服务器状态作废
+void ResetCongestion(Congestion *c);
+
+struct RTMP;
+
+//连接握手由librtmp 完成，之后自己读socket。接着librtmp 的chunk 大小和各chunk stream 的头，
+//并解析它缓冲区中还没处理的数据。在Init/ResetCongestion 之后调用
+void CongestionAttach(Congestion *c, struct RTMP *pRtmp);
+
+//消费者往socket 写了n 字节
+void CongestionOnWrite(Congestion *c, int fd, unsigned int n);
+
+//消费者发完一帧
+void CongestionOnFrame(Congestion *c, unsigned int timestamp);
+
+//非阻塞地读掉服务器发来的数据并解析ack，连接已关闭返回FALSE
+BOOL CongestionReadInput(Congestion *c, int fd);
+
+//令牌桶中可以发送的字节数，不限速时返回want。返回0 时*pWaitMs 是要等待的时间
+unsigned int CongestionTokens(Congestion *c, unsigned int want, int *pWaitMs);
+
+void CongestionConsume(Congestion *c, unsigned int n);
+
+//在消息之间调用，有要发的User Control 消息(回复服务器的ping 或定时的ping)时
+//写到body 并返回长度，否则返回0
+unsigned int CongestionControl(Congestion *c, unsigned char *body);
+
+//生产者调用，估计时间戳为timestamp 的帧进队列后要多久才能发出
+unsigned int CongestionLatency(Congestion *c, unsigned int timestamp,
+                               unsigned int nDepth);
+
+#endif
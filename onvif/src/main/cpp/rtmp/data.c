@@ -1,112 +1,248 @@
 #include "data.h"
+#include "video.h"
 
-AVFormatNode *AllocAVFormat()
+#define SLOT_REF_MASK  0x3fff
+#define SLOT_USED      0x4000
+#define SLOT_LIVE      0x8000
+#define SLOT_GEN_ONE   0x10000
+
+static unsigned int HashKey(int key)
 {
-    AVFormatNode *pAVFormat = (AVFormatNode*) malloc(sizeof(AVFormatNode));
-    if (!pAVFormat)
-    {
-        LOGE("Alloc AVFormat error!");
-        return NULL;
-    }
-    pAVFormat->pFormatCtx = NULL;
-    pAVFormat->pNext = NULL;
-    return pAVFormat;
+    return ((unsigned int) key * 2654435761u) & (HANDLE_TABLE_SIZE - 1);
 }
 
-BOOL InitAVFormatQueue(AVFormatQueue **q)
+static pthread_mutex_t *KeyLock(HandleTable *t, int key)
 {
-    AVFormatQueue *queue = (AVFormatQueue*) malloc(sizeof(AVFormatQueue));
-    if (!queue)
+    return &t->locks[(unsigned int) key % HANDLE_TABLE_STRIPES];
+}
+
+BOOL InitHandleTable(HandleTable **t, BOOL (*pfnFree)(void *pObject))
+{
+    int i;
+    HandleTable *table = (HandleTable *) calloc(1, sizeof(HandleTable));
+    if (!table)
     {
-        LOGE("Alloc AVFormatQueue error!");
+        LOGE("Alloc HandleTable error!");
         return FALSE;
     }
-    queue->head = AllocAVFormat();
-    if (!queue->head)
-        return FALSE;
-    queue->tail = queue->head;
-    *q = queue;
+    for (i = 0; i < HANDLE_TABLE_STRIPES; i++)
+        pthread_mutex_init(&table->locks[i], NULL);
+    table->pfnFree = pfnFree;
+    *t = table;
     return TRUE;
 }
 
-BOOL IsAVFormatQueueEmpty(AVFormatQueue *q)
+//探测长度只增不减，多个分段的插入可能同时更新
+static void RaiseMaxProbe(HandleTable *t, unsigned int probe)
 {
-    return (q->head->pNext == NULL);
+    unsigned int cur = __atomic_load_n(&t->maxProbe, __ATOMIC_RELAXED);
+    while (cur < probe
+            && !__atomic_compare_exchange_n(&t->maxProbe, &cur, probe, FALSE,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
 }
 
-BOOL PushAVFormat(AVFormatQueue *q, AVFormatNode *a)
+//在有效的slot 中找key，找不到返回-1。不加引用，只在持有key 的锁时使用
+static int FindSlot(HandleTable *t, int key)
 {
-    q->tail->pNext = a;
-    q->tail = a;
-    return TRUE;
+    unsigned int i, index, s;
+    unsigned int h = HashKey(key);
+    unsigned int n = __atomic_load_n(&t->maxProbe, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++)
+    {
+        index = (h + i) & (HANDLE_TABLE_SIZE - 1);
+        s = __atomic_load_n(&t->slots[index].state, __ATOMIC_ACQUIRE);
+        if (!(s & SLOT_USED))
+            return -1;
+        if ((s & SLOT_LIVE) && t->slots[index].key == key)
+            return index;
+    }
+    return -1;
 }
 
-BOOL PopAVFormat(AVFormatQueue *q, AVFormatNode **a)
+BOOL HandleTableAcquire(HandleTable *t, int key, void **pObject, int *slot)
 {
-    if (IsAVFormatQueueEmpty(q))
+    unsigned int i, index, s;
+    unsigned int h = HashKey(key);
+    unsigned int n = __atomic_load_n(&t->maxProbe, __ATOMIC_ACQUIRE);
+    HandleSlot *p;
+
+    for (i = 0; i < n; i++)
     {
-        LOGE("AVFormatQueue empty!");
-        return FALSE;
+        index = (h + i) & (HANDLE_TABLE_SIZE - 1);
+        p = &t->slots[index];
+        s = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+        if (!(s & SLOT_USED))
+            break;
+        while ((s & SLOT_LIVE) && p->key == key)
+        {
+            if ((s & SLOT_REF_MASK) == SLOT_REF_MASK)
+            {
+                LOGE("HandleTable slot refcount overflow! key:%d", key);
+                return FALSE;
+            }
+            //状态字没变说明generation 没变，key 和pObject 仍然属于这个对象
+            if (__atomic_compare_exchange_n(&p->state, &s, s + 1, FALSE,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            {
+                *pObject = p->pObject;
+                *slot = index;
+                return TRUE;
+            }
+        }
     }
-    *a = q->head->pNext;
-    q->head->pNext = (*a)->pNext;
-    if (q->tail == *a)
+    return FALSE;
+}
+
+void HandleTableRelease(HandleTable *t, int slot)
+{
+    HandleSlot *p = &t->slots[slot];
+    //持有引用时slot 不会被重用，先取出对象
+    void *pObject = p->pObject;
+    unsigned int s = __atomic_sub_fetch(&p->state, 1, __ATOMIC_ACQ_REL);
+    if ((s & SLOT_REF_MASK) == 0 && !(s & SLOT_LIVE))
     {
-        LOGI("AVFormatQueue empty!");
-        q->tail = q->head;
+        if (t->pfnFree)
+            t->pfnFree(pObject);
     }
-    return TRUE;
 }
 
-BOOL PopAVFormatById(AVFormatQueue *q, AVFormatNode **a, int id)
+BOOL HandleTableInsert(HandleTable *t, int key, void *pObject, int *slot)
 {
-    if (IsAVFormatQueueEmpty(q))
+    unsigned int i, index, s, claimed;
+    unsigned int h = HashKey(key);
+    HandleSlot *p;
+    pthread_mutex_t *lock = KeyLock(t, key);
+
+    pthread_mutex_lock(lock);
+    if (FindSlot(t, key) >= 0)
     {
-        LOGE("AVFormatQueue empty!");
+        pthread_mutex_unlock(lock);
+        LOGE("HandleTable key exists! key:%d", key);
         return FALSE;
     }
+    for (i = 0; i < HANDLE_TABLE_SIZE; i++)
+    {
+        index = (h + i) & (HANDLE_TABLE_SIZE - 1);
+        p = &t->slots[index];
+        s = __atomic_load_n(&p->state, __ATOMIC_ACQUIRE);
+        if ((s & SLOT_LIVE) || (s & SLOT_REF_MASK))
+            continue;
+        //先以1个引用、无效状态占住slot，别的key 插入不会再选它，查找也看不到它
+        claimed = ((s & ~SLOT_REF_MASK) + SLOT_GEN_ONE) | SLOT_USED | 1;
+        if (!__atomic_compare_exchange_n(&p->state, &s, claimed, FALSE,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        p->key = key;
+        p->pObject = pObject;
+        //先放宽查找的探测长度，再让slot 生效
+        RaiseMaxProbe(t, i + 1);
+        __atomic_store_n(&p->state, claimed | SLOT_LIVE, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(lock);
+        *slot = index;
+        return TRUE;
+    }
+    pthread_mutex_unlock(lock);
+    LOGE("HandleTable full! key:%d", key);
+    return FALSE;
+}
 
-    AVFormatNode *p = q->head;
-    while (p->pNext != NULL && p->pNext->id != id)
-        p = p->pNext;
+BOOL HandleTableRemove(HandleTable *t, int key)
+{
+    int index;
+    HandleSlot *p;
+    pthread_mutex_t *lock = KeyLock(t, key);
 
-    if (p->pNext == NULL)
+    pthread_mutex_lock(lock);
+    index = FindSlot(t, key);
+    if (index < 0)
     {
-        LOGE("AVFormatNode not find! id:%d", id);
+        pthread_mutex_unlock(lock);
+        LOGE("HandleTable key not find! key:%d", key);
         return FALSE;
     }
-    *a = p->pNext;
-    p->pNext = (*a)->pNext;
-    if (q->tail == *a)
-    {
-        LOGI("AVFormatQueue empty!");
-        q->tail = q->head;
-    }
+    p = &t->slots[index];
+    __atomic_fetch_and(&p->state, ~SLOT_LIVE, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(lock);
+
+    //释放表持有的引用
+    HandleTableRelease(t, index);
     return TRUE;
 }
 
-BOOL GetAVFormatById(AVFormatQueue *q, AVFormatNode **a, int id)
+///////////////////
+
+AVFormatNode *AllocAVFormat()
 {
-    if (IsAVFormatQueueEmpty(q))
+    AVFormatNode *pAVFormat = (AVFormatNode*) malloc(sizeof(AVFormatNode));
+    if (!pAVFormat)
     {
-        LOGE("AVFormatQueue empty!");
-        return FALSE;
+        LOGE("Alloc AVFormat error!");
+        return NULL;
     }
+    pAVFormat->slot = -1;
+    pAVFormat->pFormatCtx = NULL;
+    av_init_packet(&pAVFormat->m_Pending);
+    pAVFormat->m_HasPending = FALSE;
+    pAVFormat->m_OpenTimeout = AVFORMAT_OPEN_TIMEOUT_MS;
+    pAVFormat->m_ReadTimeout = AVFORMAT_READ_TIMEOUT_MS;
+    pAVFormat->m_Deadline = 0;
+    pAVFormat->m_bDeadline = FALSE;
+    pAVFormat->m_bCancel = FALSE;
+    pAVFormat->m_InfoKey = 0;
+    pAVFormat->m_bCheckInfo = FALSE;
+    pAVFormat->m_Transport = RTSP_TRANSPORT_AUTO;
+    pAVFormat->m_CurTransport = 0;
+    pAVFormat->m_Url = NULL;
+    pAVFormat->m_Options = NULL;
+    pAVFormat->m_nLost = 0;
+    pAVFormat->m_nRecv = 0;
+    pAVFormat->m_LossStart = 0;
+    pAVFormat->m_bReceived = FALSE;
+    pAVFormat->m_bSwitchTcp = FALSE;
+    pAVFormat->m_TsOffset = 0;
+    pAVFormat->m_LastTs = AV_NOPTS_VALUE;
+    pAVFormat->m_bRebase = FALSE;
+    pthread_mutex_init(&pAVFormat->m_ReadLock, NULL);
+    return pAVFormat;
+}
 
-    AVFormatNode *p = q->head->pNext;
-    while (p != NULL && p->id != id)
-        p = p->pNext;
+static BOOL FreeAVFormatObject(void *pObject)
+{
+    return FreeAVFormat((AVFormatNode *) pObject);
+}
+
+BOOL InitAVFormatTable(HandleTable **t)
+{
+    return InitHandleTable(t, FreeAVFormatObject);
+}
+
+BOOL PushAVFormat(HandleTable *t, AVFormatNode *a)
+{
+    return HandleTableInsert(t, a->id, a, &a->slot);
+}
 
-    if (p == NULL)
+BOOL GetAVFormatById(HandleTable *t, AVFormatNode **a, int id)
+{
+    int slot;
+    if (!HandleTableAcquire(t, id, (void **) a, &slot))
     {
         LOGE("AVFormatNode not find! id:%d", id);
         return FALSE;
     }
-
-    *a = p;
     return TRUE;
 }
 
+void PutAVFormat(HandleTable *t, AVFormatNode *a)
+{
+    HandleTableRelease(t, a->slot);
+}
+
+BOOL RemoveAVFormatById(HandleTable *t, int id)
+{
+    return HandleTableRemove(t, id);
+}
+
 BOOL FreeAVFormat(AVFormatNode *pAVFormat)
 {
     if (pAVFormat)
@@ -116,132 +252,539 @@ BOOL FreeAVFormat(AVFormatNode *pAVFormat)
             avformat_close_input(&pAVFormat->pFormatCtx);
             pAVFormat->pFormatCtx = NULL;
         }
+        if (pAVFormat->m_HasPending)
+            av_packet_unref(&pAVFormat->m_Pending);
+        av_freep(&pAVFormat->m_Url);
+        av_dict_free(&pAVFormat->m_Options);
+        pthread_mutex_destroy(&pAVFormat->m_ReadLock);
         free(pAVFormat);
     }
     return TRUE;
 }
 
-///////////////////
+//正在打开的流，还没有放进表中，CancelAVFormatById 也要能找到
+static pthread_mutex_t m_OpeningLock = PTHREAD_MUTEX_INITIALIZER;
+static AVFormatNode *m_Opening[AVFORMAT_OPENING_MAX];
 
-RtmpNode *AllocRtmpNode()
+int ReadFrameInterrupt(void *ctx)
 {
-    RtmpNode *pRtmpNode = (RtmpNode *) malloc(sizeof(RtmpNode));
-    if (!pRtmpNode)
+    AVFormatNode *pAVFormat = (AVFormatNode *) ctx;
+
+    if (__atomic_load_n(&pAVFormat->m_bCancel, __ATOMIC_ACQUIRE))
+        return 1;
+    //截止时间只由阻塞调用所在的线程设置，回调也在这个线程
+    if (pAVFormat->m_bDeadline && (int) (GetTickMs() - pAVFormat->m_Deadline) >= 0)
     {
-        LOGE("Alloc RtmpNode error!");
-        return NULL;
+        LOGE("AVFormat timeout! id:%d", pAVFormat->id);
+        return 1;
     }
-    pRtmpNode->m_pRtmp = NULL;
-    pRtmpNode->m_SendSpsPps = FALSE;
-    pRtmpNode->pNext = NULL;
-    return pRtmpNode;
+    return 0;
+}
+
+static void StartDeadline(AVFormatNode *pAVFormat, int timeout)
+{
+    pAVFormat->m_Deadline = GetTickMs() + (unsigned int) timeout;
+    pAVFormat->m_bDeadline = timeout > 0;
+}
+
+static void StopDeadline(AVFormatNode *pAVFormat)
+{
+    pAVFormat->m_bDeadline = FALSE;
+}
+
+static BOOL AddOpening(AVFormatNode *pAVFormat)
+{
+    int i;
+    pthread_mutex_lock(&m_OpeningLock);
+    for (i = 0; i < AVFORMAT_OPENING_MAX; i++)
+    {
+        if (m_Opening[i] == NULL)
+        {
+            m_Opening[i] = pAVFormat;
+            pthread_mutex_unlock(&m_OpeningLock);
+            return TRUE;
+        }
+    }
+    pthread_mutex_unlock(&m_OpeningLock);
+    LOGE("Too many streams opening! id:%d", pAVFormat->id);
+    return FALSE;
+}
+
+static void RemoveOpening(AVFormatNode *pAVFormat)
+{
+    int i;
+    pthread_mutex_lock(&m_OpeningLock);
+    for (i = 0; i < AVFORMAT_OPENING_MAX; i++)
+    {
+        if (m_Opening[i] == pAVFormat)
+            m_Opening[i] = NULL;
+    }
+    pthread_mutex_unlock(&m_OpeningLock);
+}
+
+//每个摄像头最后成功的传输方式，按url 的hash
+static pthread_mutex_t m_TransportLock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    uint64_t key;
+    int transport;
+    unsigned int time;
+} m_Transports[RTSP_TRANSPORT_CACHE];
+static int m_NextTransport = 0;
+
+static int GetTransport(uint64_t key)
+{
+    int i, transport = RTSP_TRANSPORT_UDP;
+    pthread_mutex_lock(&m_TransportLock);
+    for (i = 0; i < RTSP_TRANSPORT_CACHE; i++)
+    {
+        if (m_Transports[i].transport && m_Transports[i].key == key)
+        {
+            //网络可能变了，TCP 过一段时间再试UDP
+            if (m_Transports[i].transport == RTSP_TRANSPORT_TCP
+                    && GetTickMs() - m_Transports[i].time >= RTSP_TCP_RETRY_MS)
+                m_Transports[i].transport = 0;
+            else
+                transport = m_Transports[i].transport;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m_TransportLock);
+    return transport;
+}
+
+static void SetTransport(uint64_t key, int transport)
+{
+    int i;
+    pthread_mutex_lock(&m_TransportLock);
+    for (i = 0; i < RTSP_TRANSPORT_CACHE; i++)
+    {
+        if (m_Transports[i].transport && m_Transports[i].key == key)
+            break;
+    }
+    if (i == RTSP_TRANSPORT_CACHE)
+    {
+        i = m_NextTransport;
+        m_NextTransport = (m_NextTransport + 1) % RTSP_TRANSPORT_CACHE;
+    }
+    m_Transports[i].key = key;
+    m_Transports[i].transport = transport;
+    m_Transports[i].time = GetTickMs();
+    pthread_mutex_unlock(&m_TransportLock);
+}
+
+static BOOL IsRtspUrl(const char *url)
+{
+    return strncmp(url, "rtsp://", 7) == 0 || strncmp(url, "rtsps://", 8) == 0;
 }
 
-BOOL InitRtmpNodeQueue(RtmpNodeQueue **q)
+//按传输方式打开一次，transport 为0 时不加RTSP 选项
+static BOOL OpenAVFormatOnce(AVFormatNode *pAVFormat, const char *url,
+                             AVDictionary *options, int transport)
 {
-    RtmpNodeQueue *queue = (RtmpNodeQueue*) malloc(sizeof(RtmpNodeQueue));
-    if (!queue)
+    AVFormatContext *pFormatCtx = avformat_alloc_context();
+    AVDictionary *opts = NULL;
+    char buf[16];
+    int ret;
+
+    if (pFormatCtx == NULL)
+        return FALSE;
+    pFormatCtx->interrupt_callback.callback = ReadFrameInterrupt;
+    pFormatCtx->interrupt_callback.opaque = pAVFormat;
+    av_dict_copy(&opts, options, 0);
+    if (transport == RTSP_TRANSPORT_UDP)
+    {
+        av_dict_set(&opts, "rtsp_transport", "udp", 0);
+        snprintf(buf, sizeof(buf), "%d", RTSP_REORDER_QUEUE_SIZE);
+        av_dict_set(&opts, "reorder_queue_size", buf, AV_DICT_DONT_OVERWRITE);
+        snprintf(buf, sizeof(buf), "%d", RTSP_UDP_BUFFER_SIZE);
+        av_dict_set(&opts, "buffer_size", buf, AV_DICT_DONT_OVERWRITE);
+        snprintf(buf, sizeof(buf), "%d", RTSP_RECV_BATCH);
+        av_dict_set(&opts, "recv_batch", buf, AV_DICT_DONT_OVERWRITE);
+    }
+    else if (transport == RTSP_TRANSPORT_TCP)
+    {
+        av_dict_set(&opts, "rtsp_transport", "tcp", 0);
+    }
+
+    StartDeadline(pAVFormat, pAVFormat->m_OpenTimeout);
+    //失败时pFormatCtx 已被释放
+    ret = avformat_open_input(&pFormatCtx, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret != 0)
     {
-        LOGE("Alloc RtmpNodeQueue error!");
+        LOGE("Couldn't open input stream. id:%d transport:%d\n", pAVFormat->id, transport);
         return FALSE;
     }
-    queue->head = AllocRtmpNode();
-    if (!queue->head)
+    pAVFormat->m_InfoKey = StreamInfoKey(url);
+    if (ApplyStreamInfo(pAVFormat->m_InfoKey, pFormatCtx))
+    {
+        //参数和上次一样，省掉探测和解码几秒的数据
+        LOGI("Stream info from cache. id:%d", pAVFormat->id);
+        pAVFormat->m_bCheckInfo = TRUE;
+    }
+    else
+    {
+        StartDeadline(pAVFormat, pAVFormat->m_OpenTimeout);
+        if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
+        {
+            LOGE("Couldn't find stream information. id:%d\n", pAVFormat->id);
+            avformat_close_input(&pFormatCtx);
+            return FALSE;
+        }
+        SaveStreamInfo(pAVFormat->m_InfoKey, pFormatCtx);
+    }
+    pAVFormat->pFormatCtx = pFormatCtx;
+    pAVFormat->m_CurTransport = transport;
+    pAVFormat->m_nRecv = 0;
+    pAVFormat->m_LossStart = GetTickMs();
+    pAVFormat->m_bReceived = FALSE;
+    __atomic_store_n(&pAVFormat->m_nLost, 0, __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+static BOOL OpenAVFormatTransport(AVFormatNode *pAVFormat, const char *url,
+                                  AVDictionary *options)
+{
+    int transport;
+    uint64_t key;
+
+    if (!IsRtspUrl(url))
+        return OpenAVFormatOnce(pAVFormat, url, options, 0);
+    if (pAVFormat->m_Transport != RTSP_TRANSPORT_AUTO)
+        return OpenAVFormatOnce(pAVFormat, url, options, pAVFormat->m_Transport);
+
+    key = StreamInfoKey(url);
+    transport = GetTransport(key);
+    if (OpenAVFormatOnce(pAVFormat, url, options, transport))
+        return TRUE;
+    if (transport == RTSP_TRANSPORT_TCP
+            || __atomic_load_n(&pAVFormat->m_bCancel, __ATOMIC_ACQUIRE))
+        return FALSE;
+    //UDP 被防火墙或NAT 挡住时收不到数据，打开超时，换TCP 再试
+    LOGI("RTSP over UDP failed, retry TCP. id:%d", pAVFormat->id);
+    if (!OpenAVFormatOnce(pAVFormat, url, options, RTSP_TRANSPORT_TCP))
         return FALSE;
-    queue->tail = queue->head;
-    *q = queue;
+    SetTransport(key, RTSP_TRANSPORT_TCP);
     return TRUE;
 }
 
-BOOL IsRtmpNodeQueueEmpty(RtmpNodeQueue *q)
+BOOL OpenAVFormat(AVFormatNode *pAVFormat, const char *url, AVDictionary **options)
 {
-    return (q->head->pNext == NULL);
+    BOOL bRet;
+
+    if (!AddOpening(pAVFormat))
+        return FALSE;
+    pAVFormat->m_Url = av_strdup(url);
+    if (options)
+        av_dict_copy(&pAVFormat->m_Options, *options, 0);
+    bRet = pAVFormat->m_Url != NULL
+           && OpenAVFormatTransport(pAVFormat, url, pAVFormat->m_Options);
+    StopDeadline(pAVFormat);
+    RemoveOpening(pAVFormat);
+    return bRet;
 }
 
-BOOL PushRtmpNode(RtmpNodeQueue *q, RtmpNode *a)
+void CountRtpLoss(void *ptr, const char *fmt, va_list vl)
 {
-    q->tail->pNext = a;
-    q->tail = a;
-    return TRUE;
+    AVFormatContext *pFormatCtx = (AVFormatContext *) ptr;
+    AVFormatNode *pAVFormat;
+    int lost;
+
+    //rtpdec 的"RTP: missed %d packets"，ptr 是AVFormatContext。只认自己打开的流
+    if (ptr == NULL || strncmp(fmt, "RTP: missed ", 12) != 0
+            || *(const AVClass **) ptr != avformat_get_class()
+            || pFormatCtx->interrupt_callback.callback != ReadFrameInterrupt)
+        return;
+    pAVFormat = (AVFormatNode *) pFormatCtx->interrupt_callback.opaque;
+    lost = va_arg(vl, int);
+    if (lost > 0)
+        __atomic_fetch_add(&pAVFormat->m_nLost, (unsigned int) lost, __ATOMIC_RELAXED);
 }
 
-BOOL PopRtmpNode(RtmpNodeQueue *q, RtmpNode **a)
+static int FindVideoIndex(AVFormatContext *pFormatCtx)
 {
-    if (IsRtmpNodeQueueEmpty(q))
+    unsigned int i;
+    for (i = 0; i < pFormatCtx->nb_streams; i++)
     {
-        LOGE("RtmpNodeQueue empty!");
-        return FALSE;
+        if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            return (int) i;
     }
-    *a = q->head->pNext;
-    q->head = (*a)->pNext;
-    if (q->tail == *a)
+    return -1;
+}
+
+//换TCP 重新打开，之后第一个包重新对齐时间戳。先关掉UDP 的会话，有的摄像头只允许一个会话。
+//参数已在缓存中，通常只有一次打开的时间。失败时这一路不能再读，由调用者重新打开
+static BOOL SwitchToTcp(AVFormatNode *pAVFormat)
+{
+    BOOL bRet;
+
+    pAVFormat->m_bSwitchTcp = FALSE;
+    avformat_close_input(&pAVFormat->pFormatCtx);
+    pAVFormat->videoindex = -1;
+    bRet = OpenAVFormatOnce(pAVFormat, pAVFormat->m_Url, pAVFormat->m_Options,
+                            RTSP_TRANSPORT_TCP);
+    StopDeadline(pAVFormat);
+    if (bRet)
     {
-        LOGI("RtmpNodeQueue empty!");
-        q->tail = q->head;
+        pAVFormat->videoindex = FindVideoIndex(pAVFormat->pFormatCtx);
+        if (pAVFormat->videoindex < 0)
+        {
+            avformat_close_input(&pAVFormat->pFormatCtx);
+            bRet = FALSE;
+        }
     }
+    if (!bRet)
+    {
+        LOGE("RTSP switch to TCP failed, stream closed. id:%d", pAVFormat->id);
+        return FALSE;
+    }
+    DiscardOtherStreams(pAVFormat);
+    pAVFormat->m_bRebase = TRUE;
+    LOGI("RTSP switched to TCP. id:%d", pAVFormat->id);
     return TRUE;
 }
 
-BOOL PopRtmpNodeById(RtmpNodeQueue *q, RtmpNode **a, int id)
+//每个窗口算一次丢包率
+static void CheckRtpLoss(AVFormatNode *pAVFormat, AVPacket *packet)
+{
+    unsigned int lost, permille;
+
+    pAVFormat->m_nRecv += packet->size / RTSP_RTP_PAYLOAD + 1;
+    if (GetTickMs() - pAVFormat->m_LossStart < RTSP_LOSS_WINDOW_MS)
+        return;
+    lost = __atomic_exchange_n(&pAVFormat->m_nLost, 0, __ATOMIC_RELAXED);
+    permille = lost * 1000 / (lost + pAVFormat->m_nRecv);
+    pAVFormat->m_nRecv = 0;
+    pAVFormat->m_LossStart = GetTickMs();
+    if (permille <= RTSP_LOSS_MAX_PERMILLE || pAVFormat->m_Transport != RTSP_TRANSPORT_AUTO)
+        return;
+
+    //这个包照常返回，下一次读时再重新打开
+    LOGE("RTSP over UDP lost %u/1000, switch to TCP. id:%d", permille, pAVFormat->id);
+    SetTransport(pAVFormat->m_InfoKey, RTSP_TRANSPORT_TCP);
+    pAVFormat->m_bSwitchTcp = TRUE;
+}
+
+//重新打开后时间戳从头开始，接在上一个包后面一帧
+static void RebasePacket(AVFormatNode *pAVFormat, AVPacket *packet)
 {
-    if (IsRtmpNodeQueueEmpty(q))
+    AVRational tb = pAVFormat->pFormatCtx->streams[pAVFormat->videoindex]->time_base;
+    int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+
+    if (ts == AV_NOPTS_VALUE)
+        return;
+    if (pAVFormat->m_bRebase)
     {
-        LOGE("RtmpNodeQueue empty!");
-        return FALSE;
+        pAVFormat->m_bRebase = FALSE;
+        if (pAVFormat->m_LastTs != AV_NOPTS_VALUE)
+            pAVFormat->m_TsOffset = pAVFormat->m_LastTs + AV_TIME_BASE / 25
+                                    - av_rescale_q(ts, tb, AV_TIME_BASE_Q);
     }
+    if (pAVFormat->m_TsOffset)
+    {
+        if (packet->pts != AV_NOPTS_VALUE)
+            packet->pts += av_rescale_q(pAVFormat->m_TsOffset, AV_TIME_BASE_Q, tb);
+        if (packet->dts != AV_NOPTS_VALUE)
+            packet->dts += av_rescale_q(pAVFormat->m_TsOffset, AV_TIME_BASE_Q, tb);
+        ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    }
+    pAVFormat->m_LastTs = av_rescale_q(ts, tb, AV_TIME_BASE_Q);
+}
 
-    RtmpNode *p = q->head;
-    while (p->pNext != NULL && p->pNext->id != id)
-        p = p->pNext;
+BOOL CancelAVFormatById(HandleTable *t, int id)
+{
+    AVFormatNode *pAVFormat;
+    BOOL bFound = FALSE;
+    int i;
 
-    if (p->pNext == NULL)
+    pthread_mutex_lock(&m_OpeningLock);
+    for (i = 0; i < AVFORMAT_OPENING_MAX; i++)
     {
-        LOGE("RtmpNode not find! id:%d", id);
-        return FALSE;
+        if (m_Opening[i] && m_Opening[i]->id == id)
+        {
+            __atomic_store_n(&m_Opening[i]->m_bCancel, TRUE, __ATOMIC_RELEASE);
+            bFound = TRUE;
+        }
     }
+    pthread_mutex_unlock(&m_OpeningLock);
 
-    *a = p->pNext;
-    p->pNext = (*a)->pNext;
-    if (q->tail == *a)
+    if (HandleTableAcquire(t, id, (void **) &pAVFormat, &i))
     {
-        LOGI("RtmpNodeQueue empty!");
-        q->tail = q->head;
+        __atomic_store_n(&pAVFormat->m_bCancel, TRUE, __ATOMIC_RELEASE);
+        HandleTableRelease(t, i);
+        bFound = TRUE;
+    }
+    return bFound;
+}
+
+void DiscardOtherStreams(AVFormatNode *pAVFormat)
+{
+    AVFormatContext *pFormatCtx = pAVFormat->pFormatCtx;
+    unsigned int i;
+
+    //libavformat 对AVDISCARD_ALL 的流不走parser，音频包读出来直接释放
+    for (i = 0; i < pFormatCtx->nb_streams; i++)
+    {
+        if ((int) i != pAVFormat->videoindex)
+            pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
     }
-    return TRUE;
 }
 
-BOOL GetRtmpNodeById(RtmpNodeQueue *q, RtmpNode **a, int id)
+BOOL ReadVideoPacket(AVFormatNode *pAVFormat, AVPacket *packet)
 {
-    if (IsRtmpNodeQueueEmpty(q))
+    int num = 0;
+    if (pAVFormat->m_HasPending)
     {
-        LOGE("RtmpNodeQueue empty!");
-        return FALSE;
+        av_packet_move_ref(packet, &pAVFormat->m_Pending);
+        pAVFormat->m_HasPending = FALSE;
+        return TRUE;
     }
+    while (TRUE)
+    {
+        if (__atomic_load_n(&pAVFormat->m_bCancel, __ATOMIC_ACQUIRE))
+            return FALSE;
+        if (pAVFormat->m_bSwitchTcp && !SwitchToTcp(pAVFormat))
+            return FALSE;
+        if (pAVFormat->pFormatCtx == NULL)
+        {
+            LOGE("av_read_frame error : stream closed\n");
+            return FALSE;
+        }
+        av_init_packet(packet);
+        LOGD("Call av_read_frame\n");
+        StartDeadline(pAVFormat, pAVFormat->m_ReadTimeout);
+        if (av_read_frame(pAVFormat->pFormatCtx, packet) < 0)
+        {
+            StopDeadline(pAVFormat);
+            //参数取自缓存时UDP 不经过探测就打开成功，被挡住时到这里才知道
+            if (pAVFormat->m_CurTransport == RTSP_TRANSPORT_UDP && !pAVFormat->m_bReceived
+                    && pAVFormat->m_Transport == RTSP_TRANSPORT_AUTO
+                    && !__atomic_load_n(&pAVFormat->m_bCancel, __ATOMIC_ACQUIRE))
+            {
+                LOGE("RTSP over UDP got no packet, switch to TCP. id:%d", pAVFormat->id);
+                SetTransport(pAVFormat->m_InfoKey, RTSP_TRANSPORT_TCP);
+                pAVFormat->m_bSwitchTcp = TRUE;
+                continue;
+            }
+            LOGE("av_read_frame error\n");
+            return FALSE;
+        }
+        StopDeadline(pAVFormat);
+        LOGD("Call av_read_frame finish!\n");
+        if (packet->stream_index != pAVFormat->videoindex)
+        {
+            LOGD("Not video stream!\n");
+#ifdef _DEBUG_
+            LOGD("packet->data = %d,%d,%d,%d,%d\n",
+                 packet->data[0], packet->data[1], packet->data[2], packet->data[3], packet->data[4]);
+#endif
+            av_packet_unref(packet);
+            if (num++ > 100)
+            {
+                LOGE("av_read_frame error : No video stream\n");
+                return FALSE;
+            }
+        }
+        else
+        {
+            pAVFormat->m_bReceived = TRUE;
+            RebasePacket(pAVFormat, packet);
+            //换TCP 从下一个包开始生效
+            if (pAVFormat->m_CurTransport == RTSP_TRANSPORT_UDP)
+                CheckRtpLoss(pAVFormat, packet);
+            if (pAVFormat->m_bCheckInfo && (packet->flags & AV_PKT_FLAG_KEY))
+            {
+                pAVFormat->m_bCheckInfo = FALSE;
+                CheckStreamInfo(pAVFormat->m_InfoKey,
+                                pAVFormat->pFormatCtx->streams[pAVFormat->videoindex]->codecpar,
+                                packet->data, packet->size);
+            }
+            return TRUE;
+        }
+    }
+}
 
-    RtmpNode *p = q->head->pNext;
-    while (p != NULL && p->id != id)
-        p = p->pNext;
+void KeepVideoPacket(AVFormatNode *pAVFormat, AVPacket *packet)
+{
+    av_packet_move_ref(&pAVFormat->m_Pending, packet);
+    pAVFormat->m_HasPending = TRUE;
+}
 
-    if (p == NULL)
+int GetPacketTick(AVFormatNode *pAVFormat, AVPacket *packet)
+{
+    AVStream *st = pAVFormat->pFormatCtx->streams[pAVFormat->videoindex];
+    int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (ts == AV_NOPTS_VALUE)
+        return 0;
+    return (int) av_rescale_q(ts, st->time_base, (AVRational) { 1, 1000 });
+}
+
+///////////////////
+
+RtmpNode *AllocRtmpNode()
+{
+    RtmpNode *pRtmpNode = (RtmpNode *) malloc(sizeof(RtmpNode));
+    if (!pRtmpNode)
+    {
+        LOGE("Alloc RtmpNode error!");
+        return NULL;
+    }
+    pRtmpNode->slot = -1;
+    pRtmpNode->m_SendSpsPps = FALSE;
+    pRtmpNode->m_Codec = VIDEO_CODEC_H264;
+    pRtmpNode->m_pSendQueue = NULL;
+    pthread_mutex_init(&pRtmpNode->m_WriteLock, NULL);
+    return pRtmpNode;
+}
+
+static BOOL FreeRtmpNodeObject(void *pObject)
+{
+    return FreeRtmpNode((RtmpNode *) pObject);
+}
+
+BOOL InitRtmpNodeTable(HandleTable **t)
+{
+    return InitHandleTable(t, FreeRtmpNodeObject);
+}
+
+BOOL PushRtmpNode(HandleTable *t, RtmpNode *a)
+{
+    return HandleTableInsert(t, a->id, a, &a->slot);
+}
+
+BOOL GetRtmpNodeById(HandleTable *t, RtmpNode **a, int id)
+{
+    int slot;
+    if (!HandleTableAcquire(t, id, (void **) a, &slot))
     {
         LOGE("RtmpNode not find! id:%d", id);
         return FALSE;
     }
-
-    *a = p;
     return TRUE;
 }
 
+void PutRtmpNode(HandleTable *t, RtmpNode *a)
+{
+    HandleTableRelease(t, a->slot);
+}
+
+BOOL RemoveRtmpNodeById(HandleTable *t, int id)
+{
+    return HandleTableRemove(t, id);
+}
+
 BOOL FreeRtmpNode(RtmpNode *pRtmpNode)
 {
     if (pRtmpNode)
     {
-        if (pRtmpNode->m_pRtmp)
+        //停发送线程并关闭连接
+        if (pRtmpNode->m_pSendQueue)
         {
-            RTMP_Close(pRtmpNode->m_pRtmp);
-            RTMP_Free(pRtmpNode->m_pRtmp);
-            pRtmpNode->m_pRtmp = NULL;
+            FreeSendQueue(pRtmpNode->m_pSendQueue);
+            pRtmpNode->m_pSendQueue = NULL;
         }
+        pthread_mutex_destroy(&pRtmpNode->m_WriteLock);
         free(pRtmpNode);
     }
     return TRUE;
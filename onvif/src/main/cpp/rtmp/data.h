@@ -1,70 +1,164 @@
 #ifndef __DATA_H
 #define __DATA_H
 
+#include <pthread.h>
+
 #include "platform.h"
 #include "libavformat/avformat.h"
 #include "librtmp/rtmp.h"
+#include "sendqueue.h"
+#include "infocache.h"
+
+#define HANDLE_TABLE_SIZE     4096 //必须是2的幂
+#define HANDLE_TABLE_STRIPES  16
+
+//id -> 对象的并发表，查找无锁，插入/删除按id 分段加锁。
+//slot 状态字: 高16位generation，bit15 表示有效，bit14 表示用过(线性探测不能在这里停)，
+//低14位引用计数。表本身持有一个引用，最后一个引用释放时调用pfnFree。
+typedef struct
+{
+    unsigned int state;
+    int key;
+    void *pObject;
+} HandleSlot;
+
+typedef struct
+{
+    HandleSlot slots[HANDLE_TABLE_SIZE];
+    pthread_mutex_t locks[HANDLE_TABLE_STRIPES];
+    //插入用过的最长探测长度。用过的slot 不会变回空，查找最多探测这么多个，
+    //找不到时不用扫完整个表
+    unsigned int maxProbe;
+    BOOL (*pfnFree)(void *pObject);
+} HandleTable;
+
+BOOL InitHandleTable(HandleTable **t, BOOL (*pfnFree)(void *pObject));
+
+BOOL HandleTableInsert(HandleTable *t, int key, void *pObject, int *slot);
+
+//找到后引用计数加1，用完必须调用HandleTableRelease
+BOOL HandleTableAcquire(HandleTable *t, int key, void **pObject, int *slot);
+
+void HandleTableRelease(HandleTable *t, int slot);
+
+//从表中删除，对象在最后一个引用释放时才真正释放
+BOOL HandleTableRemove(HandleTable *t, int key);
+
+#define AVFORMAT_OPEN_TIMEOUT_MS  10000 //打开和探测流信息的默认超时
+#define AVFORMAT_READ_TIMEOUT_MS  5000 //读一个包的默认超时
+#define AVFORMAT_OPENING_MAX      64 //同时在打开的流
+
+//RTSP 传输方式
+#define RTSP_TRANSPORT_AUTO  0 //先UDP，打开超时或丢包多时换TCP，每个摄像头记住结果
+#define RTSP_TRANSPORT_UDP   1
+#define RTSP_TRANSPORT_TCP   2
+
+#define RTSP_REORDER_QUEUE_SIZE  64 //UDP 重排序队列的包数，FFmpeg 默认10
+#define RTSP_UDP_BUFFER_SIZE     (1024 * 1024) //UDP socket 接收缓冲，关键帧突发时不丢
+#define RTSP_RECV_BATCH          32 //一次recvmmsg 读的RTP 包数，要用改过的FFmpeg，旧的库忽略这个选项
+#define RTSP_LOSS_WINDOW_MS      5000 //丢包率统计窗口
+#define RTSP_LOSS_MAX_PERMILLE   20 //AUTO 时丢包率超过2% 换TCP
+#define RTSP_RTP_PAYLOAD         1400 //按包大小估算收到的RTP 包数
+#define RTSP_TCP_RETRY_MS        (10 * 60 * 1000) //记住TCP 这么久，之后再试UDP
+#define RTSP_TRANSPORT_CACHE     64
 
 typedef struct AVFormat
 {
     int id;
+    int slot;
     int videoindex;
     AVFormatContext *pFormatCtx;
-    struct AVFormat *pNext;
+    AVPacket m_Pending; //上次调用放不下的包，下次调用先返回它
+    BOOL m_HasPending;
+    pthread_mutex_t m_ReadLock; //同一路的读取串行
+    //中断回调的状态，每一路独立
+    int m_OpenTimeout; //ms
+    int m_ReadTimeout; //ms
+    unsigned int m_Deadline; //当前阻塞调用的截止时间(GetTickMs)
+    BOOL m_bDeadline; //有阻塞调用在等
+    BOOL m_bCancel; //CancelAVFormatById 之后所有阻塞调用立即返回
+    uint64_t m_InfoKey; //流参数缓存的key
+    BOOL m_bCheckInfo; //参数取自缓存，第一个关键帧到来时校验
+    //RTSP 传输方式，以下除m_nLost 外只由持有m_ReadLock 的线程访问
+    int m_Transport; //RTSP_TRANSPORT_*，打开前设置
+    int m_CurTransport; //实际使用的UDP/TCP，不是RTSP 时为0
+    char *m_Url; //换传输方式时重新打开
+    AVDictionary *m_Options;
+    unsigned int m_nLost; //窗口内丢失的RTP 包，av_log 回调中累加
+    unsigned int m_nRecv; //窗口内估计收到的RTP 包
+    unsigned int m_LossStart;
+    BOOL m_bReceived; //打开后收到过视频包
+    BOOL m_bSwitchTcp; //下一次av_read_frame 之前换TCP 重新打开
+    int64_t m_TsOffset; //重新打开后加到pts/dts 上，us，时间戳保持连续
+    int64_t m_LastTs; //上一个视频包的pts，us
+    BOOL m_bRebase;
 } AVFormatNode;
 
-typedef struct
-{
-    AVFormatNode *head;
-    AVFormatNode *tail;
-} AVFormatQueue;
-
 AVFormatNode *AllocAVFormat();
 
-BOOL InitAVFormatQueue(AVFormatQueue **q);
-
-BOOL IsAVFormatQueueEmpty(AVFormatQueue *q);
+BOOL InitAVFormatTable(HandleTable **t);
 
-BOOL PushAVFormat(AVFormatQueue *q, AVFormatNode *a);
+BOOL PushAVFormat(HandleTable *t, AVFormatNode *a);
 
-BOOL PopAVFormat(AVFormatQueue *q, AVFormatNode **a);
+BOOL GetAVFormatById(HandleTable *t, AVFormatNode **a, int id);
 
-BOOL PopAVFormatById(AVFormatQueue *q, AVFormatNode **a, int id);
+void PutAVFormat(HandleTable *t, AVFormatNode *a);
 
-BOOL GetAVFormatById(AVFormatQueue *q, AVFormatNode **a, int id);
+BOOL RemoveAVFormatById(HandleTable *t, int id);
 
 BOOL FreeAVFormat(AVFormatNode *pAVFormat);
 
+//pFormatCtx->interrupt_callback，ctx 是AVFormatNode，超过截止时间或被取消时中断
+int ReadFrameInterrupt(void *ctx);
+
+//打开url 并探测流信息，各自有m_OpenTimeout 的超时，打开期间可以被CancelAVFormatById 中断。
+//这个url 的参数已缓存时不再探测。成功后pFormatCtx 有效，videoindex 还要调用者设置
+BOOL OpenAVFormat(AVFormatNode *pAVFormat, const char *url, AVDictionary **options);
+
+//av_log 回调中调用，统计rtpdec 报告的丢包
+void CountRtpLoss(void *ptr, const char *fmt, va_list vl);
+
+//中断这一路正在打开或者读取的调用，之后的读取都失败。打开中或者已在表中都返回TRUE
+BOOL CancelAVFormatById(HandleTable *t, int id);
+
+//设置videoindex 之后调用，其他流不再解析和分配包
+void DiscardOtherStreams(AVFormatNode *pAVFormat);
+
+//读取下一个视频包，先返回上次放不下的包。调用者持有m_ReadLock，用完av_packet_unref。
+//AUTO 的UDP 流丢包多，或者打开后第一次读就超时时，下一次读之前换TCP 重新打开，
+//pFormatCtx 会被替换，时间戳保持连续。重新打开失败后这一路一直返回FALSE
+BOOL ReadVideoPacket(AVFormatNode *pAVFormat, AVPacket *packet);
+
+//放不下的包留到下一次调用，packet 的引用移走，调用者不再unref
+void KeepVideoPacket(AVFormatNode *pAVFormat, AVPacket *packet);
+
+//包的时间戳，单位ms
+int GetPacketTick(AVFormatNode *pAVFormat, AVPacket *packet);
+
 typedef struct Rtmp
 {
     int id;
+    int slot;
     BOOL m_SendSpsPps;
-    RTMP *m_pRtmp;
+    int m_Codec; //VIDEO_CODEC_H264/VIDEO_CODEC_HEVC，sendSpsPps 时检测
     int width;
     int height;
     int rate;
-    struct Rtmp *pNext;
+    SendQueue *m_pSendQueue; //发送队列，连接由它所有，断线后自动重连
+    pthread_mutex_t m_WriteLock; //发送队列的生产者锁
 } RtmpNode;
 
-typedef struct
-{
-    RtmpNode *head;
-    RtmpNode *tail;
-} RtmpNodeQueue;
-
 RtmpNode *AllocRtmpNode();
 
-BOOL InitRtmpNodeQueue(RtmpNodeQueue **q);
-
-BOOL IsRtmpNodeQueueEmpty(RtmpNodeQueue *q);
+BOOL InitRtmpNodeTable(HandleTable **t);
 
-BOOL PushRtmpNode(RtmpNodeQueue *q, RtmpNode *a);
+BOOL PushRtmpNode(HandleTable *t, RtmpNode *a);
 
-BOOL PopRtmpNode(RtmpNodeQueue *q, RtmpNode **a);
+BOOL GetRtmpNodeById(HandleTable *t, RtmpNode **a, int id);
 
-BOOL PopRtmpNodeById(RtmpNodeQueue *q, RtmpNode **a, int id);
+void PutRtmpNode(HandleTable *t, RtmpNode *a);
 
-BOOL GetRtmpNodeById(RtmpNodeQueue *q, RtmpNode **a, int id);
+BOOL RemoveRtmpNodeById(HandleTable *t, int id);
 
 BOOL FreeRtmpNode(RtmpNode *pRtmpNode);
 
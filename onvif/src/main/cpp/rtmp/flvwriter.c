@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "flvwriter.h"
+
+static BOOL WriteAll(int fd, struct iovec *iov, int count)
+{
+    ssize_t n;
+    while (count > 0)
+    {
+        n = writev(fd, iov, count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOGE("FlvWriter write error! errno:%d\n", errno);
+            return FALSE;
+        }
+        while (count > 0 && (size_t) n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return TRUE;
+}
+
+//RTMP 的metadata 以"@setDataFrame" 开头，文件中的script tag 要从"onMetaData" 开始，
+//否则播放器不认。返回要跳过的字节数
+static unsigned int SetDataFrameSize(SendItem *item)
+{
+    static const unsigned char prefix[] = { 0x02, 0x00, 0x0d, '@', 's', 'e', 't',
+                                            'D', 'a', 't', 'a', 'F', 'r', 'a', 'm', 'e' };
+
+    if (item->packetType != RTMP_PACKET_TYPE_INFO || item->pFrame->size < sizeof(prefix)
+            || memcmp(item->pFrame->body, prefix, sizeof(prefix)) != 0)
+        return 0;
+    return sizeof(prefix);
+}
+
+//tag 头 + body + PreviousTagSize，body 直接从帧缓冲区写出
+static BOOL WriteTag(FlvWriter *w, SendItem *item)
+{
+    unsigned char header[FLV_TAG_HEADER_SIZE];
+    unsigned char trailer[4];
+    unsigned int skip = SetDataFrameSize(item);
+    unsigned int size = item->pFrame->size - skip;
+    unsigned int ts = item->timestamp;
+    unsigned int total = FLV_TAG_HEADER_SIZE + size;
+    struct iovec iov[3];
+
+    header[0] = item->packetType;
+    header[1] = size >> 16;
+    header[2] = size >> 8;
+    header[3] = size;
+    header[4] = ts >> 16;
+    header[5] = ts >> 8;
+    header[6] = ts;
+    header[7] = ts >> 24;
+    header[8] = 0; // StreamID
+    header[9] = 0;
+    header[10] = 0;
+    trailer[0] = total >> 24;
+    trailer[1] = total >> 16;
+    trailer[2] = total >> 8;
+    trailer[3] = total;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = item->pFrame->body + skip;
+    iov[1].iov_len = size;
+    iov[2].iov_base = trailer;
+    iov[2].iov_len = sizeof(trailer);
+    return WriteAll(w->fd, iov, 3);
+}
+
+static void FreeHead(SendItem *pHead, int nHead)
+{
+    int i;
+    for (i = 0; i < nHead; i++)
+        UnrefFrameBuf(pHead[i].pFrame);
+    free(pHead);
+}
+
+static void *FlvWriterThread(void *arg)
+{
+    FlvWriter *w = (FlvWriter *) arg;
+    SendItem *item;
+    int i;
+
+    for (i = 0; i < w->nHead; i++)
+    {
+        if (!WriteTag(w, &w->pHead[i]))
+            __atomic_fetch_add(&w->nWriteError, 1, __ATOMIC_RELAXED);
+    }
+    FreeHead(w->pHead, w->nHead);
+    w->pHead = NULL;
+    w->nHead = 0;
+
+    while (TRUE)
+    {
+        if (__atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->head)
+        {
+            pthread_mutex_lock(&w->mutex);
+            while (w->bRunning
+                    && __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->head)
+            {
+                w->bWaiting = TRUE;
+                pthread_cond_wait(&w->cond, &w->mutex);
+            }
+            w->bWaiting = FALSE;
+            pthread_mutex_unlock(&w->mutex);
+            //停止时先写完队列中剩下的
+            if (__atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == w->head)
+                break;
+        }
+
+        item = &w->items[w->head & (FLV_WRITER_QUEUE_SIZE - 1)];
+        if (!WriteTag(w, item))
+            __atomic_fetch_add(&w->nWriteError, 1, __ATOMIC_RELAXED);
+        UnrefFrameBuf(item->pFrame);
+        item->pFrame = NULL;
+        __atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+BOOL InitFlvWriter(FlvWriter **w, const char *path)
+{
+    return InitFlvWriterHead(w, path, NULL, 0, 0);
+}
+
+BOOL InitFlvWriterHead(FlvWriter **w, const char *path, SendItem *pHead,
+                       int nHead, unsigned int nTsBase)
+{
+    //FLV 文件头，只有视频，后面是PreviousTagSize0
+    static const unsigned char header[] = { 'F', 'L', 'V', 0x01, 0x01,
+                                            0x00, 0x00, 0x00, 0x09,
+                                            0x00, 0x00, 0x00, 0x00 };
+    struct iovec iov;
+    int i;
+    FlvWriter *writer = (FlvWriter *) calloc(1, sizeof(FlvWriter));
+    if (!writer)
+    {
+        LOGE("Alloc FlvWriter error!");
+        FreeHead(pHead, nHead);
+        return FALSE;
+    }
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0)
+    {
+        LOGE("Open flv file error! %s errno:%d\n", path, errno);
+        FreeHead(pHead, nHead);
+        free(writer);
+        return FALSE;
+    }
+    iov.iov_base = (void *) header;
+    iov.iov_len = sizeof(header);
+    if (!WriteAll(writer->fd, &iov, 1))
+    {
+        FreeHead(pHead, nHead);
+        close(writer->fd);
+        free(writer);
+        return FALSE;
+    }
+    writer->bWaitIdr = TRUE;
+    writer->bRunning = TRUE;
+    writer->pHead = pHead;
+    writer->nHead = nHead;
+    //开头已经有帧时接着写，不用等关键帧
+    for (i = 0; i < nHead; i++)
+    {
+        if (!(pHead[i].flags & SEND_ITEM_CONFIG))
+        {
+            writer->bWaitIdr = FALSE;
+            writer->bStarted = TRUE;
+            writer->nTsBase = nTsBase;
+            break;
+        }
+    }
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, FlvWriterThread, writer) != 0)
+    {
+        LOGE("Create flv writer thread error!");
+        FreeHead(pHead, nHead);
+        pthread_mutex_destroy(&writer->mutex);
+        pthread_cond_destroy(&writer->cond);
+        close(writer->fd);
+        free(writer);
+        return FALSE;
+    }
+    *w = writer;
+    return TRUE;
+}
+
+unsigned int FlvWriterDepth(FlvWriter *w)
+{
+    return w->tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+}
+
+static void PutItem(FlvWriter *w, FrameBuf *f, unsigned int packetType,
+                    unsigned int timestamp, unsigned int flags)
+{
+    SendItem *item = &w->items[w->tail & (FLV_WRITER_QUEUE_SIZE - 1)];
+    item->packetType = packetType;
+    item->timestamp = timestamp;
+    item->flags = flags;
+    item->pFrame = RefFrameBuf(f);
+    __atomic_store_n(&w->tail, w->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void CacheConfig(SendItem *item, FrameBuf *f, unsigned int packetType,
+                        unsigned int flags)
+{
+    if (item->pFrame)
+        UnrefFrameBuf(item->pFrame);
+    item->packetType = packetType;
+    item->timestamp = 0;
+    item->flags = flags;
+    item->pFrame = RefFrameBuf(f);
+}
+
+BOOL FlvWriterPush(FlvWriter *w, FrameBuf *f, unsigned int packetType,
+                   unsigned int timestamp, unsigned int flags)
+{
+    if (!(flags & SEND_ITEM_CONFIG))
+    {
+        //文件从关键帧开始，队列满过也要丢到下一个关键帧
+        if (w->bWaitIdr && !(flags & SEND_ITEM_KEYFRAME))
+        {
+            w->nDropGop++;
+            return FALSE;
+        }
+        //补写的metadata 和sequence header 也要放得下
+        if (FlvWriterDepth(w) + (w->bResendConfig ? 2 : 0) >= FLV_WRITER_QUEUE_SIZE)
+        {
+            w->nDropGop++;
+            w->bWaitIdr = TRUE;
+            return FALSE;
+        }
+        if (!w->bStarted)
+        {
+            w->bStarted = TRUE;
+            w->nTsBase = timestamp;
+        }
+        w->bWaitIdr = FALSE;
+        timestamp = timestamp > w->nTsBase ? timestamp - w->nTsBase : 0;
+        //bWaitIdr 同时被设置过，这里一定是关键帧
+        if (w->bResendConfig)
+        {
+            if (w->meta.pFrame)
+                PutItem(w, w->meta.pFrame, w->meta.packetType, 0, w->meta.flags);
+            if (w->seqHeader.pFrame)
+                PutItem(w, w->seqHeader.pFrame, w->seqHeader.packetType, 0,
+                        w->seqHeader.flags);
+            w->bResendConfig = FALSE;
+        }
+    }
+    else
+    {
+        CacheConfig(packetType == RTMP_PACKET_TYPE_INFO ? &w->meta : &w->seqHeader,
+                    f, packetType, flags);
+        //放不下，或者前面还有推迟的配置时，保持顺序一起推迟，到下一个关键帧前补写
+        if (w->bResendConfig || FlvWriterDepth(w) >= FLV_WRITER_QUEUE_SIZE)
+        {
+            if (!w->bResendConfig)
+                LOGI("FlvWriterPush queue full, write config before next keyframe\n");
+            w->bResendConfig = TRUE;
+            w->bWaitIdr = TRUE;
+            return TRUE;
+        }
+        timestamp = 0;
+    }
+
+    PutItem(w, f, packetType, timestamp, flags);
+
+    pthread_mutex_lock(&w->mutex);
+    if (w->bWaiting)
+        pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    return TRUE;
+}
+
+BOOL FreeFlvWriter(FlvWriter *w)
+{
+    if (w)
+    {
+        pthread_mutex_lock(&w->mutex);
+        w->bRunning = FALSE;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+        pthread_join(w->thread, NULL);
+
+        close(w->fd);
+        if (w->meta.pFrame)
+            UnrefFrameBuf(w->meta.pFrame);
+        if (w->seqHeader.pFrame)
+            UnrefFrameBuf(w->seqHeader.pFrame);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+        free(w);
+    }
+    return TRUE;
+}
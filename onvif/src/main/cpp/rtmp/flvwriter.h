@@ -0,0 +1,55 @@
+#ifndef __FLVWRITER_H
+#define __FLVWRITER_H
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "sendqueue.h"
+
+#define FLV_WRITER_QUEUE_SIZE  64 //必须是2的幂
+#define FLV_TAG_HEADER_SIZE    11
+
+//把发送队列中同样的FLV tag 写到本地文件，有自己的队列和写线程。
+//队列满时丢到下一个关键帧，写文件慢不会影响其它输出
+typedef struct FlvWriter
+{
+    SendItem items[FLV_WRITER_QUEUE_SIZE];
+    unsigned int head; //只由写线程写
+    unsigned int tail; //只由生产者写
+    BOOL bWaitIdr;
+    BOOL bResendConfig; //队列满时没放进去的配置，在下一个关键帧前补写
+    SendItem meta; //最近的metadata 和sequence header，只由生产者使用
+    SendItem seqHeader;
+    BOOL bStarted; //已经写过第一个关键帧，时间戳从它开始算
+    unsigned int nTsBase;
+    unsigned int nDropGop;
+    unsigned int nWriteError;
+    SendItem *pHead; //开头的tag(pre-roll)，写线程先写完它们再写队列
+    int nHead;
+    int fd;
+    BOOL bRunning;
+    BOOL bWaiting;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} FlvWriter;
+
+//创建文件并写FLV 文件头
+BOOL InitFlvWriter(FlvWriter **w, const char *path);
+
+//同InitFlvWriter，先写pHead 中的tag，不经过队列，不会被丢帧策略丢掉。pHead 是malloc 的，
+//连同其中的引用都归写线程所有，失败时也会释放。有非配置的帧时之后push 的时间戳减去nTsBase
+BOOL InitFlvWriterHead(FlvWriter **w, const char *path, SendItem *pHead,
+                       int nHead, unsigned int nTsBase);
+
+//提交一个tag，增加f 的引用。被丢帧策略丢掉时返回FALSE。配置不会丢，队列满时
+//推迟到下一个关键帧前写，返回TRUE
+BOOL FlvWriterPush(FlvWriter *w, FrameBuf *f, unsigned int packetType,
+                   unsigned int timestamp, unsigned int flags);
+
+unsigned int FlvWriterDepth(FlvWriter *w);
+
+//写完队列中剩下的tag 后关闭文件
+BOOL FreeFlvWriter(FlvWriter *w);
+
+#endif
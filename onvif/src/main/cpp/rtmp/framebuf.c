@@ -0,0 +1,83 @@
+#include <pthread.h>
+
+#include "framebuf.h"
+
+static pthread_mutex_t m_FrameBufLock = PTHREAD_MUTEX_INITIALIZER;
+
+static FrameBuf *m_FrameBufPool[FRAMEBUF_CLASSES];
+
+static int m_FrameBufPoolCount[FRAMEBUF_CLASSES];
+
+FrameBuf *AllocFrameBuf(unsigned int size)
+{
+    FrameBuf *f;
+    unsigned int capacity = FRAMEBUF_MIN_SIZE;
+    int nClass = 0;
+
+    while (capacity < size && nClass < FRAMEBUF_CLASSES)
+    {
+        capacity <<= 1;
+        nClass++;
+    }
+    if (nClass == FRAMEBUF_CLASSES)
+    {
+        nClass = -1;
+        capacity = size;
+    }
+    else
+    {
+        pthread_mutex_lock(&m_FrameBufLock);
+        f = m_FrameBufPool[nClass];
+        if (f)
+        {
+            m_FrameBufPool[nClass] = f->pNext;
+            m_FrameBufPoolCount[nClass]--;
+        }
+        pthread_mutex_unlock(&m_FrameBufLock);
+        if (f)
+        {
+            f->nRefs = 1;
+            f->size = 0;
+            return f;
+        }
+    }
+
+    f = (FrameBuf *) malloc(sizeof(FrameBuf) + RTMP_MAX_HEADER_SIZE + capacity);
+    if (!f)
+    {
+        LOGE("Alloc FrameBuf error! size:%u", size);
+        return NULL;
+    }
+    f->nRefs = 1;
+    f->nClass = nClass;
+    f->capacity = capacity;
+    f->size = 0;
+    f->body = (unsigned char *) (f + 1) + RTMP_MAX_HEADER_SIZE;
+    f->pNext = NULL;
+    return f;
+}
+
+FrameBuf *RefFrameBuf(FrameBuf *f)
+{
+    __atomic_fetch_add(&f->nRefs, 1, __ATOMIC_RELAXED);
+    return f;
+}
+
+void UnrefFrameBuf(FrameBuf *f)
+{
+    if (f == NULL || __atomic_sub_fetch(&f->nRefs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    if (f->nClass >= 0)
+    {
+        pthread_mutex_lock(&m_FrameBufLock);
+        if (m_FrameBufPoolCount[f->nClass] < FRAMEBUF_POOL_MAX)
+        {
+            f->pNext = m_FrameBufPool[f->nClass];
+            m_FrameBufPool[f->nClass] = f;
+            m_FrameBufPoolCount[f->nClass]++;
+            f = NULL;
+        }
+        pthread_mutex_unlock(&m_FrameBufLock);
+    }
+    free(f);
+}
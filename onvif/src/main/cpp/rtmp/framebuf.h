@@ -0,0 +1,31 @@
+#ifndef __FRAMEBUF_H
+#define __FRAMEBUF_H
+
+#include "platform.h"
+#include "librtmp/rtmp.h"
+
+#define FRAMEBUF_MIN_SIZE   4096 //最小的一级，每级大小翻倍
+#define FRAMEBUF_CLASSES    11 //4K ~ 4M，更大的不进池
+#define FRAMEBUF_POOL_MAX   32 //每一级池中最多保留的个数
+
+//带引用计数的帧缓冲区，发送队列和GOP 缓存共享同一份数据。
+//body 前面留有RTMP_MAX_HEADER_SIZE 字节
+typedef struct FrameBuf
+{
+    int nRefs;
+    int nClass; //-1 表示不进池
+    unsigned int capacity; //body 可用的长度
+    unsigned int size; //body 中有效数据长度
+    unsigned char *body;
+    struct FrameBuf *pNext; //池中的空闲链表
+} FrameBuf;
+
+//引用计数为1，body 至少有size 字节
+FrameBuf *AllocFrameBuf(unsigned int size);
+
+FrameBuf *RefFrameBuf(FrameBuf *f);
+
+//最后一个引用释放时放回池中
+void UnrefFrameBuf(FrameBuf *f);
+
+#endif
@@ -0,0 +1,441 @@
+#include "group.h"
+
+static pthread_once_t m_GroupOnce = PTHREAD_ONCE_INIT;
+
+static HandleTable *m_GroupTable = NULL;
+
+static int m_GroupIdIndex = 0;
+
+static void FreeSink(GroupNode *g, GroupSink *s)
+{
+    if (s->pRtmpNode)
+        PutRtmpNode(g->pRtmpNodeTable, s->pRtmpNode);
+    if (s->pWriter)
+        FreeFlvWriter(s->pWriter);
+    free(s->pPath);
+    memset(s, 0, sizeof(GroupSink));
+}
+
+static BOOL FreeGroup(void *pObject)
+{
+    GroupNode *g = (GroupNode *) pObject;
+    int i;
+    if (g)
+    {
+        for (i = 0; i < g->nSinks; i++)
+            FreeSink(g, &g->sinks[i]);
+        if (g->pMeta)
+            UnrefFrameBuf(g->pMeta);
+        if (g->pSeqHeader)
+            UnrefFrameBuf(g->pSeqHeader);
+        if (g->pPreRoll)
+        {
+            ClearPreRoll(g->pPreRoll);
+            free(g->pPreRoll);
+        }
+        pthread_mutex_destroy(&g->m_WriteLock);
+        free(g);
+    }
+    return TRUE;
+}
+
+static void InitGroup(void)
+{
+    InitHandleTable(&m_GroupTable, FreeGroup);
+}
+
+int CreateGroup(HandleTable *pRtmpNodeTable)
+{
+    GroupNode *g;
+
+    pthread_once(&m_GroupOnce, InitGroup);
+    if (!m_GroupTable)
+        return -1;
+
+    g = (GroupNode *) calloc(1, sizeof(GroupNode));
+    if (!g)
+    {
+        LOGE("Alloc Group error!");
+        return -1;
+    }
+    g->id = __atomic_fetch_add(&m_GroupIdIndex, 1, __ATOMIC_RELAXED);
+    g->pRtmpNodeTable = pRtmpNodeTable;
+    pthread_mutex_init(&g->m_WriteLock, NULL);
+    if (!HandleTableInsert(m_GroupTable, g->id, g, &g->slot))
+    {
+        FreeGroup(g);
+        return -1;
+    }
+    return g->id;
+}
+
+BOOL DestroyGroup(int id)
+{
+    pthread_once(&m_GroupOnce, InitGroup);
+    //正在使用的线程释放引用后才关闭输出
+    return HandleTableRemove(m_GroupTable, id);
+}
+
+BOOL GetGroupById(GroupNode **g, int id)
+{
+    int slot;
+    pthread_once(&m_GroupOnce, InitGroup);
+    if (!HandleTableAcquire(m_GroupTable, id, (void **) g, &slot))
+    {
+        LOGE("Group not find! id:%d", id);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void PutGroup(GroupNode *g)
+{
+    HandleTableRelease(m_GroupTable, g->slot);
+}
+
+//发给一个输出，RTMP 连接也可能被别人直接annexH264，用它自己的写锁
+static void SinkPush(GroupSink *s, FrameBuf *f, unsigned int packetType,
+                     unsigned int timestamp, unsigned int flags)
+{
+    if (s->bWaitKey && !(flags & SEND_ITEM_CONFIG))
+    {
+        if (!(flags & SEND_ITEM_KEYFRAME))
+            return;
+        s->bWaitKey = FALSE;
+    }
+    if (s->pRtmpNode)
+    {
+        pthread_mutex_lock(&s->pRtmpNode->m_WriteLock);
+        SendQueuePush(s->pRtmpNode->m_pSendQueue, f, packetType, timestamp, flags);
+        pthread_mutex_unlock(&s->pRtmpNode->m_WriteLock);
+    }
+    else
+    {
+        FlvWriterPush(s->pWriter, f, packetType, timestamp, flags);
+    }
+}
+
+//新输出先收到已有的metadata 和sequence header
+static void SinkStart(GroupNode *g, GroupSink *s)
+{
+    s->bWaitKey = TRUE;
+    if (!g->m_SendSpsPps)
+        return;
+    SinkPush(s, g->pMeta, RTMP_PACKET_TYPE_INFO, 0, SEND_ITEM_CONFIG);
+    SinkPush(s, g->pSeqHeader, RTMP_PACKET_TYPE_VIDEO, 0, SEND_ITEM_CONFIG);
+    if (s->pRtmpNode)
+    {
+        pthread_mutex_lock(&s->pRtmpNode->m_WriteLock);
+        s->pRtmpNode->m_Codec = g->m_Codec;
+        s->pRtmpNode->m_SendSpsPps = TRUE;
+        pthread_mutex_unlock(&s->pRtmpNode->m_WriteLock);
+    }
+}
+
+static GroupSink *AddSink(GroupNode *g)
+{
+    if (g->nSinks >= GROUP_MAX_SINKS)
+    {
+        LOGE("Group sinks full! id:%d", g->id);
+        return NULL;
+    }
+    //删除时最后一项搬到了前面，这里还留着它的指针
+    memset(&g->sinks[g->nSinks], 0, sizeof(GroupSink));
+    return &g->sinks[g->nSinks];
+}
+
+BOOL GroupAddRtmp(int id, int serId)
+{
+    GroupNode *g;
+    GroupSink *s;
+    int i;
+    BOOL bRet = FALSE;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    for (i = 0; i < g->nSinks; i++)
+    {
+        if (g->sinks[i].pRtmpNode && g->sinks[i].serId == serId)
+            break;
+    }
+    s = i < g->nSinks ? NULL : AddSink(g);
+    if (s && GetRtmpNodeById(g->pRtmpNodeTable, &s->pRtmpNode, serId))
+    {
+        s->serId = serId;
+        SinkStart(g, s);
+        g->nSinks++;
+        bRet = TRUE;
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+    PutGroup(g);
+    return bRet;
+}
+
+BOOL GroupRemoveRtmp(int id, int serId)
+{
+    GroupNode *g;
+    GroupSink sink;
+    int i;
+    BOOL bRet = FALSE;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    for (i = 0; i < g->nSinks; i++)
+    {
+        if (g->sinks[i].pRtmpNode && g->sinks[i].serId == serId)
+        {
+            sink = g->sinks[i];
+            g->sinks[i] = g->sinks[--g->nSinks];
+            bRet = TRUE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+    //最后一个引用会停掉发送线程，不能在写锁内等它
+    if (bRet)
+        FreeSink(g, &sink);
+    PutGroup(g);
+    return bRet;
+}
+
+//metadata、sequence header 和pre-roll 中的帧，都只增加引用。没有可写的帧时返回NULL
+static SendItem *MakePreRollHead(GroupNode *g, int *nHead, unsigned int *nTsBase)
+{
+    SendItem *pHead;
+    unsigned int count;
+
+    if (!g->pPreRoll || !g->m_SendSpsPps
+            || (count = PreRollCount(g->pPreRoll)) == 0)
+        return NULL;
+    pHead = (SendItem *) malloc((count + 2) * sizeof(SendItem));
+    if (pHead == NULL)
+        return NULL;
+    memset(pHead, 0, 2 * sizeof(SendItem));
+    pHead[0].packetType = RTMP_PACKET_TYPE_INFO;
+    pHead[0].flags = SEND_ITEM_CONFIG;
+    pHead[0].pFrame = RefFrameBuf(g->pMeta);
+    pHead[1].packetType = RTMP_PACKET_TYPE_VIDEO;
+    pHead[1].flags = SEND_ITEM_CONFIG;
+    pHead[1].pFrame = RefFrameBuf(g->pSeqHeader);
+    *nTsBase = PreRollFirstTs(g->pPreRoll);
+    *nHead = 2 + PreRollCopy(g->pPreRoll, pHead + 2, *nTsBase);
+    return pHead;
+}
+
+static BOOL AddFile(int id, const char *path, BOOL bPreRoll)
+{
+    GroupNode *g;
+    GroupSink *s;
+    SendItem *pHead = NULL;
+    int nHead = 0;
+    unsigned int nTsBase = 0;
+    BOOL bRet = FALSE;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    s = AddSink(g);
+    if (s && (s->pPath = strdup(path)) != NULL)
+    {
+        //在写锁内取pre-roll，之后的帧由SinkPush 接着送来
+        if (bPreRoll)
+            pHead = MakePreRollHead(g, &nHead, &nTsBase);
+        if (InitFlvWriterHead(&s->pWriter, path, pHead, nHead, nTsBase))
+        {
+            s->serId = -1;
+            if (pHead)
+                s->bWaitKey = FALSE;
+            else
+                SinkStart(g, s);
+            g->nSinks++;
+            bRet = TRUE;
+        }
+        else
+        {
+            FreeSink(g, s);
+        }
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+    PutGroup(g);
+    return bRet;
+}
+
+BOOL GroupAddFile(int id, const char *path)
+{
+    return AddFile(id, path, FALSE);
+}
+
+BOOL GroupRecordFile(int id, const char *path)
+{
+    return AddFile(id, path, TRUE);
+}
+
+BOOL GroupRemoveFile(int id, const char *path)
+{
+    GroupNode *g;
+    GroupSink sink;
+    int i;
+    BOOL bRet = FALSE;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    for (i = 0; i < g->nSinks; i++)
+    {
+        if (g->sinks[i].pWriter && strcmp(g->sinks[i].pPath, path) == 0)
+        {
+            sink = g->sinks[i];
+            g->sinks[i] = g->sinks[--g->nSinks];
+            bRet = TRUE;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+    //写完剩下的帧要一段时间，不阻塞生产者
+    if (bRet)
+        FreeSink(g, &sink);
+    PutGroup(g);
+    return bRet;
+}
+
+BOOL GroupSetPreRoll(int id, unsigned int nDuration, unsigned int nMaxBytes)
+{
+    GroupNode *g;
+    BOOL bRet = TRUE;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    if (nDuration == 0)
+    {
+        if (g->pPreRoll)
+        {
+            ClearPreRoll(g->pPreRoll);
+            free(g->pPreRoll);
+            g->pPreRoll = NULL;
+        }
+    }
+    else
+    {
+        if (!g->pPreRoll)
+            g->pPreRoll = (PreRoll *) calloc(1, sizeof(PreRoll));
+        if (g->pPreRoll)
+            SetPreRoll(g->pPreRoll, nDuration, nMaxBytes);
+        else
+            bRet = FALSE;
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+    PutGroup(g);
+    return bRet;
+}
+
+BOOL GetGroupPreRollStats(int id, long long *stats)
+{
+    GroupNode *g;
+    BOOL bRet;
+
+    if (!GetGroupById(&g, id))
+        return FALSE;
+    pthread_mutex_lock(&g->m_WriteLock);
+    bRet = g->pPreRoll != NULL;
+    if (bRet)
+        GetPreRollStats(g->pPreRoll, stats);
+    pthread_mutex_unlock(&g->m_WriteLock);
+    PutGroup(g);
+    return bRet;
+}
+
+BOOL GroupSendSpsPps(GroupNode *g, char *h264, int length, int width,
+                     int height, int rate)
+{
+    FrameBuf *pMeta, *pSeqHeader;
+    int i, codec;
+
+    if (!PackSpsPps(h264, length, width, height, rate, &pMeta, &pSeqHeader,
+                    &codec))
+        return FALSE;
+    //sps/pps 变了，之前的帧不能再用新的sequence header 写
+    if (g->pPreRoll && !(g->pSeqHeader && g->pSeqHeader->size == pSeqHeader->size
+                         && memcmp(g->pSeqHeader->body, pSeqHeader->body,
+                                   pSeqHeader->size) == 0))
+        ClearPreRoll(g->pPreRoll);
+    if (g->pMeta)
+        UnrefFrameBuf(g->pMeta);
+    if (g->pSeqHeader)
+        UnrefFrameBuf(g->pSeqHeader);
+    g->pMeta = pMeta;
+    g->pSeqHeader = pSeqHeader;
+    g->m_Codec = codec;
+    g->m_SendSpsPps = TRUE;
+
+    for (i = 0; i < g->nSinks; i++)
+    {
+        SinkPush(&g->sinks[i], pMeta, RTMP_PACKET_TYPE_INFO, 0, SEND_ITEM_CONFIG);
+        SinkPush(&g->sinks[i], pSeqHeader, RTMP_PACKET_TYPE_VIDEO, 0, SEND_ITEM_CONFIG);
+        if (g->sinks[i].pRtmpNode)
+        {
+            pthread_mutex_lock(&g->sinks[i].pRtmpNode->m_WriteLock);
+            g->sinks[i].pRtmpNode->width = width;
+            g->sinks[i].pRtmpNode->height = height;
+            g->sinks[i].pRtmpNode->rate = rate;
+            g->sinks[i].pRtmpNode->m_Codec = codec;
+            g->sinks[i].pRtmpNode->m_SendSpsPps = TRUE;
+            pthread_mutex_unlock(&g->sinks[i].pRtmpNode->m_WriteLock);
+        }
+    }
+    return TRUE;
+}
+
+//打包一次，每个输出按自己的丢帧策略放进自己的队列，慢的输出只会丢自己的帧
+BOOL GroupAnnexH264(GroupNode *g, char *h264, int length, unsigned int tick)
+{
+    unsigned int flags;
+    FrameBuf *f;
+    int i;
+
+    if (!g->m_SendSpsPps)
+        return FALSE;
+    f = PackH264(h264, length, g->m_Codec, &flags);
+    if (f == NULL)
+        return FALSE;
+    for (i = 0; i < g->nSinks; i++)
+        SinkPush(&g->sinks[i], f, RTMP_PACKET_TYPE_VIDEO, tick, flags);
+    if (g->pPreRoll)
+        PreRollPush(g->pPreRoll, f, tick, flags);
+    UnrefFrameBuf(f);
+    return TRUE;
+}
+
+void GetGroupQueueStats(GroupNode *g, long long *stats)
+{
+    SendQueue *q;
+    FlvWriter *w;
+    long long depth;
+    int i;
+
+    memset(stats, 0, 4 * sizeof(long long));
+    pthread_mutex_lock(&g->m_WriteLock);
+    for (i = 0; i < g->nSinks; i++)
+    {
+        if (g->sinks[i].pRtmpNode)
+        {
+            q = g->sinks[i].pRtmpNode->m_pSendQueue;
+            depth = SendQueueDepth(q);
+            stats[1] += __atomic_load_n(&q->nDropNonRef, __ATOMIC_RELAXED);
+            stats[2] += __atomic_load_n(&q->nDropGop, __ATOMIC_RELAXED);
+            stats[3] += __atomic_load_n(&q->nSendError, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            w = g->sinks[i].pWriter;
+            depth = FlvWriterDepth(w);
+            stats[2] += __atomic_load_n(&w->nDropGop, __ATOMIC_RELAXED);
+            stats[3] += __atomic_load_n(&w->nWriteError, __ATOMIC_RELAXED);
+        }
+        if (depth > stats[0])
+            stats[0] = depth;
+    }
+    pthread_mutex_unlock(&g->m_WriteLock);
+}
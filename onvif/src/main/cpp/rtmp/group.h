@@ -0,0 +1,78 @@
+#ifndef __GROUP_H
+#define __GROUP_H
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "data.h"
+#include "flvwriter.h"
+#include "packer.h"
+#include "preroll.h"
+
+#define GROUP_MAX_SINKS  8
+
+//组的一个输出，RTMP 连接或者FLV 文件，各自有队列和丢帧策略
+typedef struct GroupSink
+{
+    int serId; //文件输出为-1
+    RtmpNode *pRtmpNode; //持有引用
+    FlvWriter *pWriter;
+    char *pPath; //文件输出的路径，removeGroupFile 按它查找
+    BOOL bWaitKey; //新加入的输出从下一个关键帧开始
+} GroupSink;
+
+//一路视频同时发到多个输出。每帧只打包一次，所有输出引用同一个帧缓冲区
+typedef struct Group
+{
+    int id;
+    int slot;
+    HandleTable *pRtmpNodeTable;
+    GroupSink sinks[GROUP_MAX_SINKS];
+    int nSinks;
+    BOOL m_SendSpsPps;
+    int m_Codec;
+    FrameBuf *pMeta; //最近的metadata 和sequence header，发给中途加入的输出
+    FrameBuf *pSeqHeader;
+    PreRoll *pPreRoll; //setGroupPreRoll 之后保存最近的帧，录像时先写它们
+    pthread_mutex_t m_WriteLock; //生产者和增删输出串行
+} GroupNode;
+
+//返回组id，失败返回-1
+int CreateGroup(HandleTable *pRtmpNodeTable);
+
+BOOL DestroyGroup(int id);
+
+BOOL GetGroupById(GroupNode **g, int id);
+
+void PutGroup(GroupNode *g);
+
+//serId 是connectRtmpSer/connectRtmpPublisher 返回的id，组持有连接的引用
+BOOL GroupAddRtmp(int id, int serId);
+
+BOOL GroupRemoveRtmp(int id, int serId);
+
+BOOL GroupAddFile(int id, const char *path);
+
+//nDuration 为0 时关闭，nMaxBytes 为0 时用PREROLL_MAX_BYTES
+BOOL GroupSetPreRoll(int id, unsigned int nDuration, unsigned int nMaxBytes);
+
+//同GroupAddFile，文件从pre-roll 的第一个关键帧开始，之后接着写实时的帧，中间不丢不重复。
+//没有pre-roll 时等下一个关键帧
+BOOL GroupRecordFile(int id, const char *path);
+
+//写完已提交的帧后关闭文件
+BOOL GroupRemoveFile(int id, const char *path);
+
+//stats 长度为PREROLL_STATS_COUNT，没有开启pre-roll 时返回FALSE
+BOOL GetGroupPreRollStats(int id, long long *stats);
+
+//以下调用者持有g->m_WriteLock
+BOOL GroupSendSpsPps(GroupNode *g, char *h264, int length, int width,
+                     int height, int rate);
+
+BOOL GroupAnnexH264(GroupNode *g, char *h264, int length, unsigned int tick);
+
+//所有RTMP 输出的队列深度(最大值)和丢帧、发送错误(总和)
+void GetGroupQueueStats(GroupNode *g, long long *stats);
+
+#endif
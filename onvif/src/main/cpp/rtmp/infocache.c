@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "infocache.h"
+#include "video.h"
+
+#define STREAM_INFO_MAGIC  0x31434953 //"SIC1"
+
+static pthread_mutex_t m_InfoLock = PTHREAD_MUTEX_INITIALIZER;
+static StreamInfo m_Infos[STREAM_INFO_CACHE_SIZE];
+static BOOL m_InfoUsed[STREAM_INFO_CACHE_SIZE];
+static int m_NextInfo = 0;
+static char m_CacheDir[256] = { 0 };
+
+void SetStreamInfoCacheDir(const char *dir)
+{
+    pthread_mutex_lock(&m_InfoLock);
+    snprintf(m_CacheDir, sizeof(m_CacheDir), "%s", dir ? dir : "");
+    pthread_mutex_unlock(&m_InfoLock);
+}
+
+//FNV-1a
+uint64_t StreamInfoKey(const char *url)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*url)
+    {
+        h ^= (unsigned char) *url++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//以下调用者持有m_InfoLock
+static int FindInfo(uint64_t key)
+{
+    int i;
+    for (i = 0; i < STREAM_INFO_CACHE_SIZE; i++)
+    {
+        if (m_InfoUsed[i] && m_Infos[i].key == key)
+            return i;
+    }
+    return -1;
+}
+
+static void StoreInfo(const StreamInfo *info)
+{
+    int i = FindInfo(info->key);
+    if (i < 0)
+    {
+        i = m_NextInfo;
+        m_NextInfo = (m_NextInfo + 1) % STREAM_INFO_CACHE_SIZE;
+    }
+    m_Infos[i] = *info;
+    m_InfoUsed[i] = TRUE;
+}
+
+static void InfoFilePath(char *path, int size, uint64_t key)
+{
+    snprintf(path, size, "%s/%016llx.sinfo", m_CacheDir, (unsigned long long) key);
+}
+
+static BOOL LoadInfoFile(uint64_t key, StreamInfo *info)
+{
+    char path[300];
+    unsigned int magic = 0;
+    BOOL bRet;
+    FILE *fp;
+
+    InfoFilePath(path, sizeof(path), key);
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return FALSE;
+    bRet = fread(&magic, sizeof(magic), 1, fp) == 1
+           && magic == STREAM_INFO_MAGIC
+           && fread(info, sizeof(StreamInfo), 1, fp) == 1
+           && info->key == key
+           && info->extradataSize >= 0
+           && info->extradataSize <= STREAM_INFO_MAX_EXTRADATA;
+    fclose(fp);
+    return bRet;
+}
+
+//先写临时文件再改名，不会留下写了一半的缓存
+static void SaveInfoFile(const StreamInfo *info)
+{
+    char path[300], tmp[310];
+    unsigned int magic = STREAM_INFO_MAGIC;
+    BOOL bRet;
+    FILE *fp;
+
+    InfoFilePath(path, sizeof(path), info->key);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        LOGE("Can't write stream info cache %s", tmp);
+        return;
+    }
+    bRet = fwrite(&magic, sizeof(magic), 1, fp) == 1
+           && fwrite(info, sizeof(StreamInfo), 1, fp) == 1;
+    if (fclose(fp) != 0 || !bRet || rename(tmp, path) != 0)
+        remove(tmp);
+}
+
+static BOOL GetInfo(uint64_t key, StreamInfo *info)
+{
+    BOOL bFound;
+    int i;
+
+    pthread_mutex_lock(&m_InfoLock);
+    i = FindInfo(key);
+    bFound = i >= 0;
+    if (bFound)
+        *info = m_Infos[i];
+    else if (m_CacheDir[0] && LoadInfoFile(key, info))
+    {
+        StoreInfo(info);
+        bFound = TRUE;
+    }
+    pthread_mutex_unlock(&m_InfoLock);
+    return bFound;
+}
+
+void DropStreamInfo(uint64_t key)
+{
+    char path[300];
+    int i;
+
+    pthread_mutex_lock(&m_InfoLock);
+    i = FindInfo(key);
+    if (i >= 0)
+        m_InfoUsed[i] = FALSE;
+    if (m_CacheDir[0])
+    {
+        InfoFilePath(path, sizeof(path), key);
+        remove(path);
+    }
+    pthread_mutex_unlock(&m_InfoLock);
+}
+
+static int FindVideoStream(AVFormatContext *pFormatCtx)
+{
+    unsigned int i;
+    for (i = 0; i < pFormatCtx->nb_streams; i++)
+    {
+        if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            return (int) i;
+    }
+    return -1;
+}
+
+BOOL ApplyStreamInfo(uint64_t key, AVFormatContext *pFormatCtx)
+{
+    StreamInfo info;
+    AVCodecParameters *par;
+    AVStream *st;
+    int index;
+
+    if (!GetInfo(key, &info))
+        return FALSE;
+    index = FindVideoStream(pFormatCtx);
+    if (index < 0)
+        return FALSE;
+    st = pFormatCtx->streams[index];
+    par = st->codecpar;
+    if (par->codec_id != info.codecId)
+    {
+        LOGI("Stream info cache codec changed %d -> %d", info.codecId, par->codec_id);
+        DropStreamInfo(key);
+        return FALSE;
+    }
+
+    //只补SDP 里没有的，demuxer 给出的值优先
+    if (par->width <= 0 || par->height <= 0)
+    {
+        par->width = info.width;
+        par->height = info.height;
+    }
+    if (par->extradata_size <= 0 && info.extradataSize > 0)
+    {
+        par->extradata = (uint8_t *) av_mallocz(info.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (par->extradata == NULL)
+            return FALSE;
+        memcpy(par->extradata, info.extradata, info.extradataSize);
+        par->extradata_size = info.extradataSize;
+    }
+    if (st->avg_frame_rate.num <= 0 || st->avg_frame_rate.den <= 0)
+        st->avg_frame_rate = info.frameRate;
+    if (st->r_frame_rate.num <= 0 || st->r_frame_rate.den <= 0)
+        st->r_frame_rate = info.frameRate;
+    if (st->time_base.num <= 0 || st->time_base.den <= 0)
+        st->time_base = info.timeBase;
+    return TRUE;
+}
+
+void SaveStreamInfo(uint64_t key, AVFormatContext *pFormatCtx)
+{
+    StreamInfo info;
+    AVCodecParameters *par;
+    AVStream *st;
+    int index = FindVideoStream(pFormatCtx);
+
+    if (index < 0)
+        return;
+    st = pFormatCtx->streams[index];
+    par = st->codecpar;
+    if (par->codec_id == AV_CODEC_ID_NONE || par->extradata_size > STREAM_INFO_MAX_EXTRADATA)
+        return;
+
+    memset(&info, 0, sizeof(info));
+    info.key = key;
+    info.codecId = par->codec_id;
+    info.width = par->width;
+    info.height = par->height;
+    info.timeBase = st->time_base;
+    info.frameRate = st->avg_frame_rate.num > 0 ? st->avg_frame_rate : st->r_frame_rate;
+    if (par->extradata_size > 0)
+    {
+        memcpy(info.extradata, par->extradata, par->extradata_size);
+        info.extradataSize = par->extradata_size;
+    }
+
+    pthread_mutex_lock(&m_InfoLock);
+    StoreInfo(&info);
+    if (m_CacheDir[0])
+        SaveInfoFile(&info);
+    pthread_mutex_unlock(&m_InfoLock);
+}
+
+static BOOL IsSps(int codecId, const unsigned char *nal)
+{
+    if (codecId == AV_CODEC_ID_HEVC)
+        return HEVC_NAL_TYPE(nal) == HEVC_NAL_SPS;
+    return (nal[0] & 0x1f) == NAL_SPS;
+}
+
+//取第一个sps，data 是Annex-B，或者H264 的avcC
+static BOOL FindSps(int codecId, const uint8_t *data, int size,
+                    const uint8_t **sps, int *length)
+{
+    NALU_Scanner_t scanner;
+    NALU_t nalu;
+
+    if (codecId == AV_CODEC_ID_H264 && size >= 8 && data[0] == 1)
+    {
+        if ((data[5] & 0x1f) == 0)
+            return FALSE;
+        *length = (data[6] << 8) | data[7];
+        *sps = data + 8;
+        return 8 + *length <= size;
+    }
+    NALUScannerInit(&scanner, data, size);
+    while (NALUScannerNext(&scanner, &nalu))
+    {
+        if (IsSps(codecId, nalu.buf))
+        {
+            *sps = nalu.buf;
+            *length = nalu.len;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+BOOL CheckStreamInfo(uint64_t key, AVCodecParameters *par,
+                     const uint8_t *data, int size)
+{
+    StreamInfo info;
+    const uint8_t *sps, *cachedSps;
+    int length, cachedLength;
+
+    if (par->codec_id != AV_CODEC_ID_H264 && par->codec_id != AV_CODEC_ID_HEVC)
+        return TRUE;
+    if (!GetInfo(key, &info) || info.extradataSize <= 0)
+        return TRUE;
+    if (!FindSps(par->codec_id, data, size, &sps, &length)
+            || !FindSps(par->codec_id, info.extradata, info.extradataSize,
+                        &cachedSps, &cachedLength))
+        return TRUE;
+    if (length == cachedLength && memcmp(sps, cachedSps, length) == 0)
+        return TRUE;
+
+    LOGE("Stream info cache sps changed, drop it.");
+    DropStreamInfo(key);
+    //extradata 是从缓存填进去的才去掉，SDP 给出的保留
+    if (par->extradata_size == info.extradataSize
+            && memcmp(par->extradata, info.extradata, info.extradataSize) == 0)
+    {
+        av_freep(&par->extradata);
+        par->extradata_size = 0;
+    }
+    //宽高可能也是缓存的旧值，改用带内sps 的。解析失败时清零，由发送时再从sps 取
+    if (!GetSpsResolution(par->codec_id == AV_CODEC_ID_HEVC ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264,
+                          sps, length, &par->width, &par->height))
+    {
+        par->width = 0;
+        par->height = 0;
+    }
+    return FALSE;
+}
@@ -0,0 +1,45 @@
+#ifndef __INFOCACHE_H
+#define __INFOCACHE_H
+
+#include <stdint.h>
+
+#include "platform.h"
+#include "libavformat/avformat.h"
+
+#define STREAM_INFO_CACHE_SIZE     64 //内存中缓存的路数，满了轮流替换
+#define STREAM_INFO_MAX_EXTRADATA  1024 //sps/pps 更长的流不缓存
+
+//视频流的参数，按url 的hash 缓存，命中时跳过avformat_find_stream_info。
+//url 里可能有用户名密码，文件中只保存hash
+typedef struct StreamInfo
+{
+    uint64_t key;
+    int codecId; //enum AVCodecID
+    int width;
+    int height;
+    AVRational timeBase;
+    AVRational frameRate;
+    int extradataSize;
+    uint8_t extradata[STREAM_INFO_MAX_EXTRADATA];
+} StreamInfo;
+
+//缓存文件的目录，重启后也能命中。NULL 为只在内存中缓存
+void SetStreamInfoCacheDir(const char *dir);
+
+uint64_t StreamInfoKey(const char *url);
+
+//avformat_open_input 之后调用，命中时把参数填进视频流，返回TRUE 可以不再探测。
+//流的codec 和缓存不一致时删除缓存，返回FALSE
+BOOL ApplyStreamInfo(uint64_t key, AVFormatContext *pFormatCtx);
+
+//avformat_find_stream_info 之后保存第一个视频流的参数
+void SaveStreamInfo(uint64_t key, AVFormatContext *pFormatCtx);
+
+//用第一个关键帧中的sps 校验缓存的extradata。不一致时删除缓存，去掉par 中旧的extradata
+//让调用者改用带内的sps，宽高改为带内sps 中的，返回FALSE。关键帧没有sps 时无法校验，返回TRUE
+BOOL CheckStreamInfo(uint64_t key, AVCodecParameters *par,
+                     const uint8_t *data, int size);
+
+void DropStreamInfo(uint64_t key);
+
+#endif
@@ -0,0 +1,371 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "logger.h"
+
+typedef struct
+{
+    int level;
+    const char *tag;
+    char text[LOG_TEXT_SIZE];
+} LogRecord;
+
+typedef struct LogRing
+{
+    unsigned int head; //写线程取到的位置
+    unsigned int tail; //所属线程写到的位置
+    unsigned int nDropped; //缓冲满丢掉的条数，写线程取走后清零
+    int bUsed; //线程退出后置FALSE，给新线程复用
+    //以下只由所属线程写，用于合并重复日志。nSuppressed 不为0 时写线程也会取走它并读
+    //pLastTag/nLastLevel，所属线程把不为0 的计数清零要持有repeatLock
+    const char *pLastFmt;
+    const char *pLastTag;
+    int nLastLevel;
+    int nRepeat;
+    unsigned int nSuppressed;
+    long long nWindow;
+    pthread_mutex_t repeatLock;
+    struct LogRing *pNext;
+    LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+static struct
+{
+    LogRing *pRings; //只在表头插入，从不删除
+    pthread_key_t key;
+    pthread_once_t once;
+    BOOL bDirect; //写线程没起来，直接输出
+    BOOL bSleeping;
+    sem_t wake;
+    pthread_mutex_t fileLock;
+    FILE *pFile;
+} m_log = { .pRings = NULL, .once = PTHREAD_ONCE_INIT };
+
+static long long NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void OutputRecord(int level, const char *tag, const char *text)
+{
+    size_t len = strlen(text);
+    BOOL bNewLine = len > 0 && text[len - 1] == '\n';
+#ifdef ANDROID
+    __android_log_write(level, tag, text);
+#else
+    (void) level;
+    fprintf(stderr, bNewLine ? "%s %s" : "%s %s\n", tag, text);
+#endif
+    if (m_log.pFile)
+        fprintf(m_log.pFile, bNewLine ? "%s %s" : "%s %s\n", tag, text);
+}
+
+//写线程取走重复次数直接输出，调用者持有fileLock
+static int OutputRepeat(LogRing *r)
+{
+    unsigned int n = 0;
+    const char *tag = NULL;
+    int level = 0;
+    char text[64];
+
+    pthread_mutex_lock(&r->repeatLock);
+    if (__atomic_load_n(&r->nSuppressed, __ATOMIC_ACQUIRE))
+    {
+        tag = r->pLastTag;
+        level = r->nLastLevel;
+        n = __atomic_exchange_n(&r->nSuppressed, 0, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_unlock(&r->repeatLock);
+    if (!n)
+        return 0;
+    snprintf(text, sizeof(text), "last message repeated %u times", n);
+    OutputRecord(level, tag, text);
+    return 1;
+}
+
+//取出所有线程缓冲里的日志，返回条数。线程停了一个窗口还没输出的重复次数也输出，
+//bAll 时不管窗口；还有要等窗口过去的重复次数时*pPending 为TRUE
+static int DrainRings(BOOL bAll, BOOL *pPending)
+{
+    int n = 0;
+    unsigned int head, tail, nDropped;
+    long long now = NowMs();
+    LogRing *r;
+    LogRecord *rec;
+    char text[64];
+
+    *pPending = FALSE;
+    pthread_mutex_lock(&m_log.fileLock);
+    for (r = __atomic_load_n(&m_log.pRings, __ATOMIC_ACQUIRE); r; r = r->pNext)
+    {
+        head = r->head;
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, n++)
+        {
+            rec = &r->records[head & (LOG_RING_SIZE - 1)];
+            OutputRecord(rec->level, rec->tag, rec->text);
+        }
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+        nDropped = __atomic_exchange_n(&r->nDropped, 0, __ATOMIC_RELAXED);
+        if (nDropped)
+        {
+            snprintf(text, sizeof(text), "log buffer full, %u dropped", nDropped);
+            OutputRecord(LOG_LEVEL_WARN, "logger", text);
+            n++;
+        }
+
+        if (__atomic_load_n(&r->nSuppressed, __ATOMIC_RELAXED))
+        {
+            if (bAll || now - __atomic_load_n(&r->nWindow, __ATOMIC_RELAXED) >= LOG_REPEAT_WINDOW)
+                n += OutputRepeat(r);
+            else
+                *pPending = TRUE;
+        }
+    }
+    if (n && m_log.pFile)
+        fflush(m_log.pFile);
+    pthread_mutex_unlock(&m_log.fileLock);
+    return n;
+}
+
+static void *LogThread(void *arg)
+{
+    BOOL bPending;
+    struct timespec ts;
+
+    (void) arg;
+    while (TRUE)
+    {
+        if (DrainRings(FALSE, &bPending))
+            continue;
+        //先声明要睡眠再检查一遍，生产者看到标志才sem_post，不会丢唤醒
+        __atomic_store_n(&m_log.bSleeping, TRUE, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (DrainRings(FALSE, &bPending))
+        {
+            __atomic_store_n(&m_log.bSleeping, FALSE, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (!bPending)
+        {
+            while (sem_wait(&m_log.wake) < 0)
+                ;
+            continue;
+        }
+        //有线程停在重复日志上，一个窗口后醒来输出重复次数
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += LOG_REPEAT_WINDOW / 1000;
+        ts.tv_nsec += (LOG_REPEAT_WINDOW % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        while (sem_timedwait(&m_log.wake, &ts) < 0 && errno == EINTR)
+            ;
+        __atomic_store_n(&m_log.bSleeping, FALSE, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static void PushRecordF(LogRing *r, int level, const char *tag, const char *fmt, ...);
+
+//所属线程把重复次数放进自己的缓冲
+static void PushRepeat(LogRing *r)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&r->repeatLock);
+    n = __atomic_exchange_n(&r->nSuppressed, 0, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&r->repeatLock);
+    if (n)
+        PushRecordF(r, r->nLastLevel, r->pLastTag, "last message repeated %u times", n);
+}
+
+//线程退出时先交出还没输出的重复次数
+static void ReleaseRing(void *p)
+{
+    LogRing *r = (LogRing *) p;
+    if (__atomic_load_n(&r->nSuppressed, __ATOMIC_ACQUIRE))
+        PushRepeat(r);
+    __atomic_store_n(&r->bUsed, FALSE, __ATOMIC_RELEASE);
+}
+
+static void InitLogger(void)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_mutex_init(&m_log.fileLock, NULL);
+    if (pthread_key_create(&m_log.key, ReleaseRing) != 0 || sem_init(&m_log.wake, 0, 0) != 0)
+    {
+        m_log.bDirect = TRUE;
+        return;
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, LogThread, NULL) != 0)
+        m_log.bDirect = TRUE;
+    pthread_attr_destroy(&attr);
+    atexit(LogFlush);
+}
+
+//当前线程的缓冲，第一次调用时复用退出线程留下的或者新建一个
+static LogRing *GetRing(void)
+{
+    int bUsed;
+    LogRing *r = (LogRing *) pthread_getspecific(m_log.key);
+    if (r)
+        return r;
+
+    for (r = __atomic_load_n(&m_log.pRings, __ATOMIC_ACQUIRE); r; r = r->pNext)
+    {
+        bUsed = FALSE;
+        if (__atomic_compare_exchange_n(&r->bUsed, &bUsed, TRUE, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!r)
+    {
+        r = (LogRing *) calloc(1, sizeof(LogRing));
+        if (!r)
+            return NULL;
+        r->bUsed = TRUE;
+        pthread_mutex_init(&r->repeatLock, NULL);
+        r->pNext = __atomic_load_n(&m_log.pRings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&m_log.pRings, &r->pNext, r, TRUE,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    r->pLastFmt = NULL;
+    r->nRepeat = 0;
+    pthread_setspecific(m_log.key, r);
+    return r;
+}
+
+static void WakeWriter(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_log.bSleeping, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&m_log.bSleeping, FALSE, __ATOMIC_SEQ_CST))
+        sem_post(&m_log.wake);
+}
+
+static void PushRecord(LogRing *r, int level, const char *tag, const char *fmt, va_list vl)
+{
+    unsigned int tail = r->tail;
+    LogRecord *rec;
+
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE)
+    {
+        __atomic_add_fetch(&r->nDropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    rec = &r->records[tail & (LOG_RING_SIZE - 1)];
+    rec->level = level;
+    rec->tag = tag;
+    vsnprintf(rec->text, LOG_TEXT_SIZE, fmt, vl);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    WakeWriter();
+}
+
+static void PushRecordF(LogRing *r, int level, const char *tag, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    PushRecord(r, level, tag, fmt, vl);
+    va_end(vl);
+}
+
+static void LogDirect(int level, const char *tag, const char *fmt, va_list vl)
+{
+    char text[LOG_TEXT_SIZE];
+    vsnprintf(text, sizeof(text), fmt, vl);
+    pthread_mutex_lock(&m_log.fileLock);
+    OutputRecord(level, tag, text);
+    pthread_mutex_unlock(&m_log.fileLock);
+}
+
+void LogWriteV(int level, const char *tag, const char *fmt, va_list vl)
+{
+    LogRing *r;
+    long long now;
+
+    pthread_once(&m_log.once, InitLogger);
+    r = m_log.bDirect ? NULL : GetRing();
+    if (!r)
+    {
+        LogDirect(level, tag, fmt, vl);
+        return;
+    }
+
+    //同一个格式串在窗口内超过LOG_REPEAT_BURST 次后只计数，窗口过后或换了日志时输出重复次数
+    now = NowMs();
+    if (fmt == r->pLastFmt && now - r->nWindow < LOG_REPEAT_WINDOW)
+    {
+        if (++r->nRepeat > LOG_REPEAT_BURST)
+        {
+            //第一次不输出时叫醒写线程，让它在窗口过后输出重复次数
+            if (__atomic_add_fetch(&r->nSuppressed, 1, __ATOMIC_RELEASE) == 1)
+                WakeWriter();
+            return;
+        }
+    }
+    else
+    {
+        //计数为0 时写线程不会读pLastTag/nLastLevel，可以直接改
+        if (__atomic_load_n(&r->nSuppressed, __ATOMIC_ACQUIRE))
+            PushRepeat(r);
+        r->pLastFmt = fmt;
+        r->pLastTag = tag;
+        r->nLastLevel = level;
+        r->nRepeat = 1;
+        __atomic_store_n(&r->nWindow, now, __ATOMIC_RELAXED);
+    }
+    PushRecord(r, level, tag, fmt, vl);
+}
+
+void LogWrite(int level, const char *tag, const char *fmt, ...)
+{
+    va_list vl;
+    va_start(vl, fmt);
+    LogWriteV(level, tag, fmt, vl);
+    va_end(vl);
+}
+
+void LogFlush(void)
+{
+    BOOL bPending;
+
+    pthread_once(&m_log.once, InitLogger);
+    if (m_log.bDirect)
+        return;
+    DrainRings(TRUE, &bPending);
+}
+
+BOOL LogSetFile(const char *path)
+{
+    FILE *fp = NULL;
+    FILE *old;
+
+    pthread_once(&m_log.once, InitLogger);
+    if (path)
+    {
+        fp = fopen(path, "a+");
+        if (!fp)
+            return FALSE;
+    }
+    pthread_mutex_lock(&m_log.fileLock);
+    old = m_log.pFile;
+    m_log.pFile = fp;
+    pthread_mutex_unlock(&m_log.fileLock);
+    if (old)
+        fclose(old);
+    return TRUE;
+}
@@ -0,0 +1,24 @@
+#ifndef __LOGGER_H
+#define __LOGGER_H
+
+#include <stdarg.h>
+
+#include "platform.h"
+
+#define LOG_RING_SIZE      128 //每个线程的环形缓冲记录数，必须是2的幂
+#define LOG_TEXT_SIZE      240
+#define LOG_REPEAT_BURST   10  //同一条日志每个窗口内最多输出的次数
+#define LOG_REPEAT_WINDOW  1000 //ms
+
+//日志异步输出：每个线程一个无锁单生产者环形缓冲，由一个后台线程取出写到logcat 和文件。
+//缓冲满时丢弃，不阻塞调用者。tag 必须是常量字符串。
+//LOGE/LOGI 等宏在定义了LOG_ASYNC 时走这里，级别门限见platform.h 的LOG_LEVEL
+void LogWriteV(int level, const char *tag, const char *fmt, va_list vl);
+
+//立即写出所有线程缓冲中的日志和还没输出的重复次数。进程退出和库卸载时调用
+void LogFlush(void);
+
+//日志同时追加写到文件，path 为NULL 时关闭文件
+BOOL LogSetFile(const char *path);
+
+#endif
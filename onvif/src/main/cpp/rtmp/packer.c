@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "librtmp/amf.h"
+#include "librtmp/rtmp.h"
+
+#include "RTMPMetadata.h"
+#include "video.h"
+#include "packer.h"
+
+#define FLV_CODECID_H264           7
+
+//enhanced-RTMP: 视频tag 第一个字节最高位置1，低4位是包类型，后面跟4字节FourCC
+#define FLV_FOURCC_HVC1            0x68766331 // 'hvc1'
+#define FLV_VIDEO_EX_HEADER        0x80
+#define FLV_PACKET_SEQUENCE_START  0
+#define FLV_PACKET_CODED_FRAMES_X  3 //没有composition time
+
+char * put_byte(char *output, uint8_t nVal)
+{
+    output[0] = nVal;
+    return output + 1;
+}
+char * put_be16(char *output, uint16_t nVal)
+{
+    output[1] = nVal & 0xff;
+    output[0] = nVal >> 8;
+    return output + 2;
+}
+char * put_be24(char *output, uint32_t nVal)
+{
+    output[2] = nVal & 0xff;
+    output[1] = nVal >> 8;
+    output[0] = nVal >> 16;
+    return output + 3;
+}
+char * put_be32(char *output, uint32_t nVal)
+{
+    output[3] = nVal & 0xff;
+    output[2] = nVal >> 8;
+    output[1] = nVal >> 16;
+    output[0] = nVal >> 24;
+    return output + 4;
+}
+char * put_be64(char *output, uint64_t nVal)
+{
+    output = put_be32(output, nVal >> 32);
+    output = put_be32(output, nVal);
+    return output;
+}
+char * put_amf_string(char *c, const char *str)
+{
+    uint16_t len = strlen(str);
+    c = put_be16(c, len);
+    memcpy(c, str, len);
+    return c + len;
+}
+char * put_amf_double(char *c, double d)
+{
+    *c++ = AMF_NUMBER; /* type: Number */
+    {
+        unsigned char *ci, *co;
+        ci = (unsigned char *) &d;
+        co = (unsigned char *) c;
+        co[0] = ci[7];
+        co[1] = ci[6];
+        co[2] = ci[5];
+        co[3] = ci[4];
+        co[4] = ci[3];
+        co[5] = ci[2];
+        co[6] = ci[1];
+        co[7] = ci[0];
+    }
+    return c + 8;
+}
+
+//onMetaData 和AVC sequence header 打包成两个帧缓冲区，由调用者释放
+static BOOL PackMetadata(LPRTMPMetadata lpMetaData, FrameBuf **ppMeta,
+                         FrameBuf **ppSeqHeader)
+{
+    if (lpMetaData == NULL)
+    {
+        LOGE("PackMetadata lpMetaData == NULL!\n");
+        return FALSE;
+    }
+    FrameBuf *f = AllocFrameBuf(1024);
+    if (f == NULL)
+        return FALSE;
+    char *body = (char *) f->body;
+
+    char * p = (char *) body;
+    p = put_byte(p, AMF_STRING);
+    p = put_amf_string(p, "@setDataFrame");
+
+    p = put_byte(p, AMF_STRING);
+    p = put_amf_string(p, "onMetaData");
+
+    p = put_byte(p, AMF_OBJECT);
+    p = put_amf_string(p, "copyright");
+    p = put_byte(p, AMF_STRING);
+    p = put_amf_string(p, "firehood");
+
+    p = put_amf_string(p, "width");
+    p = put_amf_double(p, lpMetaData->nWidth);
+
+    p = put_amf_string(p, "height");
+    p = put_amf_double(p, lpMetaData->nHeight);
+
+    p = put_amf_string(p, "framerate");
+    p = put_amf_double(p, lpMetaData->nFrameRate);
+
+    p = put_amf_string(p, "videocodecid");
+    p = put_amf_double(p, lpMetaData->nCodec == VIDEO_CODEC_HEVC
+                       ? FLV_FOURCC_HVC1 : FLV_CODECID_H264);
+
+    p = put_amf_string(p, "");
+    p = put_byte(p, AMF_OBJECT_END);
+
+    f->size = p - body;
+    *ppMeta = f;
+
+    f = AllocFrameBuf(48 + lpMetaData->nVpsLen + lpMetaData->nSpsLen
+                      + lpMetaData->nPpsLen);
+    if (f == NULL)
+    {
+        UnrefFrameBuf(*ppMeta);
+        return FALSE;
+    }
+    body = (char *) f->body;
+
+    int i = 0;
+    if (lpMetaData->nCodec == VIDEO_CODEC_HEVC)
+    {
+        body[i++] = FLV_VIDEO_EX_HEADER | 0x10 | FLV_PACKET_SEQUENCE_START; // 1:keyframe
+        p = put_be32(&body[i], FLV_FOURCC_HVC1);
+        i += 4;
+        // HEVCDecoderConfigurationRecord.
+        int n = Pack_HEVC_Config_Record((unsigned char *) &body[i], f->capacity - i,
+                                        lpMetaData->Vps, lpMetaData->nVpsLen,
+                                        lpMetaData->Sps, lpMetaData->nSpsLen,
+                                        lpMetaData->Pps, lpMetaData->nPpsLen);
+        if (n == 0)
+        {
+            UnrefFrameBuf(f);
+            UnrefFrameBuf(*ppMeta);
+            return FALSE;
+        }
+        f->size = i + n;
+        *ppSeqHeader = f;
+        return TRUE;
+    }
+
+    body[i++] = 0x17; // 1:keyframe  7:AVC
+    body[i++] = 0x00; // AVC sequence header
+
+    body[i++] = 0x00;
+    body[i++] = 0x00;
+    body[i++] = 0x00; // fill in 0;
+
+    // AVCDecoderConfigurationRecord.
+    body[i++] = 0x01; // configurationVersion
+    body[i++] = lpMetaData->Sps[1]; // AVCProfileIndication
+    body[i++] = lpMetaData->Sps[2]; // profile_compatibility
+    body[i++] = lpMetaData->Sps[3]; // AVCLevelIndication
+    body[i++] = 0xff; // lengthSizeMinusOne
+
+    // sps nums
+    body[i++] = 0xE1; //&0x1f
+    // sps data length
+    body[i++] = lpMetaData->nSpsLen >> 8;
+    body[i++] = lpMetaData->nSpsLen & 0xff;
+    // sps data
+    memcpy(&body[i], lpMetaData->Sps, lpMetaData->nSpsLen);
+    i = i + lpMetaData->nSpsLen;
+
+    // pps nums
+    body[i++] = 0x01; //&0x1f
+    // pps data length
+    body[i++] = lpMetaData->nPpsLen >> 8;
+    body[i++] = lpMetaData->nPpsLen & 0xff;
+    // sps data
+    memcpy(&body[i], lpMetaData->Pps, lpMetaData->nPpsLen);
+    i = i + lpMetaData->nPpsLen;
+
+    f->size = i;
+    *ppSeqHeader = f;
+    return TRUE;
+}
+
+FrameBuf *PackH264(char *h264, int length, int codec, unsigned int *flags)
+{
+    FrameBuf *f = AllocFrameBuf(5 + AVCC_MAX_PACKED_SIZE(length));
+    if (f == NULL)
+        return NULL;
+
+    int framesize = 0;
+    BOOL Is_KyeFrame;
+    BOOL Is_Reference;
+    //整个访问单元直接打包进帧缓冲区，前5个字节留给tag 头
+    if (codec == VIDEO_CODEC_HEVC)
+        framesize = Pack_HEVC_Access_Unit(f->body + 5, f->capacity - 5, h264,
+                                          length, &Is_KyeFrame, &Is_Reference);
+    else
+        framesize = Pack_H264_Access_Unit(f->body + 5, f->capacity - 5, h264,
+                                          length, &Is_KyeFrame, &Is_Reference);
+    if (framesize == 0)
+    {
+        LOGE("Pack access unit error! codec:%d\n", codec);
+        UnrefFrameBuf(f);
+        return NULL;
+    }
+
+    unsigned char *body = f->body;
+    int i = 0;
+    if (codec == VIDEO_CODEC_HEVC)
+    {
+        // 1:keyframe 2:inter frame，tag 头和H264 一样是5个字节
+        body[i++] = FLV_VIDEO_EX_HEADER | (Is_KyeFrame ? 0x10 : 0x20)
+                    | FLV_PACKET_CODED_FRAMES_X;
+        put_be32((char *) &body[i], FLV_FOURCC_HVC1);
+        i += 4;
+    }
+    else
+    {
+        if (Is_KyeFrame)
+        {
+            body[i++] = 0x17; // 1:Iframe  7:AVC
+        }
+        else
+        {
+            body[i++] = 0x27; // 2:Pframe  7:AVC
+        }
+        body[i++] = 0x01; // AVC NALU
+        body[i++] = 0x00;
+        body[i++] = 0x00;
+        body[i++] = 0x00;
+    }
+
+    f->size = i + framesize;
+    *flags = (Is_KyeFrame ? SEND_ITEM_KEYFRAME : 0)
+             | (Is_Reference ? SEND_ITEM_REFERENCE : 0);
+    return f;
+}
+
+BOOL PackSpsPps(char* h264, int length, int width, int height, int rate,
+                FrameBuf **ppMeta, FrameBuf **ppSeqHeader, int *pCodec)
+{
+    RTMPMetadata metaData;
+    memset(&metaData, 0, sizeof(RTMPMetadata));
+
+    //有VPS 的是HEVC，按enhanced-RTMP 发送
+    metaData.nCodec = GetVideoCodec(h264, length);
+    if (metaData.nCodec == VIDEO_CODEC_HEVC)
+    {
+        if (!GainVpsSpsPps(metaData.Vps, &metaData.nVpsLen, sizeof(metaData.Vps),
+                           metaData.Sps, &metaData.nSpsLen, sizeof(metaData.Sps),
+                           metaData.Pps, &metaData.nPpsLen, sizeof(metaData.Pps),
+                           h264, length))
+            return FALSE;
+    }
+    else if (!GainSpsPps(metaData.Sps, &metaData.nSpsLen, sizeof(metaData.Sps),
+                         metaData.Pps, &metaData.nPpsLen, sizeof(metaData.Pps),
+                         h264, length))
+        return FALSE;
+    //SDP 里没有宽高，或者缓存失效被清掉时，从sps 解析，不发0x0 的onMetaData
+    if (width <= 0 || height <= 0)
+        GetSpsResolution(metaData.nCodec, metaData.Sps, metaData.nSpsLen,
+                         &width, &height);
+    metaData.nWidth = width; //352; //1920;
+    metaData.nHeight = height; //288; //1080;
+    metaData.nFrameRate = rate; //25;
+    LOGI("width ,height, framerate:%d,%d,%d\n", metaData.nWidth,
+         metaData.nHeight, metaData.nFrameRate);
+    LOGD("sps_len, pps_len: %d,%d  \n", metaData.nSpsLen, metaData.nPpsLen);
+
+    if (!PackMetadata(&metaData, ppMeta, ppSeqHeader))
+        return FALSE;
+    *pCodec = metaData.nCodec;
+    return TRUE;
+}
+
+//metadata 和sequence header 都放进发送队列，保证在视频帧之前发出
+BOOL SendSpsPps(SendQueue *q, char* h264, int length, int width, int height,
+                int rate, int *pCodec)
+{
+    FrameBuf *pMeta, *pSeqHeader;
+    BOOL bRet;
+    if (!PackSpsPps(h264, length, width, height, rate, &pMeta, &pSeqHeader,
+                    pCodec))
+        return FALSE;
+    bRet = SendQueuePush(q, pMeta, RTMP_PACKET_TYPE_INFO, 0, SEND_ITEM_CONFIG)
+           && SendQueuePush(q, pSeqHeader, RTMP_PACKET_TYPE_VIDEO, 0, SEND_ITEM_CONFIG);
+    UnrefFrameBuf(pMeta);
+    UnrefFrameBuf(pSeqHeader);
+    return bRet;
+}
+
+//打包一帧放进发送队列，调用者持有m_WriteLock。被丢帧策略丢掉不算错误
+BOOL AnnexH264(RtmpNode *pRtmpNode, char *h264, int length,
+               unsigned int tick)
+{
+    unsigned int flags;
+    if (!pRtmpNode->m_SendSpsPps)
+        return FALSE;
+
+    FrameBuf *f = PackH264(h264, length, pRtmpNode->m_Codec, &flags);
+    if (f == NULL)
+        return FALSE;
+    //队列满时丢帧，帧仍然进GOP 缓存
+    SendQueuePush(pRtmpNode->m_pSendQueue, f, RTMP_PACKET_TYPE_VIDEO, tick, flags);
+    UnrefFrameBuf(f);
+    return TRUE;
+}
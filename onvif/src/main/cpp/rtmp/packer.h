@@ -0,0 +1,25 @@
+#ifndef __PACKER_H
+#define __PACKER_H
+
+#include "platform.h"
+#include "framebuf.h"
+#include "sendqueue.h"
+#include "data.h"
+
+//H264/HEVC Annex-B 打包成FLV 视频tag，不依赖JNI，bench 也直接链接
+
+//pCodec 返回VIDEO_CODEC_H264/VIDEO_CODEC_HEVC，打包帧时传给PackH264
+BOOL PackSpsPps(char* h264, int length, int width, int height, int rate,
+                FrameBuf **ppMeta, FrameBuf **ppSeqHeader, int *pCodec);
+
+//打包一个访问单元为FLV 视频tag 的数据，flags 返回关键帧/参考帧标志，失败返回NULL
+FrameBuf *PackH264(char *h264, int length, int codec, unsigned int *flags);
+
+//以下调用者持有pRtmpNode->m_WriteLock
+BOOL SendSpsPps(SendQueue *q, char* h264, int length, int width, int height,
+                int rate, int *pCodec);
+
+BOOL AnnexH264(RtmpNode *pRtmpNode, char *h264, int length,
+               unsigned int tick);
+
+#endif
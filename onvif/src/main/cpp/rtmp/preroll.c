@@ -0,0 +1,108 @@
+#include "preroll.h"
+
+#define PREROLL_ITEM(p, i)  (&(p)->items[(i) & (PREROLL_MAX_FRAMES - 1)])
+
+void SetPreRoll(PreRoll *p, unsigned int nDuration, unsigned int nMaxBytes)
+{
+    p->nDuration = nDuration;
+    p->nMaxBytes = nMaxBytes > 0 ? nMaxBytes : PREROLL_MAX_BYTES;
+}
+
+static void DropTo(PreRoll *p, unsigned int index)
+{
+    SendItem *item;
+    while (p->head != index)
+    {
+        item = PREROLL_ITEM(p, p->head);
+        p->nBytes -= item->pFrame->capacity;
+        UnrefFrameBuf(item->pFrame);
+        item->pFrame = NULL;
+        p->head++;
+    }
+}
+
+//第二个GOP 的开始位置，只有一个GOP 时返回tail
+static unsigned int NextGop(PreRoll *p)
+{
+    unsigned int i;
+    for (i = p->head + 1; i != p->tail; i++)
+    {
+        if (PREROLL_ITEM(p, i)->flags & SEND_ITEM_KEYFRAME)
+            break;
+    }
+    return i;
+}
+
+void ClearPreRoll(PreRoll *p)
+{
+    DropTo(p, p->tail);
+}
+
+void PreRollPush(PreRoll *p, FrameBuf *f, unsigned int timestamp,
+                 unsigned int flags)
+{
+    SendItem *item;
+    unsigned int next;
+
+    if (p->head == p->tail && !(flags & SEND_ITEM_KEYFRAME))
+        return;
+    //满了先淘汰最老的GOP，只有一个GOP 时全部丢掉，等下一个关键帧
+    if (p->tail - p->head == PREROLL_MAX_FRAMES)
+    {
+        next = NextGop(p);
+        DropTo(p, next);
+        if (p->head == p->tail && !(flags & SEND_ITEM_KEYFRAME))
+            return;
+    }
+
+    item = PREROLL_ITEM(p, p->tail);
+    item->packetType = RTMP_PACKET_TYPE_VIDEO;
+    item->timestamp = timestamp;
+    item->flags = flags;
+    item->pFrame = RefFrameBuf(f);
+    item->nTime = 0;
+    p->nBytes += f->capacity;
+    p->tail++;
+
+    //去掉第一个GOP 后剩下的还够长，或者超过内存上限
+    while ((next = NextGop(p)) != p->tail
+            && (timestamp - PREROLL_ITEM(p, next)->timestamp >= p->nDuration
+                || p->nBytes > p->nMaxBytes))
+        DropTo(p, next);
+    if (p->nBytes > p->nMaxBytes)
+    {
+        LOGE("PreRoll gop exceeds %u bytes, dropped.\n", p->nMaxBytes);
+        ClearPreRoll(p);
+    }
+}
+
+unsigned int PreRollCount(PreRoll *p)
+{
+    return p->tail - p->head;
+}
+
+int PreRollCopy(PreRoll *p, SendItem *items, unsigned int nTsBase)
+{
+    unsigned int i;
+    int n = 0;
+    for (i = p->head; i != p->tail; i++, n++)
+    {
+        items[n] = *PREROLL_ITEM(p, i);
+        items[n].timestamp -= nTsBase;
+        RefFrameBuf(items[n].pFrame);
+    }
+    return n;
+}
+
+unsigned int PreRollFirstTs(PreRoll *p)
+{
+    return p->head == p->tail ? 0 : PREROLL_ITEM(p, p->head)->timestamp;
+}
+
+void GetPreRollStats(PreRoll *p, long long *stats)
+{
+    stats[PREROLL_STAT_DURATION] = p->head == p->tail ? 0
+            : PREROLL_ITEM(p, p->tail - 1)->timestamp - PreRollFirstTs(p);
+    stats[PREROLL_STAT_FRAMES] = p->tail - p->head;
+    stats[PREROLL_STAT_BYTES] = p->nBytes;
+}
@@ -0,0 +1,48 @@
+#ifndef __PREROLL_H
+#define __PREROLL_H
+
+#include "platform.h"
+#include "framebuf.h"
+#include "sendqueue.h"
+
+#define PREROLL_MAX_FRAMES  1024 //必须是2的幂
+#define PREROLL_MAX_BYTES   (4 * 1024 * 1024) //默认的内存上限
+
+//最近一段时间已打包的帧，总是从关键帧开始，按整个GOP 淘汰。
+//只持有帧缓冲区的引用，和其它输出共享数据，内存按缓冲区容量计算
+typedef struct PreRoll
+{
+    SendItem items[PREROLL_MAX_FRAMES];
+    unsigned int head;
+    unsigned int tail;
+    unsigned int nDuration; //ms，保留的GOP 至少覆盖这么长
+    unsigned int nMaxBytes;
+    unsigned int nBytes;
+} PreRoll;
+
+//修改时长和内存上限，已有的帧在下一次PreRollPush 时按新的限制淘汰
+void SetPreRoll(PreRoll *p, unsigned int nDuration, unsigned int nMaxBytes);
+
+//增加f 的引用。第一帧必须是关键帧，之前的帧忽略
+void PreRollPush(PreRoll *p, FrameBuf *f, unsigned int timestamp,
+                 unsigned int flags);
+
+unsigned int PreRollCount(PreRoll *p);
+
+//按顺序复制出所有帧，每个增加一个引用，时间戳减去nTsBase，返回个数
+int PreRollCopy(PreRoll *p, SendItem *items, unsigned int nTsBase);
+
+//第一帧的时间戳，没有帧时返回0
+unsigned int PreRollFirstTs(PreRoll *p);
+
+//GetPreRollStats 的下标
+#define PREROLL_STAT_DURATION  0 //第一帧到最后一帧，ms
+#define PREROLL_STAT_FRAMES    1
+#define PREROLL_STAT_BYTES     2 //按缓冲区的容量计算
+#define PREROLL_STATS_COUNT    3
+
+void GetPreRollStats(PreRoll *p, long long *stats);
+
+void ClearPreRoll(PreRoll *p);
+
+#endif
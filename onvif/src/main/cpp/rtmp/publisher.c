@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "publisher.h"
+
+static pthread_once_t m_PublisherOnce = PTHREAD_ONCE_INIT;
+
+static Publisher *m_Publishers[PUBLISHER_LOOPS];
+
+static int m_PublisherIndex = 0;
+
+static unsigned long long MakeToken(Publisher *p, int slot)
+{
+    return ((unsigned long long) p->gens[slot] << 32) | (unsigned int) slot;
+}
+
+//调用者持有p->mutex，连接已经删除时返回NULL
+static SendQueue *GetConnByToken(Publisher *p, unsigned long long token)
+{
+    int slot = (int) (token & 0xffffffff);
+    if (slot < 0 || slot >= PUBLISHER_MAX_CONN
+            || p->gens[slot] != (unsigned int) (token >> 32))
+        return NULL;
+    return p->conns[slot];
+}
+
+//服务器发来的数据读掉，ack 用来估计速率，其它丢弃，避免接收窗口填满
+static void DrainInput(SendQueue *q)
+{
+    if (!CongestionReadInput(&q->cc, q->fd))
+    {
+        LOGE("RTMP connection closed by server! fd:%d\n", q->fd);
+        q->bBroken = TRUE;
+    }
+}
+
+static void ClearDeferred(Publisher *p, int slot)
+{
+    if (p->bDeferred[slot])
+    {
+        p->bDeferred[slot] = FALSE;
+        p->nDeferred--;
+    }
+}
+
+//发送，被限速时记下到期时间
+static void FlushConn(Publisher *p, SendQueue *q)
+{
+    int slot = q->nPublisherSlot;
+    int wait = SendQueueFlush(q);
+
+    if (wait < 0)
+    {
+        ClearDeferred(p, slot);
+        return;
+    }
+    if (!p->bDeferred[slot])
+    {
+        p->bDeferred[slot] = TRUE;
+        p->nDeferred++;
+    }
+    p->deadline[slot] = GetTickMs() + wait;
+}
+
+//发送已经到期的限速连接，返回epoll_wait 的超时
+static int FlushDeferred(Publisher *p)
+{
+    unsigned int now;
+    int slot, left, timeout = -1;
+
+    if (p->nDeferred == 0)
+        return -1;
+    now = GetTickMs();
+    for (slot = 0; slot < PUBLISHER_MAX_CONN; slot++)
+    {
+        if (!p->bDeferred[slot])
+            continue;
+        left = (int) (p->deadline[slot] - now);
+        if (left <= 0)
+        {
+            FlushConn(p, p->conns[slot]);
+            if (!p->bDeferred[slot])
+                continue;
+            left = (int) (p->deadline[slot] - now);
+        }
+        if (timeout < 0 || left < timeout)
+            timeout = left;
+    }
+    return timeout;
+}
+
+static void *PublisherThread(void *arg)
+{
+    Publisher *p = (Publisher *) arg;
+    struct epoll_event events[64];
+    unsigned long long ready[PUBLISHER_MAX_CONN];
+    unsigned long long value;
+    SendQueue *q;
+    int i, j, n, nReady, timeout;
+
+    while (TRUE)
+    {
+        pthread_mutex_lock(&p->mutex);
+        timeout = FlushDeferred(p);
+        pthread_mutex_unlock(&p->mutex);
+        n = epoll_wait(p->epfd, events, 64, timeout);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOGE("epoll_wait error! errno:%d\n", errno);
+            break;
+        }
+
+        pthread_mutex_lock(&p->mutex);
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.u64 == PUBLISHER_WAKE)
+            {
+                if (read(p->evfd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                    LOGE("eventfd read error! errno:%d\n", errno);
+                pthread_mutex_lock(&p->readyLock);
+                nReady = p->nReady;
+                memcpy(ready, p->ready, nReady * sizeof(ready[0]));
+                p->nReady = 0;
+                pthread_mutex_unlock(&p->readyLock);
+                for (j = 0; j < nReady; j++)
+                {
+                    q = GetConnByToken(p, ready[j]);
+                    if (q)
+                        FlushConn(p, q);
+                }
+                continue;
+            }
+
+            q = GetConnByToken(p, events[i].data.u64);
+            if (q == NULL)
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                DrainInput(q);
+            FlushConn(p, q);
+        }
+        pthread_mutex_unlock(&p->mutex);
+    }
+    return NULL;
+}
+
+static void InitPublishers(void)
+{
+    int i;
+    struct epoll_event ev;
+    Publisher *p;
+
+    for (i = 0; i < PUBLISHER_LOOPS; i++)
+    {
+        p = (Publisher *) calloc(1, sizeof(Publisher));
+        if (!p)
+        {
+            LOGE("Alloc Publisher error!");
+            return;
+        }
+        p->epfd = epoll_create1(EPOLL_CLOEXEC);
+        p->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (p->epfd < 0 || p->evfd < 0)
+        {
+            LOGE("Create epoll error! errno:%d", errno);
+            if (p->epfd >= 0)
+                close(p->epfd);
+            if (p->evfd >= 0)
+                close(p->evfd);
+            free(p);
+            return;
+        }
+        pthread_mutex_init(&p->mutex, NULL);
+        pthread_mutex_init(&p->readyLock, NULL);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = PUBLISHER_WAKE;
+        epoll_ctl(p->epfd, EPOLL_CTL_ADD, p->evfd, &ev);
+
+        if (pthread_create(&p->thread, NULL, PublisherThread, p) != 0)
+        {
+            LOGE("Create publisher thread error!");
+            close(p->epfd);
+            close(p->evfd);
+            pthread_mutex_destroy(&p->mutex);
+            pthread_mutex_destroy(&p->readyLock);
+            free(p);
+            return;
+        }
+        pthread_detach(p->thread);
+        m_Publishers[i] = p;
+    }
+}
+
+BOOL AddPublisher(SendQueue *q)
+{
+    Publisher *p;
+    struct epoll_event ev;
+    int slot, flags;
+    RTMP *pRtmp = q->pRtmp;
+
+    if (pRtmp->Link.protocol & (RTMP_FEATURE_HTTP | RTMP_FEATURE_SSL))
+    {
+        LOGE("Publisher not support rtmpt/rtmps!");
+        return FALSE;
+    }
+
+    pthread_once(&m_PublisherOnce, InitPublishers);
+    p = m_Publishers[(unsigned int) __atomic_fetch_add(&m_PublisherIndex, 1,
+                     __ATOMIC_RELAXED) % PUBLISHER_LOOPS];
+    if (p == NULL)
+        return FALSE;
+
+    q->fd = pRtmp->m_sb.sb_socket;
+    flags = fcntl(q->fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(q->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        LOGE("Set socket nonblock error! errno:%d", errno);
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&p->mutex);
+    for (slot = 0; slot < PUBLISHER_MAX_CONN; slot++)
+        if (p->conns[slot] == NULL)
+            break;
+    if (slot == PUBLISHER_MAX_CONN)
+    {
+        pthread_mutex_unlock(&p->mutex);
+        fcntl(q->fd, F_SETFL, flags);
+        LOGE("Publisher full!");
+        return FALSE;
+    }
+    p->conns[slot] = q;
+    //生产者在q->mutex 下读pPublisher
+    pthread_mutex_lock(&q->mutex);
+    q->pPublisher = p;
+    q->nPublisherSlot = slot;
+    q->bReady = FALSE;
+    pthread_mutex_unlock(&q->mutex);
+
+    //边沿触发，写满后等EPOLLOUT 再继续
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.u64 = MakeToken(p, slot);
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, q->fd, &ev) < 0)
+    {
+        LOGE("epoll_ctl add error! errno:%d", errno);
+        p->conns[slot] = NULL;
+        pthread_mutex_lock(&q->mutex);
+        q->pPublisher = NULL;
+        pthread_mutex_unlock(&q->mutex);
+        pthread_mutex_unlock(&p->mutex);
+        fcntl(q->fd, F_SETFL, flags);
+        return FALSE;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return TRUE;
+}
+
+void WakePublisher(SendQueue *q)
+{
+    //调用者持有q->mutex，pPublisher 和slot 不会变
+    Publisher *p = q->pPublisher;
+    unsigned long long value = 1;
+
+    //已经在等待发送的队列不用重复通知
+    if (__atomic_exchange_n(&q->bReady, TRUE, __ATOMIC_SEQ_CST))
+        return;
+    pthread_mutex_lock(&p->readyLock);
+    p->ready[p->nReady++] = MakeToken(p, q->nPublisherSlot);
+    pthread_mutex_unlock(&p->readyLock);
+    if (write(p->evfd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        LOGE("eventfd write error! errno:%d\n", errno);
+}
+
+void RemovePublisher(SendQueue *q)
+{
+    Publisher *p = q->pPublisher;
+    int i, j, slot = q->nPublisherSlot;
+    int flags;
+
+    if (p == NULL)
+        return;
+
+    pthread_mutex_lock(&p->mutex);
+    epoll_ctl(p->epfd, EPOLL_CTL_DEL, q->fd, NULL);
+    p->conns[slot] = NULL;
+    ClearDeferred(p, slot);
+    pthread_mutex_lock(&q->mutex);
+    p->gens[slot]++;
+    q->pPublisher = NULL;
+    pthread_mutex_unlock(&q->mutex);
+    //去掉还没处理的唤醒，保证ready 不会超过PUBLISHER_MAX_CONN
+    pthread_mutex_lock(&p->readyLock);
+    for (i = 0, j = 0; i < p->nReady; i++)
+        if ((int) (p->ready[i] & 0xffffffff) != slot)
+            p->ready[j++] = p->ready[i];
+    p->nReady = j;
+    pthread_mutex_unlock(&p->readyLock);
+    pthread_mutex_unlock(&p->mutex);
+
+    //RTMP_Close 还要用阻塞方式发送deleteStream
+    flags = fcntl(q->fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(q->fd, F_SETFL, flags & ~O_NONBLOCK);
+}
@@ -0,0 +1,40 @@
+#ifndef __PUBLISHER_H
+#define __PUBLISHER_H
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "sendqueue.h"
+
+#define PUBLISHER_LOOPS     2 //epoll 线程数
+#define PUBLISHER_MAX_CONN  256 //每个epoll 线程最多的连接数
+#define PUBLISHER_WAKE      (~0ULL) //eventfd 在epoll 中的标记
+
+//一个epoll 线程，负责多个非阻塞RTMP 连接的发送
+typedef struct Publisher
+{
+    int epfd;
+    int evfd; //生产者提交后通过eventfd 唤醒
+    pthread_t thread;
+    pthread_mutex_t mutex; //保护conns，处理事件期间持有
+    SendQueue *conns[PUBLISHER_MAX_CONN];
+    unsigned int gens[PUBLISHER_MAX_CONN]; //slot 重用后旧的事件和唤醒失效
+    pthread_mutex_t readyLock;
+    unsigned long long ready[PUBLISHER_MAX_CONN]; //有新数据的连接
+    int nReady;
+    //被令牌桶限速的连接，到时间后再发送，只由epoll 线程在mutex 下访问
+    BOOL bDeferred[PUBLISHER_MAX_CONN];
+    unsigned int deadline[PUBLISHER_MAX_CONN];
+    int nDeferred;
+} Publisher;
+
+//把q 的socket 设为非阻塞并加入一个epoll 线程，SSL/HTTP 连接不支持
+BOOL AddPublisher(SendQueue *q);
+
+//生产者提交后在q->mutex 下调用，通知epoll 线程发送
+void WakePublisher(SendQueue *q);
+
+//返回后epoll 线程不会再访问q，socket 恢复为阻塞
+void RemovePublisher(SendQueue *q);
+
+#endif
@@ -0,0 +1,584 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "congestion.h"
+#include "relay.h"
+
+#define RELAY_MAX_READ_ERROR  3 //连续读失败次数，超过后停止转发
+
+//转发线程池。每个转发一次处理一帧，处理完放回队尾，同一路同时只在一个线程中处理。
+//av_read_frame 是阻塞的，线程数随转发路数增加，最多RELAY_MAX_WORKERS 个
+typedef struct
+{
+    int jobs[RELAY_JOB_SIZE];
+    unsigned int head;
+    unsigned int tail;
+    int nJobs; //已占用的位置，包括已停止还没取出的id
+    int nWorkers;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} RelayPool;
+
+//原生RTSP 拉流的epoll 线程，socket 可读时读一次，解析出的帧直接打包发送。
+//事件带的是转发id，转发删除后旧的事件找不到对象
+typedef struct
+{
+    int epfd;
+    pthread_t thread;
+    pthread_mutex_t mutex; //保护ids
+    int ids[RELAY_JOB_SIZE];
+    int nIds;
+} RtspLoop;
+
+static pthread_once_t m_RelayOnce = PTHREAD_ONCE_INIT;
+
+static pthread_once_t m_RtspLoopOnce = PTHREAD_ONCE_INIT;
+
+static RtspLoop *m_RtspLoops[RELAY_RTSP_LOOPS];
+
+static int m_RtspLoopIndex = 0;
+
+static HandleTable *m_RelayTable = NULL;
+
+static RelayPool m_Pool;
+
+static int m_RelayIdIndex = 0;
+
+static BOOL FreeRelay(void *pObject)
+{
+    RelayNode *r = (RelayNode *) pObject;
+    if (r)
+    {
+        if (r->pAVFormat)
+            PutAVFormat(r->pAVFormatTable, r->pAVFormat);
+        if (r->pRtmpNode)
+            PutRtmpNode(r->pRtmpNodeTable, r->pRtmpNode);
+        if (r->pGroup)
+            PutGroup(r->pGroup);
+        //关闭socket 时自动从epoll 中删除
+        if (r->pRtsp)
+            RtspClientClose(r->pRtsp);
+        free(r);
+    }
+    return TRUE;
+}
+
+static void InitRelay(void)
+{
+    InitHandleTable(&m_RelayTable, FreeRelay);
+    pthread_mutex_init(&m_Pool.mutex, NULL);
+    pthread_cond_init(&m_Pool.cond, NULL);
+}
+
+static void PushJob(int id)
+{
+    pthread_mutex_lock(&m_Pool.mutex);
+    m_Pool.jobs[m_Pool.tail++ & (RELAY_JOB_SIZE - 1)] = id;
+    pthread_cond_signal(&m_Pool.cond);
+    pthread_mutex_unlock(&m_Pool.mutex);
+}
+
+//第一帧之前发送metadata 和sequence header，sps/pps 优先取SDP 中的extradata。
+//两处都取不出(没有或者超过RTMPMetadata 的缓冲)时返回FALSE，这个关键帧不发送
+static BOOL RelaySendSpsPps(RelayNode *r, char *data, int size)
+{
+    AVStream *st;
+    RtmpNode *pRtmpNode = r->pRtmpNode;
+    char *extradata;
+    int extradataSize, width, height, rate = 25;
+
+    if (r->pRtsp)
+    {
+        extradata = (char *) r->pRtsp->sprop;
+        extradataSize = r->pRtsp->spropSize;
+        width = r->pRtsp->width;
+        height = r->pRtsp->height;
+        if (r->pRtsp->rate > 0)
+            rate = r->pRtsp->rate;
+    }
+    else
+    {
+        st = r->pAVFormat->pFormatCtx->streams[r->pAVFormat->videoindex];
+        extradata = (char *) st->codecpar->extradata;
+        extradataSize = st->codecpar->extradata_size;
+        width = st->codecpar->width;
+        height = st->codecpar->height;
+        if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0)
+            rate = (st->avg_frame_rate.num + st->avg_frame_rate.den / 2)
+                   / st->avg_frame_rate.den;
+        else if (st->r_frame_rate.num > 0 && st->r_frame_rate.den > 0)
+            rate = (st->r_frame_rate.num + st->r_frame_rate.den / 2)
+                   / st->r_frame_rate.den;
+    }
+
+    if (r->pGroup)
+        return (extradataSize > 0
+                && GroupSendSpsPps(r->pGroup, extradata, extradataSize, width,
+                                   height, rate))
+               || GroupSendSpsPps(r->pGroup, data, size, width, height, rate);
+
+    if (!(extradataSize > 0
+            && SendSpsPps(pRtmpNode->m_pSendQueue, extradata, extradataSize,
+                          width, height, rate, &pRtmpNode->m_Codec))
+            && !SendSpsPps(pRtmpNode->m_pSendQueue, data, size, width, height,
+                           rate, &pRtmpNode->m_Codec))
+        return FALSE;
+
+    pRtmpNode->width = width;
+    pRtmpNode->height = height;
+    pRtmpNode->rate = rate;
+    pRtmpNode->m_SendSpsPps = TRUE;
+    return TRUE;
+}
+
+//打包发送一个访问单元，tick 为源的时间戳(ms)
+static void RelayWriteFrame(RelayNode *r, char *data, int size, int tick, BOOL bKey)
+{
+    pthread_mutex_t *pWriteLock;
+
+    pWriteLock = r->pGroup ? &r->pGroup->m_WriteLock : &r->pRtmpNode->m_WriteLock;
+    pthread_mutex_lock(pWriteLock);
+    //从第一个关键帧开始转发
+    if (!r->bStarted && bKey)
+    {
+        if (RelaySendSpsPps(r, data, size))
+        {
+            r->bStarted = TRUE;
+            r->nFirstTick = tick;
+        }
+        else
+        {
+            LOGE("Relay %d: no usable sps/pps, drop keyframe", r->id);
+            __atomic_fetch_add(&r->nPackError, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (r->bStarted)
+    {
+        tick -= r->nFirstTick;
+        if (tick < 0)
+            tick = 0;
+        if (r->pGroup ? GroupAnnexH264(r->pGroup, data, size, tick)
+                : AnnexH264(r->pRtmpNode, data, size, tick))
+        {
+            __atomic_fetch_add(&r->nFrames, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&r->nBytes, size, __ATOMIC_RELAXED);
+            __atomic_store_n(&r->nLastTick, tick, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_fetch_add(&r->nPackError, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(pWriteLock);
+}
+
+//转发一帧，返回FALSE 表示这一路停止
+static BOOL RelayOnce(RelayNode *r)
+{
+    AVPacket packet;
+    BOOL bRet;
+
+    pthread_mutex_lock(&r->pAVFormat->m_ReadLock);
+    bRet = ReadVideoPacket(r->pAVFormat, &packet);
+    pthread_mutex_unlock(&r->pAVFormat->m_ReadLock);
+    if (!bRet)
+    {
+        LOGE("Relay read error! id:%d\n", r->id);
+        __atomic_fetch_add(&r->nReadError, 1, __ATOMIC_RELAXED);
+        return ++r->nReadErrorRun < RELAY_MAX_READ_ERROR;
+    }
+    r->nReadErrorRun = 0;
+
+    RelayWriteFrame(r, (char *) packet.data, packet.size,
+                    GetPacketTick(r->pAVFormat, &packet),
+                    (packet.flags & AV_PKT_FLAG_KEY) != 0);
+
+    av_packet_unref(&packet);
+    return TRUE;
+}
+
+static void *RelayWorker(void *arg)
+{
+    int id, slot;
+    RelayNode *r;
+    BOOL bContinue;
+
+    while (TRUE)
+    {
+        pthread_mutex_lock(&m_Pool.mutex);
+        while (m_Pool.head == m_Pool.tail)
+            pthread_cond_wait(&m_Pool.cond, &m_Pool.mutex);
+        id = m_Pool.jobs[m_Pool.head++ & (RELAY_JOB_SIZE - 1)];
+        pthread_mutex_unlock(&m_Pool.mutex);
+
+        bContinue = FALSE;
+        if (HandleTableAcquire(m_RelayTable, id, (void **) &r, &slot))
+        {
+            bContinue = __atomic_load_n(&r->bRunning, __ATOMIC_ACQUIRE)
+                        && RelayOnce(r);
+            if (!bContinue)
+                __atomic_store_n(&r->bRunning, FALSE, __ATOMIC_RELEASE);
+            HandleTableRelease(m_RelayTable, slot);
+        }
+
+        if (bContinue)
+        {
+            PushJob(id);
+        }
+        else
+        {
+            pthread_mutex_lock(&m_Pool.mutex);
+            m_Pool.nJobs--;
+            pthread_mutex_unlock(&m_Pool.mutex);
+        }
+    }
+    return NULL;
+}
+
+static void RelayRtspFrame(void *ctx, RtspFrame *frame)
+{
+    RelayNode *r = (RelayNode *) ctx;
+    RelayWriteFrame(r, (char *) frame->data, frame->size, frame->tick, frame->bKey);
+}
+
+//只在epoll 线程中调用，不再读这一路，对象等stopRelay 时释放
+static void StopRtspRead(RtspLoop *l, RelayNode *r)
+{
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, r->pRtsp->fd, NULL);
+    __atomic_fetch_add(&r->nReadError, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->bRunning, FALSE, __ATOMIC_RELEASE);
+    LOGI("Rtsp relay stopped! id:%d lost:%u drop:%u\n", r->id, r->pRtsp->nLost,
+         r->pRtsp->nDropAu);
+}
+
+//保活和读取超时，去掉已经删除或停止的转发
+static void CheckRtspRelays(RtspLoop *l)
+{
+    unsigned int now = GetTickMs();
+    RelayNode *r;
+    BOOL bKeep;
+    int i, j, id, slot;
+
+    pthread_mutex_lock(&l->mutex);
+    for (i = 0, j = 0; i < l->nIds; i++)
+    {
+        id = l->ids[i];
+        bKeep = FALSE;
+        if (HandleTableAcquire(m_RelayTable, id, (void **) &r, &slot))
+        {
+            if (__atomic_load_n(&r->bRunning, __ATOMIC_ACQUIRE))
+            {
+                if (r->nReadTimeout > 0
+                        && (int) (now - r->pRtsp->lastRecv) > r->nReadTimeout)
+                {
+                    LOGE("Rtsp relay read timeout! id:%d\n", id);
+                    StopRtspRead(l, r);
+                }
+                else if (!RtspClientKeepAlive(r->pRtsp))
+                {
+                    LOGE("Rtsp relay keepalive error! id:%d\n", id);
+                    StopRtspRead(l, r);
+                }
+            }
+            bKeep = __atomic_load_n(&r->bRunning, __ATOMIC_ACQUIRE);
+            HandleTableRelease(m_RelayTable, slot);
+        }
+        if (bKeep)
+            l->ids[j++] = id;
+    }
+    l->nIds = j;
+    pthread_mutex_unlock(&l->mutex);
+}
+
+static void *RtspLoopThread(void *arg)
+{
+    RtspLoop *l = (RtspLoop *) arg;
+    struct epoll_event events[64];
+    unsigned int lastCheck = GetTickMs();
+    RelayNode *r;
+    int i, n, slot;
+
+    while (TRUE)
+    {
+        n = epoll_wait(l->epfd, events, 64, RELAY_RTSP_CHECK_MS);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOGE("epoll_wait error! errno:%d\n", errno);
+            break;
+        }
+        //水平触发，每路每次只读一次，路数多时轮流读
+        for (i = 0; i < n; i++)
+        {
+            if (!HandleTableAcquire(m_RelayTable, (int) events[i].data.u64,
+                                    (void **) &r, &slot))
+                continue;
+            if (__atomic_load_n(&r->bRunning, __ATOMIC_ACQUIRE)
+                    && !RtspClientRead(r->pRtsp, RelayRtspFrame, r))
+                StopRtspRead(l, r);
+            HandleTableRelease(m_RelayTable, slot);
+        }
+        if ((int) (GetTickMs() - lastCheck) >= RELAY_RTSP_CHECK_MS)
+        {
+            lastCheck = GetTickMs();
+            CheckRtspRelays(l);
+        }
+    }
+    return NULL;
+}
+
+static void InitRtspLoops(void)
+{
+    RtspLoop *l;
+    int i;
+
+    for (i = 0; i < RELAY_RTSP_LOOPS; i++)
+    {
+        l = (RtspLoop *) calloc(1, sizeof(RtspLoop));
+        if (!l)
+        {
+            LOGE("Alloc RtspLoop error!");
+            return;
+        }
+        l->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (l->epfd < 0)
+        {
+            LOGE("Create epoll error! errno:%d", errno);
+            free(l);
+            return;
+        }
+        pthread_mutex_init(&l->mutex, NULL);
+        if (pthread_create(&l->thread, NULL, RtspLoopThread, l) != 0)
+        {
+            LOGE("Create rtsp loop thread error!");
+            close(l->epfd);
+            pthread_mutex_destroy(&l->mutex);
+            free(l);
+            return;
+        }
+        pthread_detach(l->thread);
+        m_RtspLoops[i] = l;
+    }
+}
+
+static RelayNode *NewRelay(void)
+{
+    RelayNode *r;
+
+    pthread_once(&m_RelayOnce, InitRelay);
+    if (!m_RelayTable)
+        return NULL;
+
+    r = (RelayNode *) calloc(1, sizeof(RelayNode));
+    if (!r)
+    {
+        LOGE("Alloc Relay error!");
+        return NULL;
+    }
+    r->id = __atomic_fetch_add(&m_RelayIdIndex, 1, __ATOMIC_RELAXED);
+    r->camId = -1;
+    r->serId = -1;
+    r->groupId = -1;
+    r->bRunning = TRUE;
+    return r;
+}
+
+static RelayNode *AllocRelay(HandleTable *pAVFormatTable, int camId)
+{
+    RelayNode *r = NewRelay();
+    if (!r)
+        return NULL;
+    r->camId = camId;
+    r->pAVFormatTable = pAVFormatTable;
+    if (!GetAVFormatById(pAVFormatTable, &r->pAVFormat, camId))
+    {
+        FreeRelay(r);
+        return NULL;
+    }
+    return r;
+}
+
+//打开RTSP 并加入epoll 线程，失败时释放r
+static int AddRtspRelay(RelayNode *r, const char *url, int openTimeout,
+                        int readTimeout)
+{
+    RtspLoop *l;
+    struct epoll_event ev;
+
+    pthread_once(&m_RtspLoopOnce, InitRtspLoops);
+    l = m_RtspLoops[(unsigned int) __atomic_fetch_add(&m_RtspLoopIndex, 1,
+                    __ATOMIC_RELAXED) % RELAY_RTSP_LOOPS];
+    if (l == NULL
+            || !RtspClientOpen(&r->pRtsp, url,
+                               openTimeout > 0 ? openTimeout : AVFORMAT_OPEN_TIMEOUT_MS))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+    r->nReadTimeout = readTimeout;
+    if (!HandleTableInsert(m_RelayTable, r->id, r, &r->slot))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+
+    pthread_mutex_lock(&l->mutex);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (unsigned int) r->id;
+    if (l->nIds >= RELAY_JOB_SIZE || epoll_ctl(l->epfd, EPOLL_CTL_ADD, r->pRtsp->fd, &ev) < 0)
+    {
+        pthread_mutex_unlock(&l->mutex);
+        LOGE("Add rtsp relay error! errno:%d", errno);
+        HandleTableRemove(m_RelayTable, r->id);
+        return -1;
+    }
+    l->ids[l->nIds++] = r->id;
+    pthread_mutex_unlock(&l->mutex);
+    return r->id;
+}
+
+//放进线程池开始转发，失败时释放r
+static int AddRelay(RelayNode *r)
+{
+    pthread_t thread;
+
+    pthread_mutex_lock(&m_Pool.mutex);
+    if (m_Pool.nJobs >= RELAY_JOB_SIZE)
+    {
+        pthread_mutex_unlock(&m_Pool.mutex);
+        LOGE("Too many relays!");
+        FreeRelay(r);
+        return -1;
+    }
+    m_Pool.nJobs++;
+    if (m_Pool.nWorkers < m_Pool.nJobs && m_Pool.nWorkers < RELAY_MAX_WORKERS)
+    {
+        if (pthread_create(&thread, NULL, RelayWorker, NULL) == 0)
+        {
+            pthread_detach(thread);
+            m_Pool.nWorkers++;
+        }
+        else if (m_Pool.nWorkers == 0)
+        {
+            m_Pool.nJobs--;
+            pthread_mutex_unlock(&m_Pool.mutex);
+            LOGE("Create relay worker error!");
+            FreeRelay(r);
+            return -1;
+        }
+    }
+    pthread_mutex_unlock(&m_Pool.mutex);
+
+    if (!HandleTableInsert(m_RelayTable, r->id, r, &r->slot))
+    {
+        pthread_mutex_lock(&m_Pool.mutex);
+        m_Pool.nJobs--;
+        pthread_mutex_unlock(&m_Pool.mutex);
+        FreeRelay(r);
+        return -1;
+    }
+    PushJob(r->id);
+    return r->id;
+}
+
+int StartRelay(HandleTable *pAVFormatTable, HandleTable *pRtmpNodeTable,
+               int camId, int serId)
+{
+    RelayNode *r = AllocRelay(pAVFormatTable, camId);
+    if (!r)
+        return -1;
+    r->serId = serId;
+    r->pRtmpNodeTable = pRtmpNodeTable;
+    if (!GetRtmpNodeById(pRtmpNodeTable, &r->pRtmpNode, serId))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+    return AddRelay(r);
+}
+
+int StartGroupRelay(HandleTable *pAVFormatTable, int camId, int groupId)
+{
+    RelayNode *r = AllocRelay(pAVFormatTable, camId);
+    if (!r)
+        return -1;
+    r->groupId = groupId;
+    if (!GetGroupById(&r->pGroup, groupId))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+    return AddRelay(r);
+}
+
+int StartRtspRelay(HandleTable *pRtmpNodeTable, const char *url, int serId,
+                   int openTimeout, int readTimeout)
+{
+    RelayNode *r = NewRelay();
+    if (!r)
+        return -1;
+    r->serId = serId;
+    r->pRtmpNodeTable = pRtmpNodeTable;
+    if (!GetRtmpNodeById(pRtmpNodeTable, &r->pRtmpNode, serId))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+    return AddRtspRelay(r, url, openTimeout, readTimeout);
+}
+
+int StartRtspGroupRelay(const char *url, int groupId, int openTimeout,
+                        int readTimeout)
+{
+    RelayNode *r = NewRelay();
+    if (!r)
+        return -1;
+    r->groupId = groupId;
+    if (!GetGroupById(&r->pGroup, groupId))
+    {
+        FreeRelay(r);
+        return -1;
+    }
+    return AddRtspRelay(r, url, openTimeout, readTimeout);
+}
+
+BOOL StopRelay(int id)
+{
+    pthread_once(&m_RelayOnce, InitRelay);
+    //正在处理这一路的线程处理完当前帧后释放
+    return HandleTableRemove(m_RelayTable, id);
+}
+
+BOOL GetRelayStats(int id, long long *stats)
+{
+    int slot;
+    RelayNode *r;
+    SendQueue *q;
+
+    pthread_once(&m_RelayOnce, InitRelay);
+    if (!HandleTableAcquire(m_RelayTable, id, (void **) &r, &slot))
+        return FALSE;
+    stats[0] = __atomic_load_n(&r->nFrames, __ATOMIC_RELAXED);
+    stats[1] = __atomic_load_n(&r->nBytes, __ATOMIC_RELAXED);
+    stats[2] = __atomic_load_n(&r->nReadError, __ATOMIC_RELAXED);
+    stats[3] = __atomic_load_n(&r->nPackError, __ATOMIC_RELAXED);
+    stats[4] = __atomic_load_n(&r->nLastTick, __ATOMIC_RELAXED);
+    if (r->pGroup)
+    {
+        GetGroupQueueStats(r->pGroup, stats + 5);
+    }
+    else
+    {
+        q = r->pRtmpNode->m_pSendQueue;
+        stats[5] = SendQueueDepth(q);
+        stats[6] = __atomic_load_n(&q->nDropNonRef, __ATOMIC_RELAXED);
+        stats[7] = __atomic_load_n(&q->nDropGop, __ATOMIC_RELAXED);
+        stats[8] = __atomic_load_n(&q->nSendError, __ATOMIC_RELAXED);
+    }
+    stats[9] = __atomic_load_n(&r->bRunning, __ATOMIC_ACQUIRE);
+    HandleTableRelease(m_RelayTable, slot);
+    return TRUE;
+}
@@ -0,0 +1,66 @@
+#ifndef __RELAY_H
+#define __RELAY_H
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "data.h"
+#include "group.h"
+#include "packer.h"
+#include "rtspclient.h"
+
+#define RELAY_MAX_WORKERS  32
+#define RELAY_JOB_SIZE     256 //必须是2的幂，同时也是最多的转发路数
+
+#define RELAY_RTSP_LOOPS     2 //原生RTSP 拉流的epoll 线程数，每个线程最多RELAY_JOB_SIZE 路
+#define RELAY_RTSP_CHECK_MS  1000 //检查保活和读取超时的间隔
+
+//一路摄像头到RTMP 服务器或者一个输出组的转发，帧数据不经过Java
+typedef struct Relay
+{
+    int id;
+    int slot;
+    int camId;
+    int serId;
+    int groupId;
+    HandleTable *pAVFormatTable;
+    HandleTable *pRtmpNodeTable;
+    AVFormatNode *pAVFormat; //转发期间持有引用
+    RtmpNode *pRtmpNode; //转发期间持有引用，发到组时为NULL
+    GroupNode *pGroup; //转发期间持有引用
+    RtspClient *pRtsp; //原生RTSP 拉流时由转发所有，这时pAVFormat 为NULL
+    int nReadTimeout; //ms，原生RTSP 没有数据超过这么久停止，<=0 不超时
+    BOOL bRunning;
+    BOOL bStarted; //已经发过sps/pps
+    int nFirstTick; //第一帧的时间戳，之后的时间戳从0 开始
+    unsigned int nFrames;
+    unsigned long long nBytes;
+    unsigned int nReadError;
+    int nReadErrorRun; //连续读失败次数
+    unsigned int nPackError;
+    int nLastTick;
+} RelayNode;
+
+//摄像头和RTMP 连接已经通过initCamStream/connectRtmpSer 建立，返回转发id，失败返回-1
+int StartRelay(HandleTable *pAVFormatTable, HandleTable *pRtmpNodeTable,
+               int camId, int serId);
+
+//转发到createGroup 创建的输出组
+int StartGroupRelay(HandleTable *pAVFormatTable, int camId, int groupId);
+
+//不经过initCamStream 和libavformat，用原生RTSP 客户端(RTP over TCP)拉流，
+//由epoll 线程非阻塞读取转发。打开是阻塞的，openTimeout<=0 时用默认值
+int StartRtspRelay(HandleTable *pRtmpNodeTable, const char *url, int serId,
+                   int openTimeout, int readTimeout);
+
+int StartRtspGroupRelay(const char *url, int groupId, int openTimeout,
+                        int readTimeout);
+
+BOOL StopRelay(int id);
+
+//stats: 帧数，字节数，读错误，打包错误，最后时间戳，队列深度，丢非参考帧，丢GOP，发送错误，是否在运行。
+//转发到组时队列深度取所有输出的最大值，丢帧和错误取总和
+#define RELAY_STATS_COUNT  10
+BOOL GetRelayStats(int id, long long *stats);
+
+#endif
@@ -24,273 +24,194 @@
 
 #include "video.h"
 
-int FLV_CODECID_H264 = 7;
+#include "relay.h"
 
-BOOL m_FFmpeg_Inited = FALSE;
+#include "group.h"
 
-AVFormatQueue *m_AVFormatQueue = NULL;
+#include "logger.h"
 
-RtmpNodeQueue *m_RtmpNodeQueue = NULL;
+//getH264StreamBatch/annexH264Batch 的buffer 布局，和Onvif.java 中的常量一致
+#define H264_BATCH_HEADER_SIZE  8
+#define H264_BATCH_ENTRY_SIZE   16
+#define H264_BATCH_FLAG_KEY     0x01
 
-int m_SerIdIndex = 0;
+pthread_once_t m_FFmpeg_Once = PTHREAD_ONCE_INIT;
 
-//Output FFmpeg's av_log()
-void custom_log(void *ptr, int level, const char* fmt, va_list vl)
-{
+HandleTable *m_AVFormatTable = NULL;
 
-    //To TXT file
-    FILE *fp = fopen("/storage/emulated/0/av_log.txt", "a+");
-    if (fp)
-    {
-        vfprintf(fp, fmt, vl);
-        fflush(fp);
-        fclose(fp);
-    }
+HandleTable *m_RtmpNodeTable = NULL;
 
-    //To Logcat
-    //LOGE(fmt, vl);
-}
+int m_SerIdIndex = 0;
 
-char * put_byte(char *output, uint8_t nVal)
-{
-    output[0] = nVal;
-    return output + 1;
-}
-char * put_be16(char *output, uint16_t nVal)
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved)
 {
-    output[1] = nVal & 0xff;
-    output[0] = nVal >> 8;
-    return output + 2;
+    if (!InitAVFormatTable(&m_AVFormatTable)
+            || !InitRtmpNodeTable(&m_RtmpNodeTable))
+        return -1;
+    return JNI_VERSION_1_4;
 }
-char * put_be24(char *output, uint32_t nVal)
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved)
 {
-    output[2] = nVal & 0xff;
-    output[1] = nVal >> 8;
-    output[0] = nVal >> 16;
-    return output + 3;
+    LogFlush();
 }
-char * put_be32(char *output, uint32_t nVal)
+
+//Output FFmpeg's av_log()
+void custom_log(void *ptr, int level, const char* fmt, va_list vl)
 {
-    output[3] = nVal & 0xff;
-    output[2] = nVal >> 8;
-    output[1] = nVal >> 16;
-    output[0] = nVal >> 24;
-    return output + 4;
+    int lv;
+    va_list vl2;
+
+    //RTSP 的丢包统计不受日志级别影响
+    va_copy(vl2, vl);
+    CountRtpLoss(ptr, fmt, vl2);
+    va_end(vl2);
+
+    //av_log 不管级别都会回调，先按av_log_get_level 过滤
+    if (level > av_log_get_level())
+        return;
+    if (level <= AV_LOG_ERROR)
+        lv = LOG_LEVEL_ERROR;
+    else if (level <= AV_LOG_WARNING)
+        lv = LOG_LEVEL_WARN;
+    else if (level <= AV_LOG_INFO)
+        lv = LOG_LEVEL_INFO;
+    else
+        lv = LOG_LEVEL_DEBUG;
+    if (lv < LOG_LEVEL)
+        return;
+
+    //To Logcat and TXT file，由日志线程写
+    LogWriteV(lv, "ffmpeg", fmt, vl);
 }
-char * put_be64(char *output, uint64_t nVal)
+
+static void InitFFmpeg(void)
 {
-    output = put_be32(output, nVal >> 32);
-    output = put_be32(output, nVal);
-    return output;
+#ifdef _DEBUG_
+    LogSetFile("/storage/emulated/0/av_log.txt");
+#endif
+    av_log_set_callback(custom_log);
+    av_register_all();
+    LOGI( "avformat_network_init");
+    //Network
+    avformat_network_init();
 }
-char * put_amf_string(char *c, const char *str)
+
+//push() 的直通模式：实时输入不按墙钟限速，由输入决定节奏。
+//输入到达时间抖动大(突发)时按时间戳平滑输出，最多增加PUSH_JITTER_MAX_MS 的延迟
+#define PUSH_JITTER_ENABLE_MS   20
+#define PUSH_JITTER_DISABLE_MS  5
+#define PUSH_JITTER_MAX_MS      100
+#define PUSH_TS_JUMP_MS         5000 //时间戳跳变超过它时重新对齐，输出时间戳保持连续
+
+//直通模式的时间戳和抖动状态，时间都是us
+typedef struct PushClock
 {
-    uint16_t len = strlen(str);
-    c = put_be16(c, len);
-    memcpy(c, str, len);
-    return c + len;
-}
-char * put_amf_double(char *c, double d)
+    int64_t nTsBase; //输入时间戳减去它，输出从0 开始。AV_NOPTS_VALUE 表示还没有包
+    int64_t nLastDts; //上一个输出包的dts，输出时间基
+    int64_t nLastTs; //上一个包去掉nTsBase 后的时间戳
+    int64_t nLastArrival;
+    int64_t nJitter; //到达时间抖动，1/16 指数平均
+    BOOL bSmooth; //输入是突发的，按时间戳平滑输出
+    int64_t nWallBase; //平滑输出时时间戳ts 的包在nWallBase + ts 写出
+} PushClock;
+
+//RTSP/RTP/UDP/RTMP 等实时输入，ctx 为NULL 时只按url 判断
+static BOOL IsRealtimeInput(const char *url, AVFormatContext *ctx)
 {
-    *c++ = AMF_NUMBER; /* type: Number */
+    static const char *prefixes[] = { "rtsp:", "rtsps:", "rtp:", "udp:", "rtmp:", "rtmps:", "tcp:" };
+    int i;
+
+    for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++)
     {
-        unsigned char *ci, *co;
-        ci = (unsigned char *) &d;
-        co = (unsigned char *) c;
-        co[0] = ci[7];
-        co[1] = ci[6];
-        co[2] = ci[5];
-        co[3] = ci[4];
-        co[4] = ci[3];
-        co[5] = ci[2];
-        co[6] = ci[1];
-        co[7] = ci[0];
+        if (!strncmp(url, prefixes[i], strlen(prefixes[i])))
+            return TRUE;
     }
-    return c + 8;
+    if (ctx && ctx->iformat)
+        return !strcmp(ctx->iformat->name, "rtsp") || !strcmp(ctx->iformat->name, "rtp")
+               || !strcmp(ctx->iformat->name, "sdp");
+    return FALSE;
 }
 
-BOOL SendPacket(RTMP *pRtmp, unsigned int nPacketType, unsigned char *data,
-                unsigned int size, unsigned int nTimestamp)
+//到达抖动大时等到包的时间戳对应的时刻再写，ts 是去掉nTsBase 后的us
+static void PushClockPace(PushClock *c, int64_t ts, int64_t now)
 {
-    if (pRtmp == NULL)
-    {
-        LOGE("SendPacket pRtmp == NULL!\n");
-        return FALSE;
-    }
-
-    RTMPPacket *packet = (RTMPPacket*) malloc(sizeof(RTMPPacket));// + size + 1);
-    RTMPPacket_Alloc(packet, size + 1); //1024*64);//
-    RTMPPacket_Reset(packet);
-
-    packet->m_hasAbsTimestamp = 1;
+    int64_t delta, due, nTarget;
 
-    packet->m_packetType = nPacketType;
-    packet->m_nChannel = 0x04;
-    packet->m_headerType = RTMP_PACKET_SIZE_LARGE;
-    packet->m_nTimeStamp = nTimestamp;
-    packet->m_nInfoField2 = pRtmp->m_stream_id;
-    packet->m_nBodySize = size;
-    memcpy(packet->m_body, data, size);
-
-    if (!RTMP_IsConnected(pRtmp))
+    if (c->nLastArrival)
     {
-        LOGE( "RTMP_IsConnected error!\n");
+        //RFC 3550 的到达抖动：到达间隔和时间戳间隔的差
+        delta = (now - c->nLastArrival) - (ts - c->nLastTs);
+        c->nJitter += ((delta < 0 ? -delta : delta) - c->nJitter) / 16;
     }
+    c->nLastArrival = now;
+    c->nLastTs = ts;
 
-#ifdef _DEBUG_
-    printf("SendPacket, size:%d, data:%s\n", size, data);
-#endif
-    int nRet = RTMP_SendPacket(pRtmp, packet, 0);
-#ifdef _DEBUG_
-    printf("SendPacket finish!\n");
-#endif
-    RTMPPacket_Free(packet);
-    free(packet);
-    if (!nRet)
+    if (!c->bSmooth && c->nJitter > PUSH_JITTER_ENABLE_MS * 1000)
     {
-        LOGE( "RTMP_SendPacket error \n");
-        return FALSE;
+        nTarget = FFMIN(c->nJitter * 2, PUSH_JITTER_MAX_MS * 1000);
+        c->nWallBase = now + nTarget - ts;
+        c->bSmooth = TRUE;
+        LOGI("push: bursty input, jitter %lld us, buffer %lld us",
+             (long long) c->nJitter, (long long) nTarget);
     }
-    return nRet;
-}
-
-int SendMetadata(RTMP *pRtmp, LPRTMPMetadata lpMetaData)
-{
-    if (lpMetaData == NULL)
+    else if (c->bSmooth && c->nJitter < PUSH_JITTER_DISABLE_MS * 1000)
     {
-        LOGE("SendMetadata lpMetaData == NULL!\n");
-        return FALSE;
+        c->bSmooth = FALSE;
+        LOGI("push: input is smooth again, jitter buffer off");
     }
-    char body[1024] = { 0 };
-
-    char * p = (char *) body;
-    p = put_byte(p, AMF_STRING);
-    p = put_amf_string(p, "@setDataFrame");
-
-    p = put_byte(p, AMF_STRING);
-    p = put_amf_string(p, "onMetaData");
-
-    p = put_byte(p, AMF_OBJECT);
-    p = put_amf_string(p, "copyright");
-    p = put_byte(p, AMF_STRING);
-    p = put_amf_string(p, "firehood");
-
-    p = put_amf_string(p, "width");
-    p = put_amf_double(p, lpMetaData->nWidth);
-
-    p = put_amf_string(p, "height");
-    p = put_amf_double(p, lpMetaData->nHeight);
-
-    p = put_amf_string(p, "framerate");
-    p = put_amf_double(p, lpMetaData->nFrameRate);
-
-    p = put_amf_string(p, "videocodecid");
-    p = put_amf_double(p, FLV_CODECID_H264);
-
-    p = put_amf_string(p, "");
-    p = put_byte(p, AMF_OBJECT_END);
-
-    printf("SendMetadata 1  \n");
-    SendPacket(pRtmp, RTMP_PACKET_TYPE_INFO, (unsigned char*) body, p - body,
-               0);
+    if (!c->bSmooth)
+        return;
 
-    int i = 0;
-    body[i++] = 0x17; // 1:keyframe  7:AVC
-    body[i++] = 0x00; // AVC sequence header
-
-    body[i++] = 0x00;
-    body[i++] = 0x00;
-    body[i++] = 0x00; // fill in 0;
-
-    // AVCDecoderConfigurationRecord.
-    body[i++] = 0x01; // configurationVersion
-    body[i++] = lpMetaData->Sps[1]; // AVCProfileIndication
-    body[i++] = lpMetaData->Sps[2]; // profile_compatibility
-    body[i++] = lpMetaData->Sps[3]; // AVCLevelIndication
-    body[i++] = 0xff; // lengthSizeMinusOne
-
-    // sps nums
-    body[i++] = 0xE1; //&0x1f
-    // sps data length
-    body[i++] = lpMetaData->nSpsLen >> 8;
-    body[i++] = lpMetaData->nSpsLen & 0xff;
-    // sps data
-    memcpy(&body[i], lpMetaData->Sps, lpMetaData->nSpsLen);
-    i = i + lpMetaData->nSpsLen;
-
-    // pps nums
-    body[i++] = 0x01; //&0x1f
-    // pps data length
-    body[i++] = lpMetaData->nPpsLen >> 8;
-    body[i++] = lpMetaData->nPpsLen & 0xff;
-    // sps data
-    memcpy(&body[i], lpMetaData->Pps, lpMetaData->nPpsLen);
-    i = i + lpMetaData->nPpsLen;
-    printf("SendMetadata 2  \n");
-    return SendPacket(pRtmp, RTMP_PACKET_TYPE_VIDEO, (unsigned char*) body, i,
-                      0);
-
-}
-
-BOOL SendH264Packet(RTMP *pRtmp, unsigned char *data, unsigned int size,
-                    BOOL bIsKeyFrame, unsigned int nTimeStamp)
-{
-    if (data == NULL && size < 11)
+    due = c->nWallBase + ts;
+    if (due <= now)
     {
-        LOGE("SendH264Packet data error!\n");
-        return FALSE;
+        //晚到的包不等，之后的包按它对齐
+        c->nWallBase = now - ts;
+        return;
     }
-
-    unsigned char *body = (unsigned char *) malloc(size + 9);
-
-    int i = 0;
-    if (bIsKeyFrame)
+    if (due - now > PUSH_JITTER_MAX_MS * 1000)
     {
-        body[i++] = 0x17; // 1:Iframe  7:AVC
+        c->nWallBase -= due - now - PUSH_JITTER_MAX_MS * 1000;
+        due = now + PUSH_JITTER_MAX_MS * 1000;
     }
-    else
-    {
-        body[i++] = 0x27; // 2:Pframe  7:AVC
-    }
-    body[i++] = 0x01; // AVC NALU
-    body[i++] = 0x00;
-    body[i++] = 0x00;
-    body[i++] = 0x00;
-
-    // NALU size
-    body[i++] = size >> 24;
-    body[i++] = size >> 16;
-    body[i++] = size >> 8;
-    body[i++] = size & 0xff;
-
-    // NALU data
-    memcpy(&body[i], data, size);
-
-    BOOL bRet = SendPacket(pRtmp, RTMP_PACKET_TYPE_VIDEO, body, i + size,
-                           nTimeStamp);
-
-    free(body);
-
-    return bRet;
+    av_usleep(due - now);
 }
 
-BOOL m_read_frame;
-int m_read_frame_time_out = 0;
-
-static int interrupt_cb(void *ctx)
+//实时输入的包直接写出，不进av_interleaved_write_frame 的交织缓冲。
+//时间戳从0 开始，dts 单调，跳变时重新对齐
+static int PushLivePacket(AVFormatContext *ofmt_ctx, PushClock *c, AVPacket *pkt,
+                          AVRational tb_in, AVRational tb_out)
 {
-    if (m_read_frame)
+    AVRational tb_us = { 1, AV_TIME_BASE };
+    int64_t now = av_gettime_relative();
+    int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    int64_t ts;
+
+    if (c->nTsBase == AV_NOPTS_VALUE)
+        c->nTsBase = dts;
+    ts = av_rescale_q(dts - c->nTsBase, tb_in, tb_us);
+    if (c->nLastArrival && FFABS(ts - c->nLastTs) > PUSH_TS_JUMP_MS * 1000LL)
     {
-        //LOGI("interrupt_cb : %d",m_read_frame_time_out);
-        m_read_frame_time_out++;
-        if (m_read_frame_time_out > 3000)
-        {
-            LOGE("read_frame_time_out");
-            m_read_frame_time_out = 0;
-            return 1;
-        }
+        LOGI("push: timestamp jump %lld ms, rebase", (long long) (ts - c->nLastTs) / 1000);
+        c->nTsBase = dts - av_rescale_q(c->nLastTs, tb_us, tb_in);
+        ts = c->nLastTs;
+        c->nLastArrival = 0;
     }
-    return 0;
+    PushClockPace(c, ts, now);
+
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts = av_rescale_q(pkt->pts - c->nTsBase, tb_in, tb_out);
+    pkt->dts = av_rescale_q(dts - c->nTsBase, tb_in, tb_out);
+    if (c->nLastDts != AV_NOPTS_VALUE && pkt->dts <= c->nLastDts)
+        pkt->dts = c->nLastDts + 1;
+    if (pkt->pts == AV_NOPTS_VALUE || pkt->pts < pkt->dts)
+        pkt->pts = pkt->dts;
+    c->nLastDts = pkt->dts;
+    pkt->duration = av_rescale_q(pkt->duration, tb_in, tb_out);
+    pkt->pos = -1;
+    pkt->stream_index = 0;
+    return av_write_frame(ofmt_ctx, pkt);
 }
 
 int push(char* input_str, char* output_str)
@@ -298,6 +219,9 @@ int push(char* input_str, char* output_str)
     AVOutputFormat *ofmt = NULL;
     AVFormatContext *ifmt_ctx = NULL, *ofmt_ctx = NULL;
     AVPacket pkt;
+    AVDictionary *options = NULL;
+    PushClock clock = { AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0, 0, 0, FALSE, 0 };
+    BOOL bLive = IsRealtimeInput(input_str, NULL);
 
     int ret, i;
 
@@ -308,11 +232,24 @@ int push(char* input_str, char* output_str)
     //Network
     avformat_network_init();
     //Input
-    if ((ret = avformat_open_input(&ifmt_ctx, input_str, 0, 0)) < 0)
+    if (bLive)
+    {
+        //实时输入不在demuxer 里攒包，RTP 乱序最多等100ms
+        av_dict_set(&options, "fflags", "nobuffer", 0);
+        av_dict_set(&options, "max_delay", "100000", 0);
+    }
+    ret = avformat_open_input(&ifmt_ctx, input_str, 0, &options);
+    av_dict_free(&options);
+    if (ret < 0)
     {
         printf( "Could not open input file.");
         goto end;
     }
+    if (!bLive && IsRealtimeInput(input_str, ifmt_ctx))
+    {
+        bLive = TRUE;
+        ifmt_ctx->flags |= AVFMT_FLAG_NOBUFFER;
+    }
     LOGI( "avformat_find_stream_info");
     if ((ret = avformat_find_stream_info(ifmt_ctx, 0)) < 0)
     {
@@ -330,6 +267,9 @@ int push(char* input_str, char* output_str)
         goto end;
     }
     ofmt = ofmt_ctx->oformat;
+    //直通模式每个包写完就flush，不在AVIOContext 里攒
+    if (bLive)
+        ofmt_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
     int videoindex = -1;
     for(i = 0; i<ifmt_ctx->nb_streams; i++)
         if(ifmt_ctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
@@ -403,6 +343,21 @@ int push(char* input_str, char* output_str)
             pkt.dts = pkt.pts;
             pkt.duration = (double)calc_duration/(double)(av_q2d(time_base1)*AV_TIME_BASE);
         }
+        in_stream  = ifmt_ctx->streams[pkt.stream_index];
+        out_stream = ofmt_ctx->streams[0];
+        if (bLive)
+        {
+            ret = PushLivePacket(ofmt_ctx, &clock, &pkt, in_stream->time_base,
+                                 out_stream->time_base);
+            av_packet_unref(&pkt);
+            if (ret < 0)
+            {
+                printf( "Error muxing packet\n");
+                break;
+            }
+            frame_index++;
+            continue;
+        }
         //Important:Delay
         if(pkt.stream_index == videoindex)
         {
@@ -414,8 +369,6 @@ int push(char* input_str, char* output_str)
                 av_usleep(pts_time - now_time);
         }
 
-        in_stream  = ifmt_ctx->streams[pkt.stream_index];
-        out_stream = ofmt_ctx->streams[pkt.stream_index];
         /* copy packet */
         //Convert PTS/DTS
         pkt.pts = av_rescale_q_rnd(pkt.pts, in_stream->time_base, out_stream->time_base, AV_ROUND_NEAR_INF|AV_ROUND_PASS_MINMAX);
@@ -425,9 +378,10 @@ int push(char* input_str, char* output_str)
         //Print to Screen
         if(pkt.stream_index == videoindex)
         {
-            printf("Send %8d video frames to output URL\n",frame_index);
+            LOGD("Send %8d video frames to output URL\n",frame_index);
             frame_index++;
         }
+        pkt.stream_index = 0; //输出只有视频流
         ret = av_interleaved_write_frame(ofmt_ctx, &pkt);
 
         if (ret < 0)
@@ -454,26 +408,12 @@ int push(char* input_str, char* output_str)
     return 0;
 }
 
-JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_initCamStream(
-    JNIEnv *env, jobject obj, jint jid, jstring jurl)
+//openTimeout/readTimeout 单位ms，<=0 表示不超时。transport 为RTSP_TRANSPORT_*
+static jboolean InitCamStream(JNIEnv *env, jint jid, jstring jurl,
+                              int openTimeout, int readTimeout, int transport)
 {
     LOGI( "initCamStream start! \n");
-    //
-    if (!m_FFmpeg_Inited)
-    {
-        m_FFmpeg_Inited = TRUE;
-
-        if (!InitAVFormatQueue(&m_AVFormatQueue))
-            return JNI_FALSE;
-#ifdef _DEBUG_
-        av_log_set_callback(custom_log);
-#endif
-        av_register_all();
-        LOGI( "avformat_network_init");
-        //Network
-        avformat_network_init();
-        LOGI( "avformat_open_input");
-    }
+    pthread_once(&m_FFmpeg_Once, InitFFmpeg);
 
     char url[500] = { 0 };
     const char *curl = (*env)->GetStringUTFChars(env, jurl, NULL);
@@ -481,42 +421,27 @@ JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_initCamStream(
     (*env)->ReleaseStringUTFChars(env, jurl, curl);
 
     int i;
-    AVCodecContext *pCodecCtx;
     AVCodec *pCodec;
-    AVFrame *pFrame, *pFrameYUV;
-    uint8_t *out_buffer;
-
-    struct SwsContext *img_convert_ctx;
 
     AVFormatNode *pAVFormat = AllocAVFormat();
-    pAVFormat->id = jid;
-
-    AVFormatContext *pFormatCtx = avformat_alloc_context();
-
-    pFormatCtx->interrupt_callback.callback = interrupt_cb; //--------注册回调函数
-    pFormatCtx->interrupt_callback.opaque = pFormatCtx;
-
-    AVDictionary* options = NULL;
-    av_dict_set(&options, "rtsp_transport", "tcp", 0);
-
-    if (avformat_open_input(&pFormatCtx, url, NULL, NULL) != 0) //打开网络流或文件流
-    {
-        LOGE("Couldn't open input stream.\n");
-        FreeAVFormat(pAVFormat);
+    if (pAVFormat == NULL)
         return JNI_FALSE;
-    }
+    pAVFormat->id = jid;
+    pAVFormat->m_OpenTimeout = openTimeout;
+    pAVFormat->m_ReadTimeout = readTimeout;
+    pAVFormat->m_Transport = transport;
 
-    if (avformat_find_stream_info(pFormatCtx, NULL) < 0)
+    //打开网络流或文件流，中断回调挂在这一路上，超时或cancelCamStream 都会让它返回
+    if (!OpenAVFormat(pAVFormat, url, NULL))
     {
-        LOGE("Couldn't find stream information.\n");
-        avformat_close_input(&pFormatCtx);
         FreeAVFormat(pAVFormat);
         return JNI_FALSE;
     }
+    AVFormatContext *pFormatCtx = pAVFormat->pFormatCtx;
 
     int videoindex = -1;
     for (i = 0; i < pFormatCtx->nb_streams; i++)
-        if (pFormatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+        if (pFormatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
         {
             videoindex = i;
             break;
@@ -524,62 +449,93 @@ JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_initCamStream(
     if (videoindex == -1)
     {
         LOGE("Didn't find a video stream.\n");
-        avformat_close_input(&pFormatCtx);
         FreeAVFormat(pAVFormat);
         return JNI_FALSE;
     }
 
-    pCodecCtx = pFormatCtx->streams[videoindex]->codec;
-    pCodec = avcodec_find_decoder(pCodecCtx->codec_id);
+    //只检查能不能解码，帧数据直接转发，不打开解码器
+    pCodec = avcodec_find_decoder(pFormatCtx->streams[videoindex]->codecpar->codec_id);
     if (pCodec == NULL)
     {
         LOGE("Codec not found.\n");
-        avformat_close_input(&pFormatCtx);
-        FreeAVFormat(pAVFormat);
-        return JNI_FALSE;
-    }
-
-    if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
-    {
-        LOGE("Could not open codec.\n");
-        avformat_close_input(&pFormatCtx);
         FreeAVFormat(pAVFormat);
         return JNI_FALSE;
     }
 
-    pFrame = av_frame_alloc();
-    pFrameYUV = av_frame_alloc();
-    out_buffer = (uint8_t *) av_malloc(
-                     avpicture_get_size(AV_PIX_FMT_YUV420P, pCodecCtx->width,
-                                        pCodecCtx->height));
-    avpicture_fill((AVPicture *) pFrameYUV, out_buffer, AV_PIX_FMT_YUV420P,
-                   pCodecCtx->width, pCodecCtx->height);
-
     //Output Info---输出一些文件（RTSP）信息
     printf("---------------- File Information ---------------\n");
     av_dump_format(pFormatCtx, 0, url, 0);
     printf("-------------------------------------------------\n");
 
-    img_convert_ctx = sws_getContext(pCodecCtx->width, pCodecCtx->height,
-                                     pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height,
-                                     AV_PIX_FMT_YUV420P, SWS_BICUBIC, NULL, NULL, NULL);
-
     pAVFormat->videoindex = videoindex;
-    pAVFormat->pFormatCtx = pFormatCtx;
+    DiscardOtherStreams(pAVFormat);
 
-    PushAVFormat(m_AVFormatQueue, pAVFormat);
+    if (!PushAVFormat(m_AVFormatTable, pAVFormat))
+    {
+        LOGE("initCamStream id already opened! id:%d\n", jid);
+        FreeAVFormat(pAVFormat);
+        return JNI_FALSE;
+    }
     LOGI( "initCamStream finish! \n");
     return JNI_TRUE;
 }
 
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_initCamStream(
+    JNIEnv *env, jobject obj, jint jid, jstring jurl)
+{
+    return InitCamStream(env, jid, jurl, AVFORMAT_OPEN_TIMEOUT_MS,
+                         AVFORMAT_READ_TIMEOUT_MS, RTSP_TRANSPORT_AUTO);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_initCamStreamOptions(
+    JNIEnv *env, jobject obj, jint jid, jstring jurl, jint openTimeout,
+    jint readTimeout, jint transport)
+{
+    if (transport < RTSP_TRANSPORT_AUTO || transport > RTSP_TRANSPORT_TCP)
+        return JNI_FALSE;
+    return InitCamStream(env, jid, jurl, openTimeout, readTimeout, transport);
+}
+
+//这一路实际使用的RTSP 传输方式，RTSP_TRANSPORT_UDP/TCP，不是RTSP 或没打开时返回0
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_getCamTransport(
+    JNIEnv *env, jobject obj, jint id)
+{
+    AVFormatNode *pAVFormat;
+    jint transport;
+    if (!GetAVFormatById(m_AVFormatTable, &pAVFormat, id))
+        return 0;
+    pthread_mutex_lock(&pAVFormat->m_ReadLock);
+    transport = pAVFormat->m_CurTransport;
+    pthread_mutex_unlock(&pAVFormat->m_ReadLock);
+    PutAVFormat(m_AVFormatTable, pAVFormat);
+    return transport;
+}
+
+//流参数缓存文件的目录，重启后initCamStream 也能跳过探测
+JNIEXPORT void JNICALL Java_com_dftc_onvif_Onvif_setStreamInfoCacheDir(
+    JNIEnv *env, jobject obj, jstring jdir)
+{
+    const char *dir = jdir ? (*env)->GetStringUTFChars(env, jdir, NULL) : NULL;
+    SetStreamInfoCacheDir(dir);
+    if (dir)
+        (*env)->ReleaseStringUTFChars(env, jdir, dir);
+}
+
+//让这一路正在打开或读取的调用立即返回，不释放，之后还要closeCamStream
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_cancelCamStream(
+    JNIEnv *env, jobject obj, jint id)
+{
+    return CancelAVFormatById(m_AVFormatTable, id) ? JNI_TRUE : JNI_FALSE;
+}
+
 JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_closeCamStream(
     JNIEnv *env, jobject obj, jint id)
 {
 
-    AVFormatNode *pAVFormat;
-    if (!PopAVFormatById(m_AVFormatQueue, &pAVFormat, id))
+    //先中断正在阻塞的读取，正在读这一路的线程释放引用后才真正关闭
+    CancelAVFormatById(m_AVFormatTable, id);
+    if (!RemoveAVFormatById(m_AVFormatTable, id))
         return JNI_FALSE;
-    FreeAVFormat(pAVFormat);
     return JNI_TRUE;
 }
 
@@ -588,157 +544,180 @@ JNIEXPORT jbyteArray JNICALL Java_com_dftc_onvif_Onvif_getH264Stream(
 {
 
     AVFormatNode *pAVFormat;
-    if (!GetAVFormatById(m_AVFormatQueue, &pAVFormat, id))
+    AVPacket packet;
+    if (!GetAVFormatById(m_AVFormatTable, &pAVFormat, id))
     {
         LOGE("GetAVFormatById error\n");
-        return JNI_FALSE;
+        return NULL;
     }
-    printf("GetAVFormatById finish\n");
-    AVPacket *packet;
-    int num = 0;
-    while (TRUE)
+    LOGD("GetAVFormatById finish\n");
+    pthread_mutex_lock(&pAVFormat->m_ReadLock);
+    if (!ReadVideoPacket(pAVFormat, &packet))
     {
-        packet = (AVPacket *) av_malloc(sizeof(AVPacket));
-        printf("Call av_read_frame\n");
-        m_read_frame_time_out = 0;
-        m_read_frame = TRUE;
-        if (av_read_frame(pAVFormat->pFormatCtx, packet) < 0)
-        {
-            m_read_frame = FALSE;
-            LOGE("av_read_frame error\n");
-            return NULL;
-        }
-        m_read_frame = FALSE;
-        printf("Call av_read_frame finish!\n");
-        if (packet->stream_index != pAVFormat->videoindex)
-        {
-            LOGE("Not video stream!\n");
-#ifdef _DEBUG_
-            LOGE("packet->data = %d,%d,%d,%d,%d\n",
-                 packet->data[0], packet->data[1], packet->data[2], packet->data[3], packet->data[4]);
-#endif
-            av_free_packet(packet);
-            if (num++ > 100)
-            {
-                LOGE("av_read_frame error : No video stream\n");
-                return NULL;
-            }
-        }
-        else
-        {
-            break;
-        }
+        pthread_mutex_unlock(&pAVFormat->m_ReadLock);
+        PutAVFormat(m_AVFormatTable, pAVFormat);
+        return NULL;
     }
-    printf("av_read_frame finish\n");
-    jbyte *by = (jbyte*) packet->data;
-    jbyteArray jarray = (*env)->NewByteArray(env, packet->size);
-    (*env)->SetByteArrayRegion(env, jarray, 0, packet->size, by);
-    av_free_packet(packet);
+    pthread_mutex_unlock(&pAVFormat->m_ReadLock);
+    LOGD("av_read_frame finish\n");
+    jbyte *by = (jbyte*) packet.data;
+    jbyteArray jarray = (*env)->NewByteArray(env, packet.size);
+    (*env)->SetByteArrayRegion(env, jarray, 0, packet.size, by);
+    av_packet_unref(&packet);
+    PutAVFormat(m_AVFormatTable, pAVFormat);
     return jarray;
 }
 
-JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_connectRtmpSer(JNIEnv *env,
-        jobject obj, jstring jserAddr)
+//读一个视频包到direct ByteBuffer 的position 0，返回长度。
+//buffer 放不下时返回-(包长度)，包保留到下一次调用，调用者换更大的buffer 再读
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_getH264StreamDirect(
+    JNIEnv *env, jobject obj, jint id, jobject jbuf)
 {
-    if (m_RtmpNodeQueue == NULL && !InitRtmpNodeQueue(&m_RtmpNodeQueue))
-        return -1;
-    char serAddr[500] = { 0 };
-    const char *cserAddr = (*env)->GetStringUTFChars(env, jserAddr, NULL);
-    sprintf(serAddr, "%s", cserAddr);
-    (*env)->ReleaseStringUTFChars(env, jserAddr, cserAddr);
-
-    RTMP *m_pRtmp = RTMP_Alloc();
-    RTMP_Init(m_pRtmp);
-    LOGI( "RTMP_Connect : %s \n", serAddr);
-    m_pRtmp->Link.timeout = 5;
-    // if (!RTMP_SetupURL2(m_pRtmp, lpAnsiURL, lpAnsiPlaypath))
-    if (!RTMP_SetupURL(m_pRtmp, (char*) serAddr))
+    AVFormatNode *pAVFormat;
+    AVPacket packet;
+    jint ret;
+    unsigned char *buf = (unsigned char *) (*env)->GetDirectBufferAddress(env, jbuf);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, jbuf);
+    if (buf == NULL || capacity < 0)
     {
-        LOGE( "RTMP_SetupURL error \n");
-        return -1;
+        LOGE("getH264StreamDirect not a direct buffer!\n");
+        return 0;
     }
-    RTMP_EnableWrite(m_pRtmp);
+    if (!GetAVFormatById(m_AVFormatTable, &pAVFormat, id))
+        return 0;
 
-    ////////////////////////////////////////////////////////////////////////
-    m_pRtmp->Link.swfUrl.av_len = m_pRtmp->Link.tcUrl.av_len;
-    m_pRtmp->Link.swfUrl.av_val = m_pRtmp->Link.tcUrl.av_val;
-    m_pRtmp->Link.flashVer.av_val = "FMLE/3.0 (compatible; FMSc/1.0)";
-    m_pRtmp->Link.flashVer.av_len = (int)strlen(m_pRtmp->Link.flashVer.av_val);
-
-    //m_pRtmp->m_outChunkSize = 4096;//RTMP_DEFAULT_CHUNKSIZE;//
-    //m_pRtmp->m_bSendChunkSizeInfo = TRUE;
+    pthread_mutex_lock(&pAVFormat->m_ReadLock);
+    if (!ReadVideoPacket(pAVFormat, &packet))
+    {
+        ret = 0;
+    }
+    else if (packet.size > capacity)
+    {
+        ret = -packet.size;
+        KeepVideoPacket(pAVFormat, &packet);
+    }
+    else
+    {
+        memcpy(buf, packet.data, packet.size);
+        ret = packet.size;
+        av_packet_unref(&packet);
+    }
+    pthread_mutex_unlock(&pAVFormat->m_ReadLock);
 
-    //m_pRtmp->m_bUseNagle = TRUE;
+    PutAVFormat(m_AVFormatTable, pAVFormat);
+    return ret;
+}
 
-    //------------------------------------------
+//批量读取，buffer 布局(本机字节序):
+//  int count, int reserved
+//  maxPackets 个索引项 {int offset, int size, int flags, int tick}
+//  之后是各个包的数据，offset 从buffer 起始算起
+//至少读一个包，读满maxPackets 或buffer 放不下为止，返回读到的包数，出错返回0，
+//第一个包就放不下时返回-(需要的buffer 大小)
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_getH264StreamBatch(
+    JNIEnv *env, jobject obj, jint id, jobject jbuf, jint maxPackets)
+{
+    AVFormatNode *pAVFormat;
+    AVPacket packet;
+    int count = 0;
+    unsigned char *buf = (unsigned char *) (*env)->GetDirectBufferAddress(env, jbuf);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, jbuf);
+    jint *index = (jint *) buf;
+    jlong offset = H264_BATCH_HEADER_SIZE + (jlong) maxPackets * H264_BATCH_ENTRY_SIZE;
+    if (buf == NULL || ((intptr_t) buf & 3) || maxPackets <= 0 || offset > capacity)
+    {
+        LOGE("getH264StreamBatch buffer error!\n");
+        return 0;
+    }
+    if (!GetAVFormatById(m_AVFormatTable, &pAVFormat, id))
+        return 0;
 
-//    int tcpBufferSize = 64*1024;
-//
-//    int curTCPBufSize, curTCPBufSizeSize = sizeof(curTCPBufSize);
-//    getsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (char *)&curTCPBufSize, &curTCPBufSizeSize);
-//    printf("SO_SNDBUF was at %u", curTCPBufSize);
-//
-//    if(curTCPBufSize < tcpBufferSize)
-//    {
-//        setsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (const char *)&tcpBufferSize, sizeof(tcpBufferSize));
-//        getsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (char *)&curTCPBufSize, &curTCPBufSizeSize);
-//        if(curTCPBufSize != tcpBufferSize)
-//            printf("Could not set SO_SNDBUF to %u, value is now %u", tcpBufferSize, curTCPBufSize);
-//    }
-//
-//    printf("SO_SNDBUF is now %u", tcpBufferSize);
+    pthread_mutex_lock(&pAVFormat->m_ReadLock);
+    while (count < maxPackets && ReadVideoPacket(pAVFormat, &packet))
+    {
+        if (offset + packet.size > capacity)
+        {
+            //一个包都放不下时返回需要的buffer 大小
+            if (count == 0)
+                count = (int) -(offset + packet.size);
+            KeepVideoPacket(pAVFormat, &packet);
+            break;
+        }
+        memcpy(buf + offset, packet.data, packet.size);
+        jint *entry = index + (H264_BATCH_HEADER_SIZE + count * H264_BATCH_ENTRY_SIZE) / 4;
+        entry[0] = (jint) offset;
+        entry[1] = packet.size;
+        entry[2] = (packet.flags & AV_PKT_FLAG_KEY) ? H264_BATCH_FLAG_KEY : 0;
+        entry[3] = GetPacketTick(pAVFormat, &packet);
+        offset += (packet.size + 3) & ~3;
+        count++;
+        av_packet_unref(&packet);
+    }
+    pthread_mutex_unlock(&pAVFormat->m_ReadLock);
+    index[0] = count > 0 ? count : 0;
+    index[1] = 0;
 
-    //------------------------------------------
+    PutAVFormat(m_AVFormatTable, pAVFormat);
+    return count;
+}
 
-    ////////////////////////////////////////////////////////////////////////
+static int ConnectRtmp(JNIEnv *env, jstring jserAddr, BOOL bEventLoop,
+                       const SendOptions *opts)
+{
+    char serAddr[500] = { 0 };
+    const char *cserAddr = (*env)->GetStringUTFChars(env, jserAddr, NULL);
+    sprintf(serAddr, "%s", cserAddr);
+    (*env)->ReleaseStringUTFChars(env, jserAddr, cserAddr);
 
-    RTMP_SetBufferMS(m_pRtmp, 3600 * 1000);
-    if (!RTMP_Connect(m_pRtmp, NULL))
+    RtmpNode *p = AllocRtmpNode();
+    p->id = __atomic_fetch_add(&m_SerIdIndex, 1, __ATOMIC_RELAXED);
+    //连接由发送队列建立，断线后由它重连
+    if (!InitSendQueue(&p->m_pSendQueue, serAddr, bEventLoop, opts))
     {
-        LOGE( "RTMP_Connect error \n");
+        FreeRtmpNode(p);
         return -1;
     }
-    if (!RTMP_ConnectStream(m_pRtmp, 0))
+    if (!PushRtmpNode(m_RtmpNodeTable, p))
     {
-        LOGE( "RTMP_ConnectStream error \n");
+        FreeRtmpNode(p);
         return -1;
     }
 
-    RtmpNode *p = AllocRtmpNode();
-    p->id = m_SerIdIndex++;
-    p->m_pRtmp = m_pRtmp;
-    PushRtmpNode(m_RtmpNodeQueue, p);
-
     return p->id;
 }
 
-JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_disconnectRtmpSer(
-    JNIEnv *env, jobject obj, jint id)
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_connectRtmpSer(JNIEnv *env,
+        jobject obj, jstring jserAddr)
 {
-    RtmpNode *pRtmpNode;
-    if (!PopRtmpNodeById(m_RtmpNodeQueue, &pRtmpNode, id))
-        return JNI_FALSE;
-    FreeRtmpNode(pRtmpNode);
-    return JNI_TRUE;
+    return ConnectRtmp(env, jserAddr, FALSE, NULL);
 }
 
-BOOL SendSpsPps(RTMP *pRtmp, char* h264, int length, int width, int height,
-                int rate)
+//连接的发送由共享的epoll 线程完成，不为每个连接创建发送线程
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_connectRtmpPublisher(
+    JNIEnv *env, jobject obj, jstring jserAddr)
 {
-    RTMPMetadata metaData;
-    memset(&metaData, 0, sizeof(RTMPMetadata));
+    return ConnectRtmp(env, jserAddr, TRUE, NULL);
+}
 
-    if (!GainSpsPps(metaData.Sps, &metaData.nSpsLen, metaData.Pps,
-                    &metaData.nPpsLen, h264, length))
-        return FALSE;
-    metaData.nWidth = width; //352; //1920;
-    metaData.nHeight = height; //288; //1080;
-    metaData.nFrameRate = rate; //25;
-    printf("width ,height, framerate:%d,%d,%d\n", metaData.nWidth,
-           metaData.nHeight, metaData.nFrameRate);
-    printf("sps_len, pps_len: %d,%d  \n", metaData.nSpsLen, metaData.nPpsLen);
+//targetLatencyMs 为0 时只按队列长度丢帧，paceKbps 为0 时不限速，burstBytes 为0 时用默认值
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_connectRtmpOptions(
+    JNIEnv *env, jobject obj, jstring jserAddr, jboolean eventLoop,
+    jint targetLatencyMs, jint paceKbps, jint burstBytes)
+{
+    SendOptions opts;
+    opts.nTargetLatency = targetLatencyMs;
+    opts.nPaceKbps = paceKbps;
+    opts.nBurstBytes = burstBytes;
+    return ConnectRtmp(env, jserAddr, eventLoop ? TRUE : FALSE, &opts);
+}
 
-    return SendMetadata(pRtmp, &metaData);
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_disconnectRtmpSer(
+    JNIEnv *env, jobject obj, jint id)
+{
+    //正在推流的线程释放引用后才真正断开
+    if (!RemoveRtmpNodeById(m_RtmpNodeTable, id))
+        return JNI_FALSE;
+    return JNI_TRUE;
 }
 
 JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_sendSpsPps(JNIEnv *env,
@@ -746,101 +725,341 @@ JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_sendSpsPps(JNIEnv *env,
         jint jheight, jint jrate)
 {
     RtmpNode *pRtmpNode;
-    if (!GetRtmpNodeById(m_RtmpNodeQueue, &pRtmpNode, id))
+    BOOL bRet;
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
         return JNI_FALSE;
-    printf("GetRtmpNodeById finish! \n");
-//    if (!pRtmpNode->m_SendSpsPps)
-//    {
-        jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
-        if (!SendSpsPps(pRtmpNode->m_pRtmp, h264, jlength, jwidth, jheight,
-                        jrate))
-        {
-            (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
-            return JNI_FALSE;
-        }
-        (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
+
+    jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
+    pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+    bRet = SendSpsPps(pRtmpNode->m_pSendQueue, (char *) h264, jlength, jwidth,
+                      jheight, jrate, &pRtmpNode->m_Codec);
+    if (bRet)
+    {
         pRtmpNode->width = jwidth;
         pRtmpNode->height = jheight;
         pRtmpNode->rate = jrate;
         pRtmpNode->m_SendSpsPps = TRUE;
-//    }
-    return JNI_TRUE;
-}
+    }
+    pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+    (*env)->ReleaseByteArrayElements(env, jh264, h264, JNI_ABORT);
 
-//unsigned char *keyFramebuf = NULL;
-//int keyFramesize;
-//int keyFrametick;
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
 
 JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_annexH264(JNIEnv *env,
         jobject obj, jint id, jbyteArray jh264, jint jlength, jint jtick)
 {
     RtmpNode *pRtmpNode;
-    if (!GetRtmpNodeById(m_RtmpNodeQueue, &pRtmpNode, id))
+    BOOL bRet;
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
         return JNI_FALSE;
-    printf("GetRtmpNodeById finish! \n");
-    if (!pRtmpNode->m_SendSpsPps)
+
+    jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
+    //发送队列是单生产者的，同一路的多个调用线程在这里串行
+    pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+    bRet = AnnexH264(pRtmpNode, (char *) h264, jlength, jtick);
+    pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+    (*env)->ReleaseByteArrayElements(env, jh264, h264, JNI_ABORT);
+
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_annexH264Direct(
+    JNIEnv *env, jobject obj, jint id, jobject jbuf, jint joffset,
+    jint jlength, jint jtick)
+{
+    RtmpNode *pRtmpNode;
+    BOOL bRet;
+    char *buf = (char *) (*env)->GetDirectBufferAddress(env, jbuf);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, jbuf);
+    if (buf == NULL || joffset < 0 || jlength < 0
+            || (jlong) joffset + jlength > capacity)
     {
+        LOGE("annexH264Direct buffer error!\n");
         return JNI_FALSE;
     }
-    else
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
+        return JNI_FALSE;
+
+    pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+    bRet = AnnexH264(pRtmpNode, buf + joffset, jlength, jtick);
+    pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+//发送getH264StreamBatch 格式的buffer，tick 取索引项里的值。返回成功放进队列的帧数
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_annexH264Batch(JNIEnv *env,
+        jobject obj, jint id, jobject jbuf)
+{
+    RtmpNode *pRtmpNode;
+    int i, count, sent = 0;
+    char *buf = (char *) (*env)->GetDirectBufferAddress(env, jbuf);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, jbuf);
+    jint *index = (jint *) buf;
+    if (buf == NULL || ((intptr_t) buf & 3) || capacity < H264_BATCH_HEADER_SIZE)
     {
-        jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
-        unsigned char *framebuf = NULL;
-        int framesize = 0;
-        BOOL Is_KyeFrame;
-        framesize = Read_One_H264_Frame(&framebuf, h264, jlength, &Is_KyeFrame);
-        if (framesize == 0)
-        {
-            LOGE("Read_One_H264_Frame error! \n");
-            if (!framebuf)
-                free(framebuf);
-            (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
-            return JNI_FALSE;
-        }
-        else if (framesize == -1)
-        {
-//            LOGE("Handler SPS PPS \n");
-//            if(SendSpsPps(pRtmpNode->m_pRtmp, h264, jlength, pRtmpNode->width, pRtmpNode->height,
-//                       pRtmpNode->rate))
-//            {
-//                LOGE("Handler SPS PPS complete! \n");
-//            }
-//
-//            (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
-            return JNI_TRUE;
-        }
+        LOGE("annexH264Batch buffer error!\n");
+        return 0;
+    }
+    count = index[0];
+    if (count < 0 || H264_BATCH_HEADER_SIZE + (jlong) count * H264_BATCH_ENTRY_SIZE > capacity)
+    {
+        LOGE("annexH264Batch index error! count:%d\n", count);
+        return 0;
+    }
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
+        return 0;
 
-//        if(Is_KyeFrame){
-//            if(!keyFramebuf)
-//                free(keyFramebuf);
-//            keyFrametick = jtick;
-//            keyFramesize = framesize;
-//            keyFramebuf = (unsigned char*) calloc(keyFramesize, sizeof(char));
-//            memcpy(keyFramebuf, framebuf, keyFramesize);
-//        }
-//        else{
-//            if(keyFramebuf && jtick - keyFrametick > 1000){
-//                SendH264Packet(pRtmpNode->m_pRtmp, keyFramebuf, keyFramesize,
-//                               TRUE, jtick);
-//            }
-//
-//        }
-
-
-        printf("Read_One_H264_Frame finish! \n");
-        if (!SendH264Packet(pRtmpNode->m_pRtmp, framebuf, framesize,
-                            Is_KyeFrame, jtick))
+    pthread_mutex_lock(&pRtmpNode->m_WriteLock);
+    for (i = 0; i < count; i++)
+    {
+        jint *entry = index + (H264_BATCH_HEADER_SIZE + i * H264_BATCH_ENTRY_SIZE) / 4;
+        if (entry[0] < 0 || entry[1] < 0 || (jlong) entry[0] + entry[1] > capacity)
         {
-            LOGE("SendH264Packet error! \n");
-            free(framebuf);
-            (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
-            return JNI_FALSE;
+            LOGE("annexH264Batch entry error! %d\n", i);
+            break;
         }
-        printf("SendH264Packet finish! \n");
-        free(framebuf);
-        (*env)->ReleaseByteArrayElements(env, jh264, h264, 0);
+        if (AnnexH264(pRtmpNode, buf + entry[0], entry[1], entry[3]))
+            sent++;
     }
+    pthread_mutex_unlock(&pRtmpNode->m_WriteLock);
+
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    return sent;
+}
 
+//摄像头到RTMP 服务器的转发完全在native 线程池中进行，返回转发id，失败返回-1
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_startRelay(JNIEnv *env,
+        jobject obj, jint camId, jint serId)
+{
+    return StartRelay(m_AVFormatTable, m_RtmpNodeTable, camId, serId);
+}
+
+//不需要initCamStream，原生RTSP 客户端拉流转发，帧不经过libavformat，用stopRelay/getRelayStats 停止和统计
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_startRtspRelay(JNIEnv *env,
+        jobject obj, jstring jurl, jint serId, jint openTimeout, jint readTimeout)
+{
+    const char *url = (*env)->GetStringUTFChars(env, jurl, NULL);
+    jint id = StartRtspRelay(m_RtmpNodeTable, url, serId, openTimeout, readTimeout);
+    (*env)->ReleaseStringUTFChars(env, jurl, url);
+    return id;
+}
+
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_startRtspGroupRelay(
+    JNIEnv *env, jobject obj, jstring jurl, jint groupId, jint openTimeout,
+    jint readTimeout)
+{
+    const char *url = (*env)->GetStringUTFChars(env, jurl, NULL);
+    jint id = StartRtspGroupRelay(url, groupId, openTimeout, readTimeout);
+    (*env)->ReleaseStringUTFChars(env, jurl, url);
+    return id;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_stopRelay(JNIEnv *env,
+        jobject obj, jint relayId)
+{
+    return StopRelay(relayId) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_dftc_onvif_Onvif_getRelayStats(
+    JNIEnv *env, jobject obj, jint relayId)
+{
+    long long stats[RELAY_STATS_COUNT];
+    jlong jstats[RELAY_STATS_COUNT];
+    int i;
+    if (!GetRelayStats(relayId, stats))
+        return NULL;
+    for (i = 0; i < RELAY_STATS_COUNT; i++)
+        jstats[i] = stats[i];
+    jlongArray jarray = (*env)->NewLongArray(env, RELAY_STATS_COUNT);
+    (*env)->SetLongArrayRegion(env, jarray, 0, RELAY_STATS_COUNT, jstats);
+    return jarray;
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_dftc_onvif_Onvif_getRtmpStats(
+    JNIEnv *env, jobject obj, jint id)
+{
+    RtmpNode *pRtmpNode;
+    long long stats[SEND_QUEUE_STATS_COUNT];
+    jlong jstats[SEND_QUEUE_STATS_COUNT];
+    int i;
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
+        return NULL;
+    GetSendQueueStats(pRtmpNode->m_pSendQueue, stats);
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    for (i = 0; i < SEND_QUEUE_STATS_COUNT; i++)
+        jstats[i] = stats[i];
+    jlongArray jarray = (*env)->NewLongArray(env, SEND_QUEUE_STATS_COUNT);
+    (*env)->SetLongArrayRegion(env, jarray, 0, SEND_QUEUE_STATS_COUNT, jstats);
+    return jarray;
+}
+
+//写到调用者的数组，定时轮询时不用每次分配
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_fillRtmpStats(
+    JNIEnv *env, jobject obj, jint id, jlongArray jarray)
+{
+    RtmpNode *pRtmpNode;
+    long long stats[SEND_QUEUE_STATS_COUNT];
+    jlong jstats[SEND_QUEUE_STATS_COUNT];
+    int i;
+    if ((*env)->GetArrayLength(env, jarray) < SEND_QUEUE_STATS_COUNT)
+        return JNI_FALSE;
+    if (!GetRtmpNodeById(m_RtmpNodeTable, &pRtmpNode, id))
+        return JNI_FALSE;
+    GetSendQueueStats(pRtmpNode->m_pSendQueue, stats);
+    PutRtmpNode(m_RtmpNodeTable, pRtmpNode);
+    for (i = 0; i < SEND_QUEUE_STATS_COUNT; i++)
+        jstats[i] = stats[i];
+    (*env)->SetLongArrayRegion(env, jarray, 0, SEND_QUEUE_STATS_COUNT, jstats);
     return JNI_TRUE;
 }
 
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_createGroup(JNIEnv *env,
+        jobject obj)
+{
+    return CreateGroup(m_RtmpNodeTable);
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_destroyGroup(JNIEnv *env,
+        jobject obj, jint groupId)
+{
+    return DestroyGroup(groupId) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_addGroupRtmp(JNIEnv *env,
+        jobject obj, jint groupId, jint serId)
+{
+    return GroupAddRtmp(groupId, serId) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_removeGroupRtmp(
+    JNIEnv *env, jobject obj, jint groupId, jint serId)
+{
+    return GroupRemoveRtmp(groupId, serId) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_addGroupFile(JNIEnv *env,
+        jobject obj, jint groupId, jstring jpath)
+{
+    BOOL bRet;
+    const char *path = (*env)->GetStringUTFChars(env, jpath, NULL);
+    bRet = GroupAddFile(groupId, path);
+    (*env)->ReleaseStringUTFChars(env, jpath, path);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_setGroupPreRoll(
+    JNIEnv *env, jobject obj, jint groupId, jint durationMs, jint maxBytes)
+{
+    if (durationMs < 0 || maxBytes < 0)
+        return JNI_FALSE;
+    return GroupSetPreRoll(groupId, durationMs, maxBytes) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_recordGroupFile(
+    JNIEnv *env, jobject obj, jint groupId, jstring jpath)
+{
+    BOOL bRet;
+    const char *path = (*env)->GetStringUTFChars(env, jpath, NULL);
+    bRet = GroupRecordFile(groupId, path);
+    (*env)->ReleaseStringUTFChars(env, jpath, path);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_removeGroupFile(
+    JNIEnv *env, jobject obj, jint groupId, jstring jpath)
+{
+    BOOL bRet;
+    const char *path = (*env)->GetStringUTFChars(env, jpath, NULL);
+    bRet = GroupRemoveFile(groupId, path);
+    (*env)->ReleaseStringUTFChars(env, jpath, path);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_dftc_onvif_Onvif_getGroupPreRollStats(
+    JNIEnv *env, jobject obj, jint groupId)
+{
+    long long stats[PREROLL_STATS_COUNT];
+    jlong jstats[PREROLL_STATS_COUNT];
+    int i;
+    if (!GetGroupPreRollStats(groupId, stats))
+        return NULL;
+    for (i = 0; i < PREROLL_STATS_COUNT; i++)
+        jstats[i] = stats[i];
+    jlongArray jarray = (*env)->NewLongArray(env, PREROLL_STATS_COUNT);
+    (*env)->SetLongArrayRegion(env, jarray, 0, PREROLL_STATS_COUNT, jstats);
+    return jarray;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_sendGroupSpsPps(
+    JNIEnv *env, jobject obj, jint groupId, jbyteArray jh264, jint jlength,
+    jint jwidth, jint jheight, jint jrate)
+{
+    GroupNode *g;
+    BOOL bRet;
+    if (!GetGroupById(&g, groupId))
+        return JNI_FALSE;
+
+    jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
+    pthread_mutex_lock(&g->m_WriteLock);
+    bRet = GroupSendSpsPps(g, (char *) h264, jlength, jwidth, jheight, jrate);
+    pthread_mutex_unlock(&g->m_WriteLock);
+    (*env)->ReleaseByteArrayElements(env, jh264, h264, JNI_ABORT);
+
+    PutGroup(g);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_annexGroupH264(
+    JNIEnv *env, jobject obj, jint groupId, jbyteArray jh264, jint jlength,
+    jint jtick)
+{
+    GroupNode *g;
+    BOOL bRet;
+    if (!GetGroupById(&g, groupId))
+        return JNI_FALSE;
+
+    jbyte* h264 = (*env)->GetByteArrayElements(env, jh264, 0);
+    pthread_mutex_lock(&g->m_WriteLock);
+    bRet = GroupAnnexH264(g, (char *) h264, jlength, jtick);
+    pthread_mutex_unlock(&g->m_WriteLock);
+    (*env)->ReleaseByteArrayElements(env, jh264, h264, JNI_ABORT);
+
+    PutGroup(g);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_dftc_onvif_Onvif_annexGroupH264Direct(
+    JNIEnv *env, jobject obj, jint groupId, jobject jbuf, jint joffset,
+    jint jlength, jint jtick)
+{
+    GroupNode *g;
+    BOOL bRet;
+    char *buf = (char *) (*env)->GetDirectBufferAddress(env, jbuf);
+    jlong capacity = (*env)->GetDirectBufferCapacity(env, jbuf);
+    if (buf == NULL || joffset < 0 || jlength < 0
+            || (jlong) joffset + jlength > capacity)
+    {
+        LOGE("annexGroupH264Direct buffer error!\n");
+        return JNI_FALSE;
+    }
+    if (!GetGroupById(&g, groupId))
+        return JNI_FALSE;
+
+    pthread_mutex_lock(&g->m_WriteLock);
+    bRet = GroupAnnexH264(g, buf + joffset, jlength, jtick);
+    pthread_mutex_unlock(&g->m_WriteLock);
+
+    PutGroup(g);
+    return bRet ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jint JNICALL Java_com_dftc_onvif_Onvif_startGroupRelay(JNIEnv *env,
+        jobject obj, jint camId, jint groupId)
+{
+    return StartGroupRelay(m_AVFormatTable, camId, groupId);
+}
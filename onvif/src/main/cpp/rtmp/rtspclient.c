@@ -0,0 +1,1000 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "libavutil/base64.h"
+#include "libavutil/md5.h"
+
+#include "congestion.h"
+#include "video.h"
+#include "rtspclient.h"
+
+#define RTSP_USER_AGENT       "sffstreamer"
+#define RTSP_DEFAULT_PORT     554
+#define RTSP_SEND_TIMEOUT_MS  100 //握手之后的保活请求，发不出去不等
+#define RTSP_REPLY_BODY_SIZE  8192
+
+//H264 RTP 打包(RFC 6184)和H265 RTP 打包(RFC 7798)的nal 类型
+#define RTP_H264_STAP_A  24
+#define RTP_H264_FU_A    28
+#define RTP_HEVC_AP      48
+#define RTP_HEVC_FU      49
+
+typedef struct
+{
+    int status;
+    char base[512]; //Content-Base
+    char body[RTSP_REPLY_BODY_SIZE];
+} RtspReply;
+
+static BOOL WaitFd(int fd, short events, unsigned int deadline)
+{
+    struct pollfd pfd;
+    int left, n;
+
+    while (TRUE)
+    {
+        left = (int) (deadline - GetTickMs());
+        if (left <= 0)
+            return FALSE;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        n = poll(&pfd, 1, left);
+        if (n > 0)
+            return TRUE;
+        if (n == 0 || errno != EINTR)
+            return FALSE;
+    }
+}
+
+static BOOL SendAll(RtspClient *c, const char *buf, int len, unsigned int deadline)
+{
+    int n;
+
+    while (len > 0)
+    {
+        n = send(c->fd, buf, len, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            buf += n;
+            len -= n;
+        }
+        else if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+                 && WaitFd(c->fd, POLLOUT, deadline))
+        {
+            continue;
+        }
+        else
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+//非阻塞连接，socket 之后一直是非阻塞的
+static BOOL ConnectHost(RtspClient *c, const char *host, int port,
+                        unsigned int deadline)
+{
+    struct addrinfo hints, *res, *ai;
+    char service[16];
+    int fd, err, on = 1;
+    socklen_t len;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+    {
+        LOGE("RTSP resolve host error! %s", host);
+        return FALSE;
+    }
+    for (ai = res; ai != NULL && c->fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            continue;
+        err = 0;
+        len = sizeof(err);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0
+                || (errno == EINPROGRESS && WaitFd(fd, POLLOUT, deadline)
+                    && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+                    && err == 0))
+        {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            c->fd = fd;
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0)
+        LOGE("RTSP connect error! %s:%d errno:%d", host, port, errno);
+    return c->fd >= 0;
+}
+
+//url 中的用户名密码可能有%xx 转义
+static void UrlDecode(char *dst, const char *src, int size)
+{
+    int i = 0;
+    unsigned int ch;
+
+    while (*src && i < size - 1)
+    {
+        if (src[0] == '%' && src[1] && src[2] && sscanf(src + 1, "%2x", &ch) == 1)
+        {
+            dst[i++] = (char) ch;
+            src += 3;
+        }
+        else
+        {
+            dst[i++] = *src++;
+        }
+    }
+    dst[i] = 0;
+}
+
+static void Md5Hex(char hex[33], const char *fmt, ...)
+{
+    char buf[1024];
+    uint8_t digest[16];
+    va_list vl;
+    int i, len;
+
+    va_start(vl, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, vl);
+    va_end(vl);
+    if (len >= (int) sizeof(buf))
+        len = sizeof(buf) - 1;
+    av_md5_sum(digest, (const uint8_t *) buf, len);
+    for (i = 0; i < 16; i++)
+        sprintf(hex + i * 2, "%02x", digest[i]);
+}
+
+//生成Authorization 头，没有收到过401 时为空
+static void MakeAuth(RtspClient *c, const char *method, const char *uri,
+                     char *out, int size)
+{
+    char plain[260], b64[360], ha1[33], ha2[33], response[33];
+    char cnonce[16], opaque[160];
+
+    out[0] = 0;
+    if (!c->bAuth)
+        return;
+    if (!c->bDigest)
+    {
+        snprintf(plain, sizeof(plain), "%s:%s", c->user, c->pass);
+        av_base64_encode(b64, sizeof(b64), (const uint8_t *) plain, strlen(plain));
+        snprintf(out, size, "Authorization: Basic %s\r\n", b64);
+        return;
+    }
+
+    Md5Hex(ha1, "%s:%s:%s", c->user, c->realm, c->pass);
+    Md5Hex(ha2, "%s:%s", method, uri);
+    opaque[0] = 0;
+    if (c->opaque[0])
+        snprintf(opaque, sizeof(opaque), ", opaque=\"%s\"", c->opaque);
+    if (c->bQop)
+    {
+        c->nc++;
+        snprintf(cnonce, sizeof(cnonce), "%08x", GetTickMs() * 2654435761u ^ c->nc);
+        Md5Hex(response, "%s:%s:%08x:%s:auth:%s", ha1, c->nonce, c->nc, cnonce, ha2);
+        snprintf(out, size, "Authorization: Digest username=\"%s\", realm=\"%s\", "
+                 "nonce=\"%s\", uri=\"%s\", response=\"%s\", qop=auth, nc=%08x, "
+                 "cnonce=\"%s\"%s\r\n", c->user, c->realm, c->nonce, uri,
+                 response, c->nc, cnonce, opaque);
+    }
+    else
+    {
+        Md5Hex(response, "%s:%s:%s", ha1, c->nonce, ha2);
+        snprintf(out, size, "Authorization: Digest username=\"%s\", realm=\"%s\", "
+                 "nonce=\"%s\", uri=\"%s\", response=\"%s\"%s\r\n", c->user,
+                 c->realm, c->nonce, uri, response, opaque);
+    }
+}
+
+//取WWW-Authenticate 中key=value 或key="value" 的值
+static BOOL GetAuthParam(const char *p, const char *key, char *value, int size)
+{
+    const char *start = p;
+    int n = strlen(key), i;
+
+    for (; *p; p++)
+    {
+        if ((p != start && p[-1] != ' ' && p[-1] != ',')
+                || strncasecmp(p, key, n) != 0 || p[n] != '=')
+            continue;
+        p += n + 1;
+        i = 0;
+        if (*p == '"')
+        {
+            for (p++; *p && *p != '"' && i < size - 1; p++)
+                value[i++] = *p;
+        }
+        else
+        {
+            for (; *p && *p != ',' && *p != ' ' && i < size - 1; p++)
+                value[i++] = *p;
+        }
+        value[i] = 0;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+//有多个WWW-Authenticate 时优先用Digest
+static void ParseChallenge(RtspClient *c, const char *value)
+{
+    char qop[64];
+
+    if (strncasecmp(value, "Digest", 6) == 0)
+    {
+        c->bAuth = TRUE;
+        c->bDigest = TRUE;
+        GetAuthParam(value + 6, "realm", c->realm, sizeof(c->realm));
+        GetAuthParam(value + 6, "nonce", c->nonce, sizeof(c->nonce));
+        if (!GetAuthParam(value + 6, "opaque", c->opaque, sizeof(c->opaque)))
+            c->opaque[0] = 0;
+        c->bQop = GetAuthParam(value + 6, "qop", qop, sizeof(qop))
+                  && strstr(qop, "auth") != NULL;
+        c->nc = 0;
+    }
+    else if (strncasecmp(value, "Basic", 5) == 0 && !c->bDigest)
+    {
+        c->bAuth = TRUE;
+    }
+}
+
+//解析一行回复头，line 已经去掉了\r\n
+static void ParseHeader(RtspClient *c, RtspReply *reply, char *line,
+                        int *contentLength)
+{
+    char *value = strchr(line, ':');
+    char *p;
+
+    if (value == NULL)
+        return;
+    *value++ = 0;
+    while (*value == ' ')
+        value++;
+
+    if (strcasecmp(line, "Content-Length") == 0)
+    {
+        *contentLength = atoi(value);
+    }
+    else if (strcasecmp(line, "Content-Base") == 0)
+    {
+        snprintf(reply->base, sizeof(reply->base), "%s", value);
+    }
+    else if (strcasecmp(line, "Session") == 0)
+    {
+        p = strchr(value, ';');
+        if (p)
+        {
+            *p++ = 0;
+            if ((p = strstr(p, "timeout=")) != NULL && atoi(p + 8) > 0)
+                c->sessionTimeout = atoi(p + 8);
+        }
+        snprintf(c->session, sizeof(c->session), "%s", value);
+    }
+    else if (strcasecmp(line, "Transport") == 0)
+    {
+        if ((p = strstr(value, "interleaved=")) != NULL)
+            c->channel = atoi(p + 12);
+    }
+    else if (strcasecmp(line, "WWW-Authenticate") == 0 && reply->status == 401)
+    {
+        ParseChallenge(c, value);
+    }
+}
+
+static void ConsumeRecv(RtspClient *c, int len)
+{
+    c->nRecv -= len;
+    if (c->nRecv > 0)
+        memmove(c->pRecv, c->pRecv + len, c->nRecv);
+}
+
+//回复头结束的位置(\r\n\r\n 之后)，不完整时返回-1
+static int FindHeaderEnd(const unsigned char *p, int size)
+{
+    int i;
+    for (i = 0; i + 3 < size; i++)
+    {
+        if (p[i] == '\r' && p[i + 1] == '\n' && p[i + 2] == '\r' && p[i + 3] == '\n')
+            return i + 4;
+    }
+    return -1;
+}
+
+//解析接收缓冲区开头的一个完整回复，返回消耗的字节数，不完整时返回0
+static int ParseReply(RtspClient *c, RtspReply *reply)
+{
+    char header[4096];
+    char *line, *next;
+    int end, contentLength = 0;
+
+    end = FindHeaderEnd(c->pRecv, c->nRecv);
+    if (end < 0)
+        return 0;
+    if (end >= (int) sizeof(header))
+        return -1;
+    memcpy(header, c->pRecv, end);
+    header[end] = 0;
+
+    reply->status = 0;
+    reply->base[0] = 0;
+    reply->body[0] = 0;
+    if (sscanf(header, "RTSP/%*d.%*d %d", &reply->status) != 1)
+        return -1;
+    line = strstr(header, "\r\n") + 2;
+    while ((next = strstr(line, "\r\n")) != NULL && next != line)
+    {
+        *next = 0;
+        ParseHeader(c, reply, line, &contentLength);
+        line = next + 2;
+    }
+
+    if (contentLength < 0 || end + contentLength > RTSP_CLIENT_RECV_SIZE)
+        return -1;
+    if (c->nRecv < end + contentLength)
+        return 0;
+    if (contentLength >= (int) sizeof(reply->body))
+        contentLength = sizeof(reply->body) - 1;
+    memcpy(reply->body, c->pRecv + end, contentLength);
+    reply->body[contentLength] = 0;
+    return end + contentLength;
+}
+
+//读一个回复，跳过前面的interleaved 数据，返回状态码，出错返回-1
+static int ReadReply(RtspClient *c, RtspReply *reply, unsigned int deadline)
+{
+    int n, len;
+
+    while (TRUE)
+    {
+        while (c->nRecv >= 4 && c->pRecv[0] == '$')
+        {
+            len = 4 + ((c->pRecv[2] << 8) | c->pRecv[3]);
+            if (c->nRecv < len)
+                break;
+            ConsumeRecv(c, len);
+        }
+        if (c->nRecv > 0 && c->pRecv[0] != '$')
+        {
+            n = ParseReply(c, reply);
+            if (n < 0)
+            {
+                LOGE("RTSP bad reply! %s", c->url);
+                return -1;
+            }
+            if (n > 0)
+            {
+                //PLAY 之后紧跟的RTP 留在缓冲区中
+                ConsumeRecv(c, n);
+                return reply->status;
+            }
+        }
+
+        if (c->nRecv == RTSP_CLIENT_RECV_SIZE || !WaitFd(c->fd, POLLIN, deadline))
+        {
+            LOGE("RTSP wait reply timeout! %s", c->url);
+            return -1;
+        }
+        n = recv(c->fd, c->pRecv + c->nRecv, RTSP_CLIENT_RECV_SIZE - c->nRecv, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            LOGE("RTSP connection closed! %s errno:%d", c->url, errno);
+            return -1;
+        }
+        if (n > 0)
+            c->nRecv += n;
+    }
+}
+
+static BOOL SendRequest(RtspClient *c, const char *method, const char *uri,
+                        const char *headers, unsigned int deadline)
+{
+    char buf[2048], auth[1024], session[160];
+    int len;
+
+    MakeAuth(c, method, uri, auth, sizeof(auth));
+    session[0] = 0;
+    if (c->session[0])
+        snprintf(session, sizeof(session), "Session: %s\r\n", c->session);
+    len = snprintf(buf, sizeof(buf), "%s %s RTSP/1.0\r\nCSeq: %d\r\n"
+                   "User-Agent: %s\r\n%s%s%s\r\n", method, uri, ++c->cseq,
+                   RTSP_USER_AGENT, session, auth, headers ? headers : "");
+    if (len >= (int) sizeof(buf))
+        return FALSE;
+    return SendAll(c, buf, len, deadline);
+}
+
+//收到401 后用服务器给的challenge 再发一次
+static int Request(RtspClient *c, const char *method, const char *uri,
+                   const char *headers, RtspReply *reply, unsigned int deadline)
+{
+    int status = -1, retry;
+
+    for (retry = 0; retry < 2; retry++)
+    {
+        if (!SendRequest(c, method, uri, headers, deadline))
+            return -1;
+        status = ReadReply(c, reply, deadline);
+        if (status != 401 || !c->bAuth || !c->user[0])
+            break;
+    }
+    return status;
+}
+
+//把fmtp 中key 的值(逗号分隔的base64)解码后加到sprop，每个nal 前加起始码
+static void AddSprop(RtspClient *c, const char *fmtp, const char *key)
+{
+    const char *p = strstr(fmtp, key);
+    char b64[512];
+    int len, n;
+
+    if (p == NULL)
+        return;
+    p += strlen(key);
+    while (*p && *p != ';' && *p != ' ')
+    {
+        len = strcspn(p, ",; ");
+        if (len > 0 && len < (int) sizeof(b64)
+                && c->spropSize + 4 < RTSP_CLIENT_SPROP_SIZE)
+        {
+            memcpy(b64, p, len);
+            b64[len] = 0;
+            n = av_base64_decode(c->sprop + c->spropSize + 4, b64,
+                                 RTSP_CLIENT_SPROP_SIZE - c->spropSize - 4);
+            if (n > 0)
+            {
+                memset(c->sprop + c->spropSize, 0, 3);
+                c->sprop[c->spropSize + 3] = 1;
+                c->spropSize += 4 + n;
+            }
+        }
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+}
+
+static void ParseMediaLine(RtspClient *c, const char *line, char *control,
+                           int controlSize)
+{
+    char name[32];
+    float rate;
+    int pt, clock, w, h;
+
+    if (sscanf(line, "a=rtpmap:%d %31[^/]/%d", &pt, name, &clock) == 3
+            && pt == c->payloadType)
+    {
+        if (strcasecmp(name, "H264") == 0)
+            c->codec = VIDEO_CODEC_H264;
+        else if (strcasecmp(name, "H265") == 0 || strcasecmp(name, "HEVC") == 0)
+            c->codec = VIDEO_CODEC_HEVC;
+        c->clockRate = clock > 0 ? clock : 90000;
+    }
+    else if (sscanf(line, "a=fmtp:%d", &pt) == 1 && pt == c->payloadType)
+    {
+        AddSprop(c, line, "sprop-vps=");
+        AddSprop(c, line, "sprop-sps=");
+        AddSprop(c, line, "sprop-pps=");
+        AddSprop(c, line, "sprop-parameter-sets=");
+    }
+    else if (strncmp(line, "a=control:", 10) == 0)
+    {
+        snprintf(control, controlSize, "%s", line + 10);
+    }
+    else if (sscanf(line, "a=framerate:%f", &rate) == 1
+             || sscanf(line, "a=x-framerate:%f", &rate) == 1)
+    {
+        c->rate = (int) (rate + 0.5f);
+    }
+    else if (sscanf(line, "a=x-dimensions:%d,%d", &w, &h) == 2
+             || sscanf(line, "a=framesize:%*d %d-%d", &w, &h) == 2)
+    {
+        c->width = w;
+        c->height = h;
+    }
+}
+
+//取第一个视频流的参数，control 返回SETUP 用的url
+static BOOL ParseSdp(RtspClient *c, const char *sdp, const char *base,
+                     char *control, int controlSize)
+{
+    char line[2048], ctl[512] = { 0 };
+    const char *p = sdp, *next;
+    BOOL bVideo = FALSE, bFound = FALSE;
+    int len;
+
+    while (*p)
+    {
+        next = strchr(p, '\n');
+        len = next ? (int) (next - p) : (int) strlen(p);
+        if (len >= (int) sizeof(line))
+            len = sizeof(line) - 1;
+        memcpy(line, p, len);
+        line[len] = 0;
+        if (len > 0 && line[len - 1] == '\r')
+            line[len - 1] = 0;
+        p = next ? next + 1 : p + strlen(p);
+
+        if (strncmp(line, "m=", 2) == 0)
+        {
+            if (bFound)
+                break;
+            bVideo = sscanf(line, "m=video %*s %*s %d", &c->payloadType) == 1;
+            bFound = bVideo;
+        }
+        else if (bVideo)
+        {
+            ParseMediaLine(c, line, ctl, sizeof(ctl));
+        }
+    }
+    if (!bFound || c->codec < 0)
+    {
+        LOGE("RTSP no H264/H265 video in sdp! %s", c->url);
+        return FALSE;
+    }
+
+    if (ctl[0] == 0 || strcmp(ctl, "*") == 0)
+        snprintf(control, controlSize, "%s", base);
+    else if (strncasecmp(ctl, "rtsp://", 7) == 0)
+        snprintf(control, controlSize, "%s", ctl);
+    else
+        snprintf(control, controlSize, "%s%s%s", base,
+                 base[strlen(base) - 1] == '/' ? "" : "/", ctl);
+    return TRUE;
+}
+
+BOOL RtspClientOpen(RtspClient **pc, const char *url, int timeoutMs)
+{
+    char proto[16], auth[256], host[256], path[512];
+    char base[512], control[512];
+    char *p;
+    RtspReply *reply = NULL;
+    unsigned int deadline = GetTickMs() + timeoutMs;
+    int port, status;
+    RtspClient *c = (RtspClient *) calloc(1, sizeof(RtspClient));
+
+    if (c == NULL)
+        return FALSE;
+    c->fd = -1;
+    c->codec = -1;
+    c->clockRate = 90000;
+    c->sessionTimeout = RTSP_CLIENT_KEEPALIVE;
+    c->nAuCapacity = RTSP_CLIENT_AU_SIZE;
+    c->pRecv = (unsigned char *) malloc(RTSP_CLIENT_RECV_SIZE);
+    c->pAu = (unsigned char *) malloc(RTSP_CLIENT_AU_SIZE);
+    reply = (RtspReply *) malloc(sizeof(RtspReply));
+    if (c->pRecv == NULL || c->pAu == NULL || reply == NULL)
+    {
+        LOGE("Alloc RtspClient error!");
+        goto error;
+    }
+
+    av_url_split(proto, sizeof(proto), auth, sizeof(auth), host, sizeof(host),
+                 &port, path, sizeof(path), url);
+    if (strcmp(proto, "rtsp") != 0 || host[0] == 0)
+    {
+        LOGE("RtspClient only support rtsp:// url!");
+        goto error;
+    }
+    if (port < 0)
+        port = RTSP_DEFAULT_PORT;
+    p = strchr(auth, ':');
+    if (p)
+    {
+        *p++ = 0;
+        UrlDecode(c->pass, p, sizeof(c->pass));
+    }
+    UrlDecode(c->user, auth, sizeof(c->user));
+    snprintf(c->url, sizeof(c->url), strchr(host, ':') ? "rtsp://[%s]:%d%s"
+             : "rtsp://%s:%d%s", host, port, path);
+
+    if (!ConnectHost(c, host, port, deadline))
+        goto error;
+
+    status = Request(c, "DESCRIBE", c->url, "Accept: application/sdp\r\n",
+                     reply, deadline);
+    if (status != 200)
+    {
+        LOGE("RTSP DESCRIBE failed! status:%d %s", status, c->url);
+        goto error;
+    }
+    snprintf(base, sizeof(base), "%s", reply->base[0] ? reply->base : c->url);
+    if (!ParseSdp(c, reply->body, base, control, sizeof(control)))
+        goto error;
+
+    c->channel = 0;
+    status = Request(c, "SETUP", control,
+                     "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n",
+                     reply, deadline);
+    if (status != 200 || c->session[0] == 0)
+    {
+        LOGE("RTSP SETUP failed! status:%d %s", status, control);
+        goto error;
+    }
+
+    status = Request(c, "PLAY", base, "Range: npt=0.000-\r\n", reply, deadline);
+    if (status != 200)
+    {
+        LOGE("RTSP PLAY failed! status:%d %s", status, base);
+        goto error;
+    }
+
+    LOGI("RTSP open %s codec:%d pt:%d channel:%d sprop:%d\n", c->url, c->codec,
+         c->payloadType, c->channel, c->spropSize);
+    c->lastRecv = c->lastKeepAlive = GetTickMs();
+    free(reply);
+    *pc = c;
+    return TRUE;
+
+error:
+    free(reply);
+    RtspClientClose(c);
+    return FALSE;
+}
+
+static BOOL IsKeyNal(RtspClient *c, const unsigned char *nal)
+{
+    int type;
+    if (c->codec == VIDEO_CODEC_HEVC)
+    {
+        type = HEVC_NAL_TYPE(nal);
+        return type >= HEVC_NAL_BLA_W_LP && type <= 23;
+    }
+    return (nal[0] & 0x1f) == NAL_SLICE_IDR;
+}
+
+static BOOL ReserveAu(RtspClient *c, int size)
+{
+    unsigned char *p;
+    int capacity = c->nAuCapacity;
+
+    if (c->nAu + size <= capacity)
+        return TRUE;
+    while (capacity < c->nAu + size)
+        capacity *= 2;
+    if (capacity > RTSP_CLIENT_AU_MAX)
+        return FALSE;
+    p = (unsigned char *) realloc(c->pAu, capacity);
+    if (p == NULL)
+        return FALSE;
+    c->pAu = p;
+    c->nAuCapacity = capacity;
+    return TRUE;
+}
+
+static void AppendData(RtspClient *c, const unsigned char *data, int size)
+{
+    if (c->bAuBroken)
+        return;
+    if (!ReserveAu(c, size))
+    {
+        c->bAuBroken = TRUE;
+        return;
+    }
+    memcpy(c->pAu + c->nAu, data, size);
+    c->nAu += size;
+}
+
+//写起始码和nal 头，分片的nal 只有重建的头
+static void StartNal(RtspClient *c, const unsigned char *nal, int size)
+{
+    static const unsigned char startCode[4] = { 0, 0, 0, 1 };
+    if (IsKeyNal(c, nal))
+        c->bAuKey = TRUE;
+    AppendData(c, startCode, 4);
+    AppendData(c, nal, size);
+}
+
+//STAP-A/AP: 每个nal 前有2字节长度
+static void AppendAggregate(RtspClient *c, const unsigned char *p, int size)
+{
+    int n;
+    while (size > 2)
+    {
+        n = (p[0] << 8) | p[1];
+        p += 2;
+        size -= 2;
+        if (n == 0 || n > size)
+        {
+            c->bAuBroken = TRUE;
+            return;
+        }
+        StartNal(c, p, n);
+        p += n;
+        size -= n;
+    }
+}
+
+static void DepacketH264(RtspClient *c, const unsigned char *p, int size)
+{
+    unsigned char header;
+    int type = p[0] & 0x1f;
+
+    if (type >= 1 && type <= 23)
+    {
+        StartNal(c, p, size);
+    }
+    else if (type == RTP_H264_STAP_A)
+    {
+        AppendAggregate(c, p + 1, size - 1);
+    }
+    else if (type == RTP_H264_FU_A && size > 2)
+    {
+        if (p[1] & 0x80)
+        {
+            header = (p[0] & 0xe0) | (p[1] & 0x1f);
+            StartNal(c, &header, 1);
+            c->bFu = TRUE;
+        }
+        else if (!c->bFu)
+        {
+            c->bAuBroken = TRUE;
+            return;
+        }
+        AppendData(c, p + 2, size - 2);
+        if (p[1] & 0x40)
+            c->bFu = FALSE;
+    }
+}
+
+//没有处理DONL，sprop-max-don-diff 不为0 的流不支持
+static void DepacketHevc(RtspClient *c, const unsigned char *p, int size)
+{
+    unsigned char header[2];
+    int type;
+
+    if (size < 3)
+        return;
+    type = HEVC_NAL_TYPE(p);
+    if (type < RTP_HEVC_AP)
+    {
+        StartNal(c, p, size);
+    }
+    else if (type == RTP_HEVC_AP)
+    {
+        AppendAggregate(c, p + 2, size - 2);
+    }
+    else if (type == RTP_HEVC_FU && size > 3)
+    {
+        if (p[2] & 0x80)
+        {
+            header[0] = (p[0] & 0x81) | ((p[2] & 0x3f) << 1);
+            header[1] = p[1];
+            StartNal(c, header, 2);
+            c->bFu = TRUE;
+        }
+        else if (!c->bFu)
+        {
+            c->bAuBroken = TRUE;
+            return;
+        }
+        AppendData(c, p + 3, size - 3);
+        if (p[2] & 0x40)
+            c->bFu = FALSE;
+    }
+}
+
+//RTP 时间戳扩展到64位后换成ms
+static int TsToTick(RtspClient *c, uint32_t ts)
+{
+    if (!c->bTs)
+    {
+        c->bTs = TRUE;
+        c->extTs = 0;
+    }
+    else
+    {
+        c->extTs += (int32_t) (ts - c->lastTs);
+    }
+    c->lastTs = ts;
+    return (int) (c->extTs * 1000 / c->clockRate);
+}
+
+static void FlushAu(RtspClient *c, RtspFrameCallback pfnFrame, void *ctx)
+{
+    RtspFrame frame;
+
+    if (c->nAu > 0 && !c->bAuBroken)
+    {
+        frame.data = c->pAu;
+        frame.size = c->nAu;
+        frame.tick = TsToTick(c, c->auTs);
+        frame.bKey = c->bAuKey;
+        pfnFrame(ctx, &frame);
+    }
+    else if (c->bAuBroken)
+    {
+        c->nDropAu++;
+    }
+    c->nAu = 0;
+    c->bAuKey = FALSE;
+    c->bAuBroken = FALSE;
+    c->bFu = FALSE;
+}
+
+static void HandleRtp(RtspClient *c, const unsigned char *p, int len,
+                      RtspFrameCallback pfnFrame, void *ctx)
+{
+    int header;
+    uint16_t seq;
+    uint32_t ts;
+    BOOL bGap;
+
+    if (len < 12 || (p[0] >> 6) != 2 || (p[1] & 0x7f) != c->payloadType)
+        return;
+    header = 12 + (p[0] & 0x0f) * 4;
+    if (p[0] & 0x10)
+    {
+        if (len < header + 4)
+            return;
+        header += 4 + ((p[header + 2] << 8) | p[header + 3]) * 4;
+    }
+    if (p[0] & 0x20)
+        len -= p[len - 1];
+    if (len <= header)
+        return;
+    seq = (p[2] << 8) | p[3];
+    ts = ((uint32_t) p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+
+    bGap = c->bSeq && seq != (uint16_t) (c->seq + 1);
+    if (bGap)
+        c->nLost += (uint16_t) (seq - c->seq - 1);
+    c->seq = seq;
+    c->bSeq = TRUE;
+
+    //时间戳变了说明上一个访问单元的最后一个包丢了
+    if (ts != c->auTs && (c->nAu > 0 || c->bAuBroken))
+    {
+        c->bAuBroken |= bGap;
+        FlushAu(c, pfnFrame, ctx);
+    }
+    else if (bGap)
+    {
+        c->bAuBroken = TRUE;
+    }
+    c->auTs = ts;
+
+    if (c->codec == VIDEO_CODEC_HEVC)
+        DepacketHevc(c, p + header, len - header);
+    else
+        DepacketH264(c, p + header, len - header);
+
+    if (p[1] & 0x80)
+        FlushAu(c, pfnFrame, ctx);
+}
+
+//缓冲区开头是保活请求的回复时返回它的长度，不完整返回0，不是回复返回-1
+static int SkipReply(RtspClient *c, const unsigned char *p, int size)
+{
+    int i, end, contentLength = 0;
+
+    if (size < 5)
+        return memcmp(p, "RTSP/", size) == 0 ? 0 : -1;
+    if (memcmp(p, "RTSP/", 5) != 0)
+        return -1;
+    end = FindHeaderEnd(p, size);
+    if (end < 0)
+        return 0;
+    for (i = 1; i + 15 < end; i++)
+    {
+        if (p[i - 1] == '\n'
+                && strncasecmp((const char *) p + i, "Content-Length:", 15) == 0)
+        {
+            contentLength = atoi((const char *) p + i + 15);
+            break;
+        }
+    }
+    if (contentLength < 0 || end + contentLength > RTSP_CLIENT_RECV_SIZE)
+        return -1;
+    return size >= end + contentLength ? end + contentLength : 0;
+}
+
+BOOL RtspClientRead(RtspClient *c, RtspFrameCallback pfnFrame, void *ctx)
+{
+    const unsigned char *p, *q;
+    int n, pos = 0, len;
+
+    //放不下一个完整的帧，只能是数据错了
+    if (c->nRecv == RTSP_CLIENT_RECV_SIZE)
+    {
+        LOGE("RTSP receive buffer overflow! %s", c->url);
+        c->nRecv = 0;
+        c->bAuBroken = TRUE;
+    }
+    n = recv(c->fd, c->pRecv + c->nRecv, RTSP_CLIENT_RECV_SIZE - c->nRecv, 0);
+    if (n == 0)
+    {
+        LOGE("RTSP connection closed by server! %s", c->url);
+        return FALSE;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        LOGE("RTSP recv error! %s errno:%d", c->url, errno);
+        return FALSE;
+    }
+    if (n > 0)
+    {
+        c->nRecv += n;
+        c->lastRecv = GetTickMs();
+    }
+
+    while (pos < c->nRecv)
+    {
+        p = c->pRecv + pos;
+        if (p[0] == '$')
+        {
+            if (c->nRecv - pos < 4)
+                break;
+            len = (p[2] << 8) | p[3];
+            if (c->nRecv - pos < 4 + len)
+                break;
+            //RTCP 不处理
+            if (p[1] == c->channel)
+                HandleRtp(c, p + 4, len, pfnFrame, ctx);
+            pos += 4 + len;
+            continue;
+        }
+        len = SkipReply(c, p, c->nRecv - pos);
+        if (len == 0)
+            break;
+        if (len > 0)
+        {
+            pos += len;
+            continue;
+        }
+        //不认识的数据，找下一个'$' 重新同步
+        q = (const unsigned char *) memchr(p + 1, '$', c->nRecv - pos - 1);
+        pos = q ? (int) (q - c->pRecv) : c->nRecv;
+        c->bAuBroken = TRUE;
+    }
+    ConsumeRecv(c, pos);
+    return TRUE;
+}
+
+BOOL RtspClientKeepAlive(RtspClient *c)
+{
+    unsigned int now = GetTickMs();
+
+    if ((int) (now - c->lastKeepAlive) < c->sessionTimeout * 1000 / 2)
+        return TRUE;
+    c->lastKeepAlive = now;
+    return SendRequest(c, "OPTIONS", c->url, NULL, now + RTSP_SEND_TIMEOUT_MS);
+}
+
+void RtspClientClose(RtspClient *c)
+{
+    if (c == NULL)
+        return;
+    if (c->fd >= 0)
+    {
+        //不等回复，发不出去也不管
+        if (c->session[0])
+            SendRequest(c, "TEARDOWN", c->url, NULL, GetTickMs());
+        close(c->fd);
+    }
+    free(c->pRecv);
+    free(c->pAu);
+    free(c);
+}
@@ -0,0 +1,92 @@
+#ifndef __RTSPCLIENT_H
+#define __RTSPCLIENT_H
+
+#include <stdint.h>
+
+#include "platform.h"
+
+#define RTSP_CLIENT_RECV_SIZE   (128 * 1024) //接收缓冲，能放下最大的interleaved 帧(4+65535)
+#define RTSP_CLIENT_AU_SIZE     (256 * 1024) //访问单元缓冲的初始大小，不够时翻倍
+#define RTSP_CLIENT_AU_MAX      (8 * 1024 * 1024) //超过的访问单元丢弃
+#define RTSP_CLIENT_SPROP_SIZE  1024
+#define RTSP_CLIENT_KEEPALIVE   60 //服务器没给Session timeout 时的默认值，s
+
+//一个完整的访问单元，Annex-B 格式(4字节起始码)，data 指向客户端内部的缓冲区，
+//只在回调中有效
+typedef struct RtspFrame
+{
+    unsigned char *data;
+    int size;
+    int tick; //ms，第一个访问单元为0，有B 帧时可能为负
+    BOOL bKey;
+} RtspFrame;
+
+typedef void (*RtspFrameCallback)(void *ctx, RtspFrame *frame);
+
+//只拉一路视频的RTSP 客户端，RTP over TCP(interleaved)，不经过libavformat。
+//握手是阻塞的，之后socket 为非阻塞，由调用者在socket 可读时调用RtspClientRead
+typedef struct RtspClient
+{
+    int fd;
+    char url[512]; //去掉了用户名密码
+    char user[128];
+    char pass[128];
+    int cseq;
+    char session[128];
+    int sessionTimeout; //s
+    //鉴权，收到401 后记下，之后每个请求都带上
+    BOOL bAuth;
+    BOOL bDigest;
+    char realm[128];
+    char nonce[128];
+    char opaque[128];
+    BOOL bQop;
+    unsigned int nc;
+    //SDP 中第一个视频流
+    int codec; //VIDEO_CODEC_H264/VIDEO_CODEC_HEVC
+    int payloadType;
+    int clockRate;
+    int width; //SDP 中没有时为0
+    int height;
+    int rate;
+    unsigned char sprop[RTSP_CLIENT_SPROP_SIZE]; //SDP 中的vps/sps/pps，Annex-B
+    int spropSize;
+    int channel; //RTP 的interleaved 通道，RTCP 为channel + 1
+    //接收
+    unsigned char *pRecv;
+    int nRecv;
+    unsigned int lastRecv; //GetTickMs
+    unsigned int lastKeepAlive;
+    //重组
+    unsigned char *pAu;
+    int nAu;
+    int nAuCapacity;
+    BOOL bAuKey;
+    BOOL bAuBroken; //丢包或者太大，整个访问单元丢弃
+    BOOL bFu; //分片进行中
+    uint32_t auTs;
+    uint16_t seq;
+    BOOL bSeq;
+    uint32_t lastTs;
+    int64_t extTs; //扩展到64位的RTP 时间戳，第一个包为0
+    BOOL bTs;
+    //统计
+    unsigned int nLost;
+    unsigned int nDropAu;
+} RtspClient;
+
+//连接、DESCRIBE、SETUP、PLAY，支持Basic 和Digest 鉴权，用户名密码取自url。
+//只支持H264/H265，timeoutMs 是整个握手的超时
+BOOL RtspClientOpen(RtspClient **c, const char *url, int timeoutMs);
+
+//读socket 中现有的数据，每得到一个完整的访问单元调用一次pfnFrame。
+//返回FALSE 表示连接已断开或者出错
+BOOL RtspClientRead(RtspClient *c, RtspFrameCallback pfnFrame, void *ctx);
+
+//到时间时发送OPTIONS 保持会话，回复在RtspClientRead 中跳过
+BOOL RtspClientKeepAlive(RtspClient *c);
+
+//发送TEARDOWN(不等回复)，关闭并释放
+void RtspClientClose(RtspClient *c);
+
+#endif
@@ -0,0 +1,833 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "sendqueue.h"
+#include "publisher.h"
+
+//普通RTMP 连接直接用sendmsg 把chunk 头和data 一起发出去，rtmpt/rtmps 走librtmp
+BOOL SendPacket(RTMP *pRtmp, unsigned int nPacketType, unsigned char *data,
+                unsigned int size, unsigned int nTimestamp)
+{
+    if (pRtmp == NULL)
+    {
+        LOGE("SendPacket pRtmp == NULL!\n");
+        return FALSE;
+    }
+
+    if (!RTMP_IsConnected(pRtmp))
+    {
+        LOGE( "RTMP_IsConnected error!\n");
+    }
+
+    if (!(pRtmp->Link.protocol & (RTMP_FEATURE_HTTP | RTMP_FEATURE_SSL)))
+        return ChunkSendMessage(pRtmp->m_sb.sb_socket, nPacketType, nTimestamp,
+                                pRtmp->m_stream_id, data, size,
+                                pRtmp->m_outChunkSize);
+
+    //RTMP_SendPacket 会改写每个chunk 之前的字节，共享的帧要先拷贝
+    unsigned char *copy = (unsigned char *) malloc(RTMP_MAX_HEADER_SIZE + size);
+    if (!copy)
+    {
+        LOGE("SendPacket alloc error! size:%u\n", size);
+        return FALSE;
+    }
+    memcpy(copy + RTMP_MAX_HEADER_SIZE, data, size);
+
+    RTMPPacket packet;
+    RTMPPacket_Reset(&packet);
+
+    packet.m_hasAbsTimestamp = 1;
+
+    packet.m_packetType = nPacketType;
+    packet.m_nChannel = CHUNK_STREAM_ID;
+    packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+    packet.m_nTimeStamp = nTimestamp;
+    packet.m_nInfoField2 = pRtmp->m_stream_id;
+    packet.m_nBodySize = size;
+    packet.m_chunk = NULL;
+    packet.m_body = (char *) copy + RTMP_MAX_HEADER_SIZE;
+
+    int nRet = RTMP_SendPacket(pRtmp, &packet, 0);
+    free(copy);
+    if (!nRet)
+    {
+        LOGE( "RTMP_SendPacket error \n");
+        return FALSE;
+    }
+    return nRet;
+}
+
+//发送Set Chunk Size 控制消息，之后的消息按新的大小切chunk
+static BOOL SendChunkSize(RTMP *pRtmp, int nChunkSize)
+{
+    char pbuf[RTMP_MAX_HEADER_SIZE + 4];
+    char *body = pbuf + RTMP_MAX_HEADER_SIZE;
+    RTMPPacket packet;
+
+    RTMPPacket_Reset(&packet);
+    packet.m_packetType = RTMP_PACKET_TYPE_CHUNK_SIZE;
+    packet.m_nChannel = 0x02; //协议控制消息
+    packet.m_headerType = RTMP_PACKET_SIZE_LARGE;
+    packet.m_nTimeStamp = 0;
+    packet.m_nInfoField2 = 0;
+    packet.m_hasAbsTimestamp = 0;
+    packet.m_nBodySize = 4;
+    packet.m_body = body;
+    body[0] = (nChunkSize >> 24) & 0x7f;
+    body[1] = nChunkSize >> 16;
+    body[2] = nChunkSize >> 8;
+    body[3] = nChunkSize;
+
+    if (!RTMP_SendPacket(pRtmp, &packet, FALSE))
+    {
+        LOGE("SendChunkSize error! size:%d\n", nChunkSize);
+        return FALSE;
+    }
+    pRtmp->m_outChunkSize = nChunkSize;
+    return TRUE;
+}
+
+//连接q->url，失败返回NULL
+static RTMP *OpenRtmp(SendQueue *q)
+{
+    RTMP *m_pRtmp = RTMP_Alloc();
+    if (m_pRtmp == NULL)
+    {
+        LOGE( "RTMP_Alloc error \n");
+        return NULL;
+    }
+    RTMP_Init(m_pRtmp);
+    LOGI( "RTMP_Connect : %s \n", q->url);
+    m_pRtmp->Link.timeout = 5;
+    strcpy(q->urlBuf, q->url);
+    // if (!RTMP_SetupURL2(m_pRtmp, lpAnsiURL, lpAnsiPlaypath))
+    if (!RTMP_SetupURL(m_pRtmp, q->urlBuf))
+    {
+        LOGE( "RTMP_SetupURL error \n");
+        RTMP_Free(m_pRtmp);
+        return NULL;
+    }
+    RTMP_EnableWrite(m_pRtmp);
+
+    ////////////////////////////////////////////////////////////////////////
+    m_pRtmp->Link.swfUrl.av_len = m_pRtmp->Link.tcUrl.av_len;
+    m_pRtmp->Link.swfUrl.av_val = m_pRtmp->Link.tcUrl.av_val;
+    m_pRtmp->Link.flashVer.av_val = "FMLE/3.0 (compatible; FMSc/1.0)";
+    m_pRtmp->Link.flashVer.av_len = (int)strlen(m_pRtmp->Link.flashVer.av_val);
+
+    //m_pRtmp->m_bUseNagle = TRUE;
+
+    //------------------------------------------
+
+//    int tcpBufferSize = 64*1024;
+//
+//    int curTCPBufSize, curTCPBufSizeSize = sizeof(curTCPBufSize);
+//    getsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (char *)&curTCPBufSize, &curTCPBufSizeSize);
+//    printf("SO_SNDBUF was at %u", curTCPBufSize);
+//
+//    if(curTCPBufSize < tcpBufferSize)
+//    {
+//        setsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (const char *)&tcpBufferSize, sizeof(tcpBufferSize));
+//        getsockopt (m_pRtmp->m_sb.sb_socket, SOL_SOCKET, SO_SNDBUF, (char *)&curTCPBufSize, &curTCPBufSizeSize);
+//        if(curTCPBufSize != tcpBufferSize)
+//            printf("Could not set SO_SNDBUF to %u, value is now %u", tcpBufferSize, curTCPBufSize);
+//    }
+//
+//    printf("SO_SNDBUF is now %u", tcpBufferSize);
+
+    //------------------------------------------
+
+    ////////////////////////////////////////////////////////////////////////
+
+    RTMP_SetBufferMS(m_pRtmp, 3600 * 1000);
+    if (!RTMP_Connect(m_pRtmp, NULL))
+    {
+        LOGE( "RTMP_Connect error \n");
+        RTMP_Free(m_pRtmp);
+        return NULL;
+    }
+    if (!RTMP_ConnectStream(m_pRtmp, 0))
+    {
+        LOGE( "RTMP_ConnectStream error \n");
+        RTMP_Close(m_pRtmp);
+        RTMP_Free(m_pRtmp);
+        return NULL;
+    }
+    //默认128 字节的chunk 太小，协商失败就继续用默认值
+    SendChunkSize(m_pRtmp, CHUNK_OUT_SIZE);
+    return m_pRtmp;
+}
+
+static void CloseRtmp(SendQueue *q)
+{
+    if (q->pRtmp)
+    {
+        RTMP_Close(q->pRtmp);
+        RTMP_Free(q->pRtmp);
+        q->pRtmp = NULL;
+    }
+}
+
+static void ClearItem(SendItem *item)
+{
+    UnrefFrameBuf(item->pFrame);
+    item->pFrame = NULL;
+}
+
+static void SetItem(SendItem *item, FrameBuf *f, unsigned int packetType,
+                    unsigned int timestamp, unsigned int flags)
+{
+    item->packetType = packetType;
+    item->timestamp = timestamp;
+    item->flags = flags;
+    item->pFrame = RefFrameBuf(f);
+    item->nTime = GetTickMs();
+}
+
+static void ClearGop(SendQueue *q)
+{
+    int i;
+    for (i = 0; i < q->nGop; i++)
+        ClearItem(&q->gop[i]);
+    q->nGop = 0;
+    q->nGopBytes = 0;
+}
+
+//调用者持有gopLock
+static void CacheItem(SendQueue *q, FrameBuf *f, unsigned int packetType,
+                      unsigned int timestamp, unsigned int flags)
+{
+    if (flags & SEND_ITEM_CONFIG)
+    {
+        SendItem *item = packetType == RTMP_PACKET_TYPE_INFO ? &q->meta
+                         : &q->seqHeader;
+        ClearItem(item);
+        SetItem(item, f, packetType, timestamp, flags);
+        //sps/pps 变了，之前的帧不能再用
+        ClearGop(q);
+        q->bGopValid = FALSE;
+        return;
+    }
+    if (flags & SEND_ITEM_KEYFRAME)
+    {
+        ClearGop(q);
+        q->bGopValid = TRUE;
+    }
+    if (!q->bGopValid)
+        return;
+    if (q->nGop == GOP_CACHE_FRAMES || q->nGopBytes + f->size > GOP_CACHE_BYTES)
+    {
+        ClearGop(q);
+        q->bGopValid = FALSE;
+        return;
+    }
+    SetItem(&q->gop[q->nGop++], f, packetType, timestamp, flags);
+    q->nGopBytes += f->size;
+}
+
+//重连后发送的时间戳，从重发的第一帧开始为0
+static unsigned int ItemTimestamp(SendQueue *q, SendItem *item)
+{
+    if (item->flags & SEND_ITEM_CONFIG)
+        return item->timestamp;
+    if (q->bRebase)
+    {
+        q->nTsBase = item->timestamp;
+        q->bRebase = FALSE;
+    }
+    return item->timestamp >= q->nTsBase ? item->timestamp - q->nTsBase : 0;
+}
+
+//等待ms 毫秒，队列释放时提前返回FALSE
+static BOOL WaitRunning(SendQueue *q, int ms)
+{
+    struct timespec ts;
+    BOOL bRunning;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&q->mutex);
+    if (q->bRunning)
+        pthread_cond_timedwait(&q->cond, &q->mutex, &ts);
+    bRunning = q->bRunning;
+    pthread_mutex_unlock(&q->mutex);
+    return bRunning;
+}
+
+//iovec 的总长度截到limit 字节，返回个数
+static int LimitIov(struct iovec *iov, int count, unsigned int limit)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (iov[i].iov_len >= limit)
+        {
+            iov[i].iov_len = limit;
+            return i + 1;
+        }
+        limit -= iov[i].iov_len;
+    }
+    return count;
+}
+
+static void HistAdd(unsigned int *hist, unsigned int ms)
+{
+    int k = ms == 0 ? 0 : 32 - __builtin_clz(ms);
+    __atomic_add_fetch(&hist[k < SEND_HIST_BUCKETS ? k : SEND_HIST_BUCKETS - 1], 1,
+                       __ATOMIC_RELAXED);
+}
+
+//队列中的一帧写完，start 是开始写的时间
+static void SendQueueOnSent(SendQueue *q, SendItem *item, unsigned int start)
+{
+    unsigned int now = GetTickMs();
+    __atomic_add_fetch(&q->nFramesSent, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&q->nBytesSent, item->pFrame->size, __ATOMIC_RELAXED);
+    HistAdd(q->histQueue, now - item->nTime);
+    HistAdd(q->histSend, now - start);
+}
+
+//阻塞地写完c，令牌不够时等待
+static BOOL SendCursorPaced(SendQueue *q, ChunkCursor *c, int fd)
+{
+    struct iovec iov[CHUNK_IOV_MAX];
+    struct msghdr msg;
+    unsigned int n;
+    int ret, wait;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    while (TRUE)
+    {
+        n = CongestionTokens(&q->cc, c->total - c->wire, &wait);
+        if (n == 0)
+        {
+            if (!WaitRunning(q, wait))
+                return FALSE;
+            continue;
+        }
+        msg.msg_iovlen = LimitIov(iov, ChunkCursorFill(c, iov, CHUNK_IOV_MAX), n);
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOGE("RTMP sendmsg error! errno:%d\n", errno);
+            return FALSE;
+        }
+        CongestionConsume(&q->cc, ret);
+        CongestionOnWrite(&q->cc, fd, ret);
+        if (ChunkCursorAdvance(c, ret))
+            return TRUE;
+    }
+}
+
+//阻塞发送一帧，先读掉服务器的ack，回复ping，令牌不够时等待
+static BOOL SendItemPaced(SendQueue *q, SendItem *item, unsigned int ts)
+{
+    ChunkCursor c;
+    unsigned char ctrl[CONGESTION_CONTROL_SIZE];
+    unsigned int n;
+    int fd = q->pRtmp->m_sb.sb_socket;
+
+    if (!CongestionReadInput(&q->cc, fd))
+    {
+        LOGE("RTMP connection closed by server! fd:%d\n", fd);
+        return FALSE;
+    }
+    while ((n = CongestionControl(&q->cc, ctrl)) > 0)
+    {
+        ChunkCursorInit(&c, RTMP_PACKET_TYPE_CONTROL, 0, 0, ctrl, n,
+                        q->pRtmp->m_outChunkSize);
+        if (!SendCursorPaced(q, &c, fd))
+            return FALSE;
+    }
+    ChunkCursorInit(&c, item->packetType, ts, q->pRtmp->m_stream_id,
+                    item->pFrame->body, item->pFrame->size,
+                    q->pRtmp->m_outChunkSize);
+    if (!SendCursorPaced(q, &c, fd))
+        return FALSE;
+    if (!(item->flags & SEND_ITEM_CONFIG))
+        CongestionOnFrame(&q->cc, item->timestamp);
+    return TRUE;
+}
+
+static BOOL SendItemBlocking(SendQueue *q, SendItem *item)
+{
+    unsigned int ts = ItemTimestamp(q, item);
+    //rtmpt/rtmps 不能直接读写socket
+    if (q->pRtmp->Link.protocol & (RTMP_FEATURE_HTTP | RTMP_FEATURE_SSL))
+        return SendPacket(q->pRtmp, item->packetType, item->pFrame->body,
+                          item->pFrame->size, ts);
+    return SendItemPaced(q, item, ts);
+}
+
+//丢掉队列中还没发的帧，先重发metadata、sequence header 和当前GOP。
+//队列中的帧都已经在GOP 缓存里，或者属于已经过去的GOP
+static BOOL ReplayGop(SendQueue *q)
+{
+    SendItem replay[GOP_CACHE_FRAMES + 2];
+    int i, n = 0;
+    BOOL bRet = TRUE;
+
+    pthread_mutex_lock(&q->gopLock);
+    while (q->head != q->tail)
+    {
+        ClearItem(&q->items[q->head & (SEND_QUEUE_SIZE - 1)]);
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+    }
+    if (q->meta.pFrame)
+    {
+        replay[n] = q->meta;
+        RefFrameBuf(replay[n++].pFrame);
+    }
+    if (q->seqHeader.pFrame)
+    {
+        replay[n] = q->seqHeader;
+        RefFrameBuf(replay[n++].pFrame);
+    }
+    for (i = 0; i < q->nGop; i++)
+    {
+        replay[n] = q->gop[i];
+        RefFrameBuf(replay[n++].pFrame);
+    }
+    //没有完整的GOP，后面的帧要等到下一个关键帧
+    q->bWaitIdr = !q->bGopValid;
+    q->bResendConfig = FALSE;
+    pthread_mutex_unlock(&q->gopLock);
+
+    q->bRebase = TRUE;
+    for (i = 0; i < n; i++)
+    {
+        if (bRet && !SendItemBlocking(q, &replay[i]))
+            bRet = FALSE;
+        ClearItem(&replay[i]);
+    }
+    return bRet;
+}
+
+//断线后按指数退避重连，连上后重发GOP。调用者是当前的消费者，socket 是阻塞的
+static BOOL ReconnectSendQueue(SendQueue *q)
+{
+    RTMP *pRtmp;
+    int backoff = RECONNECT_MIN_MS;
+
+    while (__atomic_load_n(&q->bRunning, __ATOMIC_ACQUIRE))
+    {
+        CloseRtmp(q);
+        pRtmp = OpenRtmp(q);
+        if (pRtmp)
+        {
+            q->pRtmp = pRtmp;
+            q->nReconnect++;
+            ResetCongestion(&q->cc);
+            CongestionAttach(&q->cc, pRtmp);
+            LOGI("RTMP reconnected! %s\n", q->url);
+            if (ReplayGop(q))
+                return TRUE;
+        }
+        if (!WaitRunning(q, backoff))
+            break;
+        backoff = backoff * 2 > RECONNECT_MAX_MS ? RECONNECT_MAX_MS : backoff * 2;
+    }
+    return FALSE;
+}
+
+static void *SendThread(void *arg)
+{
+    SendQueue *q = (SendQueue *) arg;
+    SendItem *item;
+    unsigned int start;
+
+    while (TRUE)
+    {
+        if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head)
+        {
+            pthread_mutex_lock(&q->mutex);
+            while (q->bRunning
+                    && __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head)
+            {
+                q->bWaiting = TRUE;
+                pthread_cond_wait(&q->cond, &q->mutex);
+            }
+            q->bWaiting = FALSE;
+            pthread_mutex_unlock(&q->mutex);
+        }
+        if (!__atomic_load_n(&q->bRunning, __ATOMIC_ACQUIRE))
+            break;
+
+        item = &q->items[q->head & (SEND_QUEUE_SIZE - 1)];
+        start = GetTickMs();
+        if (!SendItemBlocking(q, item))
+        {
+            q->nSendError++;
+            //重连时已经清空了队列
+            if (!ReconnectSendQueue(q))
+                break;
+            continue;
+        }
+        SendQueueOnSent(q, item, start);
+        ClearItem(item);
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static BOOL StartSendThread(SendQueue *q)
+{
+    if (pthread_create(&q->thread, NULL, SendThread, q) != 0)
+    {
+        LOGE("Create send thread error!");
+        return FALSE;
+    }
+    q->bThread = TRUE;
+    return TRUE;
+}
+
+static void *ReconnectThread(void *arg)
+{
+    SendQueue *q = (SendQueue *) arg;
+    BOOL bRet;
+
+    //从epoll 线程中拿下来，重连和重发期间由这个线程阻塞地发送
+    RemovePublisher(q);
+    bRet = ReconnectSendQueue(q);
+    if (bRet)
+    {
+        q->bBroken = FALSE;
+        q->bCursor = FALSE;
+        if (!AddPublisher(q) && !StartSendThread(q))
+            LOGE("RTMP reconnect can not resume sending! %s\n", q->url);
+    }
+
+    pthread_mutex_lock(&q->mutex);
+    q->bReconnecting = FALSE;
+    pthread_cond_broadcast(&q->cond);
+    if (q->pPublisher)
+        WakePublisher(q);
+    pthread_mutex_unlock(&q->mutex);
+    return NULL;
+}
+
+//epoll 线程发现连接断开后调用，另起线程重连，不阻塞epoll 线程
+static void StartReconnect(SendQueue *q)
+{
+    pthread_t thread;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->bRunning && !q->bReconnecting)
+    {
+        q->bReconnecting = TRUE;
+        if (pthread_create(&thread, NULL, ReconnectThread, q) == 0)
+        {
+            pthread_detach(thread);
+        }
+        else
+        {
+            LOGE("Create reconnect thread error!");
+            q->bReconnecting = FALSE;
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+}
+
+BOOL InitSendQueue(SendQueue **q, const char *url, BOOL bEventLoop,
+                   const SendOptions *opts)
+{
+    SendQueue *queue = (SendQueue *) calloc(1, sizeof(SendQueue));
+    if (!queue)
+    {
+        LOGE("Alloc SendQueue error!");
+        return FALSE;
+    }
+    snprintf(queue->url, sizeof(queue->url), "%s", url);
+    InitCongestion(&queue->cc, opts);
+    queue->pRtmp = OpenRtmp(queue);
+    if (queue->pRtmp == NULL)
+    {
+        free(queue);
+        return FALSE;
+    }
+    CongestionAttach(&queue->cc, queue->pRtmp);
+    queue->bRunning = TRUE;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    pthread_mutex_init(&queue->gopLock, NULL);
+    if (bEventLoop)
+    {
+        if (AddPublisher(queue))
+        {
+            *q = queue;
+            return TRUE;
+        }
+        LOGE("AddPublisher error, use send thread!");
+    }
+    if (!StartSendThread(queue))
+    {
+        CloseRtmp(queue);
+        pthread_mutex_destroy(&queue->mutex);
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->gopLock);
+        free(queue);
+        return FALSE;
+    }
+    *q = queue;
+    return TRUE;
+}
+
+unsigned int SendQueueDepth(SendQueue *q)
+{
+    return q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+
+//队列满时记录丢帧，并一直丢到下一个关键帧
+static void SendQueueDropFull(SendQueue *q)
+{
+    q->nDropGop++;
+    q->bWaitIdr = TRUE;
+}
+
+//按丢帧策略决定这一帧是否进队列
+static BOOL SendQueueAccept(SendQueue *q, unsigned int timestamp,
+                            unsigned int flags)
+{
+    unsigned int nTarget = q->cc.opts.nTargetLatency > 0 ? q->cc.opts.nTargetLatency : 0;
+    unsigned int nLatency = 0;
+
+    if (flags & SEND_ITEM_CONFIG)
+    {
+        if (SendQueueDepth(q) < SEND_QUEUE_SIZE)
+            return TRUE;
+        //已经进了缓存，补发之前的帧都用不了
+        q->bResendConfig = TRUE;
+        q->bWaitIdr = TRUE;
+        return FALSE;
+    }
+
+    if (nTarget > 0)
+        nLatency = CongestionLatency(&q->cc, timestamp, SendQueueDepth(q));
+    //队列满过，参考帧已经丢了，后面的帧要等到下一个关键帧
+    if (q->bWaitIdr)
+    {
+        //延迟还没降下来，关键帧也丢
+        if (!(flags & SEND_ITEM_KEYFRAME) || (nTarget > 0 && nLatency > nTarget))
+        {
+            q->nDropGop++;
+            return FALSE;
+        }
+        q->bWaitIdr = FALSE;
+    }
+    //补发的metadata 和sequence header 也要放得下
+    if (SendQueueDepth(q) + (q->bResendConfig ? 2 : 0) >= SEND_QUEUE_SIZE)
+    {
+        //网络跟不上，队列已满，丢掉这一帧和后面直到关键帧的所有帧
+        SendQueueDropFull(q);
+        return FALSE;
+    }
+    if (nTarget > 0 && nLatency > nTarget)
+    {
+        //延迟超过目标，丢掉剩下的GOP
+        q->nDropLatency++;
+        SendQueueDropFull(q);
+        return FALSE;
+    }
+    //先丢不被参考的帧，不影响后面的解码
+    if ((SendQueueDepth(q) >= SEND_QUEUE_HIGH_WATER || (nTarget > 0 && nLatency > nTarget / 2))
+            && !(flags & SEND_ITEM_REFERENCE))
+    {
+        q->nDropNonRef++;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//调用者持有gopLock
+static void PutItem(SendQueue *q, FrameBuf *f, unsigned int packetType,
+                    unsigned int timestamp, unsigned int flags)
+{
+    SetItem(&q->items[q->tail & (SEND_QUEUE_SIZE - 1)], f, packetType,
+            timestamp, flags);
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+BOOL SendQueuePush(SendQueue *q, FrameBuf *f, unsigned int packetType,
+                   unsigned int timestamp, unsigned int flags)
+{
+    BOOL bAccept;
+
+    pthread_mutex_lock(&q->gopLock);
+    CacheItem(q, f, packetType, timestamp, flags);
+    bAccept = SendQueueAccept(q, timestamp, flags);
+    if (bAccept)
+    {
+        //bWaitIdr 同时被设置，这里一定是关键帧
+        if (q->bResendConfig && !(flags & SEND_ITEM_CONFIG))
+        {
+            if (q->meta.pFrame)
+                PutItem(q, q->meta.pFrame, q->meta.packetType, q->meta.timestamp,
+                        q->meta.flags);
+            if (q->seqHeader.pFrame)
+                PutItem(q, q->seqHeader.pFrame, q->seqHeader.packetType,
+                        q->seqHeader.timestamp, q->seqHeader.flags);
+            q->bResendConfig = FALSE;
+        }
+        PutItem(q, f, packetType, timestamp, flags);
+    }
+    pthread_mutex_unlock(&q->gopLock);
+    if (!bAccept)
+    {
+        if (flags & SEND_ITEM_CONFIG)
+        {
+            LOGI("SendQueuePush queue full, resend config before next keyframe\n");
+            return TRUE;
+        }
+        return FALSE;
+    }
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->pPublisher)
+        WakePublisher(q);
+    else if (q->bWaiting)
+        pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return TRUE;
+}
+
+int SendQueueFlush(SendQueue *q)
+{
+    struct iovec iov[CHUNK_IOV_MAX];
+    struct msghdr msg;
+    SendItem *item;
+    unsigned int n;
+    int ret, wait;
+
+    //先清标记再读tail，之后提交的数据会再次唤醒
+    __atomic_exchange_n(&q->bReady, FALSE, __ATOMIC_SEQ_CST);
+    while (!q->bBroken)
+    {
+        item = &q->items[q->head & (SEND_QUEUE_SIZE - 1)];
+        if (!q->bCursor)
+        {
+            //消息之间先发ping/pong
+            n = CongestionControl(&q->cc, q->ctrl);
+            if (n > 0)
+            {
+                ChunkCursorInit(&q->cursor, RTMP_PACKET_TYPE_CONTROL, 0, 0,
+                                q->ctrl, n, q->pRtmp->m_outChunkSize);
+                q->bCtrl = TRUE;
+            }
+            else if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head)
+            {
+                break;
+            }
+            else
+            {
+                ChunkCursorInit(&q->cursor, item->packetType, ItemTimestamp(q, item),
+                                q->pRtmp->m_stream_id, item->pFrame->body,
+                                item->pFrame->size, q->pRtmp->m_outChunkSize);
+                q->bCtrl = FALSE;
+                q->nSendStart = GetTickMs();
+            }
+            q->bCursor = TRUE;
+        }
+        n = CongestionTokens(&q->cc, q->cursor.total - q->cursor.wire, &wait);
+        if (n == 0)
+            return wait; //令牌不够，epoll 线程到时间再来
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = LimitIov(iov, ChunkCursorFill(&q->cursor, iov, CHUNK_IOV_MAX), n);
+        ret = sendmsg(q->fd, &msg, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -1; //等EPOLLOUT
+            if (errno == EINTR)
+                continue;
+            LOGE("RTMP sendmsg error! errno:%d\n", errno);
+            q->nSendError++;
+            q->bBroken = TRUE;
+            break;
+        }
+        CongestionConsume(&q->cc, ret);
+        CongestionOnWrite(&q->cc, q->fd, ret);
+        if (ChunkCursorAdvance(&q->cursor, ret))
+        {
+            q->bCursor = FALSE;
+            if (q->bCtrl)
+                continue;
+            if (!(item->flags & SEND_ITEM_CONFIG))
+                CongestionOnFrame(&q->cc, item->timestamp);
+            SendQueueOnSent(q, item, q->nSendStart);
+            ClearItem(item);
+            __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (q->bBroken)
+        StartReconnect(q);
+    return -1;
+}
+
+void GetSendQueueStats(SendQueue *q, long long *stats)
+{
+    int i;
+    stats[0] = SendQueueDepth(q);
+    stats[1] = __atomic_load_n(&q->nDropNonRef, __ATOMIC_RELAXED);
+    stats[2] = __atomic_load_n(&q->nDropGop, __ATOMIC_RELAXED);
+    stats[3] = __atomic_load_n(&q->nDropLatency, __ATOMIC_RELAXED);
+    stats[4] = __atomic_load_n(&q->nSendError, __ATOMIC_RELAXED);
+    stats[5] = __atomic_load_n(&q->nReconnect, __ATOMIC_RELAXED);
+    stats[6] = __atomic_load_n(&q->cc.nLatency, __ATOMIC_RELAXED);
+    stats[7] = __atomic_load_n(&q->cc.nSocketDelay, __ATOMIC_RELAXED);
+    stats[8] = __atomic_load_n(&q->cc.nRate, __ATOMIC_RELAXED);
+    stats[9] = __atomic_load_n(&q->cc.nOutq, __ATOMIC_RELAXED);
+    stats[10] = __atomic_load_n(&q->cc.nAckWindow, __ATOMIC_RELAXED);
+    stats[11] = __atomic_load_n(&q->cc.nAcks, __ATOMIC_RELAXED);
+    stats[12] = __atomic_load_n(&q->nFramesSent, __ATOMIC_RELAXED);
+    stats[13] = __atomic_load_n(&q->nBytesSent, __ATOMIC_RELAXED);
+    stats[14] = __atomic_load_n(&q->cc.nRtt, __ATOMIC_RELAXED);
+    for (i = 0; i < SEND_HIST_BUCKETS; i++)
+    {
+        stats[SEND_STAT_QUEUE_HIST + i] = __atomic_load_n(&q->histQueue[i], __ATOMIC_RELAXED);
+        stats[SEND_STAT_SEND_HIST + i] = __atomic_load_n(&q->histSend[i], __ATOMIC_RELAXED);
+    }
+}
+
+BOOL FreeSendQueue(SendQueue *q)
+{
+    if (q)
+    {
+        //先等重连线程结束，之后pPublisher 和bThread 不会再变
+        pthread_mutex_lock(&q->mutex);
+        __atomic_store_n(&q->bRunning, FALSE, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&q->cond);
+        while (q->bReconnecting)
+            pthread_cond_wait(&q->cond, &q->mutex);
+        pthread_mutex_unlock(&q->mutex);
+
+        if (q->pPublisher)
+            RemovePublisher(q);
+        if (q->bThread)
+            pthread_join(q->thread, NULL);
+        CloseRtmp(q);
+
+        while (q->head != q->tail)
+            ClearItem(&q->items[q->head++ & (SEND_QUEUE_SIZE - 1)]);
+        ClearItem(&q->meta);
+        ClearItem(&q->seqHeader);
+        ClearGop(q);
+        pthread_mutex_destroy(&q->mutex);
+        pthread_cond_destroy(&q->cond);
+        pthread_mutex_destroy(&q->gopLock);
+        free(q);
+    }
+    return TRUE;
+}
@@ -0,0 +1,125 @@
+#ifndef __SENDQUEUE_H
+#define __SENDQUEUE_H
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "librtmp/rtmp.h"
+#include "chunk.h"
+#include "framebuf.h"
+#include "congestion.h"
+
+#define SEND_QUEUE_SIZE        32 //必须是2的幂
+#define SEND_QUEUE_HIGH_WATER  16 //超过后开始丢非参考帧
+
+#define SEND_ITEM_KEYFRAME   0x01 //IDR/I帧
+#define SEND_ITEM_REFERENCE  0x02 //nal_reference_idc != 0
+#define SEND_ITEM_CONFIG     0x04 //metadata/sequence header，不能丢
+
+#define GOP_CACHE_FRAMES     300 //GOP 缓存最多的帧数
+#define GOP_CACHE_BYTES      (4 * 1024 * 1024) //GOP 缓存最多的字节数，超过后到下一个关键帧前不缓存
+
+#define RECONNECT_MIN_MS     500 //断线重连的等待时间，每次失败翻倍
+#define RECONNECT_MAX_MS     8000
+
+#define RTMP_URL_SIZE        512
+
+#define SEND_HIST_BUCKETS    16 //延迟直方图，第0个桶是0ms，第k 个桶是[2^(k-1), 2^k) ms，最后一个桶包括更大的
+
+//发送队列中的一个RTMP 消息，持有pFrame 的一个引用
+typedef struct SendItem
+{
+    unsigned int packetType;
+    unsigned int timestamp;
+    unsigned int flags;
+    FrameBuf *pFrame;
+    unsigned int nTime; //进队列的GetTickMs
+} SendItem;
+
+struct Publisher;
+
+//单生产者(JNI 调用线程)单消费者(发送线程或epoll 线程)的环形队列。
+//同时缓存最新的metadata、sequence header 和当前GOP，断线重连后先重发这些
+typedef struct SendQueue
+{
+    SendItem items[SEND_QUEUE_SIZE];
+    unsigned int head; //消费者位置，只由发送线程写
+    unsigned int tail; //生产者位置，只由JNI 线程写
+    BOOL bWaitIdr; //队列满过，丢到下一个关键帧为止
+    BOOL bResendConfig; //metadata/sequence header 没放进队列，下一个关键帧之前补发缓存的
+    unsigned int nDropNonRef;
+    unsigned int nDropGop;
+    unsigned int nSendError;
+    unsigned int nReconnect;
+    unsigned int nDropLatency; //延迟超过目标丢掉GOP 的次数
+    //以下只由消费者写，统计读取时用原子操作
+    unsigned int nFramesSent;
+    unsigned long long nBytesSent;
+    unsigned int histQueue[SEND_HIST_BUCKETS]; //帧从进队列到写完的时间
+    unsigned int histSend[SEND_HIST_BUCKETS]; //帧从开始写到写完的时间
+    Congestion cc;
+    RTMP *pRtmp; //由队列所有，重连时替换
+    char url[RTMP_URL_SIZE];
+    char urlBuf[RTMP_URL_SIZE]; //RTMP_SetupURL 会修改url 并保存指向它的指针
+    BOOL bRunning;
+    BOOL bWaiting;
+    BOOL bThread; //有发送线程
+    BOOL bReconnecting; //epoll 模式下重连线程在运行
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    //GOP 缓存，生产者提交和重连后的截断都持有gopLock
+    pthread_mutex_t gopLock;
+    SendItem meta;
+    SendItem seqHeader;
+    SendItem gop[GOP_CACHE_FRAMES];
+    int nGop;
+    unsigned int nGopBytes;
+    BOOL bGopValid; //gop 从关键帧开始并且是完整的
+    //重连后时间戳从重发的第一帧开始算
+    BOOL bRebase;
+    unsigned int nTsBase;
+    //epoll 模式，没有发送线程
+    struct Publisher *pPublisher; //在mutex 下修改
+    int nPublisherSlot;
+    int fd;
+    BOOL bReady; //已经通知epoll 线程
+    BOOL bBroken; //连接已断开，等待重连
+    BOOL bCursor; //cursor 对应队头的item，正在发送
+    BOOL bCtrl; //cursor 是User Control 消息，不是队头的item
+    unsigned char ctrl[CONGESTION_CONTROL_SIZE];
+    unsigned int nSendStart;
+    ChunkCursor cursor;
+} SendQueue;
+
+BOOL SendPacket(RTMP *pRtmp, unsigned int nPacketType, unsigned char *data,
+                unsigned int size, unsigned int nTimestamp);
+
+//连接url 并创建发送队列。bEventLoop 为TRUE 时由epoll 线程非阻塞发送，不支持时退回到发送线程。
+//opts 为NULL 时不限速，只按队列长度丢帧
+BOOL InitSendQueue(SendQueue **q, const char *url, BOOL bEventLoop,
+                   const SendOptions *opts);
+
+//提交一帧，队列增加f 的引用，调用者仍持有自己的引用。
+//按丢帧策略丢弃时返回FALSE，帧仍然会进GOP 缓存。配置(SEND_ITEM_CONFIG)不会丢，
+//队列满时在下一个关键帧之前补发
+BOOL SendQueuePush(SendQueue *q, FrameBuf *f, unsigned int packetType,
+                   unsigned int timestamp, unsigned int flags);
+
+unsigned int SendQueueDepth(SendQueue *q);
+
+//epoll 线程调用，非阻塞地尽量发送，socket 写满时返回。
+//被令牌桶限速时返回要等待的ms，否则返回-1
+int SendQueueFlush(SendQueue *q);
+
+//stats: 队列深度，丢非参考帧，丢GOP，延迟丢GOP 次数，发送错误，重连次数，
+//估计延迟ms，socket 缓冲延迟ms，上行速率bytes/s，socket 未确认字节，服务器ack 窗口，服务器ack 次数，
+//发出的帧数，发出的字节数，RTT ms，排队延迟直方图，发送时间直方图
+#define SEND_STAT_QUEUE_HIST    15
+#define SEND_STAT_SEND_HIST     (SEND_STAT_QUEUE_HIST + SEND_HIST_BUCKETS)
+#define SEND_QUEUE_STATS_COUNT  (SEND_STAT_SEND_HIST + SEND_HIST_BUCKETS)
+void GetSendQueueStats(SendQueue *q, long long *stats);
+
+BOOL FreeSendQueue(SendQueue *q);
+
+#endif
@@ -1,38 +1,6 @@
 ﻿#include "video.h"
 
-NALU_t *AllocNALU(int buffersize)
-{
-    NALU_t *n;
-
-    if ((n = (NALU_t*) calloc(1, sizeof(NALU_t))) == NULL)
-    {
-        LOGE("AllocNALU Error: Allocate Meory To NALU_t error ");
-        getchar();
-    }
-
-    n->max_size = buffersize; //Assign buffer size
-
-    if ((n->buf = (unsigned char*) calloc(buffersize, sizeof(char))) == NULL)
-    {
-        free(n);
-        LOGE("AllocNALU Error: Allocate Meory To NALU_t Buffer error ");
-        getchar();
-    }
-    return n;
-}
-
-void FreeNALU(NALU_t *n)
-{
-    if (n)
-    {
-        if (n->buf)
-        {
-            free(n->buf);
-            n->buf = NULL;
-        }
-        free(n);
-    }
-}
+#include <stdint.h>
 
 BOOL FindStartCode2(unsigned char *Buf)
 {
@@ -68,74 +36,116 @@ int ReadChar(unsigned char * to, unsigned char * from, int sum)
     return sum;
 }
 
-int GetAnnexbNALU(NALU_t * nalu, char* data, int size, int *Buf_index)
+const unsigned char *FindStartCode(const unsigned char *p,
+                                   const unsigned char *end)
 {
-    if (*Buf_index >= size)
-    {
-        LOGE( "GetAnnexbNALU Buf_index error!\n");
-        return 0;
-    }
-    if (FindStartCode2(data + *Buf_index))
+    const unsigned char *a;
+
+    if (end - p < 3)
+        return end;
+
+    //先逐字节对齐到4字节边界
+    a = p + ((4 - ((uintptr_t) p & 3)) & 3);
+    for (; p < a && p < end - 2; p++)
     {
-        nalu->startcodeprefix_len = 3; //初始化前缀位三个字节
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
     }
-    else if (FindStartCode3(data + *Buf_index))
+
+    //一次检查4个字节，只有字中含0字节时才逐字节比较
+    for (; p + 6 <= end; p += 4)
     {
-        nalu->startcodeprefix_len = 4; //初始化前缀位三个字节
+        uint32_t x = *(const uint32_t *) p;
+        if ((x - 0x01010101) & ~x & 0x80808080)
+        {
+            if (p[1] == 0)
+            {
+                if (p[0] == 0 && p[2] == 1)
+                    return p;
+                if (p[2] == 0 && p[3] == 1)
+                    return p + 1;
+            }
+            if (p[3] == 0)
+            {
+                if (p[2] == 0 && p[4] == 1)
+                    return p + 2;
+                if (p[4] == 0 && p[5] == 1)
+                    return p + 3;
+            }
+        }
     }
-    else
+
+    for (; p < end - 2; p++)
     {
-        LOGE( "GetAnnexbNALU data error!\n");
-        return 0;
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
     }
+    return end;
+}
 
-    int i;
+void NALUScannerInit(NALU_Scanner_t *s, const void *data, int size)
+{
+    s->p = (const unsigned char *) data;
+    s->end = s->p + (size > 0 ? size : 0);
+}
+
+BOOL NALUScannerNext(NALU_Scanner_t *s, NALU_t *nalu)
+{
+    const unsigned char *start;
+    const unsigned char *next;
+    const unsigned char *nal_end;
 
-    int End_index;
-    for (i = *Buf_index + nalu->startcodeprefix_len; i < size - 4; i++)
+    while (TRUE)
     {
-        if (FindStartCode2(data + i) || FindStartCode3(data + i))
+        start = FindStartCode(s->p, s->end);
+        if (start == s->end)
         {
-            break;
+            s->p = s->end;
+            return FALSE;
         }
-    }
-    End_index = i;
-    if (End_index >= size - 4)
-        End_index = size;
-    else
-    {
-        LOGI( "Found SPS PPS \n");
-    }
+        //00 00 00 01 时前面多一个0
+        nalu->startcodeprefix_len = (start > s->p && start[-1] == 0) ? 4 : 3;
+        start += 3;
 
-#ifdef _DEBUG_
-    char* str = malloc(size * 2 + 1);
-    for (i = 0; i < End_index - *Buf_index; i++)
-    {
-        str[i * 2] = data[i + *Buf_index] + '0';
-        str[i * 2 + 1] = ',';
-    }
-    str[i * 2] = '\0';
-    LOGI( "size:%d \n", size);
-    LOGI( "data:%s \n", str);
-    free(str);
+        next = FindStartCode(start, s->end);
+        //nal 不会以0结尾，末尾的0属于下一个起始码或trailing_zero_8bits
+        nal_end = next;
+        while (nal_end > start && nal_end[-1] == 0)
+            nal_end--;
+        s->p = nal_end;
 
-    printf("nalu->startcodeprefix_len = %d\n", nalu->startcodeprefix_len);
-    printf("data = %d,%d,%d,%d,%d\n", data[*Buf_index], data[*Buf_index + 1],
-           data[*Buf_index + 2], data[*Buf_index + 3], data[*Buf_index + 4]);
-#endif
+        if (nal_end > start)
+            break;
+    }
 
-    nalu->len = End_index - *Buf_index - nalu->startcodeprefix_len; //设置包含nal 头的数据长度
-    memcpy(nalu->buf, &data[*Buf_index + nalu->startcodeprefix_len], nalu->len); //拷贝一个nal 数据到数组中
+    nalu->buf = (unsigned char *) start;
+    nalu->len = nal_end - start;
     nalu->forbidden_bit = nalu->buf[0] & 0x80; //1 bit  设置nal 头
     nalu->nal_reference_idc = nalu->buf[0] & 0x60; // 2 bit
     nalu->nal_unit_type = (nalu->buf[0]) & 0x1f; // 5 bit
-    printf("nal_unit_type = %d\n", nalu->nal_unit_type);
-    if (End_index >= size - 4)
+    nalu->Frametype = 0;
+    nalu->lost_packets = 0;
+    return TRUE;
+}
+
+int GetAnnexbNALU(NALU_t * nalu, char* data, int size, int *Buf_index)
+{
+    NALU_Scanner_t s;
+
+    if (*Buf_index >= size)
+    {
+        LOGE( "GetAnnexbNALU Buf_index error!\n");
+        return 0;
+    }
+
+    NALUScannerInit(&s, data + *Buf_index, size - *Buf_index);
+    if (!NALUScannerNext(&s, nalu))
     {
+        LOGE( "GetAnnexbNALU data error!\n");
         *Buf_index = size;
+        return 0;
     }
-    else
-        *Buf_index = End_index;
+    *Buf_index = (char *) s.p - data;
     return nalu->startcodeprefix_len; //((info3 == 1)? 4 : 3);
 }
 
@@ -143,33 +153,14 @@ int GetFrameType(NALU_t * nal)
 {
     bs_t s;
     int frame_type = 0;
-    unsigned char * OneFrameBuf_H264 = NULL;
-    if ((OneFrameBuf_H264 = (unsigned char *) calloc(nal->len + 4,
-                            sizeof(unsigned char))) == NULL)
-    {
-        LOGE("Error malloc OneFrameBuf_H264\n");
-        return getchar();
-    }
-    if (nal->startcodeprefix_len == 3)
-    {
-        OneFrameBuf_H264[0] = 0x00;
-        OneFrameBuf_H264[1] = 0x00;
-        OneFrameBuf_H264[2] = 0x01;
-        memcpy(OneFrameBuf_H264 + 3, nal->buf, nal->len);
-    }
-    else if (nal->startcodeprefix_len == 4)
-    {
-        OneFrameBuf_H264[0] = 0x00;
-        OneFrameBuf_H264[1] = 0x00;
-        OneFrameBuf_H264[2] = 0x00;
-        OneFrameBuf_H264[3] = 0x01;
-        memcpy(OneFrameBuf_H264 + 4, nal->buf, nal->len);
-    }
-    else
+
+    if (nal->len < 1)
     {
         LOGE("H264 error！\n");
+        return 0;
     }
-    bs_init(&s, OneFrameBuf_H264 + nal->startcodeprefix_len + 1, nal->len - 1);
+    //直接在nal 数据上读，跳过1字节nal 头，防竞争字节在读的时候去掉
+    bs_init_nal(&s, nal->buf + 1, nal->len - 1);
 
     if (nal->nal_unit_type == NAL_SLICE
             || nal->nal_unit_type == NAL_SLICE_IDR)
@@ -214,139 +205,528 @@ int GetFrameType(NALU_t * nal)
     {
         nal->Frametype = NAL_PPS;
     }
-    if (OneFrameBuf_H264)
-    {
-        free(OneFrameBuf_H264);
-        OneFrameBuf_H264 = NULL;
-    }
     return 1;
 }
 
 BOOL GainSpsPps(unsigned char * spsbuf, unsigned int * spslength,
-                unsigned char * ppsbuf, unsigned int * ppslength, char* data, int size)
+                unsigned int spsCap, unsigned char * ppsbuf,
+                unsigned int * ppslength, unsigned int ppsCap, char* data, int size)
 {
-    //读取二帧数据
-    NALU_t * n_1 = NULL;
-    NALU_t * n_2 = NULL;
-    unsigned int avcc_pos;
-    n_1 = AllocNALU(MAX_VIDEO_TAG_BUF_SIZE);
-    n_2 = AllocNALU(MAX_VIDEO_TAG_BUF_SIZE);
-    int Buf_index = 0;
-loop_1_1:
-    printf("loop_1_1\n");
-    if (Buf_index >= size)
-    {
-        LOGE("loop_1_1 error\n");
-        return FALSE;
-    }
-    if (GetAnnexbNALU(n_1, data, size, &Buf_index) == 0)
-        return FALSE;
-    //判断帧类型
-    GetFrameType(n_1);
-    if (n_1->nal_unit_type == NAL_SPS)
+    NALU_Scanner_t s;
+    NALU_t n;
+    NALU_t sps;
+    BOOL bHasSps = FALSE;
+
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
     {
-loop_1_2:
-        printf("loop_1_2\n");
-        if (Buf_index >= size)
+        if (n.nal_unit_type == NAL_SPS)
         {
-            LOGE("loop_1_2 error\n");
-            return FALSE;
+            sps = n;
+            bHasSps = TRUE;
         }
-        if (GetAnnexbNALU(n_2, data, size, &Buf_index) == 0)
-            return FALSE;
+        else if (n.nal_unit_type == NAL_PPS && bHasSps)
+        {
+            //数据来自网络，长度不可信
+            if (sps.len > spsCap || n.len > ppsCap)
+            {
+                LOGE("GainSpsPps: SPS/PPS too large %u,%u\n", sps.len, n.len);
+                return FALSE;
+            }
+            memcpy(spsbuf, sps.buf, sps.len);
+            *spslength = sps.len;
+            memcpy(ppsbuf, n.buf, n.len);
+            *ppslength = n.len;
+            return TRUE;
+        }
+    }
+    LOGE("GainSpsPps: SPS/PPS not found\n");
+    return FALSE;
+}
+
+int Read_One_H264_Frame(unsigned char ** buf, char* data, int size,
+                        int *Is_KyeFrame)
+{
+    NALU_Scanner_t s;
+    NALU_t n;
+    *Is_KyeFrame = FALSE;
+
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
+    {
         //判断帧类型
-        GetFrameType(n_2);
-        if (n_2->nal_unit_type == NAL_PPS)
+        GetFrameType(&n);
+
+        if (n.Frametype == FRAME_I)
         {
-            memcpy(spsbuf, n_1->buf, n_1->len);
-            *spslength = n_1->len;
-            memcpy(ppsbuf, n_2->buf, n_2->len);
-            *ppslength = n_2->len;
+            *Is_KyeFrame = TRUE;
+            *buf = n.buf;
+            return n.len;
         }
-        else
+        else if (n.Frametype == FRAME_B || n.Frametype == FRAME_P)
         {
-            goto loop_1_2;
+            *buf = n.buf;
+            return n.len;
         }
+        //其它帧直接去掉
     }
-    else
+    LOGE("Read_One_H264_Frame: no slice found\n");
+    return 0;
+}
+
+int Pack_H264_Access_Unit(unsigned char * dst, unsigned int dst_size,
+                          char* data, int size, int *Is_KyeFrame,
+                          int *Is_Reference)
+{
+    NALU_Scanner_t s;
+    NALU_t n;
+    unsigned int pos = 0;
+    BOOL bHasSlice = FALSE;
+    *Is_KyeFrame = FALSE;
+    *Is_Reference = FALSE;
+
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
     {
-        goto loop_1_1;
+        switch (n.nal_unit_type)
+        {
+        case NAL_SLICE_IDR:
+            *Is_KyeFrame = TRUE;
+        //fall through
+        case NAL_SLICE:
+        case NAL_SLICE_DPA:
+        case NAL_SLICE_DPB:
+        case NAL_SLICE_DPC:
+            //只需要看第一个slice 判断是否为I帧
+            if (!bHasSlice && n.nal_unit_type == NAL_SLICE)
+            {
+                GetFrameType(&n);
+                if (n.Frametype == FRAME_I)
+                    *Is_KyeFrame = TRUE;
+            }
+            if (n.nal_reference_idc)
+                *Is_Reference = TRUE;
+            bHasSlice = TRUE;
+            break;
+        case NAL_SEI:
+        case NAL_AUD:
+            break;
+        default: //SPS/PPS 已经在sequence header 中发送，其它nal 丢掉
+            continue;
+        }
+
+        if (pos + 4 + n.len > dst_size)
+        {
+            LOGE("Pack_H264_Access_Unit: buffer too small %u\n", dst_size);
+            return 0;
+        }
+        dst[pos++] = n.len >> 24;
+        dst[pos++] = (n.len >> 16) & 0xFF;
+        dst[pos++] = (n.len >> 8) & 0xFF;
+        dst[pos++] = n.len & 0xFF;
+        memcpy(dst + pos, n.buf, n.len);
+        pos += n.len;
     }
-    FreeNALU(n_1);
-    FreeNALU(n_2);
-    return TRUE;
+
+    if (!bHasSlice)
+    {
+        LOGE("Pack_H264_Access_Unit: no slice found\n");
+        return 0;
+    }
+    return pos;
 }
 
-int Read_One_H264_Frame(unsigned char ** buf, char* data, int size,
-                        int *Is_KyeFrame)
+int GetVideoCodec(char* data, int size)
 {
-    NALU_t * n = NULL;
-    int startcodeprefix_size;
-    unsigned int video_buf_size = 0;
-    *Is_KyeFrame = FALSE;
-    //分配nal 资源
-    n = AllocNALU(MAX_VIDEO_TAG_BUF_SIZE);
-    int Buf_index = 0;
+    NALU_Scanner_t s;
+    NALU_t n;
 
-loop_2:
-    //读取一帧数据
-    if (Buf_index >= size)
+    //HEVC 的VPS 头是40 01，对H264 是保留的nal 类型0
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
     {
-        LOGE("loop_2 error\n");
+        if (n.len >= 2 && HEVC_NAL_TYPE(n.buf) == HEVC_NAL_VPS
+                && (n.buf[0] & 0x81) == 0 && (n.buf[1] & 0x07) != 0)
+            return VIDEO_CODEC_HEVC;
+    }
+    return VIDEO_CODEC_H264;
+}
+
+BOOL GainVpsSpsPps(unsigned char * vpsbuf, unsigned int * vpslength,
+                   unsigned int vpsCap, unsigned char * spsbuf,
+                   unsigned int * spslength, unsigned int spsCap,
+                   unsigned char * ppsbuf, unsigned int * ppslength,
+                   unsigned int ppsCap, char* data, int size)
+{
+    NALU_Scanner_t s;
+    NALU_t n;
+    NALU_t vps, sps;
+    BOOL bHasVps = FALSE, bHasSps = FALSE;
+
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
+    {
+        if (n.len < 2)
+            continue;
+        switch (HEVC_NAL_TYPE(n.buf))
+        {
+        case HEVC_NAL_VPS:
+            vps = n;
+            bHasVps = TRUE;
+            break;
+        case HEVC_NAL_SPS:
+            sps = n;
+            bHasSps = TRUE;
+            break;
+        case HEVC_NAL_PPS:
+            if (!bHasVps || !bHasSps)
+                break;
+            if (vps.len > vpsCap || sps.len > spsCap || n.len > ppsCap)
+            {
+                LOGE("GainVpsSpsPps: VPS/SPS/PPS too large %u,%u,%u\n",
+                     vps.len, sps.len, n.len);
+                return FALSE;
+            }
+            memcpy(vpsbuf, vps.buf, vps.len);
+            *vpslength = vps.len;
+            memcpy(spsbuf, sps.buf, sps.len);
+            *spslength = sps.len;
+            memcpy(ppsbuf, n.buf, n.len);
+            *ppslength = n.len;
+            return TRUE;
+        }
+    }
+    LOGE("GainVpsSpsPps: VPS/SPS/PPS not found\n");
+    return FALSE;
+}
+
+//去掉防竞争字节00 00 03 中的03，返回去掉后的长度
+static int NALUUnescape(unsigned char *dst, const unsigned char *src, int len)
+{
+    int i, n = 0, zeros = 0;
+    for (i = 0; i < len; i++)
+    {
+        if (zeros >= 2 && src[i] == 0x03)
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = src[i] == 0 ? zeros + 1 : 0;
+        dst[n++] = src[i];
+    }
+    return n;
+}
+
+int Pack_HEVC_Config_Record(unsigned char * dst, unsigned int dst_size,
+                            unsigned char * vps, unsigned int vpslength,
+                            unsigned char * sps, unsigned int spslength,
+                            unsigned char * pps, unsigned int ppslength)
+{
+    unsigned char rbsp[1024];
+    unsigned char *ptl;
+    unsigned char *nals[3];
+    unsigned int lens[3];
+    bs_t s;
+    int len, i, sub_layers, temporal_id_nested;
+    int profile_present[8], level_present[8];
+    int chroma_format_idc, bit_depth_luma, bit_depth_chroma;
+    unsigned int pos = 0;
+
+    if (dst_size < 23 + 15 + vpslength + spslength + ppslength)
+    {
+        LOGE("Pack_HEVC_Config_Record: buffer too small %u\n", dst_size);
         return 0;
     }
-    startcodeprefix_size = GetAnnexbNALU(n, data, size, &Buf_index);
-    if (startcodeprefix_size == 0)
+    //截断后解析出来的字段不可信
+    if (spslength > sizeof(rbsp))
     {
-        printf("loop_1_2 error \n");
+        LOGE("Pack_HEVC_Config_Record: sps too long %u\n", spslength);
         return 0;
     }
-    //判断帧类型
-    GetFrameType(n);
-
-    if (n->Frametype == FRAME_I)
-    {
-        //将data填入bufz中
-#if 0
-        buf[0] = n->len >> 24;
-        buf[1] = (n->len >> 16) & 0xFF;
-        buf[2] = (n->len >> 8) & 0xFF;
-        buf[3] = n->len & 0xFF;
-        memcpy(buf + 4 ,n->buf,n->len);
-        video_buf_size = n->len + 4;
-#endif
-        *Is_KyeFrame = TRUE;
-        *buf = (unsigned char*) calloc(n->len, sizeof(char));
-        memcpy(*buf, n->buf, n->len);
-        video_buf_size = n->len;
-        LOGE("Is_KyeFrame\n");
-
-    }
-    else if (n->Frametype == FRAME_B || n->Frametype == FRAME_P)
-    {
-#if 0
-        buf[0] = n->len >> 24;
-        buf[1] = (n->len >> 16) & 0xFF;
-        buf[2] = (n->len >> 8) & 0xFF;
-        buf[3] = n->len & 0xFF;
-        memcpy(buf + 4 ,n->buf,n->len);
-        video_buf_size = n->len + 4;
-#endif
-        *buf = (unsigned char*) calloc(n->len, sizeof(char));
-        memcpy(*buf, n->buf, n->len);
-        video_buf_size = n->len;
-        LOGE("!Is_KyeFrame, %d\n", n->Frametype);
-    }
-//    else if (n->Frametype == NAL_SPS || n->Frametype == NAL_PPS)
-//    {
-//        return -1;
-//    }
-    else   //其它帧直接去掉
-    {
-        goto loop_2;
-    }
-
-    FreeNALU(n); //释放nal 资源
-    return video_buf_size;
+    len = NALUUnescape(rbsp, sps, spslength);
+    //2字节nal 头 + vps_id/max_sub_layers/temporal_id_nesting + 12字节general profile_tier_level
+    if (len < 15)
+    {
+        LOGE("Pack_HEVC_Config_Record: sps too short %d\n", len);
+        return 0;
+    }
+    sub_layers = ((rbsp[2] >> 1) & 0x07) + 1;
+    //sps_max_sub_layers_minus1 最大为6，numTemporalLayers 只有3位
+    if (sub_layers > 7)
+    {
+        LOGE("Pack_HEVC_Config_Record: bad sub layers %d\n", sub_layers);
+        return 0;
+    }
+    temporal_id_nested = rbsp[2] & 0x01;
+    ptl = rbsp + 3;
+
+    //跳过子层的profile/level，读到位深
+    bs_init(&s, rbsp + 15, len - 15);
+    for (i = 0; i < sub_layers - 1; i++)
+    {
+        profile_present[i] = bs_read1(&s);
+        level_present[i] = bs_read1(&s);
+    }
+    if (sub_layers > 1)
+        bs_read(&s, 2 * (9 - sub_layers));
+    for (i = 0; i < sub_layers - 1; i++)
+    {
+        if (profile_present[i])
+        {
+            bs_read(&s, 32);
+            bs_read(&s, 32);
+            bs_read(&s, 24);
+        }
+        if (level_present[i])
+            bs_read(&s, 8);
+    }
+    bs_read_ue(&s); // sps_seq_parameter_set_id
+    chroma_format_idc = bs_read_ue(&s);
+    if (chroma_format_idc == 3)
+        bs_read1(&s); // separate_colour_plane_flag
+    bs_read_ue(&s); // pic_width_in_luma_samples
+    bs_read_ue(&s); // pic_height_in_luma_samples
+    if (bs_read1(&s)) // conformance_window_flag
+    {
+        for (i = 0; i < 4; i++)
+            bs_read_ue(&s);
+    }
+    bit_depth_luma = bs_read_ue(&s);
+    bit_depth_chroma = bs_read_ue(&s);
+
+    dst[pos++] = 0x01; // configurationVersion
+    memcpy(dst + pos, ptl, 12); // profile_space/tier/profile_idc，兼容标志，约束标志，level_idc
+    pos += 12;
+    dst[pos++] = 0xF0; // min_spatial_segmentation_idc
+    dst[pos++] = 0x00;
+    dst[pos++] = 0xFC; // parallelismType
+    dst[pos++] = 0xFC | (chroma_format_idc & 0x03);
+    dst[pos++] = 0xF8 | (bit_depth_luma & 0x07);
+    dst[pos++] = 0xF8 | (bit_depth_chroma & 0x07);
+    dst[pos++] = 0x00; // avgFrameRate
+    dst[pos++] = 0x00;
+    // constantFrameRate:0 numTemporalLayers temporalIdNested lengthSizeMinusOne:3
+    dst[pos++] = (sub_layers << 3) | (temporal_id_nested << 2) | 0x03;
+
+    nals[0] = vps;
+    lens[0] = vpslength;
+    nals[1] = sps;
+    lens[1] = spslength;
+    nals[2] = pps;
+    lens[2] = ppslength;
+    dst[pos++] = 3; // numOfArrays
+    for (i = 0; i < 3; i++)
+    {
+        dst[pos++] = 0x80 | HEVC_NAL_TYPE(nals[i]); // array_completeness
+        dst[pos++] = 0x00; // numNalus
+        dst[pos++] = 0x01;
+        dst[pos++] = lens[i] >> 8;
+        dst[pos++] = lens[i] & 0xff;
+        memcpy(dst + pos, nals[i], lens[i]);
+        pos += lens[i];
+    }
+    return pos;
 }
 
+//scaling_list 里没有宽高，只需要跳过
+static void SkipScalingList(bs_t *s, int size)
+{
+    int i, last = 8, next = 8;
+    for (i = 0; i < size; i++)
+    {
+        if (next != 0)
+            next = (last + bs_read_se(s) + 256) % 256;
+        last = next == 0 ? last : next;
+    }
+}
+
+static BOOL GetH264Resolution(const unsigned char *sps, unsigned int spslength,
+                              int *width, int *height)
+{
+    bs_t s;
+    int profile, chroma_format_idc = 1, poc_type, frame_mbs_only, i, count;
+    int width_mbs, height_map, crop[4] = { 0 }, crop_x, crop_y;
+
+    if (spslength < 4)
+        return FALSE;
+    bs_init_nal(&s, (void *) (sps + 1), spslength - 1);
+    profile = bs_read(&s, 8);
+    bs_read(&s, 16); // constraint_set_flags, level_idc
+    bs_read_ue(&s); // seq_parameter_set_id
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244
+            || profile == 44 || profile == 83 || profile == 86 || profile == 118
+            || profile == 128 || profile == 138 || profile == 139
+            || profile == 134 || profile == 135)
+    {
+        chroma_format_idc = bs_read_ue(&s);
+        if (chroma_format_idc == 3)
+            bs_read1(&s); // separate_colour_plane_flag
+        bs_read_ue(&s); // bit_depth_luma_minus8
+        bs_read_ue(&s); // bit_depth_chroma_minus8
+        bs_read1(&s); // qpprime_y_zero_transform_bypass_flag
+        if (bs_read1(&s)) // seq_scaling_matrix_present_flag
+        {
+            count = chroma_format_idc == 3 ? 12 : 8;
+            for (i = 0; i < count; i++)
+            {
+                if (bs_read1(&s))
+                    SkipScalingList(&s, i < 6 ? 16 : 64);
+            }
+        }
+    }
+    bs_read_ue(&s); // log2_max_frame_num_minus4
+    poc_type = bs_read_ue(&s);
+    if (poc_type == 0)
+    {
+        bs_read_ue(&s); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (poc_type == 1)
+    {
+        bs_read1(&s); // delta_pic_order_always_zero_flag
+        bs_read_se(&s); // offset_for_non_ref_pic
+        bs_read_se(&s); // offset_for_top_to_bottom_field
+        count = bs_read_ue(&s);
+        for (i = 0; i < count; i++)
+            bs_read_se(&s);
+    }
+    bs_read_ue(&s); // max_num_ref_frames
+    bs_read1(&s); // gaps_in_frame_num_value_allowed_flag
+    width_mbs = bs_read_ue(&s) + 1;
+    height_map = bs_read_ue(&s) + 1;
+    frame_mbs_only = bs_read1(&s);
+    if (!frame_mbs_only)
+        bs_read1(&s); // mb_adaptive_frame_field_flag
+    bs_read1(&s); // direct_8x8_inference_flag
+    if (bs_read1(&s)) // frame_cropping_flag
+    {
+        for (i = 0; i < 4; i++)
+            crop[i] = bs_read_ue(&s);
+    }
+    //后面至少还有vui 标志和结束位，读完了说明sps 不完整
+    if (bs_eof(&s))
+        return FALSE;
+
+    crop_x = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+    crop_y = (chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+    *width = width_mbs * 16 - crop_x * (crop[0] + crop[1]);
+    *height = (2 - frame_mbs_only) * height_map * 16 - crop_y * (crop[2] + crop[3]);
+    return *width > 0 && *height > 0;
+}
+
+static BOOL GetHevcResolution(const unsigned char *sps, unsigned int spslength,
+                              int *width, int *height)
+{
+    bs_t s;
+    int sub_layers, i, chroma_format_idc, w, h, sub_w, sub_h;
+    int profile_present[8], level_present[8], crop[4] = { 0 };
+
+    if (spslength < 16)
+        return FALSE;
+    bs_init_nal(&s, (void *) (sps + 2), spslength - 2);
+    sub_layers = ((bs_read(&s, 8) >> 1) & 0x07) + 1;
+    if (sub_layers > 7)
+        return FALSE;
+    //12字节general profile_tier_level
+    bs_read(&s, 32);
+    bs_read(&s, 32);
+    bs_read(&s, 32);
+    for (i = 0; i < sub_layers - 1; i++)
+    {
+        profile_present[i] = bs_read1(&s);
+        level_present[i] = bs_read1(&s);
+    }
+    if (sub_layers > 1)
+        bs_read(&s, 2 * (9 - sub_layers));
+    for (i = 0; i < sub_layers - 1; i++)
+    {
+        if (profile_present[i])
+        {
+            bs_read(&s, 32);
+            bs_read(&s, 32);
+            bs_read(&s, 24);
+        }
+        if (level_present[i])
+            bs_read(&s, 8);
+    }
+    bs_read_ue(&s); // sps_seq_parameter_set_id
+    chroma_format_idc = bs_read_ue(&s);
+    if (chroma_format_idc == 3)
+        bs_read1(&s); // separate_colour_plane_flag
+    w = bs_read_ue(&s); // pic_width_in_luma_samples
+    h = bs_read_ue(&s); // pic_height_in_luma_samples
+    if (bs_read1(&s)) // conformance_window_flag
+    {
+        for (i = 0; i < 4; i++)
+            crop[i] = bs_read_ue(&s);
+    }
+    if (bs_eof(&s))
+        return FALSE;
+
+    sub_w = (chroma_format_idc == 1 || chroma_format_idc == 2) ? 2 : 1;
+    sub_h = chroma_format_idc == 1 ? 2 : 1;
+    *width = w - sub_w * (crop[0] + crop[1]);
+    *height = h - sub_h * (crop[2] + crop[3]);
+    return *width > 0 && *height > 0;
+}
+
+BOOL GetSpsResolution(int codec, const unsigned char *sps, unsigned int spslength,
+                      int *width, int *height)
+{
+    if (codec == VIDEO_CODEC_HEVC)
+        return GetHevcResolution(sps, spslength, width, height);
+    return GetH264Resolution(sps, spslength, width, height);
+}
+
+int Pack_HEVC_Access_Unit(unsigned char * dst, unsigned int dst_size,
+                          char* data, int size, int *Is_KyeFrame,
+                          int *Is_Reference)
+{
+    NALU_Scanner_t s;
+    NALU_t n;
+    unsigned int pos = 0;
+    int type;
+    BOOL bHasSlice = FALSE;
+    *Is_KyeFrame = FALSE;
+    *Is_Reference = FALSE;
+
+    NALUScannerInit(&s, data, size);
+    while (NALUScannerNext(&s, &n))
+    {
+        if (n.len < 2)
+            continue;
+        type = HEVC_NAL_TYPE(n.buf);
+        if (type <= HEVC_NAL_RSV_VCL31)
+        {
+            if (type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_CRA)
+                *Is_KyeFrame = TRUE;
+            //TRAIL_N/TSA_N/STSA_N/RADL_N/RASL_N 不被同一子层参考
+            if (!(type <= HEVC_NAL_RSV_VCL_N14 && (type & 1) == 0))
+                *Is_Reference = TRUE;
+            bHasSlice = TRUE;
+        }
+        else if (type != HEVC_NAL_AUD && type != HEVC_NAL_SEI_PREFIX
+                 && type != HEVC_NAL_SEI_SUFFIX)
+        {
+            continue; //VPS/SPS/PPS 已经在sequence header 中发送，其它nal 丢掉
+        }
+
+        if (pos + 4 + n.len > dst_size)
+        {
+            LOGE("Pack_HEVC_Access_Unit: buffer too small %u\n", dst_size);
+            return 0;
+        }
+        dst[pos++] = n.len >> 24;
+        dst[pos++] = (n.len >> 16) & 0xFF;
+        dst[pos++] = (n.len >> 8) & 0xFF;
+        dst[pos++] = n.len & 0xFF;
+        memcpy(dst + pos, n.buf, n.len);
+        pos += n.len;
+    }
+
+    if (!bHasSlice)
+    {
+        LOGE("Pack_HEVC_Access_Unit: no slice found\n");
+        return 0;
+    }
+    return pos;
+}
@@ -12,9 +12,11 @@
 #include "libswscale/swscale.h"
 #include "libavutil/pixfmt.h"
 
-#define  MAX_VIDEO_TAG_BUF_SIZE   1024 * 1024
 #define  VIDEO_TAG_HEADER_LENGTH  11
 
+//AVCC 打包后的最大长度: 每个nal 至少占4字节(3字节起始码+nal 头)，换成4字节长度最多多1字节
+#define  AVCC_MAX_PACKED_SIZE(size)  ((size) + (size) / 4 + 4)
+
 extern unsigned int decode_video_done;
 extern unsigned int Is_KyeFrame; //是否是关键帧
 
@@ -26,12 +28,18 @@ typedef struct Tag_NALU_t
     unsigned char nal_unit_type; //! NALU_TYPE_xxxx
     unsigned int startcodeprefix_len; //! 前缀字节数
     unsigned int len; //! 包含nal 头的nal 长度，从第一个00000001到下一个000000001的长度
-    unsigned int max_size; //! 做多一个nal 的长度
-    unsigned char * buf; //! 包含nal 头的nal 数据
+    unsigned char * buf; //! 包含nal 头的nal 数据，指向调用者缓冲区，不拷贝
     unsigned char Frametype; //! 帧类型
     unsigned int lost_packets; //! 预留
 } NALU_t;
 
+//Annex-B 扫描器，逐个返回调用者缓冲区中的nal 视图
+typedef struct Tag_NALU_Scanner_t
+{
+    const unsigned char *p; //! 下一次查找起始码的位置
+    const unsigned char *end; //! 缓冲区尾地址
+} NALU_Scanner_t;
+
 //nal类型
 enum nal_unit_type_e
 {
@@ -43,25 +51,74 @@ enum nal_unit_type_e
     NAL_SLICE_IDR = 5, /* ref_idc != 0 */
     NAL_SEI = 6, /* ref_idc == 0 */
     NAL_SPS = 7,
-    NAL_PPS = 8
+    NAL_PPS = 8,
+    NAL_AUD = 9
     /* ref_idc == 0 for 6,9,10,11,12 */
 };
 
+//HEVC nal类型，nal 头2字节，类型在第一个字节的bit1-6
+enum hevc_nal_unit_type_e
+{
+    HEVC_NAL_TRAIL_N = 0,
+    HEVC_NAL_RSV_VCL_N14 = 14, /* 0-14 中偶数为子层非参考帧 */
+    HEVC_NAL_BLA_W_LP = 16, /* 16-21 为IRAP */
+    HEVC_NAL_CRA = 21,
+    HEVC_NAL_RSV_VCL31 = 31, /* 0-31 为slice */
+    HEVC_NAL_VPS = 32,
+    HEVC_NAL_SPS = 33,
+    HEVC_NAL_PPS = 34,
+    HEVC_NAL_AUD = 35,
+    HEVC_NAL_SEI_PREFIX = 39,
+    HEVC_NAL_SEI_SUFFIX = 40
+};
+
+#define HEVC_NAL_TYPE(buf)  (((buf)[0] >> 1) & 0x3f)
+
+//视频编码
+enum video_codec_e
+{
+    VIDEO_CODEC_H264 = 0, VIDEO_CODEC_HEVC = 1
+};
+
 //帧类型
 enum Frametype_e
 {
     FRAME_I = 15, FRAME_P = 16, FRAME_B = 17
 };
 
-NALU_t *AllocNALU(int buffersize); //分配nal 资源
-void FreeNALU(NALU_t * n); //释放nal 资源
 int FindStartCode2(unsigned char *Buf); //判断nal 前缀是否为3个字节
 int FindStartCode3(unsigned char *Buf); //判断nal 前缀是否为4个字节
+const unsigned char *FindStartCode(const unsigned char *p,
+                                   const unsigned char *end); //查找下一个00 00 01，找不到返回end
+void NALUScannerInit(NALU_Scanner_t *s, const void *data, int size); //初始化扫描器
+BOOL NALUScannerNext(NALU_Scanner_t *s, NALU_t *nalu); //取下一个nal，没有则返回FALSE
 int GetAnnexbNALU(NALU_t * nalu, char* data, int size, int *Buf_index); //填写nal 数据和头
 int GetFrameType(NALU_t * n); //获取帧类型
 int GainSpsPps(unsigned char * spsbuf, unsigned int * spslength,
-               unsigned char * ppsbuf, unsigned int * ppslength, char* data, int size); //将sps pps取出
+               unsigned int spsCap, unsigned char * ppsbuf,
+               unsigned int * ppslength, unsigned int ppsCap, char* data,
+               int size); //将sps pps取出，超过spsCap/ppsCap 时返回FALSE
 int Read_One_H264_Frame(unsigned char ** buf, char* data, int size,
-                        int *Is_KyeFrame);
+                        int *Is_KyeFrame); //buf 指向data 内部，调用者不需要释放
+int Pack_H264_Access_Unit(unsigned char * dst, unsigned int dst_size,
+                          char* data, int size, int *Is_KyeFrame,
+                          int *Is_Reference); //把一帧的所有slice/SEI/AUD 打包成AVCC格式
+int GetVideoCodec(char* data, int size); //有HEVC 的VPS 时返回VIDEO_CODEC_HEVC，否则为H264
+BOOL GainVpsSpsPps(unsigned char * vpsbuf, unsigned int * vpslength,
+                   unsigned int vpsCap, unsigned char * spsbuf,
+                   unsigned int * spslength, unsigned int spsCap,
+                   unsigned char * ppsbuf, unsigned int * ppslength,
+                   unsigned int ppsCap, char* data,
+                   int size); //将HEVC 的vps sps pps取出，超过容量时返回FALSE
+int Pack_HEVC_Config_Record(unsigned char * dst, unsigned int dst_size,
+                            unsigned char * vps, unsigned int vpslength,
+                            unsigned char * sps, unsigned int spslength,
+                            unsigned char * pps, unsigned int ppslength); //生成HEVCDecoderConfigurationRecord，失败返回0
+BOOL GetSpsResolution(int codec, const unsigned char *sps,
+                      unsigned int spslength, int *width,
+                      int *height); //从sps(含nal 头)解析裁剪后的宽高，codec 为VIDEO_CODEC_H264/HEVC
+int Pack_HEVC_Access_Unit(unsigned char * dst, unsigned int dst_size,
+                          char* data, int size, int *Is_KyeFrame,
+                          int *Is_Reference); //把一帧的所有slice/SEI/AUD 打包成hvcC 格式
 
 #endif
@@ -23,6 +23,7 @@ import java.io.File;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.InputStreamReader;
+import java.nio.ByteBuffer;
 import java.text.SimpleDateFormat;
 import java.util.Date;
 
@@ -312,7 +313,32 @@ public class Onvif {
 //        cd.IPCamInit();
 //    }
 
-    public native boolean initCamStream(int id, String url);
+    // RTSP 传输方式，和data.h 中的RTSP_TRANSPORT_* 一致
+    public static final int RTSP_TRANSPORT_AUTO = 0; // 先UDP，打开超时或丢包超过2%时换TCP，每个摄像头记住结果
+    public static final int RTSP_TRANSPORT_UDP = 1;
+    public static final int RTSP_TRANSPORT_TCP = 2;
+
+    public native boolean initCamStream(int id, String url); // 默认打开超时10s，读取超时5s，RTSP_TRANSPORT_AUTO
+
+    // openTimeoutMs: 打开和探测流信息各自的超时，readTimeoutMs: 读一个包的超时，<=0 为不超时
+    public boolean initCamStream(int id, String url, int openTimeoutMs, int readTimeoutMs) {
+        return initCamStreamOptions(id, url, openTimeoutMs, readTimeoutMs, RTSP_TRANSPORT_AUTO);
+    }
+
+    public boolean initCamStream(int id, String url, int openTimeoutMs, int readTimeoutMs, int transport) {
+        return initCamStreamOptions(id, url, openTimeoutMs, readTimeoutMs, transport);
+    }
+
+    private native boolean initCamStreamOptions(int id, String url, int openTimeoutMs, int readTimeoutMs,
+                                                int transport);
+
+    public native int getCamTransport(int id); // 实际使用的RTSP_TRANSPORT_UDP/TCP，不是RTSP 时为0
+
+    // 摄像头流参数缓存到这个目录(如getCacheDir())，重连和重启后initCamStream 跳过几秒的探测，null 为只缓存在内存中
+    public native void setStreamInfoCacheDir(String dir);
+
+    // 中断这一路正在进行的initCamStream 或读取，可以在其他线程调用，之后仍要disconnectCam
+    public native boolean cancelCamStream(int id);
 
     // 断开摄像头发送流
     public void disconnectCam(CameraDevice device) {
@@ -328,10 +354,81 @@ public class Onvif {
 
     private native byte[] getH264Stream(int id);
 
+    // getH264StreamBatch/annexH264Batch 的buffer 布局(本机字节序，用ByteOrder.nativeOrder()读写):
+    // int count, int reserved, 然后是maxPackets 个索引项 {int offset, int size, int flags, int tick}，
+    // 之后是各个包的数据，offset 从buffer 起始算起
+    public static final int BATCH_HEADER_SIZE = 8;
+    public static final int BATCH_ENTRY_SIZE = 16;
+    public static final int BATCH_FLAG_KEY = 0x01;
+
+    // 取得摄像头发送流，写到direct buffer 中，不产生Java 对象
+    public int getH264Stream(CameraDevice device, ByteBuffer buffer) {
+        return getH264StreamDirect(device.getId(), buffer);
+    }
+
+    public int getH264StreamBatch(CameraDevice device, ByteBuffer buffer,
+                                  int maxPackets) {
+        return getH264StreamBatch(device.getId(), buffer, maxPackets);
+    }
+
+    // 返回包长度，buffer 放不下时返回-(包长度)，换更大的buffer 后再取
+    private native int getH264StreamDirect(int id, ByteBuffer buffer);
+
+    // 返回读到的包数，buffer 连一个包都放不下时返回-(需要的大小)
+    private native int getH264StreamBatch(int id, ByteBuffer buffer,
+                                          int maxPackets);
+
     public native int connectRtmpSer(String serAddr); // 连接rtmp服务器
 
+    public native int connectRtmpPublisher(String serAddr); // 连接rtmp服务器，由共享的epoll 线程非阻塞发送
+
+    // targetLatencyMs: 估计的发送延迟超过一半时丢非参考帧，超过时丢整个GOP，0 为只按队列长度丢帧
+    // paceKbps: 限制发送速率，大的关键帧分散发出，0 为不限速
+    public int connectRtmpSer(String serAddr, int targetLatencyMs, int paceKbps) {
+        return connectRtmpOptions(serAddr, false, targetLatencyMs, paceKbps, 0);
+    }
+
+    public int connectRtmpPublisher(String serAddr, int targetLatencyMs, int paceKbps) {
+        return connectRtmpOptions(serAddr, true, targetLatencyMs, paceKbps, 0);
+    }
+
+    private native int connectRtmpOptions(String serAddr, boolean eventLoop,
+                                          int targetLatencyMs, int paceKbps, int burstBytes);
+
+    // getRtmpStats 返回数组的下标
+    public static final int RTMP_STAT_QUEUE_DEPTH = 0;
+    public static final int RTMP_STAT_DROP_NON_REF = 1;
+    public static final int RTMP_STAT_DROP_GOP = 2;
+    public static final int RTMP_STAT_DROP_LATENCY = 3;
+    public static final int RTMP_STAT_SEND_ERROR = 4;
+    public static final int RTMP_STAT_RECONNECT = 5;
+    public static final int RTMP_STAT_LATENCY = 6; // 估计的发送延迟ms
+    public static final int RTMP_STAT_SOCKET_DELAY = 7; // socket 发送缓冲中的数据还要多少ms 发完
+    public static final int RTMP_STAT_RATE = 8; // 估计的上行速率bytes/s
+    public static final int RTMP_STAT_OUTQ = 9; // socket 中还没被确认的字节数
+    public static final int RTMP_STAT_ACK_WINDOW = 10; // 服务器的ack 窗口
+    public static final int RTMP_STAT_ACKS = 11; // 收到服务器ack 的次数
+    public static final int RTMP_STAT_FRAMES_SENT = 12;
+    public static final int RTMP_STAT_BYTES_SENT = 13;
+    public static final int RTMP_STAT_RTT = 14; // ping 测得的RTT ms，0 表示还没有
+    // 两个延迟直方图各RTMP_STAT_HIST_BUCKETS 个桶，第0个桶是0ms，第k 个桶是[2^(k-1), 2^k) ms
+    public static final int RTMP_STAT_HIST_BUCKETS = 16;
+    public static final int RTMP_STAT_QUEUE_HIST = 15; // 帧从进队列到写完socket
+    public static final int RTMP_STAT_SEND_HIST = RTMP_STAT_QUEUE_HIST + RTMP_STAT_HIST_BUCKETS; // 帧从开始写到写完
+    public static final int RTMP_STATS_COUNT = RTMP_STAT_SEND_HIST + RTMP_STAT_HIST_BUCKETS;
+
+    public native long[] getRtmpStats(int serId); // 连接的发送统计，下标见RTMP_STAT_*
+
+    // stats 长度至少RTMP_STATS_COUNT，定时轮询时重用同一个数组
+    public boolean getRtmpStats(int serId, long[] stats) {
+        return fillRtmpStats(serId, stats);
+    }
+
+    private native boolean fillRtmpStats(int serId, long[] stats);
+
     public native boolean disconnectRtmpSer(int serId); // 断开rtmp服务器
 
+    // h264 也可以是H265 的Annex-B 数据，含VPS 时按enhanced-RTMP(hvc1) 推送，之后的annexH264 按H265 打包
     public boolean sendSpsPps(int serId, byte[] h264, CameraDevice device) {
         return sendSpsPps(serId, h264, h264.length, device.width,
                 device.height, device.rate);
@@ -347,6 +444,108 @@ public class Onvif {
     private native boolean annexH264(int serId, byte[] h264, int length,
                                      int tick); // 推送帧数据
 
+    public boolean annexH264(int serId, ByteBuffer h264, int length, int tick) {
+        return annexH264Direct(serId, h264, 0, length, tick);
+    }
+
+    private native boolean annexH264Direct(int serId, ByteBuffer h264,
+                                           int offset, int length, int tick); // 推送direct buffer 中的帧数据
+
+    public native int annexH264Batch(int serId, ByteBuffer batch); // 推送getH264StreamBatch 取得的所有帧，返回推送的帧数
+
+    // getRelayStats 返回数组的下标
+    public static final int RELAY_STAT_FRAMES = 0;
+    public static final int RELAY_STAT_BYTES = 1;
+    public static final int RELAY_STAT_READ_ERROR = 2;
+    public static final int RELAY_STAT_PACK_ERROR = 3;
+    public static final int RELAY_STAT_LAST_TICK = 4;
+    public static final int RELAY_STAT_QUEUE_DEPTH = 5;
+    public static final int RELAY_STAT_DROP_NON_REF = 6;
+    public static final int RELAY_STAT_DROP_GOP = 7;
+    public static final int RELAY_STAT_SEND_ERROR = 8;
+    public static final int RELAY_STAT_RUNNING = 9;
+
+    public int startRelay(CameraDevice device, int serId) {
+        return startRelay(device.getId(), serId);
+    }
+
+    // 摄像头流直接在native 中转发到rtmp服务器，帧数据不经过Java，返回转发id，失败返回-1
+    private native int startRelay(int camId, int serId);
+
+    public int startRtspRelay(String url, int serId) {
+        return startRtspRelay(url, serId, 10000, 5000);
+    }
+
+    // 不用initCamStream，native 的RTSP 客户端(RTP over TCP，Basic/Digest 鉴权)直接拉流转发，只支持H264/H265，
+    // 所有路共用两个epoll 线程。打开是阻塞的，readTimeoutMs<=0 为不超时，返回转发id，失败返回-1
+    public native int startRtspRelay(String url, int serId, int openTimeoutMs, int readTimeoutMs);
+
+    public native boolean stopRelay(int relayId); // 停止转发，要在closeCamStream/disconnectRtmpSer 之前调用
+
+    public native long[] getRelayStats(int relayId); // 转发统计，下标见RELAY_STAT_*
+
+    // 输出组: 一路视频同时推到多个rtmp服务器和本地FLV 文件，每帧只打包一次
+    public native int createGroup(); // 返回组id，失败返回-1
+
+    public native boolean destroyGroup(int groupId);
+
+    public native boolean addGroupRtmp(int groupId, int serId); // serId 为connectRtmpSer/connectRtmpPublisher 的返回值
+
+    public native boolean removeGroupRtmp(int groupId, int serId);
+
+    public native boolean addGroupFile(int groupId, String path); // 写FLV 文件
+
+    // getGroupPreRollStats 返回数组的下标
+    public static final int PREROLL_STAT_DURATION = 0;
+    public static final int PREROLL_STAT_FRAMES = 1;
+    public static final int PREROLL_STAT_BYTES = 2;
+
+    // 事件录像: 组内保存最近durationMs 的帧(按GOP 对齐)，durationMs 为0 时关闭，maxBytes 为0 时上限4MB
+    public native boolean setGroupPreRoll(int groupId, int durationMs, int maxBytes);
+
+    // 从pre-roll 的第一个关键帧开始写FLV 文件，之后接着写实时的帧
+    public native boolean recordGroupFile(int groupId, String path);
+
+    public native boolean removeGroupFile(int groupId, String path); // 停止addGroupFile/recordGroupFile 的文件
+
+    public native long[] getGroupPreRollStats(int groupId); // 下标见PREROLL_STAT_*，没有开启时返回null
+
+    public boolean sendGroupSpsPps(int groupId, byte[] h264, CameraDevice device) {
+        return sendGroupSpsPps(groupId, h264, h264.length, device.width,
+                device.height, device.rate);
+    }
+
+    private native boolean sendGroupSpsPps(int groupId, byte[] h264, int length,
+                                           int width, int height, int frameRate);
+
+    public boolean annexGroupH264(int groupId, byte[] h264, int tick) {
+        return annexGroupH264(groupId, h264, h264.length, tick);
+    }
+
+    private native boolean annexGroupH264(int groupId, byte[] h264, int length,
+                                          int tick);
+
+    public boolean annexGroupH264(int groupId, ByteBuffer h264, int length, int tick) {
+        return annexGroupH264Direct(groupId, h264, 0, length, tick);
+    }
+
+    private native boolean annexGroupH264Direct(int groupId, ByteBuffer h264,
+                                                int offset, int length, int tick);
+
+    public int startGroupRelay(CameraDevice device, int groupId) {
+        return startGroupRelay(device.getId(), groupId);
+    }
+
+    // 摄像头流直接在native 中转发到输出组，用stopRelay/getRelayStats 停止和统计
+    private native int startGroupRelay(int camId, int groupId);
+
+    public int startRtspGroupRelay(String url, int groupId) {
+        return startRtspGroupRelay(url, groupId, 10000, 5000);
+    }
+
+    // 同startRtspRelay，转发到输出组
+    public native int startRtspGroupRelay(String url, int groupId, int openTimeoutMs, int readTimeoutMs);
+
     public void testPush(final Context context, final String devIP,
                          final int devPort) {
 //        connectCam(devIP, devPort, false, new OnSoapDoneListener() {